@@ -0,0 +1,116 @@
+﻿using System.Text;
+using Compiler.Operations;
+using Compiler.Serialization;
+using Compiler.SourceFiles;
+using Compiler.Tests.Storage;
+using Compiler.Util;
+
+namespace Compiler.Tests.SerializerTests;
+
+public class IndexedSerializerTests
+{
+    private static int U2(byte[] bytes, int offset) => (bytes[offset] << 8) | bytes[offset + 1];
+
+    private static int U4(byte[] bytes, int offset) =>
+        (bytes[offset] << 24) | (bytes[offset + 1] << 16) | (bytes[offset + 2] << 8) | bytes[offset + 3];
+
+    private static Dictionary<int, (int Offset, int Size)> ReadSections(byte[] bytes)
+    {
+        var sections = new Dictionary<int, (int Offset, int Size)>();
+        int count = U2(bytes, 8);
+        for (int i = 0; i < count; i++)
+        {
+            int entry = 12 + i * 12;
+            sections[U4(bytes, entry)] = (U4(bytes, entry + 4), U4(bytes, entry + 8));
+        }
+
+        return sections;
+    }
+
+    private static byte[] SerializeIndexed(string name)
+    {
+        var ball = BallStore.ReturnBall(name);
+        ball.Header = new Header([Header.IndexedVersion, 0, 0], 0);
+
+        return new Serializer().SerializeToArray(ball);
+    }
+
+    [Fact]
+    public void Serialize_Indexed_Ball_Writes_Aligned_Sections()
+    {
+        byte[] result = SerializeIndexed("SimpleBall");
+
+        Assert.Equal(new byte[] { 0x62, 0x61, 0x6c, 0x6c, 2, 0, 0, 0 }, result[..8]);
+
+        var sections = ReadSections(result);
+        Assert.Equal(new[] { 1, 2, 3, 4, 5 }, sections.Keys.Order());
+        foreach (var (offset, size) in sections.Values)
+        {
+            Assert.Equal(0, offset % 8);
+            Assert.True(offset + size <= result.Length);
+        }
+    }
+
+    [Fact]
+    public void Serialize_Indexed_Ball_Moves_Strings_To_String_Table()
+    {
+        byte[] result = SerializeIndexed("SimpleBall");
+        var sections = ReadSections(result);
+
+        var (strings, _) = sections[1];
+        Assert.Equal(3, U4(result, strings));
+
+        // entry 0: "Main"
+        int offset = U4(result, strings + 8);
+        int length = U4(result, strings + 12);
+        Assert.Equal("Main", Encoding.UTF8.GetString(result, strings + offset, length));
+
+        var (constants, _) = sections[2];
+        Assert.Equal(5, U4(result, constants));
+        Assert.Equal(0xB, result[constants + 4]);
+        Assert.Equal(0, U4(result, constants + 5));
+    }
+
+    [Fact]
+    public void Serialize_Indexed_Ball_Function_Table_Locates_Code()
+    {
+        byte[] result = SerializeIndexed("SimpleBall");
+        var sections = ReadSections(result);
+        var function = BallStore.ReturnBall("SimpleBall").FunctionPool.GetFunctions()[0];
+
+        var expectedCode = new List<byte>();
+        var visitor = new SerializingVisitor(expectedCode, wideJumps: true);
+        foreach (var operation in function.Operations)
+        {
+            operation.Accept(visitor);
+        }
+
+        var (table, _) = sections[3];
+        Assert.Equal(1, U4(result, table));
+
+        int entry = table + 8;
+        Assert.Equal(0, U2(result, entry));        // name
+        Assert.Equal(1, U2(result, entry + 2));    // parameters
+        Assert.Equal(2, U2(result, entry + 4));    // return type
+        Assert.Equal(3, U2(result, entry + 8));    // locals
+        Assert.Equal(function.OperationsLength, U4(result, entry + 12));
+
+        int codeOffset = U4(result, entry + 16);
+        int codeSize = U4(result, entry + 20);
+        Assert.Equal(expectedCode.Count, codeSize);
+
+        var (code, _) = sections[4];
+        Assert.Equal(expectedCode.ToArray(), result[(code + codeOffset)..(code + codeOffset + codeSize)]);
+    }
+
+    [Fact]
+    public void Serialize_Version_One_Ball_Keeps_Sequential_Layout()
+    {
+        var ball = BallStore.ReturnBall("SimpleBall");
+
+        byte[] result = new Serializer().SerializeToArray(ball);
+
+        // the constant pool count follows the header directly
+        Assert.Equal(ball.ConstantPool.Length, U2(result, 8));
+    }
+}
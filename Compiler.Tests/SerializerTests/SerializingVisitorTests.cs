@@ -75,5 +75,30 @@ public class SerializingVisitorTests
             idx[0], idx[1]
         }, buffer);
     }
-}
 
+    [Theory]
+    [InlineData(0x15)]
+    [InlineData(0x16)]
+    [InlineData(0x17)]
+    public void Visit_Jump_WithWideJumps_WritesU4Target(byte opcode)
+    {
+        var buffer = new List<byte>();
+        var visitor = new SerializingVisitor(buffer, wideJumps: true);
+
+        IOperation operation = opcode switch
+        {
+            0x15 => new Jmp(70000),
+            0x16 => new Jz(70000),
+            _ => new Jnz(70000),
+        };
+        operation.Accept(visitor);
+
+        var idx = ByteConverter.IntToU4(70000);
+
+        Assert.Equal(new byte[]
+        {
+            0x00, opcode,
+            idx[0], idx[1], idx[2], idx[3]
+        }, buffer);
+    }
+}
\ No newline at end of file
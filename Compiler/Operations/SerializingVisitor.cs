@@ -2,10 +2,20 @@
 
 namespace Compiler.Operations;
 
-public class SerializingVisitor(IList<byte> buffer) : IOperationVisitor
+// wideJumps writes u4 jump targets, as in the indexed .ball layout
+public class SerializingVisitor(IList<byte> buffer, bool wideJumps = false) : IOperationVisitor
 {
     public IList<byte> Buffer { get; } = buffer;
 
+    private void AddJumpIndex(int index)
+    {
+        byte[] idx = wideJumps ? ByteConverter.IntToU4(index) : ByteConverter.IntToU2(index);
+        foreach (var b in idx)
+        {
+            Buffer.Add(b);
+        }
+    }
+
     public void Visit(Ldc operation)
     {
         Buffer.Add(0);
@@ -150,30 +160,24 @@ public class SerializingVisitor(IList<byte> buffer) : IOperationVisitor
     {
         Buffer.Add(0);
         Buffer.Add(0x15);
-        
-        byte[] idx = ByteConverter.IntToU2(operation.JumpIndex);
-        Buffer.Add(idx[0]);
-        Buffer.Add(idx[1]);
+
+        AddJumpIndex(operation.JumpIndex);
     }
     
     public void Visit(Jz operation)
     {
         Buffer.Add(0);
         Buffer.Add(0x16);
-        
-        byte[] idx = ByteConverter.IntToU2(operation.JumpIndex);
-        Buffer.Add(idx[0]);
-        Buffer.Add(idx[1]);
+
+        AddJumpIndex(operation.JumpIndex);
     }
 
     public void Visit(Jnz operation)
     {
         Buffer.Add(0);
         Buffer.Add(0x17);
-        
-        byte[] idx = ByteConverter.IntToU2(operation.JumpIndex);
-        Buffer.Add(idx[0]);
-        Buffer.Add(idx[1]);
+
+        AddJumpIndex(operation.JumpIndex);
     }
     
     public void Visit(Neg operation)
@@ -0,0 +1,191 @@
+﻿using Compiler.Operations;
+using Compiler.SourceFiles;
+using Compiler.Util;
+
+namespace Compiler.Serialization.Handlers;
+
+// Everything after the header of an indexed (v2) .ball: a section table,
+// then the string table, constants, code, function table and classes,
+// each starting at an 8-byte boundary. Class methods are appended to the
+// function table and referenced by index.
+public class IndexedSectionsHandler : Handler
+{
+    private const byte StringTag = 11;
+
+    private const int SectionEntrySize = 12;
+
+    private const int Alignment = 8;
+
+    private enum Section
+    {
+        Strings = 1,
+        Constants = 2,
+        Functions = 3,
+        Code = 4,
+        Classes = 5,
+    }
+
+    public override void Handle(Ball source, IList<byte> target)
+    {
+        var strings = new List<byte[]>();
+        var constants = WriteConstants(source.ConstantPool, strings);
+
+        var functions = new List<Function>(source.FunctionPool.GetFunctions());
+        var classes = WriteClasses(source.ClassPool, functions);
+
+        var code = new List<byte>();
+        var table = WriteFunctions(functions, code);
+
+        var sections = new List<(Section Id, List<byte> Data)>
+        {
+            (Section.Strings, WriteStrings(strings)),
+            (Section.Constants, constants),
+            (Section.Code, code),
+            (Section.Functions, table),
+            (Section.Classes, classes),
+        };
+
+        int offset = Align(target.Count + 4 + sections.Count * SectionEntrySize);
+        Add(target, ByteConverter.IntToU2(sections.Count));
+        Add(target, ByteConverter.IntToU2(0));
+        foreach (var (id, data) in sections)
+        {
+            Add(target, ByteConverter.IntToU4((int)id));
+            Add(target, ByteConverter.IntToU4(offset));
+            Add(target, ByteConverter.IntToU4(data.Count));
+            offset = Align(offset + data.Count);
+        }
+
+        foreach (var (_, data) in sections)
+        {
+            Pad(target);
+            Add(target, data);
+        }
+
+        Next?.Handle(source, target);
+    }
+
+    // A string constant refers to its entry in the string table by u4 index
+    private static List<byte> WriteConstants(ConstantPool pool, List<byte[]> strings)
+    {
+        var section = new List<byte>();
+        Add(section, ByteConverter.IntToU4(pool.Length));
+
+        foreach (var constant in pool.GetConstants())
+        {
+            section.Add(constant.Tag);
+            if (constant.Tag == StringTag)
+            {
+                // the v1 encoding is a u2 length followed by the bytes
+                Add(section, ByteConverter.IntToU4(strings.Count));
+                strings.Add(constant.Data[2..]);
+            }
+            else
+            {
+                Add(section, constant.Data);
+            }
+        }
+
+        return section;
+    }
+
+    private static List<byte> WriteStrings(List<byte[]> strings)
+    {
+        var section = new List<byte>();
+        Add(section, ByteConverter.IntToU4(strings.Count));
+        Add(section, ByteConverter.IntToU4(0));
+
+        int offset = 8 + strings.Count * 8;
+        foreach (var s in strings)
+        {
+            Add(section, ByteConverter.IntToU4(offset));
+            Add(section, ByteConverter.IntToU4(s.Length));
+            offset += s.Length;
+        }
+
+        foreach (var s in strings)
+        {
+            Add(section, s);
+        }
+
+        return section;
+    }
+
+    // Fixed-size entries locating each body in the code section
+    private static List<byte> WriteFunctions(List<Function> functions, List<byte> code)
+    {
+        var section = new List<byte>();
+        Add(section, ByteConverter.IntToU4(functions.Count));
+        Add(section, ByteConverter.IntToU4(0));
+
+        var visitor = new SerializingVisitor(code, wideJumps: true);
+        foreach (var function in functions)
+        {
+            int codeOffset = code.Count;
+            foreach (var operation in function.Operations)
+            {
+                operation.Accept(visitor);
+            }
+
+            Add(section, ByteConverter.IntToU2(function.NameIndex));
+            Add(section, ByteConverter.IntToU2(function.ParameterDescriptorIndex));
+            Add(section, ByteConverter.IntToU2(function.ReturnTypeIndex));
+            Add(section, ByteConverter.IntToU2(function.MaxStackUsed));
+            Add(section, ByteConverter.IntToU2(function.LocalsLength));
+            Add(section, ByteConverter.IntToU2(0));
+            Add(section, ByteConverter.IntToU4(function.OperationsLength));
+            Add(section, ByteConverter.IntToU4(codeOffset));
+            Add(section, ByteConverter.IntToU4(code.Count - codeOffset));
+        }
+
+        return section;
+    }
+
+    private static List<byte> WriteClasses(ClassPool pool, List<Function> functions)
+    {
+        var section = new List<byte>();
+        Add(section, ByteConverter.IntToU2(pool.Length));
+
+        foreach (var c in pool.GetClasses())
+        {
+            Add(section, ByteConverter.IntToU2(c.NameIndex));
+
+            Add(section, ByteConverter.IntToU2(c.FieldsLength));
+            foreach (var field in c.Fields)
+            {
+                Add(section, ByteConverter.IntToU2(field.NameIndex));
+                Add(section, ByteConverter.IntToU2(field.DescriptorIndex));
+            }
+
+            Add(section, ByteConverter.IntToU2(c.MethodsLength));
+            foreach (var method in c.Methods)
+            {
+                Add(section, ByteConverter.IntToU2(functions.Count));
+                functions.Add(method);
+            }
+        }
+
+        return section;
+    }
+
+    private static int Align(int offset)
+    {
+        return (offset + Alignment - 1) / Alignment * Alignment;
+    }
+
+    private static void Pad(IList<byte> target)
+    {
+        while (target.Count % Alignment != 0)
+        {
+            target.Add(0);
+        }
+    }
+
+    private static void Add(IList<byte> target, IEnumerable<byte> bytes)
+    {
+        foreach (var b in bytes)
+        {
+            target.Add(b);
+        }
+    }
+}
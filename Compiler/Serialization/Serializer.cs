@@ -11,6 +11,8 @@ public class Serializer
     private IOperationVisitor visitor;
 
     private Handler _handlers;
+
+    private Handler _indexedHandlers;
     
     public Serializer()
     {
@@ -20,12 +22,14 @@ public class Serializer
             .AddNextHandler(new ConstantsHandler())
             .AddNextHandler(new FunctionsHandler(visitor))
             .AddNextHandler(new ClassesHandler(visitor));
+        _indexedHandlers = new HeaderHandler()
+            .AddNextHandler(new IndexedSectionsHandler());
     }
     
     public void Serialize(Ball source, string target)
     {
         _buffer.Clear();
-        _handlers.Handle(source, _buffer);
+        HandlersFor(source).Handle(source, _buffer);
         
         File.WriteAllBytes(target, _buffer.ToArray());
     }
@@ -33,8 +37,14 @@ public class Serializer
     public byte[] SerializeToArray(Ball source)
     {
         _buffer.Clear();
-        _handlers.Handle(source, _buffer);
+        HandlersFor(source).Handle(source, _buffer);
 
         return _buffer.ToArray();
     }
+
+    // The version major in the header selects the layout
+    private Handler HandlersFor(Ball source)
+    {
+        return source.Header.IsIndexed ? _indexedHandlers : _handlers;
+    }
 }
\ No newline at end of file
@@ -7,4 +7,9 @@ public struct Header(byte[] version, byte flags)
     public readonly byte[] Version { get; } = version;
 
     public byte Flags { get; set; } = flags;
+
+    // Version major of the indexed .ball layout (sections, function table, u4 jumps)
+    public const byte IndexedVersion = 2;
+
+    public bool IsIndexed => Version.Length > 0 && Version[0] >= IndexedVersion;
 }
\ No newline at end of file
@@ -1,6 +1,7 @@
 #pragma once
 
 #include <cstdint>
+#include <functional>
 #include <string>
 #include <vector>
 #include <unordered_map>
@@ -8,11 +9,33 @@
 
 #include "common.hpp"
 #include "runtime_data_area.hpp"
+#include "mapped_file.hpp"
+#include "thread_pool.hpp"
 
 namespace czffvm {
 const int32_t kBitsInByte = 8;
 const uint32_t kMagicNumber = 0x62616c6c;
 
+// Version major of the indexed layout; files with a lower major use the
+// sequential v1 layout (see docs/bytecode/bytecode.md)
+const uint8_t kIndexedBallVersion = 2;
+
+enum class BallSection : uint32_t {
+    STRINGS = 1,
+    CONSTANTS = 2,
+    FUNCTIONS = 3,
+    CODE = 4,
+    CLASSES = 5,
+};
+
+const size_t kSectionEntrySize = 12;
+const size_t kFunctionEntrySize = 24;
+
+// Post-load images written by ClassLoader::SaveImage
+const uint32_t kImageMagicNumber = 0x637a6669;
+const uint8_t kImageVersion = 1;
+const size_t kImageFunctionEntrySize = 20;
+
 class ClassLoaderError : public std::runtime_error {
 public:
     ClassLoaderError(
@@ -22,22 +45,79 @@ public:
     );
 };
 
+// Big-endian reader over bytes it does not own. Reads past the end throw
+// std::out_of_range; the Unchecked variants skip that check for callers
+// that validated the length with Remaining() first.
 class ByteReader {
 public:
     explicit ByteReader(const std::vector<uint8_t>& data);
+    ByteReader(const uint8_t* data, size_t size);
 
     uint8_t ReadU1();
     uint16_t ReadU2();
     uint32_t ReadU4();
     std::string ReadString();
 
+    // The next `count` bytes, valid as long as the input is
+    const uint8_t* ReadBytes(size_t count);
+
+    uint8_t ReadU1Unchecked();
+    uint16_t ReadU2Unchecked();
+    uint32_t ReadU4Unchecked();
+
+    size_t Offset() const;
+    size_t Remaining() const;
     bool Eof() const;
 
 private:
-    const std::vector<uint8_t>& data_;
+    const uint8_t* data_;
+    size_t size_;
     size_t offset_;
+
+    void Require(size_t count) const;
+};
+
+// Big-endian counterpart of ByteReader that owns its output
+class ByteWriter {
+public:
+    void WriteU1(uint8_t value);
+    void WriteU2(uint16_t value);
+    void WriteU4(uint32_t value);
+    void WriteBytes(const uint8_t* data, size_t count);
+
+    // Overwrites a u4 written earlier, e.g. an offset known only later
+    void PatchU4(size_t offset, uint32_t value);
+
+    size_t Size() const;
+    std::vector<uint8_t>& Data();
+
+private:
+    std::vector<uint8_t> data_;
 };
 
+// Bounds of a v2 section, absolute within the file
+struct BallSectionRange {
+    size_t offset = 0;
+    size_t size = 0;
+};
+
+// A v2 function table entry
+struct BallFunctionEntry {
+    uint16_t name_index;
+    uint16_t params_descriptor_index;
+    uint16_t return_type_index;
+    uint16_t max_stack;
+    uint16_t locals_count;
+    uint32_t code_length;    // operations
+    uint32_t code_offset;    // relative to the code section
+    uint32_t code_size;      // bytes
+};
+
+// The v2 section table following the header; each section is checked to
+// lie within the file
+std::unordered_map<uint32_t, BallSectionRange> ReadBallSections(ByteReader& reader);
+BallFunctionEntry ReadBallFunctionEntry(ByteReader& reader);
+
 class ClassLoader {
 public:
     explicit ClassLoader(RuntimeDataArea& rda);
@@ -46,17 +126,90 @@ public:
     void LoadProgram(const std::string& path);
 
     RuntimeFunction* EntryPoint() const;
+
+    void EnableEscapeAnalysis(bool enabled);
+    void EnableTailCallElimination(bool enabled);
+    void EnableSuperinstructions(bool enabled);
+
+    // Function bodies are decoded, verified and analyzed on first use
+    // (see MethodArea::EnsureCode) instead of while loading
+    void EnableLazyDecoding(bool enabled);
+
+    // Once the program is loaded, drops the functions and constants its
+    // entry point cannot reach. Needs lazy decoding: with every body still
+    // in the files, only the file tables and signatures are remapped.
+    void EnableTreeShaking(bool enabled);
+
+    // Bodies decoded while loading are decoded on this many threads, and
+    // their superinstructions selected; 1 keeps loading on the caller.
+    // Functions are registered in file order either way.
+    void SetLoadThreads(size_t threads);
+
+    // The loaded program as an image: the method area after every
+    // load-time pass, with all bodies decoded. LoadImage restores it into
+    // an empty method area, decoding bodies as LoadFile would but without
+    // running the passes again; it returns false, changing nothing, when
+    // the image is missing, damaged or was saved under another key.
+    std::vector<uint8_t> SaveImage(uint64_t key);
+    bool LoadImage(const std::string& path, uint64_t key);
+
+    // The settings that change what a load produces, to key cached images
+    uint64_t ImageOptions() const;
+
+    // Rewrites each loaded function before the other load-time passes
+    using FunctionPass = std::function<void(RuntimeFunction&, MethodArea&)>;
+    void SetBytecodeOptimizer(FunctionPass optimizer);
 private:
+    struct LoadedFile {
+        std::unique_ptr<MappedFile> mapping;
+        bool indexed = false;
+        bool image = false;
+        BallSectionRange code;
+        std::vector<uint16_t> constants;    // file constant index -> pool index
+        std::vector<uint16_t> functions;    // file function index -> function table index
+    };
+
     RuntimeDataArea& rda_;
     RuntimeFunction* entry_point_ = nullptr;
+    std::vector<LoadedFile> files_;
+    bool escape_analysis_ = false;
+    bool tail_calls_ = false;
+    bool superinstructions_ = false;
+    bool lazy_decoding_ = false;
+    bool tree_shaking_ = false;
+    FunctionPass bytecode_optimizer_;
+    size_t load_threads_ = 1;
+    std::unique_ptr<ThreadPool> pool_;
 
     void LoadFile(const std::string& path);
     void ResolveEntryPoint();
+    void ShakeTree();
+    void ScanBody(const RuntimeFunction& fn, std::vector<uint16_t>& calls,
+                  std::vector<uint16_t>& constants) const;
+
+    uint8_t LoadHeader(ByteReader& reader);
+    void LoadConstantPool(ByteReader& reader, LoadedFile& file);
+    void LoadClasses(ByteReader& reader, const LoadedFile& file);
+    void LoadFunctions(ByteReader& reader, LoadedFile& file);
+
+    void LoadIndexed(ByteReader& reader, LoadedFile& file);
+    void LoadIndexedConstants(ByteReader& reader, LoadedFile& file,
+                              const BallSectionRange* strings);
+    void LoadIndexedFunctions(ByteReader& reader, LoadedFile& file, size_t section_offset);
+    uint16_t ResolveDeclaration(uint16_t name_index, uint16_t params_index, uint16_t return_index);
 
-    void LoadHeader(ByteReader& reader);
-    void LoadConstantPool(ByteReader& reader);
-    void LoadClasses(ByteReader& reader);
-    void LoadFunctions(ByteReader& reader);
+    void DecodeCode(ByteReader& reader, const LoadedFile& file, RuntimeFunction& fn,
+                    uint32_t code_len, bool wide_jumps);
+    void DecodeIndexedCode(const LoadedFile& file, const BallFunctionEntry& entry, RuntimeFunction& fn);
+    void DecodeImageCode(const LoadedFile& file, RuntimeFunction& fn);
+    void SkipCode(ByteReader& reader, uint16_t code_len);
+    void DecodeBody(RuntimeFunction& fn);
+    void FinishDecoding(RuntimeFunction& fn);
+    void DecodeFunction(RuntimeFunction& fn);
+    void DecodeFunctions(size_t first);
+    void AnalyzeFunctions(size_t first);
+    void AnalyzeFunction(RuntimeFunction& fn);
+    void RewriteFunction(RuntimeFunction& fn);
 };
 
 }  // namespace czffvm
@@ -19,8 +19,13 @@ namespace czffvm_jit {
 
 namespace czffvm {
 const uint32_t kBytesInKiB = 1024;
-const uint32_t kDefaultMaxHeapSizeInKiB = kBytesInKiB * 50; // 5 MiB
+const uint32_t kDefaultMaxHeapSizeInKiB = kBytesInKiB * 50; // 50 MiB
+const uint32_t kDefaultGcGrowthPercent = 100;
+const uint32_t kMinGcTriggerInKiB = kBytesInKiB * 4; // 4 MiB
+const uint32_t kDefaultLargeObjectThresholdInKiB = 256;
 constexpr uint32_t kJitThreshold = 5;
+// back edges a function took in a profiled run for it to count as hot
+constexpr uint64_t kHotBackEdges = 10000;
 
 enum class OperationCode : uint16_t {
     NOP = 0x0000,
@@ -50,7 +55,17 @@ enum class OperationCode : uint16_t {
     NEG = 0x0018,
     MOD = 0x0019,
     LOR = 0x001A,
-    LAND = 0x001B
+    LAND = 0x001B,
+
+    // Superinstructions: created by the loader for the interpreter only,
+    // never stored in a .ball file and never seen by the JIT
+    LDV_LDV = 0x0100,
+    LDV_LDC = 0x0101,
+    LDV_LDV_ADD_STORE = 0x0102,
+    LDV_LDC_ADD_STORE = 0x0103,
+    CMP_JZ = 0x0104,
+    LDV_LDC_CMP_JZ = 0x0105,
+    LDV_LDV_LDELEM = 0x0106
 };
 
 struct Operation {
@@ -76,6 +91,8 @@ enum class ConstantTag : uint8_t {
 struct Constant {
     ConstantTag tag;
     std::vector<uint8_t> data;
+
+    bool operator==(const Constant&) const = default;
 };
 
 struct RuntimeField {
@@ -97,9 +114,22 @@ struct RuntimeFunction {
     uint16_t max_stack;
     uint16_t locals_count;
     std::vector<Operation> code;
+    std::vector<Operation> fused_code; // same pcs as code, run by the interpreter when not empty
+
+    std::vector<bool> frame_arrays; // NEWARR pc -> array never escapes the frame
+
+    // Body not decoded yet, it starts at code_offset in the loader's code_file
+    // (see MethodArea::EnsureCode). code_file is the module the function was
+    // loaded from.
+    bool code_pending = false;
+    uint32_t code_file = 0;
+    size_t code_offset = 0;
 
     uint32_t call_count = 0;
+    uint64_t back_edge_count = 0;   // taken jumps to the jump itself or before it
+    bool jit_on_first_call = false; // a saved profile found hot loops, see ProfileData::Apply
     bool compilable = true;
+    bool jit_cache_probed = false;  // the JIT code cache was asked for this function
     std::unique_ptr<czffvm_jit::CompiledRuntimeFunction> jit_function; 
 };
 
@@ -0,0 +1,74 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "common.hpp"
+#include "runtime_data_area/method_area.hpp"
+
+namespace czffvm {
+
+// Arrays of at most this many elements are candidates for scalar replacement
+constexpr uint32_t kMaxScalarReplacedLength = 8;
+
+/**
+ * Escape Analysis
+ *
+ * Load-time pass over a single function. Tracks every array created by
+ * NEWARR through the operand stack and locals; an array escapes when its
+ * reference reaches anything other than STORE/DUP or the array operand of
+ * LDELEM/STELEM (a CALL argument, RET, a STELEM value, a block boundary...).
+ *
+ * Non-escaping arrays
+ *   * of small constant length, indexed only by constants, are replaced
+ *     by one local per element;
+ *   * allocated outside of loops, are marked in RuntimeFunction::frame_arrays
+ *     and freed by the interpreter when the frame returns.
+ */
+class EscapeAnalyzer {
+public:
+    EscapeAnalyzer(RuntimeFunction& function, MethodArea& method_area);
+
+    void Run();
+
+    size_t ScalarReplacedCount() const;
+    size_t FrameAllocatedCount() const;
+
+private:
+    struct ElementUse {
+        size_t array_load;   // LDV of the array local
+        size_t index_load;   // LDC of the index
+        size_t access;       // LDELEM or STELEM
+    };
+
+    RuntimeFunction& function_;
+    MethodArea& method_area_;
+
+    std::vector<int> parent_;           // union-find over sites and locals
+    std::vector<bool> escapes_;
+    std::vector<bool> leaders_;
+    std::vector<int> site_of_pc_;       // NEWARR pc -> site node, -1 otherwise
+    std::vector<size_t> site_pcs_;
+    std::vector<uint32_t> local_stores_;
+    std::vector<ElementUse> uses_;
+
+    size_t scalar_replaced_ = 0;
+    size_t frame_allocated_ = 0;
+
+    void Analyze();
+    bool ScalarReplace();
+    void MarkFrameArrays();
+
+    int LocalNode(uint16_t local) const;
+    int Find(int node);
+    void Union(int a, int b);
+    bool Escapes(int node);
+    std::vector<size_t> ComponentSizes();    // indexed by root node
+
+    std::vector<bool> FindLoopPcs() const;
+    std::vector<bool> FindLeaders() const;
+    bool ConstantIndex(const Operation& op, uint32_t& value) const;
+    uint16_t DefaultConstant(uint16_t element_type_index);
+};
+
+}  // namespace czffvm
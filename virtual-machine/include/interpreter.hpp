@@ -1,6 +1,9 @@
 #pragma once
 
+#include <ostream>
+
 #include "runtime_data_area.hpp"
+#include "opcode_profile.hpp"
 #include "jit/jit_x86_64.hpp"
 
 namespace czffvm {
@@ -19,10 +22,25 @@ public:
     void ExecuteJitFunction(RuntimeFunction* function, CallFrame& caller_frame, std::vector<Value>& args);
     bool CanCompile(const RuntimeFunction* function);
 
+    // Counts executed opcode pairs and triples from now on
+    void EnableOpcodeProfile();
+    const OpcodeProfile* Profile() const;
+    void PrintOpcodeProfile(std::ostream& out) const;
+
+    // The call and back edge counters are written to `path` when the
+    // program ends, also when HALT ends it
+    void SetProfileOutput(const std::string& path);
+    // A profile that cannot be written only warns
+    void SaveProfile() const;
+
 private:
     RuntimeDataArea& rda_;
     std::unique_ptr<czffvm_jit::JitCompiler> jit_compiler_;
     std::unique_ptr<czffvm_jit::X86JitHeapHelper> heapHelper_;
+    std::unique_ptr<OpcodeProfile> profile_;
+    std::string profile_output_;
+
+    Value LoadElement(const Value& array, const Value& index);
 };
 
 } // namespace czffvm
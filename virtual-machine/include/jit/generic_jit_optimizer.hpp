@@ -3,13 +3,16 @@
 #include <iostream>
 #include <vector>
 #include <algorithm>
+#include <map>
 #include <unordered_map>
 #include <unordered_set>
 #include <memory>
+#include <optional>
 #include <cstdint>
 #include "common.hpp"
 #include "runtime_data_area/method_area.hpp"
 #include "jit/jit_compiler.hpp"
+#include "jit/loop_analysis.hpp"
 
 
 namespace czffvm_jit {
@@ -62,6 +65,8 @@ int StackProduces(OperationCode op) {
         case OperationCode::LEQ:
         case OperationCode::LOR:
         case OperationCode::LAND:
+        case OperationCode::NEG:
+        case OperationCode::MIN:
             return 1;
 
         case OperationCode::DUP:
@@ -91,6 +96,7 @@ int StackConsumes(OperationCode op) {
             return 2;
 
         case OperationCode::NEG:
+        case OperationCode::MIN:
         case OperationCode::STORE:
         case OperationCode::PRINT:
         case OperationCode::RET:
@@ -146,13 +152,29 @@ bool operator==(const czffvm_jit::StackSlot& lhs, const czffvm_jit::StackSlot& r
 
 using StackState = std::vector<StackSlot>;
 
+// Inlining heuristics, sizes are in callee operations
+constexpr size_t kInlineSmallSize = 24;        // always inlined
+constexpr size_t kInlineHotSize = 96;          // inlined once the callee is hot
+constexpr uint32_t kInlineHotCalls = 50;
+constexpr size_t kInlineMaxCodeSize = 4096;    // caller size after inlining
+
+struct InlineSite {
+    int pc;
+    const RuntimeFunction* callee;
+    size_t argc;
+};
+
 
 class GenericJitOptimizer {
 private:
     MethodArea& method_area_;
     std::vector<Operation>& code_;
     std::vector<BasicBlock> basic_blocks_;
-    std::unordered_map<int, int> addr_to_block_;
+    std::vector<int> addr_to_block_;         // -1 past the end
+    bool cfg_valid_ = false;
+    bool reachability_valid_ = false;
+    std::optional<std::vector<bool>> liveness_;
+    bool interpreter_semantics_ = false;
 
     int decodeJumpTarget(const Operation& instr) const {
         int hi = instr.arguments[0];
@@ -165,6 +187,15 @@ private:
         instr.arguments[1] = target_addr & 0xFF;
     }
 
+    int BlockAt(int addr) const {
+        return addr >= 0 && addr < (int)addr_to_block_.size() ? addr_to_block_[addr] : -1;
+    }
+
+    // Index of an equal constant already in the pool, registered if missing
+    uint16_t InternConstant(const Constant& c);
+    // Operand stack (consumed, produced) counts, CALL included
+    std::pair<int, int> StackEffect(const Operation& instr) const;
+
 
 public:
     GenericJitOptimizer(
@@ -172,13 +203,47 @@ public:
         MethodArea& method_area
     ) : code_(code), method_area_(method_area) {}
 
+    // For code the interpreter runs: folds only operations the interpreter
+    // accepts for the operand types and keeps operations that may throw
+    // (DIV, MOD, LDELEM) even when their result is unused. By default the
+    // passes assume compiled code, where every value is an untyped word.
+    void SetInterpreterSemantics(bool enabled) { interpreter_semantics_ = enabled; }
+
+    // Cached analyses. Passes invalidate them when they change the code;
+    // BuildControlFlowGraph always rebuilds.
     void BuildControlFlowGraph();
+    const std::vector<BasicBlock>& ControlFlowGraph();   // built, reachability marked
+    const std::vector<bool>& StackLiveness();            // per pc: its stack results are consumed
+    void InvalidateAnalyses();
+
     void MarkReachableBlocks();
     void RemoveDeadCode();
     void CompactCode();
+    // Sparse conditional constant propagation: tracks constants on the
+    // operand stack and in locals across blocks, folds operations of every
+    // integer width with the interpreter's result type, turns decided JZ/JNZ
+    // into JMP or NOP and drops the blocks that become unreachable
     void ConstantFolding();
     void DeadStackElimination();
     void RemoveRedundantJumps();
+
+    // Replaces CALLs to small leaf functions with their bodies: arguments
+    // stay on the operand stack, callee locals are mapped to slots from
+    // `locals_count` up (which grows to cover them) and RET jumps to the
+    // continuation. Returns the number of inlined call sites. Calls that
+    // run inlined are not counted in the callee's call_count.
+    size_t InlineCalls(uint16_t& locals_count);
+    // The CALLs InlineCalls would replace, in code order. Only reads the
+    // code and the callees: a callee whose body is not decoded yet is not
+    // inlined.
+    std::vector<InlineSite> FindInlineSites(uint16_t locals_count) const;
+    bool CanInline(const RuntimeFunction& callee) const;
+
+    // Natural loops of the current CFG, loop blocks are basic block ids
+    LoopAnalysis FindLoops() const;
+
+    const std::vector<BasicBlock>& BasicBlocks() const { return basic_blocks_; }
+    const std::vector<Operation>& Code() const { return code_; }
 };
 
 }  // namespace czffvm_jit
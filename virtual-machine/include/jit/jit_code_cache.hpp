@@ -0,0 +1,72 @@
+#pragma once
+
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include "common.hpp"
+#include "runtime_data_area/method_area.hpp"
+#include "jit/jit_compiler.hpp"
+#include "image_cache.hpp"
+
+namespace czffvm_jit {
+
+constexpr uint32_t kJitCacheMagicNumber = 0x637a666a;  // "czfj"
+// Changes whenever the compiler emits different code for the same bytecode
+constexpr uint8_t kJitCacheVersion = 1;
+
+enum class CodePatchKind : uint8_t {
+    HELPER = 0,     // address of a runtime helper
+    CONSTANT = 1,   // index of a constant in the constant pool
+};
+
+// An immediate in cached code that depends on the process it runs in
+struct CodePatch {
+    uint32_t offset;        // of the immediate within the code
+    uint8_t width;          // 4 or 8 bytes, little-endian
+    CodePatchKind kind;
+    uint16_t index;         // helper number, or entry of CachedCode::constants
+    uint32_t bias;          // or-ed into a constant index
+};
+
+// Compiled function in a form that can be loaded into another process
+struct CachedCode {
+    std::vector<uint8_t> code;
+    std::vector<CodePatch> patches;
+    std::vector<czffvm::Constant> constants;
+    uint32_t argument_count = 0;
+    uint16_t locals_count = 0;
+    std::vector<StackMap> stack_maps;
+};
+
+/**
+ * On-disk cache of compiled functions, one file per function.
+ *
+ * The key hashes what the compiled code depends on: the function's
+ * signature, locals and bytecode, the bytecode of every function it may
+ * call (which the compiler may inline) and the values of the constants
+ * it loads, together with kJitCacheVersion and a word describing the
+ * target (e.g. its CPU features). Constant indices themselves are not
+ * part of the key, so the same function in a program whose constant pool
+ * is laid out differently still hits; every index in the code is patched
+ * on load instead.
+ *
+ * Load() returns nothing for a missing, damaged or mismatching entry.
+ * Store() throws std::runtime_error when the entry cannot be written.
+ */
+class JitCodeCache {
+public:
+    JitCodeCache(std::string directory, uint64_t target);
+
+    uint64_t Key(const czffvm::RuntimeFunction& function, czffvm::MethodArea& method_area) const;
+
+    std::optional<CachedCode> Load(uint64_t key) const;
+    void Store(uint64_t key, const CachedCode& code) const;
+
+private:
+    czffvm::ImageCache files_;
+    uint64_t target_;
+};
+
+}  // namespace czffvm_jit
@@ -2,6 +2,8 @@
 
 #include <memory>
 #include <optional>
+#include <string>
+#include <vector>
 #include "common.hpp"
 
 namespace czffvm {
@@ -40,6 +42,9 @@ namespace czffvm {
 
 namespace czffvm_jit {
 
+// Words of a compiled frame that may hold a HeapRef id at one safepoint
+using StackMap = std::vector<uint32_t>;
+
 class CompiledRuntimeFunction {
 public:
     template<typename FuncType>
@@ -52,8 +57,10 @@ public:
     virtual void* GetCode() const = 0;
     virtual size_t GetSize() const = 0;
     virtual size_t GetArgumentCount() const = 0;
+    virtual uint16_t GetLocalsCount() const = 0;   // of the compiled code
     virtual uint16_t GetNameIndex() const = 0;
     virtual uint16_t GetReturnTypeIndex() const = 0;
+    virtual const std::vector<StackMap>& GetStackMaps() const = 0;
     
     explicit operator bool() const { return GetCode() != nullptr; }
 };
@@ -64,12 +71,32 @@ public:
     
     virtual bool CanCompile(czffvm::OperationCode opcode) = 0;
     virtual bool CanCompile(czffvm::Operation op) = 0;
+    // every operation compiles once the optimizer has inlined the calls;
+    // changes neither the function, its callees nor the constant pool
+    virtual bool CanCompileFunction(const czffvm::RuntimeFunction& function,
+                                    czffvm::MethodArea& method_area);
     virtual std::unique_ptr<CompiledRuntimeFunction> CompileFunction(
         const czffvm::RuntimeFunction& function,
         czffvm::RuntimeDataArea& rda
     ) = 0;
+
+    // Compiled code is also kept in `directory`, and later runs load it
+    // from there instead of compiling again. Backends without relocatable
+    // output ignore it.
+    virtual void SetCodeCache(const std::string& /*directory*/) {}
+    // Code an earlier run stored for `function`, nullptr when there is none
+    virtual std::unique_ptr<CompiledRuntimeFunction> LoadCachedFunction(
+        const czffvm::RuntimeFunction& /*function*/,
+        czffvm::RuntimeDataArea& /*rda*/
+    ) {
+        return nullptr;
+    }
     
     static std::unique_ptr<JitCompiler> create();
 };
 
+// Load-time cleanup of bytecode the interpreter runs: the JitPassManager
+// cleanup passes with interpreter semantics, applied to function.code
+void OptimizeBytecode(czffvm::RuntimeFunction& function, czffvm::MethodArea& method_area);
+
 }  // namespace czffvm_jit
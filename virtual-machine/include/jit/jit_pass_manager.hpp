@@ -0,0 +1,48 @@
+#pragma once
+
+#include <chrono>
+#include <functional>
+#include <iosfwd>
+#include <string>
+#include <vector>
+
+#include "jit/generic_jit_optimizer.hpp"
+
+namespace czffvm_jit {
+
+struct PassReport {
+    std::string name;
+    std::chrono::nanoseconds time;
+    size_t size_before;   // operations
+    size_t size_after;
+
+    size_t Removed() const { return size_before > size_after ? size_before - size_after : 0; }
+};
+
+/**
+ * Runs bytecode passes over one GenericJitOptimizer in order and records
+ * the time and code size of each. Passes share the optimizer's cached
+ * analyses, which every pass invalidates when it changes the code.
+ */
+class JitPassManager {
+public:
+    using Pass = std::function<void(GenericJitOptimizer&)>;
+
+    explicit JitPassManager(GenericJitOptimizer& optimizer);
+
+    void Add(std::string name, Pass pass);
+    // dead code, constant folding, dead stack values, redundant jumps
+    void AddCleanupPasses();
+
+    void Run();
+
+    const std::vector<PassReport>& Reports() const;
+    void PrintReports(std::ostream& out) const;
+
+private:
+    GenericJitOptimizer& optimizer_;
+    std::vector<std::pair<std::string, Pass>> passes_;
+    std::vector<PassReport> reports_;
+};
+
+}  // namespace czffvm_jit
@@ -0,0 +1,58 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "common.hpp"
+#include "runtime_data_area/method_area.hpp"
+#include "jit/jit_compiler.hpp"
+
+namespace czffvm_jit {
+
+/**
+ * Stack maps for compiled code
+ *
+ * Compiled functions keep every value as an untyped int32 word, so array
+ * ids are indistinguishable from integers. This pass infers, for every
+ * safepoint (a NEWARR, the only helper call that can trigger a GC), which
+ * locals and operand stack slots may hold a HeapRef id.
+ *
+ * The analysis is conservative: a word that is a reference on any path
+ * reaching the safepoint is reported.
+ */
+class StackMapBuilder {
+public:
+    StackMapBuilder(const std::vector<czffvm::Operation>& code,
+                    const czffvm::RuntimeFunction& function,
+                    uint16_t locals_count,
+                    czffvm::MethodArea& method_area);
+
+    // One map per NEWARR, in code order. Local i lives at word i, operand
+    // stack slot k at word operand_base + k.
+    std::vector<StackMap> Build(uint32_t operand_base);
+
+private:
+    enum class Slot : uint8_t {
+        INT,
+        REF,            // array of non-references
+        REF_OF_REFS,    // array whose elements may be references
+    };
+
+    struct State {
+        bool reached = false;
+        std::vector<Slot> locals;
+        std::vector<Slot> stack;
+    };
+
+    const std::vector<czffvm::Operation>& code_;
+    const czffvm::RuntimeFunction& function_;
+    uint16_t locals_count_;     // of `code`, which may differ from the function's
+    czffvm::MethodArea& method_area_;
+
+    State EntryState();
+    Slot ArrayOf(const std::string& element) const;
+    bool Merge(State& into, const State& from) const;
+    void Transfer(const czffvm::Operation& op, State& state) const;
+};
+
+}  // namespace czffvm_jit
@@ -3,6 +3,7 @@
 #include <memory>
 #include <asmjit/x86.h>
 #include "jit_compiler.hpp"
+#include "jit_code_cache.hpp"
 #include "common.hpp"
 #include "runtime_data_area/runtime_data_area.hpp"
 
@@ -17,9 +18,13 @@ private:
     uint16_t return_type_index;
     uint16_t max_stack;
     size_t argument_count;
+    uint16_t locals_count;
+    std::vector<StackMap> stack_maps;
 public:
-    X86CompiledRuntimeFunction(void* code, size_t size, std::weak_ptr<asmjit::JitRuntime> runtime_, size_t argument_count_) 
-        : compiled_code(code), code_size(size), runtime(runtime_), argument_count(argument_count_) {}
+    X86CompiledRuntimeFunction(void* code, size_t size, std::weak_ptr<asmjit::JitRuntime> runtime_, size_t argument_count_,
+                               uint16_t locals_count_ = 0, std::vector<StackMap> stack_maps_ = {}) 
+        : compiled_code(code), code_size(size), runtime(runtime_), argument_count(argument_count_),
+          locals_count(locals_count_), stack_maps(std::move(stack_maps_)) {}
     
     ~X86CompiledRuntimeFunction() {
 #ifdef DEBUG_BUILD
@@ -36,9 +41,11 @@ public:
     void* GetCode() const override { return compiled_code; }
     size_t GetSize() const override { return code_size; }
     size_t GetArgumentCount() const override { return argument_count; }
+    uint16_t GetLocalsCount() const override { return locals_count; }
     
     uint16_t GetNameIndex() const override { return name_index; }
     uint16_t GetReturnTypeIndex() const override { return return_type_index; }
+    const std::vector<StackMap>& GetStackMaps() const override { return stack_maps; }
 };
 
 class X86JitHeapHelper {
@@ -49,18 +56,22 @@ public:
 
     czffvm::HeapRef NewArray(
         uint32_t size,
-        uint16_t type_idx
+        uint16_t type_idx,
+        uint32_t safepoint
     );
 
+    // check_bounds is false for accesses the optimizer proved in range
     void StoreElem(
         czffvm::HeapRef ref,
         uint32_t index,
-        czffvm::Value* value
+        czffvm::Value* value,
+        bool check_bounds = true
     );
 
     czffvm::Value LoadElem(
         czffvm::HeapRef ref,
-        uint32_t index
+        uint32_t index,
+        bool check_bounds = true
     );
 
     void Print(
@@ -78,8 +89,14 @@ public:
     std::unique_ptr<CompiledRuntimeFunction> CompileFunction(
         const czffvm::RuntimeFunction& function,
         czffvm::RuntimeDataArea& rda) override;
+
+    void SetCodeCache(const std::string& directory) override;
+    std::unique_ptr<CompiledRuntimeFunction> LoadCachedFunction(
+        const czffvm::RuntimeFunction& function,
+        czffvm::RuntimeDataArea& rda) override;
 private:
     std::shared_ptr<asmjit::JitRuntime> runtime;
+    std::optional<JitCodeCache> code_cache_;
 
     enum class VMReg {
         STACK_PTR,
@@ -98,6 +115,20 @@ private:
         asmjit::x86::Gp heapPtr,
         const czffvm::Operation& op,
         const std::vector<asmjit::v1_21::Label>& labels,
+        asmjit::v1_21::Label epilogue,
+        uint32_t& next_safepoint,
+        bool in_bounds,
+        czffvm::RuntimeDataArea& rda,
+        CachedCode& cached
+    );
+
+    // LDC of a positive power of two followed by MUL, DIV or MOD, compiled
+    // as a shift or a mask. Returns false if the pair does not qualify.
+    bool CompilePowerOfTwo(
+        asmjit::x86::Assembler& a,
+        asmjit::x86::Gp& stackPtr,
+        const czffvm::Operation& ldc,
+        const czffvm::Operation& op,
         czffvm::RuntimeDataArea& rda
     );
 };
@@ -106,7 +137,8 @@ extern "C" uint32_t
 JIT_NewArray(
     X86JitHeapHelper* heap,
     uint32_t size,
-    uint16_t type
+    uint16_t type,
+    uint32_t safepoint
 );
 
 extern "C" void
@@ -123,12 +155,27 @@ JIT_StoreElem_I4(
     int32_t value
 );
 
+extern "C" void
+JIT_StoreElem_I4_InBounds(
+    X86JitHeapHelper* heap,
+    uint32_t arrId,
+    uint32_t index,
+    int32_t value
+);
+
 extern "C" int32_t
 JIT_LoadElem(
     X86JitHeapHelper* heap,
     uint32_t refId,
     uint32_t index
 );
+
+extern "C" int32_t
+JIT_LoadElem_InBounds(
+    X86JitHeapHelper* heap,
+    uint32_t refId,
+    uint32_t index
+);
 extern "C" void
 JIT_Print(
     X86JitHeapHelper* heap,
@@ -0,0 +1,44 @@
+#pragma once
+
+#include <vector>
+
+namespace czffvm_jit {
+
+struct Loop {
+    int header;
+    std::vector<int> blocks;      // sorted, header included
+    std::vector<int> latches;     // blocks with a back edge to the header
+    int parent = -1;              // enclosing loop, -1 for outermost
+    int depth = 1;
+};
+
+/**
+ * Dominators and natural loops of a control flow graph given as successor
+ * lists. Unreachable blocks have no dominator and belong to no loop.
+ * Loops sharing a header are merged; Loops() lists inner loops first.
+ */
+class LoopAnalysis {
+public:
+    LoopAnalysis(const std::vector<std::vector<int>>& succs, int entry);
+
+    int ImmediateDominator(int block) const;  // -1 for entry and unreachable
+    bool Dominates(int a, int b) const;
+
+    const std::vector<Loop>& Loops() const;
+    bool Contains(const Loop& loop, int block) const;
+    int LoopDepth(int block) const;
+
+private:
+    std::vector<std::vector<int>> succs_;
+    std::vector<std::vector<int>> preds_;
+    std::vector<int> idom_;
+    std::vector<int> rpo_index_;
+    std::vector<Loop> loops_;
+    std::vector<int> depth_;
+    int entry_;
+
+    void ComputeDominators();
+    void FindLoops();
+};
+
+}  // namespace czffvm_jit
@@ -0,0 +1,116 @@
+#pragma once
+
+#include <cstdint>
+#include <optional>
+#include <vector>
+
+#include "common.hpp"
+#include "runtime_data_area/method_area.hpp"
+#include "jit/loop_analysis.hpp"
+
+namespace czffvm_jit {
+
+using SsaId = uint32_t;
+constexpr SsaId kNoSsaValue = UINT32_MAX;
+
+enum class SsaKind : uint8_t {
+    CONSTANT,    // LDC <operand>
+    ARGUMENT,    // operand stack slot <operand> on function entry
+    LOCAL,       // local <operand> before its first STORE
+    PHI,         // one input per predecessor of the block, in preds order
+    OPERATION,   // bytecode operation <code> over inputs (bottom of stack first)
+};
+
+struct SsaInstruction {
+    SsaKind kind;
+    czffvm::OperationCode code = czffvm::OperationCode::NOP;
+    uint16_t operand = 0;        // constant, type, function or local index
+    std::vector<SsaId> inputs{};
+    int block = -1;
+    bool has_result = false;
+    bool removed = false;
+    bool in_bounds = false;      // LDELEM/STELEM index proven within the array
+};
+
+struct SsaBlock {
+    int id = 0;
+    std::vector<int> preds{};
+    std::vector<int> succs{};      // JZ/JNZ: {target, fallthrough}
+    std::vector<SsaId> phis{};
+    std::vector<SsaId> body{};     // execution order, terminator last
+};
+
+struct LoweredFunction {
+    std::vector<czffvm::Operation> code;
+    uint16_t locals_count;
+    std::vector<bool> in_bounds;     // per pc, array access needs no bounds check
+};
+
+/**
+ * SSA form of a single function
+ *
+ * LDV, STORE, DUP and SWAP disappear: locals and operand stack slots are
+ * SSA values, merged with phi nodes at join points. Blocks keep the
+ * original code order, blocks[0] is a synthetic entry holding arguments
+ * and the initial values of locals.
+ */
+class SsaFunction {
+public:
+    std::vector<SsaInstruction> values;
+    std::vector<SsaBlock> blocks;
+    uint16_t locals_count = 0;
+    uint16_t argument_count = 0;
+
+    // Drops operations whose result is unused and that cannot fail or
+    // have side effects. Returns the number of removed values.
+    size_t EliminateDeadValues();
+
+    std::vector<uint32_t> UseCounts() const;
+
+    // Natural loops over `blocks`, entered at the synthetic entry block
+    LoopAnalysis FindLoops() const;
+
+    // Moves pure operations whose inputs are defined outside a loop into
+    // the loop preheader. Loops without a unique preheader are skipped.
+    // Returns the number of hoisted values.
+    size_t HoistLoopInvariants();
+
+    // For an induction variable i = phi(init, i + c) and an invariant k,
+    // replaces i * k with a new induction variable stepping by c * k.
+    // Returns the number of replaced multiplications.
+    size_t ReduceInductionVariables();
+
+    // Range analysis over loop induction variables: marks LDELEM/STELEM
+    // in_bounds when the index is an induction variable counting up from
+    // a non-negative start and the loop test keeps it below the length
+    // the array was created with. Returns the number of marked accesses.
+    size_t EliminateBoundsChecks(czffvm::MethodArea& method_area);
+
+    // Back to stack bytecode: every value that is not consumed right away
+    // lives in its own local, phis become copies on the incoming edges.
+    LoweredFunction Lower() const;
+};
+
+/**
+ * Builds SsaFunction from stack bytecode on top of
+ * GenericJitOptimizer::ControlFlowGraph. Unreachable code is removed
+ * from `code` first. Returns nullopt for code the IR does not model
+ * (inconsistent stack depths at a join, stack underflow...).
+ */
+class SsaBuilder {
+public:
+    SsaBuilder(std::vector<czffvm::Operation>& code,
+               const czffvm::RuntimeFunction& function,
+               uint16_t locals_count,
+               czffvm::MethodArea& method_area);
+
+    std::optional<SsaFunction> Build();
+
+private:
+    std::vector<czffvm::Operation>& code_;
+    const czffvm::RuntimeFunction& function_;
+    uint16_t locals_count_;     // of `code`, which may differ from the function's
+    czffvm::MethodArea& method_area_;
+};
+
+}  // namespace czffvm_jit
@@ -0,0 +1,39 @@
+#pragma once
+
+#include <cstdint>
+#include <ostream>
+#include <unordered_map>
+
+#include "common.hpp"
+
+namespace czffvm {
+
+/**
+ * Counts of executed opcode pairs and triples, used to pick superinstructions.
+ *
+ * Only operations that directly follow each other in the same function form a
+ * sequence; a taken jump, a call or a return starts a new one. The original
+ * opcodes are recorded even when the interpreter runs fused ones, and JIT
+ * compiled functions are not seen at all.
+ */
+class OpcodeProfile {
+public:
+    void Record(const RuntimeFunction* function, size_t pc);
+
+    uint64_t Count(OperationCode a, OperationCode b) const;
+    uint64_t Count(OperationCode a, OperationCode b, OperationCode c) const;
+
+    // The `limit` most frequent pairs and triples
+    void Print(std::ostream& out, size_t limit = 20) const;
+
+private:
+    const RuntimeFunction* function_ = nullptr;
+    size_t next_pc_ = 0;
+    size_t run_ = 0;                 // length of the current sequence, up to 2
+    OperationCode last_[2] = {OperationCode::NOP, OperationCode::NOP};
+
+    std::unordered_map<uint32_t, uint64_t> pairs_;
+    std::unordered_map<uint64_t, uint64_t> triples_;
+};
+
+}  // namespace czffvm
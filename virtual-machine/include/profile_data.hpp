@@ -0,0 +1,55 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "common.hpp"
+#include "runtime_data_area/method_area.hpp"
+
+namespace czffvm {
+
+struct FunctionProfile {
+    std::string name;
+    uint64_t code_hash = 0;     // ProfileData::CodeHash of the body that ran
+    uint32_t invocations = 0;
+    uint64_t back_edges = 0;
+};
+
+/**
+ * Execution counts of one run, saved for the next one.
+ *
+ * Each function that ran is recorded under its name and a hash of its
+ * bytecode. Apply() seeds the counters of functions whose body still
+ * hashes the same, so calls made in earlier runs count toward
+ * kJitThreshold and the inliner's hot callees, and a function whose loops
+ * took kHotBackEdges back edges is compiled on its first call. A profile
+ * read, seeded and written again keeps adding up the runs.
+ *
+ * The file is text: a header line, then one line per function with the
+ * hash in hex, the invocations, the back edges and the name. Read()
+ * throws std::runtime_error for a file that cannot be read or parsed,
+ * Write() for one that cannot be written.
+ */
+class ProfileData {
+public:
+    // Every function with a non-zero counter
+    static ProfileData Collect(MethodArea& method_area);
+
+    static ProfileData Read(const std::string& path);
+    void Write(const std::string& path) const;
+
+    // Returns the number of functions that were seeded
+    size_t Apply(MethodArea& method_area) const;
+
+    const std::vector<FunctionProfile>& Functions() const;
+
+    // Hashes the values of loaded constants rather than their pool
+    // indices, which differ between eager and lazy decoding
+    static uint64_t CodeHash(const RuntimeFunction& function, MethodArea& method_area);
+
+private:
+    std::vector<FunctionProfile> functions_;
+};
+
+}  // namespace czffvm
@@ -1,5 +1,6 @@
 #pragma once
 
+#include <cstdint>
 #include <vector>
 
 #include "common.hpp"
@@ -11,6 +12,17 @@ struct CallFrame {
     std::vector<Value> operand_stack;
     std::vector<Value> locals;
     size_t pc = 0;
+    std::vector<HeapRef> frame_arrays; // freed when the frame returns
+};
+
+constexpr uint32_t kNoSafepoint = UINT32_MAX;
+
+// Frame of a function running compiled code. While a helper call is in
+// progress, stack_maps[safepoint] lists the words of base holding HeapRefs.
+struct JitFrame {
+    const int32_t* base = nullptr;
+    const std::vector<czffvm_jit::StackMap>* stack_maps = nullptr;
+    uint32_t safepoint = kNoSafepoint;
 };
 
 }  // namespace czffvm
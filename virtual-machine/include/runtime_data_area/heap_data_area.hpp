@@ -1,47 +1,77 @@
 #pragma once
 
+#include <initializer_list>
 #include <vector>
 #include <optional>
 
 #include "common.hpp"
 #include "stack_data_area.hpp"
+#include "type_table.hpp"
+#include "large_object_space.hpp"
 
 namespace czffvm {
 
 struct HeapObject {
     bool marked = false;
-    std::string type;
-    std::vector<Value> fields;
+    ElementKind element_kind = ElementKind::NONE;
+    uint32_t type_id = 0;    // index in the heap TypeTable
+    size_t size = 0;         // accounted size, fixed at allocation
+    HeapFields fields;
 };
 
 class Heap {
 public:
     Heap(StackDataArea& stack,
         uint32_t max_heap_size_in_kib,
-        bool is_gc_off = false);
+        bool is_gc_off = false,
+        uint32_t gc_growth_percent = kDefaultGcGrowthPercent,
+        uint32_t large_object_threshold_in_kib = kDefaultLargeObjectThresholdInKiB,
+        bool use_huge_pages = false);
+    HeapRef AllocateArray(uint32_t type_id,
+                          uint32_t length,
+                          const Value& element);
+    // An empty or filled field buffer using this heap's allocator, to be
+    // built in place and handed to Allocate without copying
+    HeapFields MakeFields(size_t length = 0, const Value& element = Value{});
+    HeapRef Allocate(uint32_t type_id,
+                     HeapFields&& fields);
     HeapRef Allocate(const std::string& type,
-                     std::vector<Value>&& fields);
+                     HeapFields&& fields);
     HeapRef Allocate(const std::string& type,
-                     std::vector<Value>& fields);
+                     std::initializer_list<Value> fields);
 
     HeapObject& Get(HeapRef ref);
+    void Free(HeapRef ref);
+
+    TypeTable& Types();
+    const TypeTable& Types() const;
+    const LargeObjectSpace& LargeObjects() const;
 
     void Collect();
 
+    uint64_t UsedBytes() const;
+    uint64_t NextCollectionBytes() const;
+
 private:
+    LargeObjectSpace large_objects_; // must outlive objects_
     std::vector<std::optional<HeapObject>> objects_;
     std::vector<uint32_t> free_list_;
+    TypeTable types_;
     uint32_t next_id_ = 1;
     StackDataArea& stack_;
     uint64_t used_bytes_ = 0;
     bool is_gc_off_ = false;
     uint64_t max_heap_size_in_kib_;
+    uint32_t gc_growth_percent_;
+    uint64_t next_gc_bytes_;
 
     void MarkFromRoots();
     void Mark(const HeapRef& ref);
     void Sweep();
-    size_t EstimateSize(const std::string& type, const std::vector<Value>& fields);
-    size_t EstimateSize(const std::string& type, const std::vector<Value>&& fields);
+    void UpdateCollectionTrigger();
+    void Reserve(size_t bytes);
+    HeapRef Place(HeapObject&& obj);
+    size_t EstimateSize(const HeapFields& fields);
 };
 
 }  // namespace czffvm
@@ -0,0 +1,95 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <new>
+#include <unordered_map>
+#include <vector>
+
+#include "common.hpp"
+
+namespace czffvm {
+
+/**
+ * Large Object Space
+ *
+ * Backing store for field buffers at or above the configured threshold.
+ * Every buffer gets its own anonymous mapping, so large arrays are never
+ * copied by the heap and their pages go back to the OS as soon as the
+ * owning object is swept.
+ */
+class LargeObjectSpace {
+public:
+    explicit LargeObjectSpace(
+        uint32_t threshold_in_kib = kDefaultLargeObjectThresholdInKiB,
+        bool use_huge_pages = false
+    );
+    ~LargeObjectSpace();
+
+    LargeObjectSpace(const LargeObjectSpace&) = delete;
+    LargeObjectSpace& operator=(const LargeObjectSpace&) = delete;
+
+    bool IsLarge(size_t bytes) const;
+
+    void* Map(size_t bytes);
+    void Unmap(void* ptr, size_t bytes);
+
+    size_t MappedBytes() const;
+    size_t MappingCount() const;
+
+private:
+    size_t threshold_bytes_;
+    bool use_huge_pages_;
+    size_t mapped_bytes_ = 0;
+    std::unordered_map<void*, size_t> mappings_;
+};
+
+/**
+ * Allocator for heap object fields: buffers that are large enough go to
+ * the LargeObjectSpace, everything else uses the regular heap.
+ */
+template<typename T>
+class HeapAllocator {
+public:
+    using value_type = T;
+    using propagate_on_container_move_assignment = std::true_type;
+    using propagate_on_container_copy_assignment = std::true_type;
+    using propagate_on_container_swap = std::true_type;
+
+    HeapAllocator() noexcept = default;
+    explicit HeapAllocator(LargeObjectSpace* los) noexcept : los_(los) {}
+
+    template<typename U>
+    HeapAllocator(const HeapAllocator<U>& other) noexcept : los_(other.Space()) {}
+
+    T* allocate(size_t n) {
+        size_t bytes = n * sizeof(T);
+        if (los_ && los_->IsLarge(bytes)) {
+            return static_cast<T*>(los_->Map(bytes));
+        }
+        return static_cast<T*>(::operator new(bytes));
+    }
+
+    void deallocate(T* ptr, size_t n) noexcept {
+        size_t bytes = n * sizeof(T);
+        if (los_ && los_->IsLarge(bytes)) {
+            los_->Unmap(ptr, bytes);
+            return;
+        }
+        ::operator delete(ptr);
+    }
+
+    LargeObjectSpace* Space() const noexcept { return los_; }
+
+    template<typename U>
+    bool operator==(const HeapAllocator<U>& other) const noexcept {
+        return los_ == other.Space();
+    }
+
+private:
+    LargeObjectSpace* los_ = nullptr;
+};
+
+using HeapFields = std::vector<Value, HeapAllocator<Value>>;
+
+}  // namespace czffvm
@@ -1,6 +1,9 @@
 #pragma once
 
+#include <functional>
 #include <memory>
+#include <optional>
+#include <unordered_map>
 
 #include "common.hpp"
 
@@ -16,20 +19,55 @@ public:
     uint16_t RegisterClass(RuntimeClass* cls);
     uint16_t RegisterFunction(RuntimeFunction* fn);
     uint16_t RegisterConstant(const Constant& c);
+    // Index of an equal constant, registering `c` only when there is none
+    uint16_t InternConstant(const Constant& c);
+
+    // Keep only the functions or constants marked live, in their order, and
+    // return the new index of every old one. Signatures and classes are
+    // updated; code is not, so this runs before any body is decoded.
+    std::vector<std::optional<uint16_t>> RetainFunctions(const std::vector<bool>& live);
+    std::vector<std::optional<uint16_t>> RetainConstants(const std::vector<bool>& live);
+
+    void SetArrayType(uint16_t element_type_index, uint32_t type_id);
+    std::optional<uint32_t> ArrayType(uint16_t element_type_index) const;
 
     const RuntimeClass* GetClass(uint16_t) const;
     RuntimeFunction* GetFunction(uint16_t index) const;
     const Constant& GetConstant(uint16_t index) const;
+    // Decoded once when the constant is registered; equal strings share
+    // one StringRef
+    const Value& GetConstantValue(uint16_t index) const;
+
+    // The first registered function or class with this name
+    std::optional<uint16_t> FindFunction(const std::string& name) const;
+    std::optional<uint16_t> FindClass(const std::string& name) const;
 
     const std::vector<RuntimeClass*>& Classes() const;
     const std::vector<RuntimeFunction*>& Functions() const;
     const std::vector<Constant>& ConstantPool() const;
 
+    // Decodes the body of a function registered with code_pending set;
+    // every reader of another function's code goes through EnsureCode
+    using CodeLoader = std::function<void(RuntimeFunction&)>;
+    void SetCodeLoader(CodeLoader loader);
+    void EnsureCode(RuntimeFunction& fn);
+
 private:
     std::vector<RuntimeClass*> classes_;
     std::vector<RuntimeFunction*> functions_;
     std::vector<Constant> constant_pool_;
+    std::vector<Value> constant_values_;
+
+    struct ConstantHash {
+        size_t operator()(const Constant& c) const;
+    };
+    std::unordered_map<Constant, uint16_t, ConstantHash> constant_index_;    // first of equal constants
+    std::vector<uint32_t> array_types_; // element type constant -> heap type id
+    std::unordered_map<std::string, uint16_t> function_names_;
+    std::unordered_map<std::string, uint16_t> class_names_;
+    CodeLoader code_loader_;
 
     std::string ResolveName(uint16_t constant_index) const;
+    void IndexName(std::unordered_map<std::string, uint16_t>& names, uint16_t name_index, uint16_t index);
 };
 }
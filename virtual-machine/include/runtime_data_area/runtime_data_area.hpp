@@ -12,7 +12,11 @@ namespace czffvm {
 
 class RuntimeDataArea {
 public:
-    RuntimeDataArea(uint32_t max_heap_size_in_kb = kDefaultMaxHeapSizeInKiB, bool is_gc_off = false);
+    RuntimeDataArea(uint32_t max_heap_size_in_kb = kDefaultMaxHeapSizeInKiB,
+                    bool is_gc_off = false,
+                    uint32_t gc_growth_percent = kDefaultGcGrowthPercent,
+                    uint32_t large_object_threshold_in_kib = kDefaultLargeObjectThresholdInKiB,
+                    bool use_huge_pages = false);
     ~RuntimeDataArea();
 
     RuntimeDataArea(const RuntimeDataArea&) = delete;
@@ -22,6 +26,9 @@ public:
     StackDataArea& GetStack();
     Heap& GetHeap();
 
+    // Heap type id of `[<element>`, where element is a STRING constant
+    uint32_t ArrayTypeFor(uint16_t element_type_index);
+
 private:
     StackDataArea stack_;
     MethodArea method_area_;
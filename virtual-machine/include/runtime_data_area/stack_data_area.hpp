@@ -16,13 +16,22 @@ class StackDataArea {
 public:
     void PushFrame(RuntimeFunction* fn);
     void PopFrame();
+    void ReplaceFrame(RuntimeFunction* fn);  // tail call: the current frame restarts in fn
     const std::vector<CallFrame>& GetFrames() const;
 
     CallFrame& CurrentFrame();
     bool Empty() const;
 
+    void PushJitFrame(const JitFrame& frame);
+    // Runs from destructors during unwinding, so it must not throw; popping
+    // without a pushed frame is a bug and only asserts
+    void PopJitFrame() noexcept;
+    const std::vector<JitFrame>& GetJitFrames() const;
+    JitFrame* CurrentJitFrame(); // nullptr when no compiled code is running
+
 private:
     std::vector<CallFrame> frames_;
+    std::vector<JitFrame> jit_frames_;
 };
 
 } // namespace czffvm
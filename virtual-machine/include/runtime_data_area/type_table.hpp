@@ -0,0 +1,52 @@
+#pragma once
+
+#include <optional>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "common.hpp"
+
+namespace czffvm {
+
+/**
+ * Element kind of an array type, cached in every heap object header
+ * so that LDELEM/STELEM do not have to look at the descriptor.
+ */
+enum class ElementKind : uint8_t {
+    NONE,           // not an array
+    BOOL,
+    SIGNED_INT,
+    UNSIGNED_INT,
+    STRING,
+    ARRAY,
+    OTHER,
+};
+
+struct TypeInfo {
+    std::string descriptor;
+    ElementKind element_kind = ElementKind::NONE;
+    std::optional<Value> element_default;
+};
+
+/**
+ * Type Table
+ *
+ * Interns type descriptors (e.g. `[I;`) into small integer ids.
+ * Heap objects store the id instead of the descriptor string.
+ */
+class TypeTable {
+public:
+    uint32_t Intern(const std::string& descriptor);
+    uint32_t InternArrayOf(const std::string& element_descriptor);
+
+    const TypeInfo& Get(uint32_t id) const;
+    const std::string& Descriptor(uint32_t id) const;
+    size_t Size() const;
+
+private:
+    std::vector<TypeInfo> types_;
+    std::unordered_map<std::string, uint32_t> ids_;
+};
+
+}  // namespace czffvm
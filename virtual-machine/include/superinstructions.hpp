@@ -0,0 +1,48 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "common.hpp"
+
+namespace czffvm {
+
+/**
+ * Superinstruction Selection
+ *
+ * Load-time pass over a single function. Builds `fused_code`, a copy of the
+ * code in which common sequences start with one fused operation:
+ *
+ *   LDV a; LDV b                   -> LDV_LDV a b
+ *   LDV a; LDC k                   -> LDV_LDC a k
+ *   LDV a; LDV b; ADD; STORE c     -> LDV_LDV_ADD_STORE a b c
+ *   LDV a; LDC k; ADD; STORE c     -> LDV_LDC_ADD_STORE a k c
+ *   EQ|LT|LEQ; JZ t                -> CMP_JZ cmp t
+ *   LDV a; LDC k; EQ|LT|LEQ; JZ t  -> LDV_LDC_CMP_JZ a k cmp t
+ *   LDV a; LDV b; LDELEM           -> LDV_LDV_LDELEM a b
+ *
+ * The operations covered by a fused one keep their place, so every pc and
+ * jump target stays the same and a jump into the middle of a sequence runs
+ * the rest of it one by one. `code` itself is left untouched for the JIT and
+ * the other passes.
+ *
+ * Must run after every pass that rewrites code.
+ */
+class SuperinstructionSelector {
+public:
+    explicit SuperinstructionSelector(RuntimeFunction& function);
+
+    // Returns the number of fused operations
+    size_t Run();
+
+    // Number of operations a fused one stands for, 1 for the others
+    static size_t Length(OperationCode code);
+
+private:
+    RuntimeFunction& function_;
+
+    bool Match(size_t pc, std::initializer_list<OperationCode> pattern) const;
+    bool IsComparison(size_t pc) const;
+};
+
+}  // namespace czffvm
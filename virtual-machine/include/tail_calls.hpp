@@ -0,0 +1,45 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "common.hpp"
+#include "runtime_data_area/method_area.hpp"
+
+namespace czffvm {
+
+/**
+ * Self Tail-Call Elimination
+ *
+ * Load-time pass over a single function. A `CALL self; RET` reached with
+ * nothing but the arguments on the operand stack becomes stores of the
+ * arguments plus a jump back to the entry, so the recursion runs as a loop
+ * in one frame.
+ *
+ * When the function starts by storing its parameters, the arguments are
+ * stored directly and the jump skips those stores; otherwise they are put
+ * back on the stack in the order the entry expects. Locals that the body
+ * may read before writing are reset to the value a fresh frame has.
+ *
+ * Must run before EscapeAnalyzer, which records per-pc information.
+ */
+class TailCallEliminator {
+public:
+    TailCallEliminator(RuntimeFunction& function, MethodArea& method_area);
+
+    // Returns the number of rewritten calls
+    size_t Run();
+
+private:
+    RuntimeFunction& function_;
+    MethodArea& method_area_;
+    size_t argc_ = 0;
+
+    std::vector<int> StackDepths() const;
+    std::vector<bool> LocalsReadBeforeWrite() const;
+    size_t ParameterStores() const;
+    size_t ArgumentCount(const RuntimeFunction& fn) const;
+    bool ReturnsValue(const RuntimeFunction& fn) const;
+};
+
+}  // namespace czffvm
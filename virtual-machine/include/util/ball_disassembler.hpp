@@ -5,6 +5,7 @@
 #include <string>
 
 #include "class_loader.hpp"
+#include "mapped_file.hpp"
 
 namespace czffvm {
 
@@ -14,16 +15,20 @@ public:
 
     void Disassemble();
 
+    static std::string OperationCodeToString(OperationCode code);
+
 private:
     std::string path_;
 
-    void LoadHeader(ByteReader& r);
+    uint8_t LoadHeader(ByteReader& r);
+
+    void DisassembleIndexed(const MappedFile& file, ByteReader& r);
+
+    void PrintOperation(ByteReader& reader, uint32_t pc, bool wide_jumps);
 
     void LoadConstantPool(ByteReader& r);
 
     static bool HasArguments(OperationCode code);
-
-    static std::string OperationCodeToString(OperationCode code);
 };
 
 } // namespace czffvm
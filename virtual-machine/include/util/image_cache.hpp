@@ -0,0 +1,37 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace czffvm {
+
+// 64-bit FNV-1a; `seed` continues an earlier hash
+uint64_t HashBytes(const uint8_t* data, size_t size, uint64_t seed = 14695981039346656037ull);
+
+/**
+ * Directory of files keyed by a 64-bit hash, one file per key.
+ *
+ * Key() hashes the contents of the input files, in order, together with
+ * an options word, so a changed input or option names a different file
+ * and stale entries are never read. Store() writes a temporary file and
+ * renames it into place, so readers never see a partial entry. Throws
+ * std::runtime_error when an input cannot be read or an entry cannot be
+ * written.
+ */
+class ImageCache {
+public:
+    ImageCache(std::string directory, std::string extension);
+
+    static uint64_t Key(const std::vector<std::string>& inputs, uint64_t options);
+
+    std::string PathFor(uint64_t key) const;
+    void Store(uint64_t key, const std::vector<uint8_t>& bytes) const;
+
+private:
+    std::string directory_;
+    std::string extension_;
+};
+
+}  // namespace czffvm
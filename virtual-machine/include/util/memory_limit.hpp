@@ -0,0 +1,40 @@
+#pragma once
+
+#include <cstdint>
+#include <optional>
+#include <string>
+
+namespace czffvm {
+
+const char* const kDefaultCgroupRoot = "/sys/fs/cgroup";
+const char* const kDefaultProcCgroup = "/proc/self/cgroup";
+constexpr uint32_t kDefaultHeapPercentOfMemoryLimit = 75;
+
+// cgroup v1 reports "no limit" as a huge page-aligned value
+constexpr uint64_t kCgroupUnlimitedThreshold = uint64_t(1) << 60;
+
+/**
+ * Reads the memory limit of the current container.
+ *
+ * The process's own cgroup is taken from `proc_cgroup`: the cgroup v2
+ * entry (`0::<path>`) and the cgroup v1 entry of the `memory` controller.
+ * Checks cgroup v2 (`<root><path>/memory.max`) first and then cgroup v1
+ * (`<root>/memory<path>/memory.limit_in_bytes`), each from the own cgroup
+ * up to `<root>`, and returns the tightest limit found. Without an entry
+ * only the files directly under `<root>` are read. Returns std::nullopt
+ * when no file exists or the limit is unset.
+ */
+std::optional<uint64_t> ReadCgroupMemoryLimit(const std::string& cgroup_root = kDefaultCgroupRoot,
+                                              const std::string& proc_cgroup = kDefaultProcCgroup);
+
+/**
+ * Derives the heap limit as `percent` of the cgroup memory limit.
+ * Falls back to kDefaultMaxHeapSizeInKiB when there is no limit.
+ */
+uint32_t AutoMaxHeapSizeInKiB(
+    uint32_t percent = kDefaultHeapPercentOfMemoryLimit,
+    const std::string& cgroup_root = kDefaultCgroupRoot,
+    const std::string& proc_cgroup = kDefaultProcCgroup
+);
+
+}  // namespace czffvm
@@ -0,0 +1,55 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace czffvm {
+
+/**
+ * Fixed set of worker threads for data-parallel loops.
+ *
+ * ParallelFor hands out indices one at a time, the calling thread taking
+ * part, and returns once every index is done. If bodies throw, the
+ * exception of the lowest failing index is rethrown, so errors do not
+ * depend on scheduling. One ParallelFor may run at a time.
+ */
+class ThreadPool {
+public:
+    // `threads` counts the caller, so 1 starts no workers
+    explicit ThreadPool(size_t threads);
+    ~ThreadPool();
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    size_t Size() const;
+
+    void ParallelFor(size_t count, const std::function<void(size_t)>& body);
+
+private:
+    std::vector<std::thread> workers_;
+    std::mutex mutex_;
+    std::condition_variable wake_;
+    std::condition_variable done_;
+    bool stop_ = false;
+    uint64_t generation_ = 0;
+    size_t running_ = 0;
+
+    const std::function<void(size_t)>* body_ = nullptr;
+    size_t count_ = 0;
+    std::atomic<size_t> next_{0};
+    size_t failed_index_ = SIZE_MAX;
+    std::exception_ptr error_;
+
+    void WorkerLoop();
+    void RunItems();
+};
+
+}  // namespace czffvm
@@ -1,17 +1,27 @@
 #pragma once
 
+#include <optional>
+#include <string>
+#include <vector>
+
 #include "runtime_data_area.hpp"
 #include "class_loader.hpp"
 #include "interpreter.hpp"
 #include "jit/jit_compiler.hpp"
 #include "jit/jit_x86_64.hpp"
+#include "image_cache.hpp"
+#include "profile_data.hpp"
 
 namespace czffvm {
 
 class VirtualMachine {
 public:
     VirtualMachine(bool is_gc_off = false);
-    VirtualMachine(uint32_t max_heap_size_in_kib, bool is_gc_off = false);
+    VirtualMachine(uint32_t max_heap_size_in_kib,
+                   bool is_gc_off = false,
+                   uint32_t gc_growth_percent = kDefaultGcGrowthPercent,
+                   uint32_t large_object_threshold_in_kib = kDefaultLargeObjectThresholdInKiB,
+                   bool use_huge_pages = false);
     ~VirtualMachine() = default;
 
     VirtualMachine(const VirtualMachine&) = delete;
@@ -20,12 +30,42 @@ public:
     void LoadStdlib(const std::string& path);
     void LoadProgram(const std::string& path);
     void EnableJIT();
+    void EnableEscapeAnalysis();
+    void EnableTailCallElimination();
+    void EnableBytecodeOptimization();
+    void EnableSuperinstructions();
+    void EnableLazyDecoding();
+    void EnableTreeShaking();
+    void SetLoadThreads(size_t threads);
+
+    // Loaded programs are saved as images in `directory`, keyed by the
+    // contents of the stdlib and program files, and a later load of the
+    // same files restores the image instead. The stdlib is then only read
+    // once LoadProgram knows every input.
+    void SetImageCache(const std::string& directory);
+
+    // Functions the JIT compiles are also saved in `directory`, keyed by
+    // their bytecode, and later runs start them as compiled code. Takes
+    // effect when the JIT is enabled.
+    void SetJitCodeCache(const std::string& directory);
+
+    // Seeds the call and back edge counters of the loaded program from a
+    // profile an earlier run saved, so known-hot functions are compiled on
+    // their first call. A profile that cannot be read only warns.
+    void LoadProfile(const std::string& path);
+    // Saves the counters of this run to `path` when it ends, including
+    // an exit through HALT
+    void SetProfileOutput(const std::string& path);
+    void EnableOpcodeProfile();
     void Run();
 
 private:
     RuntimeDataArea runtime_data_area_;
     ClassLoader loader_;
     Interpreter interpreter_;
+    std::optional<ImageCache> image_cache_;
+    std::vector<std::string> stdlib_paths_;
+    std::string jit_code_cache_;
 };
 
 }  // namespace czffvm
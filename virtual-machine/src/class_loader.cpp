@@ -1,10 +1,72 @@
+#include <algorithm>
 #include <fstream>
 #include <sstream>
 
 #include "class_loader.hpp"
+#include "escape_analysis.hpp"
+#include "tail_calls.hpp"
+#include "superinstructions.hpp"
 
 namespace czffvm {
 
+// an opcode and a u2 argument, or a u4 jump target in the indexed layout
+static constexpr size_t kMaxOperationSize = 4;
+static constexpr size_t kMaxWideOperationSize = 6;
+
+static bool HasArgument(OperationCode code) {
+    switch (code) {
+        case OperationCode::NEWARR:
+        case OperationCode::CALL:
+        case OperationCode::HALT:
+        case OperationCode::LDC:
+        case OperationCode::STORE:
+        case OperationCode::LDV:
+        case OperationCode::JMP:
+        case OperationCode::JZ:
+        case OperationCode::JNZ:
+            return true;
+        default:
+            return false;
+    }
+}
+
+static bool HasConstantArgument(OperationCode code) {
+    return code == OperationCode::LDC ||
+           code == OperationCode::NEWARR ||
+           code == OperationCode::HALT;
+}
+
+static bool IsJump(OperationCode code) {
+    return code == OperationCode::JMP ||
+           code == OperationCode::JZ ||
+           code == OperationCode::JNZ;
+}
+
+// Fused opcodes are created by the loader and never read from a file
+static bool IsSuperinstruction(OperationCode code) {
+    return code >= OperationCode::LDV_LDV;
+}
+
+// Constants are interned into the shared pool, so every constant index read
+// from a file goes through that file's mapping
+static uint16_t PoolConstant(const std::vector<uint16_t>& constants, uint16_t index,
+                             const std::string& stage) {
+    if (index >= constants.size()) {
+        throw ClassLoaderError(stage, "Constant index out of range", std::to_string(index));
+    }
+
+    return constants[index];
+}
+
+// CALL arguments and class methods index the file's own function table
+static uint16_t LinkedFunction(const std::vector<uint16_t>& functions, uint16_t index) {
+    if (index >= functions.size()) {
+        throw ClassLoaderError("Linking", "Function index out of range", std::to_string(index));
+    }
+
+    return functions[index];
+}
+
 ClassLoaderError::ClassLoaderError(
     const std::string& stage,
     const std::string& message,
@@ -18,54 +80,165 @@ ClassLoaderError::ClassLoaderError(
 {}
 
 ByteReader::ByteReader(const std::vector<uint8_t>& data)
-    : data_(data), offset_(0) {}
+    : ByteReader(data.data(), data.size()) {}
+
+ByteReader::ByteReader(const uint8_t* data, size_t size)
+    : data_(data), size_(size), offset_(0) {}
+
+void ByteReader::Require(size_t count) const {
+    if (count > size_ - offset_) {
+        throw std::out_of_range(
+            "ByteReader: unexpected end of input at offset " + std::to_string(offset_));
+    }
+}
 
 uint8_t ByteReader::ReadU1() {
-    return data_.at(offset_++);
+    Require(1);
+    return ReadU1Unchecked();
 }
 
 uint16_t ByteReader::ReadU2() {
-    uint16_t v = (data_.at(offset_) << kBitsInByte) |
-                 data_.at(offset_ + 1);
+    Require(2);
+    return ReadU2Unchecked();
+}
+
+uint32_t ByteReader::ReadU4() {
+    Require(4);
+    return ReadU4Unchecked();
+}
+
+uint8_t ByteReader::ReadU1Unchecked() {
+    return data_[offset_++];
+}
+
+uint16_t ByteReader::ReadU2Unchecked() {
+    uint16_t v = (data_[offset_] << kBitsInByte) | data_[offset_ + 1];
     offset_ += 2;
 
     return v;
 }
 
-uint32_t ByteReader::ReadU4() {
-    uint32_t v = (data_.at(offset_) << (3 * kBitsInByte)) |
-                 (data_.at(offset_ + 1) << ( 2 * kBitsInByte)) |
-                 (data_.at(offset_ + 2) << kBitsInByte) |
-                 data_.at(offset_ + 3);
+uint32_t ByteReader::ReadU4Unchecked() {
+    const uint8_t* p = data_ + offset_;
+    uint32_t v = (uint32_t(p[0]) << (3 * kBitsInByte)) |
+                 (uint32_t(p[1]) << (2 * kBitsInByte)) |
+                 (uint32_t(p[2]) << kBitsInByte) |
+                 p[3];
     offset_ += 4;
 
     return v;
 }
 
+const uint8_t* ByteReader::ReadBytes(size_t count) {
+    Require(count);
+    const uint8_t* p = data_ + offset_;
+    offset_ += count;
+
+    return p;
+}
+
 std::string ByteReader::ReadString() {
     uint16_t len = ReadU2();
 
-    if (offset_ + len > data_.size()) {
+    if (len > Remaining()) {
         throw ClassLoaderError(
             "ByteReader",
             "Unexpected end of input while reading string",
             "offset=" + std::to_string(offset_) +
             ", len=" + std::to_string(len) +
-            ", size=" + std::to_string(data_.size())
+            ", size=" + std::to_string(size_)
         );
     }
 
-    std::string s;
-    if (len > 0) {
-        s = std::string(reinterpret_cast<const char*>(&data_[offset_]), len);
-    }
-    offset_ += len;
+    const char* p = reinterpret_cast<const char*>(ReadBytes(len));
+    return std::string(p, len);
+}
+
+size_t ByteReader::Offset() const {
+    return offset_;
+}
 
-    return s;
+size_t ByteReader::Remaining() const {
+    return size_ - offset_;
 }
 
 bool ByteReader::Eof() const {
-    return offset_ >= data_.size();
+    return offset_ >= size_;
+}
+
+void ByteWriter::WriteU1(uint8_t value) {
+    data_.push_back(value);
+}
+
+void ByteWriter::WriteU2(uint16_t value) {
+    data_.push_back(uint8_t(value >> kBitsInByte));
+    data_.push_back(uint8_t(value));
+}
+
+void ByteWriter::WriteU4(uint32_t value) {
+    WriteU2(uint16_t(value >> (2 * kBitsInByte)));
+    WriteU2(uint16_t(value));
+}
+
+void ByteWriter::WriteBytes(const uint8_t* data, size_t count) {
+    data_.insert(data_.end(), data, data + count);
+}
+
+void ByteWriter::PatchU4(size_t offset, uint32_t value) {
+    if (offset + 4 > data_.size()) {
+        throw std::out_of_range("ByteWriter: patch past the end at offset " + std::to_string(offset));
+    }
+
+    for (int i = 3; i >= 0; --i) {
+        data_[offset + i] = uint8_t(value);
+        value >>= kBitsInByte;
+    }
+}
+
+size_t ByteWriter::Size() const {
+    return data_.size();
+}
+
+std::vector<uint8_t>& ByteWriter::Data() {
+    return data_;
+}
+
+std::unordered_map<uint32_t, BallSectionRange> ReadBallSections(ByteReader& r) {
+    size_t file_size = r.Offset() + r.Remaining();
+    uint16_t count = r.ReadU2();
+    r.ReadU2(); // reserved
+
+    std::unordered_map<uint32_t, BallSectionRange> sections;
+    for (uint16_t i = 0; i < count; ++i) {
+        uint32_t id = r.ReadU4();
+        BallSectionRange range;
+        range.offset = r.ReadU4();
+        range.size = r.ReadU4();
+
+        if (range.offset > file_size || range.size > file_size - range.offset) {
+            throw ClassLoaderError("Sections", "Section exceeds the file", std::to_string(id));
+        }
+        if (!sections.emplace(id, range).second) {
+            throw ClassLoaderError("Sections", "Duplicate section", std::to_string(id));
+        }
+    }
+
+    return sections;
+}
+
+BallFunctionEntry ReadBallFunctionEntry(ByteReader& r) {
+    BallFunctionEntry entry;
+    entry.name_index = r.ReadU2();
+    entry.params_descriptor_index = r.ReadU2();
+    entry.return_type_index = r.ReadU2();
+    entry.max_stack = r.ReadU2();
+    entry.locals_count = r.ReadU2();
+    r.ReadU2(); // reserved
+    entry.code_length = r.ReadU4();
+    entry.code_offset = r.ReadU4();
+    entry.code_size = r.ReadU4();
+
+    return entry;
 }
 
 ClassLoader::ClassLoader(RuntimeDataArea& rda)
@@ -78,121 +251,231 @@ void ClassLoader::LoadStdlib(const std::string& path) {
 void ClassLoader::LoadProgram(const std::string& path) {
     LoadFile(path);
     ResolveEntryPoint();
+    if (tree_shaking_) {
+        ShakeTree();
+    }
 }
 
 RuntimeFunction* ClassLoader::EntryPoint() const {
     return entry_point_;
 }
 
+void ClassLoader::EnableEscapeAnalysis(bool enabled) {
+    escape_analysis_ = enabled;
+}
+
+void ClassLoader::EnableTailCallElimination(bool enabled) {
+    tail_calls_ = enabled;
+}
+
+void ClassLoader::EnableSuperinstructions(bool enabled) {
+    superinstructions_ = enabled;
+}
+
+void ClassLoader::EnableLazyDecoding(bool enabled) {
+    lazy_decoding_ = enabled;
+}
+
+void ClassLoader::EnableTreeShaking(bool enabled) {
+    tree_shaking_ = enabled;
+}
+
+uint64_t ClassLoader::ImageOptions() const {
+    return uint64_t(escape_analysis_) |
+           uint64_t(tail_calls_) << 1 |
+           uint64_t(superinstructions_) << 2 |
+           uint64_t(lazy_decoding_) << 3 |
+           uint64_t(tree_shaking_) << 4 |
+           uint64_t(static_cast<bool>(bytecode_optimizer_)) << 5 |
+           uint64_t(kImageVersion) << 32;
+}
+
+void ClassLoader::SetLoadThreads(size_t threads) {
+    load_threads_ = threads;
+    pool_.reset();
+}
+
+void ClassLoader::SetBytecodeOptimizer(FunctionPass optimizer) {
+    bytecode_optimizer_ = std::move(optimizer);
+}
+
 void ClassLoader::LoadFile(const std::string& path) {
-    std::ifstream file(path, std::ios::binary);
-    if (!file) {
+    std::unique_ptr<MappedFile> file;
+    try {
+        file = std::make_unique<MappedFile>(path);
+    } catch (const std::runtime_error&) {
         throw ClassLoaderError("FileLoading", "Cannot open file", path);
     }
 
-    std::vector<uint8_t> data(
-        (std::istreambuf_iterator<char>(file)),
-        std::istreambuf_iterator<char>()
-    );
+    // started on first use, lazily decoded bodies do not need it
+    if (!lazy_decoding_ && load_threads_ > 1 && !pool_) {
+        pool_ = std::make_unique<ThreadPool>(load_threads_);
+    }
+
+    ByteReader reader(file->Data(), file->Size());
+    LoadedFile& loaded = files_.emplace_back();
+    loaded.mapping = std::move(file);
+    if (lazy_decoding_) {
+        rda_.GetMethodArea().SetCodeLoader([this](RuntimeFunction& fn) { DecodeFunction(fn); });
+    }
 
-    ByteReader reader(data);
+    size_t first_function = rda_.GetMethodArea().Functions().size();
 
-    LoadHeader(reader);
-    LoadConstantPool(reader);
-    LoadFunctions(reader);
-    LoadClasses(reader);
+    if (LoadHeader(reader) >= kIndexedBallVersion) {
+        LoadIndexed(reader, loaded);
+    } else {
+        LoadConstantPool(reader, loaded);
+        LoadFunctions(reader, loaded);
+        LoadClasses(reader, loaded);
+    }
+
+    if (!lazy_decoding_) {
+        DecodeFunctions(first_function);
+    }
+    if (escape_analysis_ || tail_calls_ || superinstructions_ || bytecode_optimizer_) {
+        AnalyzeFunctions(first_function);
+    }
 }
 
-void ClassLoader::LoadHeader(ByteReader& r) {
+// Runs once the whole file is registered, so CALLs to functions defined
+// later in the same module can be resolved. Lazily decoded functions are
+// analyzed when their code is decoded.
+void ClassLoader::AnalyzeFunctions(size_t first) {
+    const auto& functions = rda_.GetMethodArea().Functions();
+
+    std::vector<RuntimeFunction*> decoded;
+    for (size_t i = first; i < functions.size(); ++i) {
+        if (!functions[i]->code_pending) {
+            decoded.push_back(functions[i]);
+        }
+    }
+
+    if (!pool_) {
+        for (RuntimeFunction* fn : decoded) {
+            AnalyzeFunction(*fn);
+        }
+        return;
+    }
+
+    // the rewriting passes register constants, so they run in file order
+    // to keep constant indices the same as in a sequential load
+    for (RuntimeFunction* fn : decoded) {
+        RewriteFunction(*fn);
+    }
+    if (superinstructions_) {
+        pool_->ParallelFor(decoded.size(), [&](size_t i) {
+            SuperinstructionSelector(*decoded[i]).Run();
+        });
+    }
+}
+
+void ClassLoader::AnalyzeFunction(RuntimeFunction& fn) {
+    RewriteFunction(fn);
+
+    // the interpreter's copy of the final code
+    if (superinstructions_) {
+        SuperinstructionSelector(fn).Run();
+    }
+}
+
+void ClassLoader::RewriteFunction(RuntimeFunction& fn) {
+    auto& method_area = rda_.GetMethodArea();
+
+    // both rewrite code, so they go before the per-pc escape information
+    if (bytecode_optimizer_) {
+        bytecode_optimizer_(fn, method_area);
+    }
+    if (tail_calls_) {
+        TailCallEliminator(fn, method_area).Run();
+    }
+    if (escape_analysis_) {
+        EscapeAnalyzer(fn, method_area).Run();
+    }
+}
+
+// Returns the version major, which selects the layout of the rest of the file
+uint8_t ClassLoader::LoadHeader(ByteReader& r) {
     uint32_t magic = r.ReadU4();
     if (magic != kMagicNumber) {
         throw ClassLoaderError("Header", "Invalid magic number");
     }
 
-    r.ReadU1(); // version major
+    uint8_t major = r.ReadU1();
     r.ReadU1(); // version minor
     r.ReadU1(); // version patch
 
     r.ReadU1(); // flags
+
+    if (major > kIndexedBallVersion) {
+        throw ClassLoaderError("Header", "Unsupported bytecode version", std::to_string(major));
+    }
+
+    return major;
 }
 
-void ClassLoader::LoadConstantPool(ByteReader& r) {
+void ClassLoader::LoadConstantPool(ByteReader& r, LoadedFile& file) {
     uint16_t count = r.ReadU2();
 
     for (uint16_t i = 0; i < count; ++i) {
         Constant c;
         c.tag = static_cast<ConstantTag>(r.ReadU1());
+
+        size_t size;
         switch (c.tag) {
             case ConstantTag::U1:
-                c.data.push_back(r.ReadU1());
+            case ConstantTag::BOOL:
+                size = 1;
                 break;
             case ConstantTag::U2:
-                c.data.push_back(r.ReadU1());
-                c.data.push_back(r.ReadU1());
+                size = 2;
                 break;
             case ConstantTag::U4:
-                for (int i = 0; i < 4; i++) {
-                    c.data.push_back(r.ReadU1());
-                }
-                break;
             case ConstantTag::I4:
-                for (int i = 0; i < 4; i++) {
-                    c.data.push_back(r.ReadU1());
-                }
+                size = 4;
                 break;
-            case ConstantTag::STRING: {
-                std::string s = r.ReadString();
-                c.data = std::vector<uint8_t>(s.begin(), s.end());
-                break;
-            }
             case ConstantTag::U8:
-                for (int i = 0; i < 8; i++) {
-                    c.data.push_back(r.ReadU1());
-                }
-                break;
             case ConstantTag::I8:
-                for (int i = 0; i < 8; i++) {
-                    c.data.push_back(r.ReadU1());
-                }
+                size = 8;
                 break;
             case ConstantTag::U16:
-                for (int i = 0; i < 16; i++) {
-                    c.data.push_back(r.ReadU1());
-                }
-                break;
             case ConstantTag::I16:
-                for (int i = 0; i < 16; i++) {
-                    c.data.push_back(r.ReadU1());
-                }
+                size = 16;
                 break;
-            case ConstantTag::BOOL:
-                c.data.push_back(r.ReadU1());
+            case ConstantTag::STRING:
+                size = r.ReadU2();
+                if (size > r.Remaining()) {
+                    throw ClassLoaderError("FileLoading", "Unexpected end of input while reading string");
+                }
                 break;
             default:
                 throw ClassLoaderError("FileLoading", "Unsupported type of constant in constant pool");
         }
-        rda_.GetMethodArea().RegisterConstant(c);
+
+        // a single copy straight out of the mapped file
+        const uint8_t* bytes = r.ReadBytes(size);
+        c.data.assign(bytes, bytes + size);
+        file.constants.push_back(rda_.GetMethodArea().InternConstant(c));
     }
 }
 
-void ClassLoader::LoadClasses(ByteReader& r) {
+void ClassLoader::LoadClasses(ByteReader& r, const LoadedFile& file) {
     uint16_t count = r.ReadU2();
 
     for (uint16_t i = 0; i < count; ++i) {
         auto cls = new RuntimeClass();
-        cls->name_index = r.ReadU2();
+        cls->name_index = PoolConstant(file.constants, r.ReadU2(), "Classes");
 
         uint16_t fields_count = r.ReadU2();
         for (uint16_t f = 0; f < fields_count; ++f) {
             RuntimeField field;
-            field.name_index = r.ReadU2();
-            field.field_descriptor_index = r.ReadU2();
+            field.name_index = PoolConstant(file.constants, r.ReadU2(), "Classes");
+            field.field_descriptor_index = PoolConstant(file.constants, r.ReadU2(), "Classes");
             cls->fields.push_back(field);
         }
 
         uint16_t methods_count = r.ReadU2();
         for (uint16_t m = 0; m < methods_count; ++m) {
-            uint16_t method_index = r.ReadU2();
+            uint16_t method_index = LinkedFunction(file.functions, r.ReadU2());
 
             cls->methods.push_back(method_index);
         }
@@ -201,79 +484,338 @@ void ClassLoader::LoadClasses(ByteReader& r) {
     }
 }
 
-void ClassLoader::LoadFunctions(ByteReader& r) {
+void ClassLoader::LoadFunctions(ByteReader& r, LoadedFile& file) {
     uint16_t count = r.ReadU2();
 
     for (uint16_t i = 0; i < count; ++i) {
+        uint16_t name_index = PoolConstant(file.constants, r.ReadU2(), "Functions");
+        uint16_t params_index = PoolConstant(file.constants, r.ReadU2(), "Functions");
+        uint16_t return_index = PoolConstant(file.constants, r.ReadU2(), "Functions");
+        uint16_t max_stack = r.ReadU2();
+        uint16_t locals_count = r.ReadU2();
+
+        size_t body_offset = r.Offset();
+        uint16_t code_len = r.ReadU2();
+        if (code_len == 0) {
+            file.functions.push_back(ResolveDeclaration(name_index, params_index, return_index));
+            continue;
+        }
+
         auto fn = new RuntimeFunction();
+        fn->name_index = name_index;
+        fn->params_descriptor_index = params_index;
+        fn->return_type_index = return_index;
+        fn->max_stack = max_stack;
+        fn->locals_count = locals_count;
+        fn->code_file = static_cast<uint32_t>(files_.size() - 1);
 
-        fn->name_index = r.ReadU2();
-        fn->params_descriptor_index = r.ReadU2();
-        fn->return_type_index = r.ReadU2();
+        if (lazy_decoding_ || pool_) {
+            // only find the end of the body; it is decoded on first use or
+            // with the others once the whole table is read
+            fn->code_pending = true;
+            fn->code_offset = body_offset;
+            SkipCode(r, code_len);
+        } else {
+            DecodeCode(r, file, *fn, code_len, false);
+        }
 
-        fn->max_stack = r.ReadU2();
-        fn->locals_count = r.ReadU2();
+        file.functions.push_back(rda_.GetMethodArea().RegisterFunction(fn));
+    }
+}
 
-        uint16_t code_len = r.ReadU2();
-        fn->code.resize(code_len);
-        for (uint16_t b = 0; b < code_len; ++b) {
-            Operation op;
-            op.code = static_cast<OperationCode>(r.ReadU2());
-            switch (op.code) {
-                case OperationCode::STELEM:
-                case OperationCode::LDELEM:
-                case OperationCode::MUL:
-                case OperationCode::MIN:
-                case OperationCode::SUB:
-                case OperationCode::DIV:
-                case OperationCode::DUP:
-                case OperationCode::SWAP:
-                case OperationCode::ADD:
-                case OperationCode::PRINT:
-                case OperationCode::RET:
-                case OperationCode::EQ:
-                case OperationCode::LT:
-                case OperationCode::LEQ:
-                case OperationCode::NEG:
-                case OperationCode::MOD:
-                case OperationCode::LOR:
-                case OperationCode::LAND:
-                    break;
-                case OperationCode::NEWARR:
-                case OperationCode::CALL:
-                case OperationCode::HALT:
-                case OperationCode::LDC:
-                case OperationCode::STORE:
-                case OperationCode::LDV:
-                case OperationCode::JMP:
-                case OperationCode::JZ:
-                case OperationCode::JNZ:
-                    op.arguments.push_back(r.ReadU1());
-                    op.arguments.push_back(r.ReadU1());
-                    break;
+// A function without a body declares one defined by a module loaded
+// earlier; its file index is linked to that definition
+uint16_t ClassLoader::ResolveDeclaration(uint16_t name_index, uint16_t params_index,
+                                         uint16_t return_index) {
+    const auto& method_area = rda_.GetMethodArea();
+    const Constant& name_raw = method_area.GetConstant(name_index);
+    std::string name(name_raw.data.begin(), name_raw.data.end());
+
+    std::optional<uint16_t> index = method_area.FindFunction(name);
+    if (!index) {
+        throw ClassLoaderError("Linking", "Unresolved function", name);
+    }
+
+    const RuntimeFunction* fn = method_area.GetFunction(*index);
+    if (method_area.GetConstant(fn->params_descriptor_index) != method_area.GetConstant(params_index) ||
+        method_area.GetConstant(fn->return_type_index) != method_area.GetConstant(return_index)) {
+        throw ClassLoaderError("Linking", "Declaration does not match the definition", name);
+    }
+
+    return *index;
+}
+
+void ClassLoader::LoadIndexed(ByteReader& r, LoadedFile& file) {
+    auto sections = ReadBallSections(r);
+    auto find = [&](BallSection id) -> const BallSectionRange* {
+        auto it = sections.find(static_cast<uint32_t>(id));
+        return it == sections.end() ? nullptr : &it->second;
+    };
+    auto require = [&](BallSection id, const char* name) {
+        const BallSectionRange* range = find(id);
+        if (!range) {
+            throw ClassLoaderError("Sections", "Missing section", name);
+        }
+        return *range;
+    };
+
+    file.indexed = true;
+    file.code = require(BallSection::CODE, "code");
+    const uint8_t* data = file.mapping->Data();
+
+    BallSectionRange constants = require(BallSection::CONSTANTS, "constants");
+    ByteReader constants_reader(data + constants.offset, constants.size);
+    LoadIndexedConstants(constants_reader, file, find(BallSection::STRINGS));
+
+    BallSectionRange functions = require(BallSection::FUNCTIONS, "functions");
+    ByteReader functions_reader(data + functions.offset, functions.size);
+    LoadIndexedFunctions(functions_reader, file, functions.offset);
+
+    // same layout as in v1
+    if (const BallSectionRange* classes = find(BallSection::CLASSES)) {
+        ByteReader classes_reader(data + classes->offset, classes->size);
+        LoadClasses(classes_reader, file);
+    }
+}
+
+// Strings are stored once in the string table; a STRING constant holds its
+// u4 index there
+void ClassLoader::LoadIndexedConstants(ByteReader& r, LoadedFile& file,
+                                       const BallSectionRange* strings) {
+    const uint8_t* data = file.mapping->Data();
+    ByteReader strings_reader(strings ? data + strings->offset : data, strings ? strings->size : 0);
+    uint32_t strings_count = strings ? strings_reader.ReadU4() : 0;
+    if (strings) strings_reader.ReadU4(); // reserved
+    if (strings_count > strings_reader.Remaining() / 8) {
+        throw ClassLoaderError("Strings", "String table exceeds its section");
+    }
+    const uint8_t* string_entries = strings_reader.ReadBytes(size_t(strings_count) * 8);
+
+    uint32_t count = r.ReadU4();
+    if (count > size_t(UINT16_MAX) + 1) {
+        throw ClassLoaderError("Constants", "Too many constants", std::to_string(count));
+    }
+
+    for (uint32_t i = 0; i < count; ++i) {
+        Constant c;
+        c.tag = static_cast<ConstantTag>(r.ReadU1());
+
+        size_t size;
+        switch (c.tag) {
+            case ConstantTag::U1:
+            case ConstantTag::BOOL:
+                size = 1;
+                break;
+            case ConstantTag::U2:
+                size = 2;
+                break;
+            case ConstantTag::U4:
+            case ConstantTag::I4:
+                size = 4;
+                break;
+            case ConstantTag::U8:
+            case ConstantTag::I8:
+                size = 8;
+                break;
+            case ConstantTag::U16:
+            case ConstantTag::I16:
+                size = 16;
+                break;
+            case ConstantTag::STRING: {
+                uint32_t index = r.ReadU4();
+                if (index >= strings_count) {
+                    throw ClassLoaderError("Constants", "String index out of range", std::to_string(index));
+                }
+                ByteReader entry(string_entries + size_t(index) * 8, 8);
+                uint32_t offset = entry.ReadU4();
+                uint32_t length = entry.ReadU4();
+                if (offset > strings->size || length > strings->size - offset) {
+                    throw ClassLoaderError("Strings", "String exceeds its section", std::to_string(index));
+                }
+                const uint8_t* bytes = data + strings->offset + offset;
+                c.data.assign(bytes, bytes + length);
+                file.constants.push_back(rda_.GetMethodArea().InternConstant(c));
+                continue;
             }
-            fn->code[b] = op;
+            default:
+                throw ClassLoaderError("Constants", "Unsupported type of constant in constant pool");
         }
 
-        rda_.GetMethodArea().RegisterFunction(fn);
+        const uint8_t* bytes = r.ReadBytes(size);
+        c.data.assign(bytes, bytes + size);
+        file.constants.push_back(rda_.GetMethodArea().InternConstant(c));
     }
 }
 
-void ClassLoader::ResolveEntryPoint() {
-    const auto& functions = rda_.GetMethodArea().Functions();
-    RuntimeFunction* fn = NULL;
-    for (auto f : functions) {
-        Constant name_raw = rda_.GetMethodArea().GetConstant(f->name_index);
-        std::string name(name_raw.data.begin(), name_raw.data.end());
-        if (name == "Main") {
-            fn = f;
-            break;
+// Entries have a fixed size and locate their body, so a lazily decoded
+// function is registered without touching its code
+void ClassLoader::LoadIndexedFunctions(ByteReader& r, LoadedFile& file, size_t section_offset) {
+    uint32_t count = r.ReadU4();
+    r.ReadU4(); // reserved
+    if (count > r.Remaining() / kFunctionEntrySize) {
+        throw ClassLoaderError("Functions", "Function table exceeds its section");
+    }
+
+    for (uint32_t i = 0; i < count; ++i) {
+        size_t entry_offset = section_offset + r.Offset();
+        BallFunctionEntry entry = ReadBallFunctionEntry(r);
+        if (entry.code_length == 0) {
+            file.functions.push_back(ResolveDeclaration(
+                PoolConstant(file.constants, entry.name_index, "Functions"),
+                PoolConstant(file.constants, entry.params_descriptor_index, "Functions"),
+                PoolConstant(file.constants, entry.return_type_index, "Functions")));
+            continue;
+        }
+        if (entry.code_offset > file.code.size || entry.code_size > file.code.size - entry.code_offset) {
+            throw ClassLoaderError("Functions", "Function body exceeds the code section", std::to_string(i));
+        }
+
+        auto fn = new RuntimeFunction();
+        fn->name_index = PoolConstant(file.constants, entry.name_index, "Functions");
+        fn->params_descriptor_index = PoolConstant(file.constants, entry.params_descriptor_index, "Functions");
+        fn->return_type_index = PoolConstant(file.constants, entry.return_type_index, "Functions");
+        fn->max_stack = entry.max_stack;
+        fn->locals_count = entry.locals_count;
+        fn->code_file = static_cast<uint32_t>(files_.size() - 1);
+
+        if (lazy_decoding_ || pool_) {
+            fn->code_pending = true;
+            fn->code_offset = entry_offset;
+        } else {
+            DecodeIndexedCode(file, entry, *fn);
+        }
+
+        file.functions.push_back(rda_.GetMethodArea().RegisterFunction(fn));
+    }
+}
+
+void ClassLoader::DecodeCode(ByteReader& r, const LoadedFile& file, RuntimeFunction& fn,
+                             uint32_t code_len, bool wide_jumps) {
+    fn.code.resize(code_len);
+
+    // when the widest encoding of every operation fits, the body needs no
+    // further bounds checks
+    size_t max_size = wide_jumps ? kMaxWideOperationSize : kMaxOperationSize;
+    bool checked = r.Remaining() < size_t(code_len) * max_size;
+    auto read_u2 = [&]() { return checked ? r.ReadU2() : r.ReadU2Unchecked(); };
+    auto read_u4 = [&]() { return checked ? r.ReadU4() : r.ReadU4Unchecked(); };
+
+    for (uint32_t b = 0; b < code_len; ++b) {
+        Operation op;
+        op.code = static_cast<OperationCode>(read_u2());
+        if (IsSuperinstruction(op.code)) {
+            throw ClassLoaderError("Functions", "Superinstructions cannot be loaded from a file");
         }
+        if (wide_jumps && IsJump(op.code)) {
+            // the runtime addresses code with u2 pcs
+            uint32_t target = read_u4();
+            if (target > UINT16_MAX) {
+                throw ClassLoaderError("Functions", "Jump target out of range", std::to_string(target));
+            }
+            op.arguments = {uint8_t(target >> kBitsInByte), uint8_t(target)};
+        } else if (HasArgument(op.code)) {
+            uint16_t argument = read_u2();
+            if (HasConstantArgument(op.code)) {
+                argument = PoolConstant(file.constants, argument, "Functions");
+            }
+            op.arguments = {uint8_t(argument >> kBitsInByte), uint8_t(argument)};
+        }
+        fn.code[b] = std::move(op);
     }
-    
-    if (!fn) {
+}
+
+void ClassLoader::DecodeIndexedCode(const LoadedFile& file, const BallFunctionEntry& entry,
+                                    RuntimeFunction& fn) {
+    if (entry.code_length > UINT16_MAX) {
+        throw ClassLoaderError("Functions", "Function is too long", std::to_string(entry.code_length));
+    }
+
+    ByteReader r(file.mapping->Data() + file.code.offset + entry.code_offset, entry.code_size);
+    DecodeCode(r, file, fn, entry.code_length, true);
+    if (!r.Eof()) {
+        throw ClassLoaderError("Functions", "Code size does not match the decoded operations");
+    }
+}
+
+void ClassLoader::SkipCode(ByteReader& r, uint16_t code_len) {
+    for (uint16_t b = 0; b < code_len; ++b) {
+        if (HasArgument(static_cast<OperationCode>(r.ReadU2()))) {
+            r.ReadBytes(2);
+        }
+    }
+}
+
+// code_offset is the body in a v1 file and the function table entry in a
+// v2 file. Only reads the file and writes `fn`, so bodies can be decoded
+// concurrently.
+void ClassLoader::DecodeBody(RuntimeFunction& fn) {
+    const LoadedFile& file = files_.at(fn.code_file);
+    const MappedFile& mapping = *file.mapping;
+    ByteReader reader(mapping.Data() + fn.code_offset, mapping.Size() - fn.code_offset);
+
+    if (file.image) {
+        DecodeImageCode(file, fn);
+    } else if (file.indexed) {
+        DecodeIndexedCode(file, ReadBallFunctionEntry(reader), fn);
+    } else {
+        DecodeCode(reader, file, fn, reader.ReadU2(), false);
+    }
+}
+
+// Needs the whole function table of the file, so it runs after the table
+// is read even when the body was decoded while reading it
+void ClassLoader::FinishDecoding(RuntimeFunction& fn) {
+    const LoadedFile& file = files_.at(fn.code_file);
+    fn.code_pending = false;
+
+    for (auto& op : fn.code) {
+        if (op.code == OperationCode::CALL) {
+            uint16_t index = LinkedFunction(file.functions, (op.arguments[0] << 8) | op.arguments[1]);
+            op.arguments = {uint8_t(index >> kBitsInByte), uint8_t(index)};
+            continue;
+        }
+
+        // intern array types once instead of on every allocation
+        if (op.code != OperationCode::NEWARR) continue;
+        uint16_t type_idx = (op.arguments[0] << 8) | op.arguments[1];
+        if (type_idx < rda_.GetMethodArea().ConstantPool().size()) {
+            rda_.ArrayTypeFor(type_idx);
+        }
+    }
+}
+
+void ClassLoader::DecodeFunction(RuntimeFunction& fn) {
+    DecodeBody(fn);
+    FinishDecoding(fn);
+    // an image holds the code the passes produced
+    if (!files_.at(fn.code_file).image) {
+        AnalyzeFunction(fn);
+    }
+}
+
+// Decodes the bodies of a file on the pool, a sequential load has already
+// decoded them while reading the table; the shared runtime data is only
+// touched afterwards, in file order
+void ClassLoader::DecodeFunctions(size_t first) {
+    const auto& functions = rda_.GetMethodArea().Functions();
+    std::vector<RuntimeFunction*> pending(functions.begin() + first, functions.end());
+
+    if (pool_) {
+        pool_->ParallelFor(pending.size(), [&](size_t i) {
+            DecodeBody(*pending[i]);
+        });
+    }
+    for (RuntimeFunction* fn : pending) {
+        FinishDecoding(*fn);
+    }
+}
+
+void ClassLoader::ResolveEntryPoint() {
+    std::optional<uint16_t> main = rda_.GetMethodArea().FindFunction("Main");
+    if (!main) {
         throw ClassLoaderError("EntryPoint", "Main not found");
     }
+    RuntimeFunction* fn = rda_.GetMethodArea().GetFunction(*main);
 
     const auto& ret =
         rda_.GetMethodArea().GetConstant(fn->return_type_index).data;
@@ -288,4 +830,350 @@ void ClassLoader::ResolveEntryPoint() {
     entry_point_ = fn;
 }
 
+// Reachability from Main over CALLs; classes are kept whole. A function or
+// constant nothing reachable refers to is removed from the method area and
+// its entries in the file tables are left dangling, since only the bodies
+// of dropped functions used them.
+void ClassLoader::ShakeTree() {
+    auto& method_area = rda_.GetMethodArea();
+    const auto& functions = method_area.Functions();
+    for (const RuntimeFunction* fn : functions) {
+        if (!fn->code_pending) return;
+    }
+
+    std::vector<bool> live_functions(functions.size(), false);
+    std::vector<bool> live_constants(method_area.ConstantPool().size(), false);
+    std::vector<uint16_t> worklist;
+    auto reach = [&](uint16_t index) {
+        if (index < live_functions.size() && !live_functions[index]) {
+            live_functions[index] = true;
+            worklist.push_back(index);
+        }
+    };
+    auto use = [&](uint16_t constant) {
+        if (constant < live_constants.size()) live_constants[constant] = true;
+    };
+
+    reach(static_cast<uint16_t>(std::find(functions.begin(), functions.end(), entry_point_) - functions.begin()));
+    for (const RuntimeClass* cls : method_area.Classes()) {
+        use(cls->name_index);
+        for (const RuntimeField& field : cls->fields) {
+            use(field.name_index);
+            use(field.field_descriptor_index);
+        }
+        for (uint16_t method : cls->methods) reach(method);
+    }
+
+    std::vector<uint16_t> calls;
+    std::vector<uint16_t> constants;
+    while (!worklist.empty()) {
+        const RuntimeFunction& fn = *functions[worklist.back()];
+        worklist.pop_back();
+        use(fn.name_index);
+        use(fn.params_descriptor_index);
+        use(fn.return_type_index);
+
+        calls.clear();
+        constants.clear();
+        try {
+            ScanBody(fn, calls, constants);
+        } catch (const std::exception&) {
+            // a bad body is reported when it is decoded
+            return;
+        }
+
+        const LoadedFile& file = files_.at(fn.code_file);
+        for (uint16_t call : calls) {
+            if (call < file.functions.size()) reach(file.functions[call]);
+        }
+        for (uint16_t constant : constants) {
+            if (constant < file.constants.size()) use(file.constants[constant]);
+        }
+    }
+
+    std::vector<RuntimeFunction*> dropped;
+    for (size_t i = 0; i < functions.size(); ++i) {
+        if (!live_functions[i]) dropped.push_back(functions[i]);
+    }
+
+    auto function_index = method_area.RetainFunctions(live_functions);
+    auto constant_index = method_area.RetainConstants(live_constants);
+    for (RuntimeFunction* fn : dropped) {
+        delete fn;
+    }
+
+    for (LoadedFile& file : files_) {
+        for (uint16_t& index : file.functions) index = function_index[index].value_or(UINT16_MAX);
+        for (uint16_t& index : file.constants) index = constant_index[index].value_or(UINT16_MAX);
+    }
+}
+
+// The CALL and constant arguments of a body that is not decoded yet, as
+// indices into its file's tables
+void ClassLoader::ScanBody(const RuntimeFunction& fn, std::vector<uint16_t>& calls,
+                           std::vector<uint16_t>& constants) const {
+    const LoadedFile& file = files_.at(fn.code_file);
+    const MappedFile& mapping = *file.mapping;
+    ByteReader r(mapping.Data() + fn.code_offset, mapping.Size() - fn.code_offset);
+
+    uint32_t code_len;
+    if (file.indexed) {
+        BallFunctionEntry entry = ReadBallFunctionEntry(r);
+        if (entry.code_offset > file.code.size || entry.code_size > file.code.size - entry.code_offset) {
+            throw ClassLoaderError("Functions", "Function body exceeds the code section");
+        }
+        r = ByteReader(mapping.Data() + file.code.offset + entry.code_offset, entry.code_size);
+        code_len = entry.code_length;
+    } else {
+        code_len = r.ReadU2();
+    }
+
+    for (uint32_t b = 0; b < code_len; ++b) {
+        auto code = static_cast<OperationCode>(r.ReadU2());
+        if (file.indexed && IsJump(code)) {
+            r.ReadU4();
+        } else if (code == OperationCode::CALL) {
+            calls.push_back(r.ReadU2());
+        } else if (HasConstantArgument(code)) {
+            constants.push_back(r.ReadU2());
+        } else if (HasArgument(code)) {
+            r.ReadU2();
+        }
+    }
+}
+
+// Header (magic, version, key), constants, classes, a table of fixed-size
+// function entries locating each body, then the bodies: the code, its
+// fused copy and the frame array marks, arguments as they are in memory
+std::vector<uint8_t> ClassLoader::SaveImage(uint64_t key) {
+    auto& method_area = rda_.GetMethodArea();
+    // decoding runs the passes, which may register constants
+    for (RuntimeFunction* fn : method_area.Functions()) {
+        method_area.EnsureCode(*fn);
+    }
+
+    ByteWriter w;
+    w.WriteU4(kImageMagicNumber);
+    w.WriteU1(kImageVersion);
+    w.WriteU1(0); w.WriteU1(0); w.WriteU1(0); // reserved
+    w.WriteU4(uint32_t(key >> 32));
+    w.WriteU4(uint32_t(key));
+
+    const auto& constants = method_area.ConstantPool();
+    w.WriteU4(static_cast<uint32_t>(constants.size()));
+    for (const Constant& c : constants) {
+        w.WriteU1(static_cast<uint8_t>(c.tag));
+        w.WriteU4(static_cast<uint32_t>(c.data.size()));
+        w.WriteBytes(c.data.data(), c.data.size());
+    }
+
+    const auto& classes = method_area.Classes();
+    w.WriteU4(static_cast<uint32_t>(classes.size()));
+    for (const RuntimeClass* cls : classes) {
+        w.WriteU2(cls->name_index);
+        w.WriteU2(static_cast<uint16_t>(cls->fields.size()));
+        for (const RuntimeField& field : cls->fields) {
+            w.WriteU2(field.name_index);
+            w.WriteU2(field.field_descriptor_index);
+        }
+        w.WriteU2(static_cast<uint16_t>(cls->methods.size()));
+        for (uint16_t method : cls->methods) {
+            w.WriteU2(method);
+        }
+    }
+
+    const auto& functions = method_area.Functions();
+    w.WriteU4(static_cast<uint32_t>(functions.size()));
+    size_t table = w.Size();
+    for (const RuntimeFunction* fn : functions) {
+        w.WriteU2(fn->name_index);
+        w.WriteU2(fn->params_descriptor_index);
+        w.WriteU2(fn->return_type_index);
+        w.WriteU2(fn->max_stack);
+        w.WriteU2(fn->locals_count);
+        w.WriteU2(0); // reserved
+        w.WriteU4(0); // body offset
+        w.WriteU4(0); // body size
+    }
+
+    auto write_code = [&](const std::vector<Operation>& code) {
+        w.WriteU4(static_cast<uint32_t>(code.size()));
+        for (const Operation& op : code) {
+            w.WriteU2(static_cast<uint16_t>(op.code));
+            w.WriteU1(static_cast<uint8_t>(op.arguments.size()));
+            w.WriteBytes(op.arguments.data(), op.arguments.size());
+        }
+    };
+    for (size_t i = 0; i < functions.size(); ++i) {
+        const RuntimeFunction& fn = *functions[i];
+        size_t body = w.Size();
+        write_code(fn.code);
+        write_code(fn.fused_code);
+        w.WriteU4(static_cast<uint32_t>(fn.frame_arrays.size()));
+        for (bool frame_array : fn.frame_arrays) {
+            w.WriteU1(frame_array);
+        }
+
+        size_t entry = table + i * kImageFunctionEntrySize;
+        w.PatchU4(entry + 12, static_cast<uint32_t>(body));
+        w.PatchU4(entry + 16, static_cast<uint32_t>(w.Size() - body));
+    }
+
+    return std::move(w.Data());
+}
+
+// The tables are read in full before anything is registered, so a damaged
+// image is a miss rather than a half-loaded program
+bool ClassLoader::LoadImage(const std::string& path, uint64_t key) {
+    auto& method_area = rda_.GetMethodArea();
+    if (!method_area.Functions().empty() || !method_area.ConstantPool().empty() ||
+        !method_area.Classes().empty()) {
+        throw ClassLoaderError("Image", "An image is loaded into an empty method area", path);
+    }
+
+    std::unique_ptr<MappedFile> mapping;
+    try {
+        mapping = std::make_unique<MappedFile>(path);
+    } catch (const std::runtime_error&) {
+        return false;
+    }
+
+    std::vector<Constant> constants;
+    std::vector<std::unique_ptr<RuntimeClass>> classes;
+    std::vector<std::unique_ptr<RuntimeFunction>> functions;
+    try {
+        ByteReader r(mapping->Data(), mapping->Size());
+        if (r.ReadU4() != kImageMagicNumber || r.ReadU1() != kImageVersion) {
+            return false;
+        }
+        r.ReadBytes(3); // reserved
+        uint64_t saved = uint64_t(r.ReadU4()) << 32;
+        saved |= r.ReadU4();
+        if (saved != key) {
+            return false;
+        }
+
+        uint32_t count = r.ReadU4();
+        if (count > size_t(UINT16_MAX) + 1) {
+            return false;
+        }
+        constants.resize(count);
+        for (Constant& c : constants) {
+            c.tag = static_cast<ConstantTag>(r.ReadU1());
+            uint32_t size = r.ReadU4();
+            const uint8_t* bytes = r.ReadBytes(size);
+            c.data.assign(bytes, bytes + size);
+        }
+        auto constant = [&](uint16_t index) {
+            if (index >= constants.size()) {
+                throw ClassLoaderError("Image", "Constant index out of range");
+            }
+            return index;
+        };
+
+        count = r.ReadU4();
+        for (uint32_t i = 0; i < count; ++i) {
+            auto& cls = classes.emplace_back(std::make_unique<RuntimeClass>());
+            cls->name_index = constant(r.ReadU2());
+            uint16_t fields_count = r.ReadU2();
+            for (uint16_t f = 0; f < fields_count; ++f) {
+                RuntimeField field;
+                field.name_index = constant(r.ReadU2());
+                field.field_descriptor_index = constant(r.ReadU2());
+                cls->fields.push_back(field);
+            }
+            uint16_t methods_count = r.ReadU2();
+            for (uint16_t m = 0; m < methods_count; ++m) {
+                cls->methods.push_back(r.ReadU2());
+            }
+        }
+
+        count = r.ReadU4();
+        if (count > size_t(UINT16_MAX) + 1 || count > r.Remaining() / kImageFunctionEntrySize) {
+            return false;
+        }
+        for (uint32_t i = 0; i < count; ++i) {
+            auto& fn = functions.emplace_back(std::make_unique<RuntimeFunction>());
+            fn->name_index = constant(r.ReadU2());
+            fn->params_descriptor_index = constant(r.ReadU2());
+            fn->return_type_index = constant(r.ReadU2());
+            fn->max_stack = r.ReadU2();
+            fn->locals_count = r.ReadU2();
+            r.ReadU2(); // reserved
+            uint32_t offset = r.ReadU4();
+            uint32_t size = r.ReadU4();
+            if (offset > mapping->Size() || size > mapping->Size() - offset) {
+                return false;
+            }
+            fn->code_pending = true;
+            fn->code_offset = offset;
+        }
+
+        for (const auto& cls : classes) {
+            for (uint16_t method : cls->methods) {
+                if (method >= functions.size()) return false;
+            }
+        }
+    } catch (const std::exception&) {
+        return false;
+    }
+
+    LoadedFile& file = files_.emplace_back();
+    file.mapping = std::move(mapping);
+    file.image = true;
+    uint32_t file_index = static_cast<uint32_t>(files_.size() - 1);
+
+    for (const Constant& c : constants) {
+        file.constants.push_back(method_area.RegisterConstant(c));
+    }
+    for (auto& fn : functions) {
+        fn->code_file = file_index;
+        file.functions.push_back(method_area.RegisterFunction(fn.release()));
+    }
+    for (auto& cls : classes) {
+        method_area.RegisterClass(cls.release());
+    }
+
+    method_area.SetCodeLoader([this](RuntimeFunction& fn) { DecodeFunction(fn); });
+    if (!lazy_decoding_) {
+        for (RuntimeFunction* fn : method_area.Functions()) {
+            DecodeFunction(*fn);
+        }
+    }
+
+    ResolveEntryPoint();
+    return true;
+}
+
+// Image bodies were verified and rewritten before they were saved
+void ClassLoader::DecodeImageCode(const LoadedFile& file, RuntimeFunction& fn) {
+    const MappedFile& mapping = *file.mapping;
+    ByteReader r(mapping.Data() + fn.code_offset, mapping.Size() - fn.code_offset);
+
+    auto read_code = [&](std::vector<Operation>& code) {
+        uint32_t count = r.ReadU4();
+        if (count > UINT16_MAX) {
+            throw ClassLoaderError("Image", "Function is too long", std::to_string(count));
+        }
+        code.resize(count);
+        for (Operation& op : code) {
+            op.code = static_cast<OperationCode>(r.ReadU2());
+            uint8_t size = r.ReadU1();
+            const uint8_t* arguments = r.ReadBytes(size);
+            op.arguments.assign(arguments, arguments + size);
+        }
+    };
+    read_code(fn.code);
+    read_code(fn.fused_code);
+
+    uint32_t marks = r.ReadU4();
+    if (marks > r.Remaining()) {
+        throw ClassLoaderError("Image", "Frame array marks exceed the image");
+    }
+    fn.frame_arrays.resize(marks);
+    for (uint32_t pc = 0; pc < marks; ++pc) {
+        fn.frame_arrays[pc] = r.ReadU1() != 0;
+    }
+}
+
 } // namespace czffvm
@@ -0,0 +1,485 @@
+#include <numeric>
+
+#include "escape_analysis.hpp"
+
+namespace czffvm {
+
+static uint16_t DecodeU2(const Operation& op) {
+    return (op.arguments[0] << 8) | op.arguments[1];
+}
+
+static std::vector<uint8_t> EncodeU2(uint16_t value) {
+    return {uint8_t((value >> 8) & 0xFF), uint8_t(value & 0xFF)};
+}
+
+static bool IsJump(OperationCode code) {
+    return code == OperationCode::JMP ||
+           code == OperationCode::JZ ||
+           code == OperationCode::JNZ;
+}
+
+EscapeAnalyzer::EscapeAnalyzer(RuntimeFunction& function, MethodArea& method_area)
+    : function_(function), method_area_(method_area) {}
+
+void EscapeAnalyzer::Run() {
+    Analyze();
+    if (ScalarReplace()) {
+        Analyze();
+    }
+    MarkFrameArrays();
+}
+
+size_t EscapeAnalyzer::ScalarReplacedCount() const {
+    return scalar_replaced_;
+}
+
+size_t EscapeAnalyzer::FrameAllocatedCount() const {
+    return frame_allocated_;
+}
+
+void EscapeAnalyzer::Analyze() {
+    const auto& code = function_.code;
+
+    site_of_pc_.assign(code.size(), -1);
+    site_pcs_.clear();
+    for (size_t pc = 0; pc < code.size(); ++pc) {
+        if (code[pc].code == OperationCode::NEWARR) {
+            site_of_pc_[pc] = static_cast<int>(site_pcs_.size());
+            site_pcs_.push_back(pc);
+        }
+    }
+
+    size_t nodes = site_pcs_.size() + function_.locals_count;
+    parent_.resize(nodes);
+    std::iota(parent_.begin(), parent_.end(), 0);
+    escapes_.assign(nodes, false);
+    local_stores_.assign(function_.locals_count, 0);
+    uses_.clear();
+
+    struct Slot {
+        int node;        // -1 when the value is not an array we track
+        size_t producer;
+    };
+    const Slot unknown{-1, SIZE_MAX};
+
+    std::vector<Slot> stack;
+    leaders_ = FindLeaders();
+
+    auto escape = [&](const Slot& s) {
+        if (s.node >= 0) escapes_[Find(s.node)] = true;
+    };
+    auto flush = [&]() {
+        for (auto& s : stack) escape(s);
+        stack.clear();
+    };
+    auto pop = [&]() -> Slot {
+        if (stack.empty()) return unknown;
+        Slot s = stack.back();
+        stack.pop_back();
+        return s;
+    };
+
+    for (size_t pc = 0; pc < code.size(); ++pc) {
+        if (leaders_[pc]) {
+            flush();
+        }
+
+        const Operation& op = code[pc];
+        switch (op.code) {
+            case OperationCode::NOP:
+            case OperationCode::HALT:
+                break;
+
+            case OperationCode::LDC:
+                stack.push_back({-1, pc});
+                break;
+
+            case OperationCode::LDV: {
+                uint16_t local = DecodeU2(op);
+                if (local >= function_.locals_count) {
+                    stack.push_back({-1, pc});
+                } else {
+                    stack.push_back({LocalNode(local), pc});
+                }
+                break;
+            }
+
+            case OperationCode::STORE: {
+                uint16_t local = DecodeU2(op);
+                Slot v = pop();
+                if (local >= function_.locals_count) {
+                    escape(v);
+                    break;
+                }
+                local_stores_[local]++;
+                if (v.node >= 0) {
+                    Union(v.node, LocalNode(local));
+                }
+                break;
+            }
+
+            case OperationCode::NEWARR:
+                escape(pop());
+                stack.push_back({site_of_pc_[pc], pc});
+                break;
+
+            case OperationCode::DUP: {
+                Slot top = stack.empty() ? unknown : stack.back();
+                if (stack.empty()) stack.push_back(top);
+                stack.push_back(top);
+                break;
+            }
+
+            case OperationCode::SWAP: {
+                Slot b = pop();
+                Slot a = pop();
+                stack.push_back(b);
+                stack.push_back(a);
+                break;
+            }
+
+            case OperationCode::LDELEM: {
+                Slot index = pop();
+                Slot array = pop();
+                escape(index);
+                uses_.push_back({array.producer, index.producer, pc});
+                stack.push_back({-1, pc});
+                break;
+            }
+
+            case OperationCode::STELEM: {
+                Slot value = pop();
+                Slot index = pop();
+                Slot array = pop();
+                escape(value);
+                escape(index);
+                uses_.push_back({array.producer, index.producer, pc});
+                break;
+            }
+
+            case OperationCode::CALL: {
+                uint16_t fn_idx = DecodeU2(op);
+                if (fn_idx >= method_area_.Functions().size()) {
+                    // unknown signature: give up on everything on the stack
+                    flush();
+                    break;
+                }
+
+                RuntimeFunction* callee = method_area_.GetFunction(fn_idx);
+                const Constant& params = method_area_.GetConstant(callee->params_descriptor_index);
+                size_t argc = CountParams(std::string(params.data.begin(), params.data.end()));
+                for (size_t i = 0; i < argc; ++i) {
+                    escape(pop());
+                }
+
+                const Constant& ret = method_area_.GetConstant(callee->return_type_index);
+                if (std::string(ret.data.begin(), ret.data.end()) != "void;") {
+                    stack.push_back({-1, pc});
+                }
+                break;
+            }
+
+            case OperationCode::RET:
+                flush();
+                break;
+
+            case OperationCode::JMP:
+                flush();
+                break;
+
+            case OperationCode::JZ:
+            case OperationCode::JNZ:
+                escape(pop());
+                flush();
+                break;
+
+            case OperationCode::PRINT:
+                escape(pop());
+                break;
+
+            case OperationCode::MIN:
+            case OperationCode::NEG:
+                escape(pop());
+                stack.push_back({-1, pc});
+                break;
+
+            default:
+                // binary arithmetic, comparison and logical operations
+                escape(pop());
+                escape(pop());
+                stack.push_back({-1, pc});
+                break;
+        }
+    }
+
+    flush();
+}
+
+bool EscapeAnalyzer::ScalarReplace() {
+    auto& code = function_.code;
+
+    struct Replacement {
+        size_t site;
+        uint16_t local;
+        uint32_t length;
+        uint16_t first_local;
+        uint16_t default_constant;
+    };
+    std::vector<Replacement> replacements;
+
+    std::vector<std::vector<size_t>> loads(function_.locals_count);
+    for (size_t pc = 0; pc < code.size(); ++pc) {
+        if (code[pc].code == OperationCode::LDV) {
+            uint16_t local = DecodeU2(code[pc]);
+            if (local < function_.locals_count) loads[local].push_back(pc);
+        }
+    }
+
+    std::vector<int> use_of_load(code.size(), -1);
+    std::vector<uint32_t> uses_per_load(code.size(), 0);
+    for (size_t i = 0; i < uses_.size(); ++i) {
+        if (uses_[i].array_load < code.size()) {
+            use_of_load[uses_[i].array_load] = static_cast<int>(i);
+            uses_per_load[uses_[i].array_load]++;
+        }
+    }
+
+    uint32_t next_local = function_.locals_count;
+    std::vector<size_t> component_size = ComponentSizes();
+
+    for (size_t site = 0; site < site_pcs_.size(); ++site) {
+        size_t pc = site_pcs_[site];
+        int node = static_cast<int>(site);
+
+        // LDC <length>; NEWARR <type>; STORE <local>
+        if (pc == 0 || pc + 1 >= code.size()) continue;
+        if (code[pc + 1].code != OperationCode::STORE) continue;
+        if (leaders_[pc] || leaders_[pc + 1]) continue;
+        if (Escapes(node) || component_size[Find(node)] != 2) continue;
+
+        uint32_t length = 0;
+        if (!ConstantIndex(code[pc - 1], length)) continue;
+        if (length == 0 || length > kMaxScalarReplacedLength) continue;
+
+        uint16_t local = DecodeU2(code[pc + 1]);
+        if (local >= function_.locals_count || local_stores_[local] != 1) continue;
+        if (next_local + length > UINT16_MAX) continue;
+
+        bool replaceable = true;
+        for (size_t load : loads[local]) {
+            int use = use_of_load[load];
+            uint32_t index = 0;
+            if (use < 0 ||
+                uses_per_load[load] != 1 ||
+                uses_[use].index_load != load + 1 ||
+                !ConstantIndex(code[load + 1], index) ||
+                index >= length ||
+                (code[uses_[use].access].code == OperationCode::LDELEM &&
+                 uses_[use].access != load + 2)) {
+                replaceable = false;
+                break;
+            }
+        }
+        if (!replaceable) continue;
+
+        uint16_t default_constant = DefaultConstant(DecodeU2(code[pc]));
+        if (default_constant == UINT16_MAX) continue;
+
+        replacements.push_back({site, local, length, static_cast<uint16_t>(next_local), default_constant});
+        next_local += length;
+    }
+
+    if (replacements.empty()) {
+        return false;
+    }
+
+    // rewrite element accesses in place, then expand the initialisations
+    std::vector<uint32_t> init_of_pc(code.size(), UINT32_MAX);
+    for (uint32_t r = 0; r < replacements.size(); ++r) {
+        const auto& rep = replacements[r];
+        size_t pc = site_pcs_[rep.site];
+        init_of_pc[pc - 1] = r;
+        code[pc].code = OperationCode::NOP;
+        code[pc].arguments.clear();
+        code[pc + 1].code = OperationCode::NOP;
+        code[pc + 1].arguments.clear();
+
+        for (size_t load : loads[rep.local]) {
+            const ElementUse& use = uses_[use_of_load[load]];
+            uint32_t index = 0;
+            ConstantIndex(code[load + 1], index);
+            uint16_t element_local = rep.first_local + index;
+
+            if (code[use.access].code == OperationCode::LDELEM) {
+                code[load] = Operation{OperationCode::LDV, EncodeU2(element_local)};
+                code[load + 1] = Operation{OperationCode::NOP, {}};
+                code[use.access] = Operation{OperationCode::NOP, {}};
+            } else {
+                code[load] = Operation{OperationCode::NOP, {}};
+                code[load + 1] = Operation{OperationCode::NOP, {}};
+                code[use.access] = Operation{OperationCode::STORE, EncodeU2(element_local)};
+            }
+        }
+    }
+
+    std::vector<Operation> new_code;
+    std::vector<uint32_t> old_to_new(code.size() + 1);
+    for (size_t pc = 0; pc < code.size(); ++pc) {
+        old_to_new[pc] = static_cast<uint32_t>(new_code.size());
+
+        if (init_of_pc[pc] != UINT32_MAX) {
+            const auto& rep = replacements[init_of_pc[pc]];
+            for (uint32_t i = 0; i < rep.length; ++i) {
+                new_code.push_back({OperationCode::LDC, EncodeU2(rep.default_constant)});
+                new_code.push_back({OperationCode::STORE, EncodeU2(rep.first_local + i)});
+            }
+            continue;
+        }
+
+        if (code[pc].code != OperationCode::NOP) {
+            new_code.push_back(code[pc]);
+        }
+    }
+    old_to_new[code.size()] = static_cast<uint32_t>(new_code.size());
+
+    for (auto& op : new_code) {
+        if (IsJump(op.code)) {
+            op.arguments = EncodeU2(old_to_new[DecodeU2(op)]);
+        }
+    }
+
+    code = std::move(new_code);
+    function_.locals_count = static_cast<uint16_t>(next_local);
+    scalar_replaced_ += replacements.size();
+
+    return true;
+}
+
+void EscapeAnalyzer::MarkFrameArrays() {
+    function_.frame_arrays.assign(function_.code.size(), false);
+    std::vector<bool> in_loop = FindLoopPcs();
+
+    for (size_t site = 0; site < site_pcs_.size(); ++site) {
+        size_t pc = site_pcs_[site];
+        if (Escapes(static_cast<int>(site)) || in_loop[pc]) {
+            continue;
+        }
+
+        function_.frame_arrays[pc] = true;
+        frame_allocated_++;
+    }
+}
+
+int EscapeAnalyzer::LocalNode(uint16_t local) const {
+    return static_cast<int>(site_pcs_.size()) + local;
+}
+
+int EscapeAnalyzer::Find(int node) {
+    while (parent_[node] != node) {
+        parent_[node] = parent_[parent_[node]];
+        node = parent_[node];
+    }
+    return node;
+}
+
+void EscapeAnalyzer::Union(int a, int b) {
+    int ra = Find(a);
+    int rb = Find(b);
+    if (ra == rb) return;
+
+    parent_[rb] = ra;
+    escapes_[ra] = escapes_[ra] || escapes_[rb];
+}
+
+bool EscapeAnalyzer::Escapes(int node) {
+    return escapes_[Find(node)];
+}
+
+std::vector<size_t> EscapeAnalyzer::ComponentSizes() {
+    std::vector<size_t> sizes(parent_.size(), 0);
+    for (int n = 0; n < static_cast<int>(parent_.size()); ++n) {
+        sizes[Find(n)]++;
+    }
+    return sizes;
+}
+
+// A pc is inside a loop when some backward jump spans it
+std::vector<bool> EscapeAnalyzer::FindLoopPcs() const {
+    const auto& code = function_.code;
+
+    // +1 where a spanned range starts, -1 past its end
+    std::vector<int> delta(code.size() + 1, 0);
+    for (size_t j = 0; j < code.size(); ++j) {
+        if (!IsJump(code[j].code)) continue;
+        uint16_t target = DecodeU2(code[j]);
+        if (target <= j) {
+            delta[target]++;
+            delta[j + 1]--;
+        }
+    }
+
+    std::vector<bool> in_loop(code.size(), false);
+    int spans = 0;
+    for (size_t pc = 0; pc < code.size(); ++pc) {
+        spans += delta[pc];
+        in_loop[pc] = spans > 0;
+    }
+    return in_loop;
+}
+
+std::vector<bool> EscapeAnalyzer::FindLeaders() const {
+    const auto& code = function_.code;
+    std::vector<bool> leaders(code.size(), false);
+
+    for (size_t pc = 0; pc < code.size(); ++pc) {
+        if (IsJump(code[pc].code)) {
+            uint16_t target = DecodeU2(code[pc]);
+            if (target < code.size()) leaders[target] = true;
+        }
+    }
+    return leaders;
+}
+
+bool EscapeAnalyzer::ConstantIndex(const Operation& op, uint32_t& value) const {
+    if (op.code != OperationCode::LDC) return false;
+
+    const Constant& c = method_area_.GetConstant(DecodeU2(op));
+    switch (c.tag) {
+        case ConstantTag::U1:
+        case ConstantTag::U2:
+        case ConstantTag::U4:
+        case ConstantTag::I4:
+            break;
+        default:
+            return false;
+    }
+
+    auto v = SafeValueToInteger<int64_t>(ConstantToValue(c));
+    if (!v || *v < 0 || *v > UINT32_MAX) return false;
+
+    value = static_cast<uint32_t>(*v);
+    return true;
+}
+
+uint16_t EscapeAnalyzer::DefaultConstant(uint16_t element_type_index) {
+    const Constant& type_c = method_area_.GetConstant(element_type_index);
+    std::string element(type_c.data.begin(), type_c.data.end());
+
+    Constant c;
+    if (element == "U1;")       c = {ConstantTag::U1, std::vector<uint8_t>(1)};
+    else if (element == "I1;")  c = {ConstantTag::I1, std::vector<uint8_t>(1)};
+    else if (element == "U2;")  c = {ConstantTag::U2, std::vector<uint8_t>(2)};
+    else if (element == "I2;")  c = {ConstantTag::I2, std::vector<uint8_t>(2)};
+    else if (element == "U;")   c = {ConstantTag::U4, std::vector<uint8_t>(4)};
+    else if (element == "I;")   c = {ConstantTag::I4, std::vector<uint8_t>(4)};
+    else if (element == "U8;")  c = {ConstantTag::U8, std::vector<uint8_t>(8)};
+    else if (element == "I8;")  c = {ConstantTag::I8, std::vector<uint8_t>(8)};
+    else if (element == "U16;") c = {ConstantTag::U16, std::vector<uint8_t>(16)};
+    else if (element == "I16;") c = {ConstantTag::I16, std::vector<uint8_t>(16)};
+    else if (element == "B;")   c = {ConstantTag::BOOL, std::vector<uint8_t>(1)};
+    else return UINT16_MAX;
+
+    return method_area_.InternConstant(c);
+}
+
+}  // namespace czffvm
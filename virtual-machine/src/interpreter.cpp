@@ -1,11 +1,15 @@
 #include <type_traits>
 #include <iostream>
 #include <optional>
+#include <algorithm>
 
 #include "interpreter.hpp"
 #include "call_frame.hpp"
 #include "runtime_data_area.hpp"
 #include "common.hpp"
+#include "ball_disassembler.hpp"
+#include "profile_data.hpp"
+#include "superinstructions.hpp"
 
 namespace czffvm {
 
@@ -105,6 +109,83 @@ static bool CheckReturnType(const std::string& expected, const Value& v) {
     return Match(t,v);
 }
 
+// The caller's RET checks the callee's result against its own return type
+static bool SameReturnType(MethodArea& method_area, const RuntimeFunction* a, const RuntimeFunction* b) {
+    if (a->return_type_index == b->return_type_index) return true;
+    return method_area.GetConstant(a->return_type_index).data ==
+           method_area.GetConstant(b->return_type_index).data;
+}
+
+// Shared by the plain operations and the superinstructions, so both report
+// the same errors
+
+static Value Add(const Value& a, const Value& b) {
+    return std::visit(
+        [](auto x, auto y) -> Value {
+            using X = std::decay_t<decltype(x)>;
+            using Y = std::decay_t<decltype(y)>;
+
+            if constexpr (std::is_same_v<X, Y> &&
+                        (std::is_integral_v<X>)) {
+                return x + y;
+            } else {
+                throw std::runtime_error("ADD: incompatible types");
+            }
+        },
+        a, b
+    );
+}
+
+static Value Compare(OperationCode code, const Value& a, const Value& b) {
+    return std::visit(
+        [code](auto&& x, auto&& y) -> Value {
+            using X = std::decay_t<decltype(x)>;
+            using Y = std::decay_t<decltype(y)>;
+
+            if constexpr (std::is_same_v<X, Y>) {
+                if (code == OperationCode::EQ) {
+                    return x == y;
+                }
+                if constexpr (std::is_integral_v<X>) {
+                    return code == OperationCode::LT ? x < y : x <= y;
+                }
+            }
+            switch (code) {
+                case OperationCode::EQ: throw std::runtime_error("EQ: incompatible types");
+                case OperationCode::LT: throw std::runtime_error("LT: incompatible types");
+                default: throw std::runtime_error("LEQ: incompatible types");
+            }
+        },
+        a, b
+    );
+}
+
+static bool IsZero(const Value& v) {
+    return std::visit([](auto&& x) -> bool {
+        using T = std::decay_t<decltype(x)>;
+
+        if constexpr (std::is_integral_v<T>)
+            return x == 0;
+        else if constexpr (std::is_same_v<T,bool>)
+            return x == false;
+        else {
+            throw std::runtime_error("JZ: invalid type");
+        }
+    }, v);
+}
+
+static uint16_t ArgumentU2(const Operation& op, size_t offset) {
+    return (op.arguments[offset] << 8) | op.arguments[offset + 1];
+}
+
+// pc is already past the jump, so a target below it closes a loop
+static void Jump(CallFrame& f, uint16_t target) {
+    if (target < f.pc) {
+        f.function->back_edge_count++;
+    }
+    f.pc = target;
+}
+
 size_t CountParams(const std::string& s){
     size_t i=0,c=0;
     while(i<s.size()){
@@ -118,6 +199,7 @@ void Interpreter::Execute(RuntimeFunction* entry) {
     if (!entry) {
         throw std::runtime_error("Main not found");
     }
+    rda_.GetMethodArea().EnsureCode(*entry);
 
     rda_.GetStack().PushFrame(entry);
 
@@ -132,12 +214,20 @@ void Interpreter::Execute(RuntimeFunction* entry) {
             throw std::runtime_error("PC out of bounds");
         }
 
-        const Operation& op = f.function->code[f.pc++];
+        const auto& code = f.function->fused_code.empty() ? f.function->code : f.function->fused_code;
+
+        if (profile_) {
+            // a fused operation runs all of the ones it covers
+            size_t length = SuperinstructionSelector::Length(code[f.pc].code);
+            for (size_t i = 0; i < length; ++i) {
+                profile_->Record(f.function, f.pc + i);
+            }
+        }
+        const Operation& op = code[f.pc++];
         switch (op.code) {
             case OperationCode::LDC: {
                 uint16_t idx = (op.arguments[0] << 8) | op.arguments[1];
-                const Constant& c = rda_.GetMethodArea().GetConstant(idx);
-                f.operand_stack.push_back(ConstantToValue(c));
+                f.operand_stack.push_back(rda_.GetMethodArea().GetConstantValue(idx));
                 break;
             }
             case OperationCode::STORE: {
@@ -164,22 +254,7 @@ void Interpreter::Execute(RuntimeFunction* entry) {
                 }
                 Value a = std::move(f.operand_stack.back()); f.operand_stack.pop_back();
 
-                auto result = std::visit(
-                    [](auto x, auto y) -> Value {
-                        using X = std::decay_t<decltype(x)>;
-                        using Y = std::decay_t<decltype(y)>;
-
-                        if constexpr (std::is_same_v<X, Y> &&
-                                    (std::is_integral_v<X>)) {
-                            return x + y;
-                        } else {
-                            throw std::runtime_error("ADD: incompatible types");
-                        }
-                    },
-                    a, b
-                );
-
-                f.operand_stack.push_back(result);
+                f.operand_stack.push_back(Add(a, b));
                 break;
             }
             case OperationCode::PRINT: {
@@ -225,6 +300,10 @@ void Interpreter::Execute(RuntimeFunction* entry) {
                     }
                 }
 
+                for (HeapRef ref : f.frame_arrays) {
+                    rda_.GetHeap().Free(ref);
+                }
+
                 rda_.GetStack().PopFrame();
 
                 if (!rda_.GetStack().Empty() && ret_value.has_value()) {
@@ -237,8 +316,7 @@ void Interpreter::Execute(RuntimeFunction* entry) {
             case OperationCode::HALT: {
                 uint16_t idx = (op.arguments[0] << 8) | op.arguments[1];
                 const Constant& c = rda_.GetMethodArea().GetConstant(idx);
-                Value return_value = ConstantToValue(c);
-                
+
                 int exit_code = 0;
                 switch (c.tag) {
                     case ConstantTag::U1: exit_code = c.data[0]; break;
@@ -253,6 +331,8 @@ void Interpreter::Execute(RuntimeFunction* entry) {
                         throw std::runtime_error("HALT: unsupported constant type for exit code");
                 }
 
+                PrintOpcodeProfile(std::cerr);
+                SaveProfile();
                 std::exit(exit_code);
             }
             case OperationCode::DUP: {
@@ -294,30 +374,19 @@ void Interpreter::Execute(RuntimeFunction* entry) {
                 }
 
                 uint16_t type_idx = (op.arguments[0] << 8) | op.arguments[1];
-                const Constant& type_c = rda_.GetMethodArea().GetConstant(type_idx);
-                std::string elem_type(type_c.data.begin(), type_c.data.end()); // пример: I; или [I;
-                std::string array_type = "[" + elem_type;
-
-                auto make_default = [&]() -> Value {
-                    if (elem_type == "U1;") return uint8_t(0);
-                    if (elem_type == "I1;") return int8_t(0);
-                    if (elem_type == "U2;") return uint16_t(0);
-                    if (elem_type == "I2;") return int16_t(0);
-                    if (elem_type == "U;") return uint32_t(0);
-                    if (elem_type == "I;") return int32_t(0);
-                    if (elem_type == "U8;") return uint64_t(0);
-                    if (elem_type == "I8;") return int64_t(0);
-                    if (elem_type == "U16;") return stdint128::uint128_t(0);
-                    if (elem_type == "I16;") return stdint128::int128_t(0);
-                    if (elem_type == "B;") return false;
-                    if (elem_type == "String;") return std::make_shared<std::string>(std::string());
-                    throw std::runtime_error("NEWARR: unknown element type"); };
-
-                Value def = make_default();
-
-                std::vector<Value> elements(arr_size, def);
-
-                HeapRef ref = rda_.GetHeap().Allocate(array_type, std::move(elements));
+                uint32_t type_id = rda_.ArrayTypeFor(type_idx);
+
+                const TypeInfo& type = rda_.GetHeap().Types().Get(type_id);
+                if (!type.element_default) {
+                    throw std::runtime_error("NEWARR: unknown element type");
+                }
+
+                HeapRef ref = rda_.GetHeap().AllocateArray(type_id, arr_size, *type.element_default);
+
+                size_t site = f.pc - 1;
+                if (site < f.function->frame_arrays.size() && f.function->frame_arrays[site]) {
+                    f.frame_arrays.push_back(ref);
+                }
 
                 f.operand_stack.push_back(ref);
                 break;
@@ -348,7 +417,7 @@ void Interpreter::Execute(RuntimeFunction* entry) {
 
                 HeapObject& obj = rda_.GetHeap().Get(*ref);
 
-                if (obj.type.empty() || obj.type[0] != '[') {
+                if (obj.element_kind == ElementKind::NONE) {
                     throw std::runtime_error("STELEM: object is not array");
                 }
 
@@ -363,35 +432,10 @@ void Interpreter::Execute(RuntimeFunction* entry) {
             case OperationCode::LDELEM: {
                 Value v_index = std::move(f.operand_stack.back());
                 f.operand_stack.pop_back();
-
-                uint32_t index;
-                if (auto p = std::get_if<uint8_t>(&v_index)) index = *p;
-                else if (auto p = std::get_if<uint16_t>(&v_index)) index = *p;
-                else if (auto p = std::get_if<uint32_t>(&v_index)) index = *p;
-                else if (auto p = std::get_if<int32_t>(&v_index)) index = *p;
-                else {
-                    throw std::runtime_error("LDELEM: index must be integer");
-                }
-
                 Value v_arr = std::move(f.operand_stack.back());
                 f.operand_stack.pop_back();
 
-                auto* ref = std::get_if<HeapRef>(&v_arr);
-                if (!ref) {
-                    throw std::runtime_error("LDELEM: not an array reference");
-                }
-
-                HeapObject& obj = rda_.GetHeap().Get(*ref);
-
-                if (obj.type.empty() || obj.type[0] != '[') {
-                    throw std::runtime_error("LDELEM: object is not array");
-                }
-
-                if (index >= obj.fields.size()) {
-                    throw std::runtime_error("LDELEM: index out of bounds");
-                }
-
-                f.operand_stack.push_back(obj.fields[index]);
+                f.operand_stack.push_back(LoadElement(v_arr, v_index));
                 break;
             }
             case OperationCode::MUL:  {
@@ -505,6 +549,7 @@ void Interpreter::Execute(RuntimeFunction* entry) {
 
                 RuntimeFunction* callee =
                     rda_.GetMethodArea().GetFunction(fn_idx);
+                rda_.GetMethodArea().EnsureCode(*callee);
 
                 CallFrame& caller =
                     rda_.GetStack().CurrentFrame();
@@ -530,7 +575,14 @@ void Interpreter::Execute(RuntimeFunction* entry) {
                     caller.operand_stack.pop_back();
                 }
 
-                if (!callee->jit_function && callee->call_count >= kJitThreshold && callee->compilable) {
+                // code compiled by an earlier run is used from the first call
+                if (!callee->jit_function && !callee->jit_cache_probed && callee->compilable && jit_compiler_) {
+                    callee->jit_cache_probed = true;
+                    callee->jit_function = jit_compiler_->LoadCachedFunction(*callee, rda_);
+                }
+
+                if (!callee->jit_function && (callee->call_count >= kJitThreshold || callee->jit_on_first_call) &&
+                    callee->compilable) {
                     if (!CanCompile(callee)) {
                         callee->compilable = false;
                     } else {
@@ -554,6 +606,24 @@ void Interpreter::Execute(RuntimeFunction* entry) {
                     }
                 }
 
+                // CALL directly followed by RET: nothing of the caller is
+                // needed anymore, so the callee takes over its frame
+                if (caller.pc < caller.function->code.size() &&
+                    caller.function->code[caller.pc].code == OperationCode::RET &&
+                    SameReturnType(rda_.GetMethodArea(), caller.function, callee)) {
+                    for (HeapRef ref : caller.frame_arrays) {
+                        rda_.GetHeap().Free(ref);
+                    }
+                    rda_.GetStack().ReplaceFrame(callee);
+
+                    callee->call_count++;
+
+                    for (auto& v : args) {
+                        caller.operand_stack.push_back(v);
+                    }
+                    break;
+                }
+
                 rda_.GetStack().PushFrame(const_cast<RuntimeFunction*>(callee));
                 CallFrame& callee_frame =
                     rda_.GetStack().CurrentFrame();
@@ -581,21 +651,7 @@ void Interpreter::Execute(RuntimeFunction* entry) {
                 Value a = std::move(f.operand_stack.back());
                 f.operand_stack.pop_back();
 
-                auto result = std::visit(
-                    [](auto&& x, auto&& y) -> Value {
-                        using X = std::decay_t<decltype(x)>;
-                        using Y = std::decay_t<decltype(y)>;
-
-                        if constexpr (std::is_same_v<X, Y>) {
-                            return x == y;
-                        } else {
-                            throw std::runtime_error("EQ: incompatible types");
-                        }
-                    },
-                    a, b
-                );
-
-                f.operand_stack.push_back(result);
+                f.operand_stack.push_back(Compare(OperationCode::EQ, a, b));
                 break;
             }
             case OperationCode::LT: {
@@ -613,22 +669,7 @@ void Interpreter::Execute(RuntimeFunction* entry) {
                 Value a = std::move(f.operand_stack.back());
                 f.operand_stack.pop_back();
 
-                auto result = std::visit(
-                    [](auto&& x, auto&& y) -> Value {
-                        using X = std::decay_t<decltype(x)>;
-                        using Y = std::decay_t<decltype(y)>;
-
-                        if constexpr (std::is_same_v<X, Y>
-                                    && std::is_integral_v<X>) {
-                            return x < y;
-                        } else {
-                            throw std::runtime_error("LT: incompatible types");
-                        }
-                    },
-                    a, b
-                );
-
-                f.operand_stack.push_back(result);
+                f.operand_stack.push_back(Compare(OperationCode::LT, a, b));
                 break;
             }
             case OperationCode::LEQ: {
@@ -646,22 +687,7 @@ void Interpreter::Execute(RuntimeFunction* entry) {
                 Value a = std::move(f.operand_stack.back());
                 f.operand_stack.pop_back();
 
-                auto result = std::visit(
-                    [](auto&& x, auto&& y) -> Value {
-                        using X = std::decay_t<decltype(x)>;
-                        using Y = std::decay_t<decltype(y)>;
-
-                        if constexpr (std::is_same_v<X, Y>
-                                    && std::is_integral_v<X>) {
-                            return x <= y;
-                        } else {
-                            throw std::runtime_error("LEQ: incompatible types");
-                        }
-                    },
-                    a, b
-                );
-
-                f.operand_stack.push_back(result);
+                f.operand_stack.push_back(Compare(OperationCode::LEQ, a, b));
                 break;
             }
             case OperationCode::JMP: {
@@ -674,7 +700,7 @@ void Interpreter::Execute(RuntimeFunction* entry) {
                     throw std::runtime_error("JMP: target out of bounds");
                 }
 
-                f.pc = target;
+                Jump(f, target);
                 break;
             }
             case OperationCode::JZ: {
@@ -687,17 +713,7 @@ void Interpreter::Execute(RuntimeFunction* entry) {
                 Value v = std::move(f.operand_stack.back());
                 f.operand_stack.pop_back();
 
-                bool cond = std::visit([](auto&& x) -> bool {
-                    using T = std::decay_t<decltype(x)>;
-
-                    if constexpr (std::is_integral_v<T>)
-                        return x == 0;
-                    else if constexpr (std::is_same_v<T,bool>)
-                        return x == false;
-                    else {
-                        throw std::runtime_error("JZ: invalid type");
-                    }
-                }, v);
+                bool cond = IsZero(v);
 
                 if (cond) {
                     uint16_t target =
@@ -706,7 +722,7 @@ void Interpreter::Execute(RuntimeFunction* entry) {
                     if (target >= f.function->code.size())
                         throw std::runtime_error("JZ: target out of bounds");
 
-                    f.pc = target;
+                    Jump(f, target);
                 }
 
                 break;
@@ -740,7 +756,7 @@ void Interpreter::Execute(RuntimeFunction* entry) {
                     if (target >= f.function->code.size())
                         throw std::runtime_error("JNZ: target out of bounds");
 
-                    f.pc = target;
+                    Jump(f, target);
                 }
 
                 break;
@@ -851,12 +867,131 @@ void Interpreter::Execute(RuntimeFunction* entry) {
             case OperationCode::NOP: {
                 break;
             }
+            case OperationCode::LDV_LDV: {
+                f.operand_stack.push_back(f.locals.at(ArgumentU2(op, 0)));
+                f.operand_stack.push_back(f.locals.at(ArgumentU2(op, 2)));
+                f.pc += 1;
+                break;
+            }
+            case OperationCode::LDV_LDC: {
+                const Value& c = rda_.GetMethodArea().GetConstantValue(ArgumentU2(op, 2));
+                f.operand_stack.push_back(f.locals.at(ArgumentU2(op, 0)));
+                f.operand_stack.push_back(c);
+                f.pc += 1;
+                break;
+            }
+            case OperationCode::LDV_LDV_ADD_STORE: {
+                Value result = Add(f.locals.at(ArgumentU2(op, 0)), f.locals.at(ArgumentU2(op, 2)));
+                f.locals.at(ArgumentU2(op, 4)) = std::move(result);
+                f.pc += 3;
+                break;
+            }
+            case OperationCode::LDV_LDC_ADD_STORE: {
+                const Value& c = rda_.GetMethodArea().GetConstantValue(ArgumentU2(op, 2));
+                Value result = Add(f.locals.at(ArgumentU2(op, 0)), c);
+                f.locals.at(ArgumentU2(op, 4)) = std::move(result);
+                f.pc += 3;
+                break;
+            }
+            case OperationCode::CMP_JZ: {
+                auto cmp = static_cast<OperationCode>(op.arguments[0]);
+                if (f.operand_stack.size() < 2) {
+                    throw std::runtime_error(
+                        BallDisassembler::OperationCodeToString(cmp) + ": Operand stack underflow");
+                }
+                Value b = std::move(f.operand_stack.back()); f.operand_stack.pop_back();
+                Value a = std::move(f.operand_stack.back()); f.operand_stack.pop_back();
+
+                f.pc += 1;
+                if (IsZero(Compare(cmp, a, b))) {
+                    uint16_t target = ArgumentU2(op, 1);
+                    if (target >= f.function->code.size())
+                        throw std::runtime_error("JZ: target out of bounds");
+                    Jump(f, target);
+                }
+                break;
+            }
+            case OperationCode::LDV_LDC_CMP_JZ: {
+                auto cmp = static_cast<OperationCode>(op.arguments[4]);
+                const Value& c = rda_.GetMethodArea().GetConstantValue(ArgumentU2(op, 2));
+
+                f.pc += 3;
+                if (IsZero(Compare(cmp, f.locals.at(ArgumentU2(op, 0)), c))) {
+                    uint16_t target = ArgumentU2(op, 5);
+                    if (target >= f.function->code.size())
+                        throw std::runtime_error("JZ: target out of bounds");
+                    Jump(f, target);
+                }
+                break;
+            }
+            case OperationCode::LDV_LDV_LDELEM: {
+                f.operand_stack.push_back(
+                    LoadElement(f.locals.at(ArgumentU2(op, 0)), f.locals.at(ArgumentU2(op, 2))));
+                f.pc += 2;
+                break;
+            }
             default:
                 throw std::runtime_error("Unknown opcode");
         }
     }
 }
 
+Value Interpreter::LoadElement(const Value& v_arr, const Value& v_index) {
+    uint32_t index;
+    if (auto p = std::get_if<uint8_t>(&v_index)) index = *p;
+    else if (auto p = std::get_if<uint16_t>(&v_index)) index = *p;
+    else if (auto p = std::get_if<uint32_t>(&v_index)) index = *p;
+    else if (auto p = std::get_if<int32_t>(&v_index)) index = *p;
+    else {
+        throw std::runtime_error("LDELEM: index must be integer");
+    }
+
+    auto* ref = std::get_if<HeapRef>(&v_arr);
+    if (!ref) {
+        throw std::runtime_error("LDELEM: not an array reference");
+    }
+
+    HeapObject& obj = rda_.GetHeap().Get(*ref);
+
+    if (obj.element_kind == ElementKind::NONE) {
+        throw std::runtime_error("LDELEM: object is not array");
+    }
+
+    if (index >= obj.fields.size()) {
+        throw std::runtime_error("LDELEM: index out of bounds");
+    }
+
+    return obj.fields[index];
+}
+
+void Interpreter::EnableOpcodeProfile() {
+    profile_ = std::make_unique<OpcodeProfile>();
+}
+
+const OpcodeProfile* Interpreter::Profile() const {
+    return profile_.get();
+}
+
+void Interpreter::PrintOpcodeProfile(std::ostream& out) const {
+    if (profile_) {
+        profile_->Print(out);
+    }
+}
+
+void Interpreter::SetProfileOutput(const std::string& path) {
+    profile_output_ = path;
+}
+
+void Interpreter::SaveProfile() const {
+    if (profile_output_.empty()) return;
+
+    try {
+        ProfileData::Collect(rda_.GetMethodArea()).Write(profile_output_);
+    } catch (const std::runtime_error& e) {
+        std::cerr << "Warning: " << e.what() << std::endl;
+    }
+}
+
 void Interpreter::JitCompile(RuntimeFunction* function) {
     function->jit_function = jit_compiler_->CompileFunction(*function, rda_);
 }
@@ -868,7 +1003,9 @@ void Interpreter::SetJitCompiler(std::unique_ptr<czffvm_jit::JitCompiler> jit) {
 void Interpreter::ExecuteJitFunction(RuntimeFunction* function, CallFrame& caller_frame, std::vector<Value>& args) {
     
     int32_t stack[100000];
-    size_t lc = ((function->locals_count * 4) + 15) / 16 * 4;
+    // frame layout of the compiled code, which may use more locals than the bytecode
+    size_t lc = ((function->jit_function->GetLocalsCount() * 4) + 15) / 16 * 4;
+    std::fill(stack, stack + lc, 0); // locals may be reported by a stack map before their first STORE
     for (size_t i = 0; i < args.size(); ++i) {
         int32_t value;
         if (auto p = std::get_if<uint8_t>(&args[i]))      value = static_cast<int32_t>(*p);
@@ -883,7 +1020,7 @@ void Interpreter::ExecuteJitFunction(RuntimeFunction* function, CallFrame& calle
         else if (auto p = std::get_if<HeapRef>(&args[i]))  value = static_cast<int32_t>(p->id);
         else if (auto p = std::get_if<StringRef>(&args[i])) {
             Constant c{ConstantTag::STRING, std::vector<uint8_t>((*p)->begin(), (*p)->end())};
-            int idx = rda_.GetMethodArea().RegisterConstant(c);
+            int idx = rda_.GetMethodArea().InternConstant(c);
             value = static_cast<int32_t>(idx | 0xbf600000); // magic number
         } else {
             throw std::runtime_error("Wrong type for JIT-compilation, only integers supported");
@@ -898,6 +1035,13 @@ void Interpreter::ExecuteJitFunction(RuntimeFunction* function, CallFrame& calle
 
     auto ret_c = rda_.GetMethodArea().GetConstant(function->return_type_index);
 
+    struct JitFrameGuard {
+        StackDataArea& stack;
+        ~JitFrameGuard() noexcept { stack.PopJitFrame(); }
+    };
+    rda_.GetStack().PushJitFrame({stack, &function->jit_function->GetStackMaps()});
+    JitFrameGuard guard{rda_.GetStack()};
+
     func_ptr(stack, &hh);
     std::string ret_type(ret_c.data.begin(), ret_c.data.end());
 
@@ -908,7 +1052,7 @@ void Interpreter::ExecuteJitFunction(RuntimeFunction* function, CallFrame& calle
     size_t i = 0;
     auto type_kind = ParseType(ret_type, i);
 
-    size_t return_index = lc;
+    size_t return_index = 0; // RET stores the result at stack[0]
 
     Constant c;
     switch (type_kind.kind) {
@@ -961,13 +1105,17 @@ bool Interpreter::CanCompile(const RuntimeFunction* function) {
     if (!jit_compiler_) {
         return false;
     }
-    for (const auto& op : function->code) {
-        if (!jit_compiler_->CanCompile(op)) {
-            return false;
-        }
+
+    // calls are inlined, so the callees' bodies are needed even when lazy
+    // decoding has not read them yet
+    MethodArea& method_area = rda_.GetMethodArea();
+    for (const Operation& op : function->code) {
+        if (op.code != OperationCode::CALL) continue;
+        RuntimeFunction* callee = method_area.GetFunction((op.arguments[0] << 8) | op.arguments[1]);
+        if (callee) method_area.EnsureCode(*callee);
     }
 
-    return true;
+    return jit_compiler_->CanCompileFunction(*function, method_area);
 }
 
 
@@ -1,36 +1,38 @@
+#include <limits>
 #include <optional>
+#include <type_traits>
 
 #include "jit/generic_jit_optimizer.hpp"
 
 namespace czffvm_jit {
 void GenericJitOptimizer::BuildControlFlowGraph() {
     basic_blocks_.clear();
-    addr_to_block_.clear();
+    addr_to_block_.assign(code_.size(), -1);
+    liveness_.reset();
 
-    std::unordered_set<int> leaders;
-    leaders.insert(0);
+    std::vector<bool> leaders(code_.size() + 1, false);
+    leaders[0] = true;
 
     for (int i = 0; i < (int)code_.size(); ++i) {
         const Operation& instr = code_[i];
 
         if (IsJump(instr)) {
             int target = decodeJumpTarget(instr);
-            leaders.insert(target);       // jump target is a leader
-
-            if (IsConditionalJump(instr)) {
-                leaders.insert(i + 1);    // fallthrough is a leader
+            if (target < (int)code_.size()) {
+                leaders[target] = true;   // jump target is a leader
             }
-        } else if (IsReturn(instr) && i + 1 < (int)code_.size()) {
-            leaders.insert(i + 1);
         }
-    }
 
-    std::vector<int> sorted_leaders(leaders.begin(), leaders.end());
-    std::sort(sorted_leaders.begin(), sorted_leaders.end());
+        // fallthrough, or code after a terminator, is a leader; blocks
+        // always end with their terminator
+        if (IsTerminator(instr)) {
+            leaders[i + 1] = true;
+        }
+    }
 
-    for (size_t i = 0; i < sorted_leaders.size(); ++i) {
-        int start = sorted_leaders[i];
-        int end = (i + 1 < sorted_leaders.size()) ? sorted_leaders[i + 1] : code_.size();
+    for (int start = 0; start < (int)code_.size();) {
+        int end = start + 1;
+        while (end < (int)code_.size() && !leaders[end]) ++end;
 
         BasicBlock bb;
         bb.id = basic_blocks_.size();
@@ -41,41 +43,50 @@ void GenericJitOptimizer::BuildControlFlowGraph() {
         for (int a = start; a < end; ++a) {
             addr_to_block_[a] = bb.id;
         }
+        start = end;
     }
 
+    auto link = [&](BasicBlock& bb, int addr) {
+        int target_bb = BlockAt(addr);
+        if (target_bb < 0) return;
+        bb.succs.push_back(target_bb);
+        basic_blocks_[target_bb].preds.push_back(bb.id);
+    };
+
     for (auto& bb : basic_blocks_) {
-        int last_addr = bb.end - 1;
-        const Operation& last = code_[last_addr];
+        const Operation& last = code_[bb.end - 1];
 
         if (IsReturn(last)) continue;
 
         if (IsJump(last)) {
-            int target = decodeJumpTarget(last);
-            int target_bb = addr_to_block_[target];
-
-            bb.succs.push_back(target_bb);
-            basic_blocks_[target_bb].preds.push_back(bb.id);
-
+            link(bb, decodeJumpTarget(last));
             if (IsConditionalJump(last)) {
-                int fallthrough = bb.end;
-                if (addr_to_block_.count(fallthrough)) {
-                    int ft_bb = addr_to_block_[fallthrough];
-                    bb.succs.push_back(ft_bb);
-                    basic_blocks_[ft_bb].preds.push_back(bb.id);
-                }
+                link(bb, bb.end);
             }
         } else {
-            int fallthrough = bb.end;
-            if (addr_to_block_.count(fallthrough)) {
-                int ft_bb = addr_to_block_[fallthrough];
-                bb.succs.push_back(ft_bb);
-                basic_blocks_[ft_bb].preds.push_back(bb.id);
-            }
+            link(bb, bb.end);
         }
     }
+
+    cfg_valid_ = true;
+    reachability_valid_ = false;
+}
+
+const std::vector<BasicBlock>& GenericJitOptimizer::ControlFlowGraph() {
+    if (!cfg_valid_) BuildControlFlowGraph();
+    if (!reachability_valid_) MarkReachableBlocks();
+    return basic_blocks_;
+}
+
+void GenericJitOptimizer::InvalidateAnalyses() {
+    cfg_valid_ = false;
+    reachability_valid_ = false;
+    liveness_.reset();
 }
 
 void GenericJitOptimizer::MarkReachableBlocks() {
+    if (!cfg_valid_) BuildControlFlowGraph();
+    reachability_valid_ = true;
     if (basic_blocks_.empty()) return;
 
     std::vector<int> stack{0};
@@ -95,176 +106,456 @@ void GenericJitOptimizer::MarkReachableBlocks() {
 }
 
 void GenericJitOptimizer::RemoveDeadCode() {
-    for (const auto& bb : basic_blocks_) {
-        if (!bb.reachable) {
-            for (int i = bb.start; i < bb.end; ++i) {
-                code_[i].code = OperationCode::NOP;
-                code_[i].arguments.clear();
-            }
-            continue;
-        }
+    ControlFlowGraph();
+    bool changed = false;
 
-        bool after_terminator = false;
+    for (const auto& bb : basic_blocks_) {
+        bool dead = !bb.reachable;
         for (int i = bb.start; i < bb.end; ++i) {
-            if (after_terminator) {
+            if (dead && code_[i].code != OperationCode::NOP) {
                 code_[i].code = OperationCode::NOP;
                 code_[i].arguments.clear();
+                changed = true;
                 continue;
             }
             if (IsTerminator(code_[i])) {
-                after_terminator = true;
+                dead = true;
             }
         }
     }
+
+    if (changed) InvalidateAnalyses();
 }
 
 void GenericJitOptimizer::CompactCode() {
+    // old_to_new[i]: new address of the first kept instruction at or after i
+    std::vector<int> old_to_new(code_.size() + 1);
+    int kept = 0;
+    for (size_t i = 0; i < code_.size(); ++i) {
+        old_to_new[i] = kept;
+        if (code_[i].code != OperationCode::NOP) ++kept;
+    }
+    old_to_new[code_.size()] = kept;
+
+    if (kept == (int)code_.size()) return;
+
     std::vector<Operation> new_code;
-    std::vector<int> old_to_new(code_.size(), -1);
+    new_code.reserve(kept);
+    for (auto& instr : code_) {
+        if (instr.code == OperationCode::NOP) continue;
 
-    for (int i = 0; i < (int)code_.size(); ++i) {
-        if (code_[i].code != OperationCode::NOP) {
-            old_to_new[i] = new_code.size();
-            new_code.push_back(code_[i]);
+        if (IsJump(instr)) {
+            int old_target = std::min<int>(decodeJumpTarget(instr), code_.size());
+            encodeJumpTarget(instr, old_to_new[old_target]);
         }
+        new_code.push_back(std::move(instr));
     }
 
-    auto resolve = [&](int old_addr) {
-        while (old_addr < (int)code_.size() && old_to_new[old_addr] == -1) ++old_addr;
-        return old_to_new[old_addr];
-    };
+    code_ = std::move(new_code);
+    InvalidateAnalyses();
+}
 
-    for (int i = 0; i < (int)new_code.size(); ++i) {
-        Operation& instr = new_code[i];
-        if (!IsJump(instr)) continue;
 
-        int old_addr = -1;
-        for (int j = 0; j < (int)code_.size(); ++j) {
-            if (old_to_new[j] == i) {
-                old_addr = j;
-                break;
+// Integral alternatives of Value and BOOL; strings, 128-bit integers and
+// references are never folded
+static bool IsFoldableTag(ConstantTag tag) {
+    switch (tag) {
+        case ConstantTag::U1: case ConstantTag::U2: case ConstantTag::U4: case ConstantTag::U8:
+        case ConstantTag::I1: case ConstantTag::I2: case ConstantTag::I4: case ConstantTag::I8:
+        case ConstantTag::BOOL:
+            return true;
+        default:
+            return false;
+    }
+}
+
+template<typename T>
+static Constant EncodeConstant(ConstantTag tag, T value) {
+    using U = std::make_unsigned_t<T>;
+    U bits = static_cast<U>(value);
+    std::vector<uint8_t> data(sizeof(T));
+    for (size_t i = sizeof(T); i-- > 0;) {
+        data[i] = uint8_t(bits & 0xFF);
+        bits = U(bits >> 8);
+    }
+    return Constant{tag, std::move(data)};
+}
+
+static std::optional<Constant> ValueToConstant(const Value& v) {
+    return std::visit([](auto x) -> std::optional<Constant> {
+        using X = std::decay_t<decltype(x)>;
+        if constexpr (std::is_same_v<X, bool>)          return Constant{ConstantTag::BOOL, {uint8_t(x)}};
+        else if constexpr (std::is_same_v<X, int8_t>)   return EncodeConstant(ConstantTag::I1, x);
+        else if constexpr (std::is_same_v<X, uint8_t>)  return EncodeConstant(ConstantTag::U1, x);
+        else if constexpr (std::is_same_v<X, int16_t>)  return EncodeConstant(ConstantTag::I2, x);
+        else if constexpr (std::is_same_v<X, uint16_t>) return EncodeConstant(ConstantTag::U2, x);
+        else if constexpr (std::is_same_v<X, int32_t>)  return EncodeConstant(ConstantTag::I4, x);
+        else if constexpr (std::is_same_v<X, uint32_t>) return EncodeConstant(ConstantTag::U4, x);
+        else if constexpr (std::is_same_v<X, int64_t>)  return EncodeConstant(ConstantTag::I8, x);
+        else if constexpr (std::is_same_v<X, uint64_t>) return EncodeConstant(ConstantTag::U8, x);
+        else return std::nullopt;
+    }, v);
+}
+
+// Result of `code` on constant operands (deepest first) as the interpreter
+// computes it, including integer promotion of narrow types. Compiled code
+// works on untyped 32-bit words, so with `untyped` operands of different
+// types up to 32 bits fold as I4. nullopt when the result overflows or
+// cannot be computed.
+static std::optional<Value> FoldOperation(OperationCode code, const Value& a, const Value& b, bool untyped) {
+    return std::visit([code, untyped](auto x, auto y) -> std::optional<Value> {
+        using X = std::decay_t<decltype(x)>;
+        using Y = std::decay_t<decltype(y)>;
+
+        if constexpr (!std::is_integral_v<X> || !std::is_integral_v<Y>) {
+            return std::nullopt;
+        } else if constexpr (!std::is_same_v<X, Y>) {
+            if constexpr (sizeof(X) <= 4 && sizeof(Y) <= 4) {
+                if (untyped) {
+                    return FoldOperation(code, Value(static_cast<int32_t>(x)), Value(static_cast<int32_t>(y)), true);
+                }
+            }
+            return std::nullopt;
+        } else {
+            using R = decltype(x + y);
+            R rx = static_cast<R>(x);
+            R ry = static_cast<R>(y);
+            R r{};
+
+            switch (code) {
+                case OperationCode::ADD:
+                    if constexpr (std::is_signed_v<R>) {
+                        if (__builtin_add_overflow(rx, ry, &r)) return std::nullopt;
+                    } else {
+                        r = rx + ry;
+                    }
+                    return Value(r);
+                case OperationCode::SUB:
+                    if constexpr (std::is_signed_v<R>) {
+                        if (__builtin_sub_overflow(rx, ry, &r)) return std::nullopt;
+                    } else {
+                        r = rx - ry;
+                    }
+                    return Value(r);
+                case OperationCode::MUL:
+                    if constexpr (std::is_signed_v<R>) {
+                        if (__builtin_mul_overflow(rx, ry, &r)) return std::nullopt;
+                    } else {
+                        r = rx * ry;
+                    }
+                    return Value(r);
+                case OperationCode::DIV:
+                case OperationCode::MOD:
+                    if (ry == 0) return std::nullopt;
+                    if constexpr (std::is_signed_v<R>) {
+                        if (rx == std::numeric_limits<R>::min() && ry == -1) return std::nullopt;
+                    }
+                    return Value(R(code == OperationCode::DIV ? rx / ry : rx % ry));
+                case OperationCode::EQ:
+                    return Value(x == y);
+                case OperationCode::LT:
+                    return Value(x < y);
+                case OperationCode::LEQ:
+                    return Value(x <= y);
+                case OperationCode::LAND:
+                case OperationCode::LOR:
+                    if constexpr (std::is_same_v<X, bool>) {
+                        return Value(code == OperationCode::LAND ? (x && y) : (x || y));
+                    }
+                    return std::nullopt;
+                default:
+                    return std::nullopt;
             }
         }
+    }, a, b);
+}
 
-        int old_target = decodeJumpTarget(instr);
-        int new_target = resolve(old_target);
+static std::optional<Value> FoldOperation(OperationCode code, const Value& a) {
+    return std::visit([code](auto x) -> std::optional<Value> {
+        using X = std::decay_t<decltype(x)>;
+
+        if constexpr (!std::is_integral_v<X>) {
+            return std::nullopt;
+        } else if (code == OperationCode::NEG) {
+            if constexpr (std::is_same_v<X, bool>) return Value(!x);
+            return std::nullopt;
+        } else if (code == OperationCode::MIN) {
+            using R = decltype(-x);
+            R r{};
+            if constexpr (std::is_signed_v<R>) {
+                if (__builtin_sub_overflow(R(0), static_cast<R>(x), &r)) return std::nullopt;
+            } else {
+                r = -x;
+            }
+            return Value(r);
+        } else {
+            return std::nullopt;
+        }
+    }, a);
+}
 
-        encodeJumpTarget(instr, new_target);
-    }
+// JZ/JNZ outcome for a constant condition
+static std::optional<bool> IsZero(const Value& v) {
+    return std::visit([](auto x) -> std::optional<bool> {
+        using X = std::decay_t<decltype(x)>;
+        if constexpr (std::is_integral_v<X>) return x == 0;
+        return std::nullopt;
+    }, v);
+}
 
-    code_ = std::move(new_code);
+uint16_t GenericJitOptimizer::InternConstant(const Constant& c) {
+    return method_area_.InternConstant(c);
 }
 
+std::pair<int, int> GenericJitOptimizer::StackEffect(const Operation& instr) const {
+    if (instr.code != OperationCode::CALL) {
+        return {StackConsumes(instr.code), StackProduces(instr.code)};
+    }
+
+    const RuntimeFunction* callee = method_area_.GetFunction(decodeJumpTarget(instr));
+    const Constant& params = method_area_.GetConstant(callee->params_descriptor_index);
+    const Constant& ret = method_area_.GetConstant(callee->return_type_index);
+    int argc = static_cast<int>(CountParams(std::string(params.data.begin(), params.data.end())));
+    return {argc, std::string(ret.data.begin(), ret.data.end()) == "void;" ? 0 : 1};
+}
 
 void GenericJitOptimizer::ConstantFolding() {
+    // nullopt: not a constant (overdefined)
+    using Lattice = std::optional<Value>;
+
     struct StackEntry {
-        std::optional<Value> value;
-        size_t addr;
+        Lattice value;
+        std::vector<size_t> producers;   // pure instructions of this block computing it
     };
 
-    std::vector<StackEntry> stack;
+    ControlFlowGraph();
+    if (basic_blocks_.empty()) return;
 
-    for (size_t i = 0; i < code_.size(); ++i) {
-        Operation& instr = code_[i];
+    size_t locals = 0;
+    for (const auto& instr : code_) {
+        if (IsLoad(instr.code) || IsStore(instr.code)) {
+            locals = std::max<size_t>(locals, decodeJumpTarget(instr) + 1);
+        }
+    }
+
+    auto removable = [](const StackEntry& e) {
+        return e.value.has_value() && !e.producers.empty();
+    };
+
+    auto erase = [&](const StackEntry& e) {
+        for (size_t addr : e.producers) {
+            code_[addr].code = OperationCode::NOP;
+            code_[addr].arguments.clear();
+        }
+    };
+
+    auto load = [&](Operation& instr, const Value& v) {
+        uint16_t idx = InternConstant(*ValueToConstant(v));
+        instr.code = OperationCode::LDC;
+        instr.arguments = {uint8_t((idx >> 8) & 0xFF), uint8_t(idx & 0xFF)};
+    };
 
-        switch (instr.code) {
-        case OperationCode::LDC: {
-            int idx = (instr.arguments[0] << 8) | instr.arguments[1];
-            const Constant& c = method_area_.GetConstant(idx);
+    // Runs one block from the given locals; the stack starts unknown. With
+    // `rewrite` the folds are applied to code_. Returns the decided branch
+    // of a terminating JZ/JNZ (true: jump taken).
+    auto simulate = [&](const BasicBlock& bb, std::vector<Lattice>& state, bool rewrite) {
+        std::vector<StackEntry> stack;
+        std::optional<bool> taken;
 
-            if ((c.tag == ConstantTag::U1 || c.tag == ConstantTag::U2 || c.tag == ConstantTag::U4 ||
-                 c.tag == ConstantTag::I1 || c.tag == ConstantTag::I2 || c.tag == ConstantTag::I4)) {
+        auto pop = [&]() {
+            if (stack.empty()) return StackEntry{};
+            StackEntry e = std::move(stack.back());
+            stack.pop_back();
+            return e;
+        };
 
-                int64_t val = 0;
-                for (auto b : c.data) val = (val << 8) | b;
-                stack.push_back({val, i});
-            } else {
-                stack.push_back({std::nullopt, i});
+        for (int i = bb.start; i < bb.end; ++i) {
+            Operation& instr = code_[i];
+            size_t addr = static_cast<size_t>(i);
+
+            switch (instr.code) {
+            case OperationCode::NOP:
+                break;
+
+            case OperationCode::LDC: {
+                uint16_t idx = decodeJumpTarget(instr);
+                if (IsFoldableTag(method_area_.GetConstant(idx).tag)) {
+                    stack.push_back({method_area_.GetConstantValue(idx), {addr}});
+                } else {
+                    stack.push_back({});
+                }
+                break;
             }
-            break;
-        }
 
-        case OperationCode::ADD:
-        case OperationCode::SUB:
-        case OperationCode::MUL:
-        case OperationCode::DIV: {
-            if (stack.size() < 2) {
-                stack.clear();
+            case OperationCode::LDV: {
+                const Lattice& v = state[decodeJumpTarget(instr)];
+                if (v && rewrite) load(instr, *v);
+                stack.push_back({v, v ? std::vector<size_t>{addr} : std::vector<size_t>{}});
                 break;
             }
 
-            auto b = stack.back(); stack.pop_back();
-            auto a = stack.back(); stack.pop_back();
+            case OperationCode::STORE:
+                state[decodeJumpTarget(instr)] = pop().value;
+                break;
 
-            if (!a.value.has_value() || !b.value.has_value()) {
-                stack.push_back({std::nullopt, i});
+            case OperationCode::DUP: {
+                // both copies share the producers, so neither can be erased
+                StackEntry e = pop();
+                stack.push_back({e.value, {}});
+                stack.push_back({e.value, {}});
                 break;
             }
 
-            auto pa = SafeValueToInteger<int64_t>(a.value.value());
-            auto pb = SafeValueToInteger<int64_t>(b.value.value());
-            if (!pa.has_value() || !pb.has_value()) {
-                stack.push_back({std::nullopt, i});
+            case OperationCode::SWAP: {
+                // erasing a moved entry erases the SWAP too: with one of
+                // the two values gone it has nothing left to exchange
+                StackEntry b = pop();
+                StackEntry a = pop();
+                if (!b.producers.empty()) b.producers.push_back(addr);
+                if (!a.producers.empty()) a.producers.push_back(addr);
+                stack.push_back(std::move(b));
+                stack.push_back(std::move(a));
                 break;
             }
 
-            int64_t result = 0;
-            switch (instr.code) {
-                case OperationCode::ADD: result = pa.value() + pb.value(); break;
-                case OperationCode::SUB: result = pa.value() - pb.value(); break;
-                case OperationCode::MUL: result = pa.value() * pb.value(); break;
-                case OperationCode::DIV: 
-                    if (pb.value() == 0) {
-                        stack.push_back({std::nullopt, i});
-                        continue;
+            case OperationCode::ADD:
+            case OperationCode::SUB:
+            case OperationCode::MUL:
+            case OperationCode::DIV:
+            case OperationCode::MOD:
+            case OperationCode::EQ:
+            case OperationCode::LT:
+            case OperationCode::LEQ:
+            case OperationCode::LAND:
+            case OperationCode::LOR: {
+                StackEntry b = pop();
+                StackEntry a = pop();
+                Lattice result;
+                if (a.value && b.value) {
+                    result = FoldOperation(instr.code, *a.value, *b.value, !interpreter_semantics_);
+                }
+
+                if (result && removable(a) && removable(b)) {
+                    if (rewrite) {
+                        erase(a);
+                        erase(b);
+                        load(instr, *result);
+                    }
+                    stack.push_back({result, {addr}});
+                } else {
+                    stack.push_back({result, {}});
+                }
+                break;
+            }
+
+            case OperationCode::NEG:
+            case OperationCode::MIN: {
+                StackEntry a = pop();
+                Lattice result;
+                if (a.value) result = FoldOperation(instr.code, *a.value);
+
+                if (result && removable(a)) {
+                    if (rewrite) {
+                        erase(a);
+                        load(instr, *result);
+                    }
+                    stack.push_back({result, {addr}});
+                } else {
+                    stack.push_back({result, {}});
+                }
+                break;
+            }
+
+            case OperationCode::JZ:
+            case OperationCode::JNZ: {
+                StackEntry cond = pop();
+                std::optional<bool> zero = cond.value ? IsZero(*cond.value) : std::nullopt;
+                if (!zero) break;
+
+                taken = instr.code == OperationCode::JZ ? *zero : !*zero;
+                if (rewrite && removable(cond)) {
+                    erase(cond);
+                    if (*taken) {
+                        instr.code = OperationCode::JMP;
+                    } else {
+                        instr.code = OperationCode::NOP;
+                        instr.arguments.clear();
                     }
-                    result = pa.value() / pb.value(); 
-                    break;
-                default: break;
+                }
+                break;
             }
 
-            size_t addr1 = a.addr;
-            size_t addr2 = b.addr;
-            size_t op_addr = i;
-
-            int const_idx = method_area_.RegisterConstant(
-                Constant{ConstantTag::I4, {
-                    uint8_t((result >> 24) & 0xFF),
-                    uint8_t((result >> 16) & 0xFF),
-                    uint8_t((result >> 8) & 0xFF),
-                    uint8_t(result & 0xFF)
-                }});
-
-            code_[addr1].code = OperationCode::LDC;
-            code_[addr1].arguments = {uint8_t((const_idx >> 8) & 0xFF), uint8_t(const_idx & 0xFF)};
-            
-            code_[addr2].code = OperationCode::NOP;
-            code_[addr2].arguments.clear();
-
-            code_[op_addr].code = OperationCode::NOP;
-            code_[op_addr].arguments.clear();
-
-            stack.push_back({result, addr1});
-            break;
+            default: {
+                auto [consumes, produces] = StackEffect(instr);
+                for (int c = 0; c < consumes; ++c) pop();
+                for (int p = 0; p < produces; ++p) stack.push_back({});
+                break;
+            }
+            }
         }
 
-        default:
-            stack.clear();
-            break;
+        return taken;
+    };
+
+    // Locals entering each block that an executable edge reaches; locals
+    // of the entry block are unknown
+    std::vector<std::optional<std::vector<Lattice>>> in(basic_blocks_.size());
+    in[0] = std::vector<Lattice>(locals);
+
+    std::vector<int> worklist{0};
+    while (!worklist.empty()) {
+        int id = worklist.back();
+        worklist.pop_back();
+        const BasicBlock& bb = basic_blocks_[id];
+
+        std::vector<Lattice> state = *in[id];
+        std::optional<bool> taken = simulate(bb, state, false);
+
+        const Operation& last = code_[bb.end - 1];
+        std::vector<int> successors;
+        if (IsConditionalJump(last) && taken) {
+            int next = BlockAt(*taken ? decodeJumpTarget(last) : bb.end);
+            if (next >= 0) successors.push_back(next);
+        } else {
+            successors = bb.succs;
+        }
+
+        for (int s : successors) {
+            if (!in[s]) {
+                in[s] = state;
+                worklist.push_back(s);
+                continue;
+            }
+
+            bool changed = false;
+            for (size_t l = 0; l < locals; ++l) {
+                Lattice& cur = (*in[s])[l];
+                if (cur && !(state[l] && *state[l] == *cur)) {
+                    cur.reset();
+                    changed = true;
+                }
+            }
+            if (changed) worklist.push_back(s);
         }
     }
 
+    for (const auto& bb : basic_blocks_) {
+        if (!in[bb.id]) continue;
+        std::vector<Lattice> state = *in[bb.id];
+        simulate(bb, state, true);
+    }
+    InvalidateAnalyses();
+
+    // decided branches leave blocks without predecessors
+    RemoveDeadCode();
     CompactCode();
 }
 
-void GenericJitOptimizer::DeadStackElimination() {
-    BuildControlFlowGraph();
-
-    const size_t N = code_.size();
-
-    std::vector<bool> produces(N, false);
-    std::vector<bool> used(N, false);
+const std::vector<bool>& GenericJitOptimizer::StackLiveness() {
+    if (liveness_) return *liveness_;
+    ControlFlowGraph();
 
+    std::vector<bool> used(code_.size(), false);
     std::vector<StackState> in_stack(basic_blocks_.size());
 
     bool changed = true;
@@ -277,26 +568,25 @@ void GenericJitOptimizer::DeadStackElimination() {
             if (!bb.preds.empty()) {
                 stack = in_stack[bb.preds[0]];
 
-                for (size_t p = 1; p < bb.preds.size(); ++p) {
-                    const auto& other = in_stack[bb.preds[p]];
-
-                    if (other.size() != stack.size()) {
-                        stack.clear();
-                        break;
-                    }
+                bool agree = true;
+                for (size_t p = 1; p < bb.preds.size() && agree; ++p) {
+                    agree = in_stack[bb.preds[p]] == stack;
+                }
 
-                    for (size_t i = 0; i < stack.size(); ++i) {
-                        if (stack[i].producer != other[i].producer) {
-                            stack.clear();
-                            break;
-                        }
+                // values flowing in from different producers are consumed
+                // by something this analysis no longer sees
+                if (!agree) {
+                    for (int p : bb.preds) {
+                        for (const auto& v : in_stack[p]) used[v.producer] = true;
                     }
+                    stack.clear();
                 }
             }
 
             StackState cur = stack;
 
-            for (size_t ip = bb.start; ip < bb.end; ++ip) {
+            for (int pc = bb.start; pc < bb.end; ++pc) {
+                size_t ip = static_cast<size_t>(pc);
                 const Operation& instr = code_[ip];
 
                 int consumes = StackConsumes(instr.code);
@@ -310,11 +600,8 @@ void GenericJitOptimizer::DeadStackElimination() {
                 }
 
                 int prod = StackProduces(instr.code);
-                if (prod > 0) {
-                    produces[ip] = true;
-                    for (int i = 0; i < prod; ++i) {
-                        cur.push_back(StackSlot{ip});
-                    }
+                for (int i = 0; i < prod; ++i) {
+                    cur.push_back(StackSlot{ip});
                 }
 
                 if (IsJump(instr) || IsReturn(instr) || instr.code == OperationCode::HALT) {
@@ -332,13 +619,29 @@ void GenericJitOptimizer::DeadStackElimination() {
         }
     }
 
-    for (size_t i = 0; i < N; ++i) {
-        if (produces[i] && !used[i] && !HasSideEffects(code_[i].code)) {
+    liveness_ = std::move(used);
+    return *liveness_;
+}
+
+void GenericJitOptimizer::DeadStackElimination() {
+    auto may_trap = [this](OperationCode op) {
+        return interpreter_semantics_ &&
+               (op == OperationCode::DIV || op == OperationCode::MOD || op == OperationCode::LDELEM);
+    };
+
+    const std::vector<bool>& used = StackLiveness();
+    bool changed = false;
+
+    for (size_t i = 0; i < code_.size(); ++i) {
+        OperationCode op = code_[i].code;
+        if (StackProduces(op) > 0 && !used[i] && !HasSideEffects(op) && !may_trap(op)) {
             code_[i].code = OperationCode::NOP;
             code_[i].arguments.clear();
+            changed = true;
         }
     }
 
+    if (changed) InvalidateAnalyses();
     CompactCode();
 }
 
@@ -352,6 +655,7 @@ void GenericJitOptimizer::RemoveRedundantJumps() {
             if (target == static_cast<int>(i + 1)) {
                 instr.code = OperationCode::NOP;
                 instr.arguments.clear();
+                InvalidateAnalyses();
             }
         }
     }
@@ -359,4 +663,177 @@ void GenericJitOptimizer::RemoveRedundantJumps() {
     CompactCode();
 }
 
+static std::string ConstantString(MethodArea& method_area, uint16_t index) {
+    const Constant& c = method_area.GetConstant(index);
+    return std::string(c.data.begin(), c.data.end());
+}
+
+bool GenericJitOptimizer::CanInline(const RuntimeFunction& callee) const {
+    const auto& body = callee.code;
+    if (body.empty()) return false;
+
+    bool small = body.size() <= kInlineSmallSize;
+    bool hot = body.size() <= kInlineHotSize && callee.call_count >= kInlineHotCalls;
+    if (!small && !hot) return false;
+
+    int argc = static_cast<int>(CountParams(ConstantString(method_area_, callee.params_descriptor_index)));
+    int returned = ConstantString(method_area_, callee.return_type_index) == "void;" ? 0 : 1;
+
+    // every path must reach RET with just the return value on the stack,
+    // anything below it would be left on the caller's operand stack
+    std::vector<int> depth(body.size(), -1);
+    std::vector<int> worklist{0};
+    depth[0] = argc;
+
+    while (!worklist.empty()) {
+        int pc = worklist.back();
+        worklist.pop_back();
+
+        const Operation& op = body[pc];
+        if (op.code == OperationCode::CALL || op.code == OperationCode::HALT) return false;
+
+        if (IsReturn(op)) {
+            if (depth[pc] != returned) return false;
+            continue;
+        }
+
+        if (depth[pc] < StackConsumes(op.code)) return false;
+        int out = depth[pc] - StackConsumes(op.code) + StackProduces(op.code);
+
+        std::vector<int> successors;
+        if (IsJump(op)) successors.push_back(decodeJumpTarget(op));
+        if (!IsUnconditionalJump(op)) successors.push_back(pc + 1);
+
+        for (int next : successors) {
+            if (next >= (int)body.size()) return false;
+            if (depth[next] < 0) {
+                depth[next] = out;
+                worklist.push_back(next);
+            } else if (depth[next] != out) {
+                return false;
+            }
+        }
+    }
+
+    return true;
+}
+
+std::vector<InlineSite> GenericJitOptimizer::FindInlineSites(uint16_t locals_count) const {
+    std::vector<InlineSite> sites;
+
+    size_t size = code_.size();
+    size_t region = 0;     // caller slots shared by all inlined bodies
+
+    for (int pc = 0; pc < (int)code_.size(); ++pc) {
+        if (code_[pc].code != OperationCode::CALL) continue;
+
+        const RuntimeFunction* callee = method_area_.GetFunction(decodeJumpTarget(code_[pc]));
+        if (!callee || callee->code_pending || !CanInline(*callee)) continue;
+
+        size_t argc = CountParams(ConstantString(method_area_, callee->params_descriptor_index));
+        size_t temps = argc > 2 ? argc : 0;
+        size_t shuffle = argc > 2 ? 2 * argc : (argc == 2 ? 1 : 0);
+        size_t grown = size - 1 + shuffle + 2 * callee->locals_count + callee->code.size();
+        if (grown > kInlineMaxCodeSize) continue;
+
+        size = grown;
+        region = std::max(region, callee->locals_count + temps);
+        sites.push_back({pc, callee, argc});
+    }
+
+    if (locals_count + region > UINT16_MAX) return {};
+    return sites;
+}
+
+size_t GenericJitOptimizer::InlineCalls(uint16_t& locals_count) {
+    std::vector<InlineSite> sites = FindInlineSites(locals_count);
+    if (sites.empty()) return 0;
+
+    size_t size = code_.size();
+    size_t region = 0;
+    for (const InlineSite& site : sites) {
+        size_t temps = site.argc > 2 ? site.argc : 0;
+        size += 2 * site.argc + 2 * site.callee->locals_count + site.callee->code.size();
+        region = std::max(region, site.callee->locals_count + temps);
+    }
+
+    uint16_t base = locals_count;
+    uint16_t zero = InternConstant(Constant{ConstantTag::I4, {0, 0, 0, 0}});
+
+    auto withU2 = [](OperationCode code, uint32_t value) {
+        return Operation{code, {uint8_t((value >> 8) & 0xFF), uint8_t(value & 0xFF)}};
+    };
+
+    std::vector<Operation> out;
+    out.reserve(size);
+    std::vector<int> new_pc(code_.size() + 1, 0);
+    std::vector<size_t> caller_jumps;
+
+    size_t next_site = 0;
+    for (int pc = 0; pc < (int)code_.size(); ++pc) {
+        new_pc[pc] = out.size();
+
+        if (next_site == sites.size() || sites[next_site].pc != pc) {
+            if (IsJump(code_[pc])) caller_jumps.push_back(out.size());
+            out.push_back(code_[pc]);
+            continue;
+        }
+
+        const InlineSite& site = sites[next_site++];
+        const RuntimeFunction& callee = *site.callee;
+
+        // the callee sees its last parameter at the bottom of the stack
+        if (site.argc == 2) {
+            out.push_back(Operation{OperationCode::SWAP, {}});
+        } else if (site.argc > 2) {
+            for (size_t k = site.argc; k-- > 0;) {
+                out.push_back(withU2(OperationCode::STORE, base + callee.locals_count + k));
+            }
+            for (size_t k = site.argc; k-- > 0;) {
+                out.push_back(withU2(OperationCode::LDV, base + callee.locals_count + k));
+            }
+        }
+
+        // a fresh frame starts with zeroed locals
+        for (uint16_t j = 0; j < callee.locals_count; ++j) {
+            out.push_back(withU2(OperationCode::LDC, zero));
+            out.push_back(withU2(OperationCode::STORE, base + j));
+        }
+
+        size_t body_start = out.size();
+        size_t continuation = body_start + callee.code.size();
+        for (const Operation& op : callee.code) {
+            Operation copy = op;
+            if (op.code == OperationCode::LDV || op.code == OperationCode::STORE) {
+                copy = withU2(op.code, base + decodeJumpTarget(op));
+            } else if (IsJump(op)) {
+                encodeJumpTarget(copy, body_start + decodeJumpTarget(op));
+            } else if (IsReturn(op)) {
+                copy = withU2(OperationCode::JMP, continuation);
+            }
+            out.push_back(copy);
+        }
+    }
+    new_pc[code_.size()] = out.size();
+
+    for (size_t j : caller_jumps) {
+        encodeJumpTarget(out[j], new_pc[decodeJumpTarget(out[j])]);
+    }
+
+    code_ = std::move(out);
+    InvalidateAnalyses();
+    locals_count = static_cast<uint16_t>(base + region);
+    return sites.size();
+}
+
+LoopAnalysis GenericJitOptimizer::FindLoops() const {
+    std::vector<std::vector<int>> succs;
+    succs.reserve(basic_blocks_.size());
+    for (const auto& bb : basic_blocks_) {
+        succs.push_back(bb.succs);
+    }
+
+    return LoopAnalysis(succs, 0);
+}
+
 }  // namespace czffvm_jit
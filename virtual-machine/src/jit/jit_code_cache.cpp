@@ -0,0 +1,178 @@
+#include <memory>
+#include <unordered_map>
+
+#include "jit/jit_code_cache.hpp"
+#include "class_loader.hpp"
+#include "mapped_file.hpp"
+
+namespace czffvm_jit {
+
+using namespace czffvm;
+
+static uint64_t Mix(uint64_t h, uint64_t value) {
+    uint8_t word[8];
+    for (int i = 0; i < 8; ++i) word[i] = uint8_t(value >> (8 * i));
+    return HashBytes(word, sizeof(word), h);
+}
+
+static uint64_t MixConstant(uint64_t h, const Constant& c) {
+    h = Mix(h, static_cast<uint8_t>(c.tag));
+    h = Mix(h, c.data.size());
+    return HashBytes(c.data.data(), c.data.size(), h);
+}
+
+JitCodeCache::JitCodeCache(std::string directory, uint64_t target)
+    : files_(std::move(directory), ".jit"), target_(target) {}
+
+uint64_t JitCodeCache::Key(const RuntimeFunction& function, MethodArea& method_area) const {
+    uint64_t h = Mix(Mix(HashBytes(nullptr, 0), kJitCacheVersion), target_);
+
+    // callees are numbered in the order they are reached, so recursion
+    // hashes to a back reference instead of looping
+    std::vector<const RuntimeFunction*> order{&function};
+    std::unordered_map<const RuntimeFunction*, uint32_t> number{{&function, 0}};
+
+    for (size_t next = 0; next < order.size(); ++next) {
+        const RuntimeFunction& fn = *order[next];
+        h = MixConstant(h, method_area.GetConstant(fn.params_descriptor_index));
+        h = MixConstant(h, method_area.GetConstant(fn.return_type_index));
+        h = Mix(h, fn.locals_count);
+        h = Mix(h, fn.code.size());
+
+        for (const Operation& op : fn.code) {
+            h = Mix(h, static_cast<uint16_t>(op.code));
+            uint16_t arg = op.arguments.size() >= 2 ? (op.arguments[0] << 8) | op.arguments[1] : 0;
+
+            if (op.code == OperationCode::LDC || op.code == OperationCode::NEWARR) {
+                h = MixConstant(h, method_area.GetConstant(arg));
+            } else if (op.code == OperationCode::CALL && arg < method_area.Functions().size()) {
+                RuntimeFunction* callee = method_area.GetFunction(arg);
+                method_area.EnsureCode(*callee);
+                auto [it, added] = number.emplace(callee, static_cast<uint32_t>(order.size()));
+                if (added) order.push_back(callee);
+                h = Mix(h, it->second);
+            } else {
+                h = Mix(h, op.arguments.size());
+                h = HashBytes(op.arguments.data(), op.arguments.size(), h);
+            }
+        }
+    }
+
+    return h;
+}
+
+std::optional<CachedCode> JitCodeCache::Load(uint64_t key) const {
+    std::unique_ptr<MappedFile> mapping;
+    try {
+        mapping = std::make_unique<MappedFile>(files_.PathFor(key));
+    } catch (const std::runtime_error&) {
+        return std::nullopt;
+    }
+
+    CachedCode cached;
+    try {
+        ByteReader r(mapping->Data(), mapping->Size());
+        if (r.ReadU4() != kJitCacheMagicNumber || r.ReadU1() != kJitCacheVersion) {
+            return std::nullopt;
+        }
+        r.ReadBytes(3); // reserved
+        uint64_t saved = uint64_t(r.ReadU4()) << 32;
+        saved |= r.ReadU4();
+        if (saved != key) {
+            return std::nullopt;
+        }
+
+        cached.argument_count = r.ReadU4();
+        cached.locals_count = r.ReadU2();
+
+        uint32_t size = r.ReadU4();
+        const uint8_t* code = r.ReadBytes(size);
+        cached.code.assign(code, code + size);
+
+        cached.constants.resize(r.ReadU2());
+        for (Constant& c : cached.constants) {
+            c.tag = static_cast<ConstantTag>(r.ReadU1());
+            uint32_t length = r.ReadU4();
+            const uint8_t* bytes = r.ReadBytes(length);
+            c.data.assign(bytes, bytes + length);
+        }
+
+        uint32_t patches = r.ReadU4();
+        for (uint32_t i = 0; i < patches; ++i) {
+            CodePatch p;
+            p.offset = r.ReadU4();
+            p.width = r.ReadU1();
+            p.kind = static_cast<CodePatchKind>(r.ReadU1());
+            p.index = r.ReadU2();
+            p.bias = r.ReadU4();
+            if ((p.width != 4 && p.width != 8) || p.offset > cached.code.size() ||
+                p.width > cached.code.size() - p.offset) {
+                return std::nullopt;
+            }
+            if (p.kind == CodePatchKind::CONSTANT ? p.index >= cached.constants.size()
+                                                  : p.kind != CodePatchKind::HELPER) {
+                return std::nullopt;
+            }
+            cached.patches.push_back(p);
+        }
+
+        uint32_t maps = r.ReadU4();
+        for (uint32_t i = 0; i < maps; ++i) {
+            uint32_t words = r.ReadU4();
+            if (words > r.Remaining() / 4) {
+                return std::nullopt;
+            }
+            StackMap& map = cached.stack_maps.emplace_back(words);
+            for (uint32_t& word : map) word = r.ReadU4();
+        }
+
+        if (!r.Eof()) {
+            return std::nullopt;
+        }
+    } catch (const std::exception&) {
+        return std::nullopt;
+    }
+
+    return cached;
+}
+
+void JitCodeCache::Store(uint64_t key, const CachedCode& cached) const {
+    ByteWriter w;
+    w.WriteU4(kJitCacheMagicNumber);
+    w.WriteU1(kJitCacheVersion);
+    w.WriteU1(0); w.WriteU1(0); w.WriteU1(0); // reserved
+    w.WriteU4(uint32_t(key >> 32));
+    w.WriteU4(uint32_t(key));
+
+    w.WriteU4(cached.argument_count);
+    w.WriteU2(cached.locals_count);
+
+    w.WriteU4(static_cast<uint32_t>(cached.code.size()));
+    w.WriteBytes(cached.code.data(), cached.code.size());
+
+    w.WriteU2(static_cast<uint16_t>(cached.constants.size()));
+    for (const Constant& c : cached.constants) {
+        w.WriteU1(static_cast<uint8_t>(c.tag));
+        w.WriteU4(static_cast<uint32_t>(c.data.size()));
+        w.WriteBytes(c.data.data(), c.data.size());
+    }
+
+    w.WriteU4(static_cast<uint32_t>(cached.patches.size()));
+    for (const CodePatch& p : cached.patches) {
+        w.WriteU4(p.offset);
+        w.WriteU1(p.width);
+        w.WriteU1(static_cast<uint8_t>(p.kind));
+        w.WriteU2(p.index);
+        w.WriteU4(p.bias);
+    }
+
+    w.WriteU4(static_cast<uint32_t>(cached.stack_maps.size()));
+    for (const StackMap& map : cached.stack_maps) {
+        w.WriteU4(static_cast<uint32_t>(map.size()));
+        for (uint32_t word : map) w.WriteU4(word);
+    }
+
+    files_.Store(key, w.Data());
+}
+
+}  // namespace czffvm_jit
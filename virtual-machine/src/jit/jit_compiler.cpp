@@ -1,4 +1,7 @@
+#include <algorithm>
+
 #include "jit/jit_compiler.hpp"
+#include "jit/generic_jit_optimizer.hpp"
 #include "jit/jit_x86_64.hpp"
 #include "jit/jit_dummy.hpp"
 
@@ -13,4 +16,46 @@ std::unique_ptr<JitCompiler> JitCompiler::create() {
     return nullptr;
 }
 
+// Jump targets are not checked by the loader. Inlined callees need no
+// check, CanInline already refuses bodies that jump out of themselves.
+static bool JumpsStayInside(const std::vector<czffvm::Operation>& code) {
+    for (const auto& op : code) {
+        if (!IsJump(op)) continue;
+        if (op.arguments.size() < 2 || size_t((op.arguments[0] << 8) | op.arguments[1]) >= code.size()) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool JitCompiler::CanCompileFunction(const czffvm::RuntimeFunction& function,
+                                     czffvm::MethodArea& method_area) {
+    std::vector<czffvm::Operation> code = function.code;
+    if (!JumpsStayInside(code)) {
+        return false;
+    }
+
+    std::vector<InlineSite> sites = GenericJitOptimizer(code, method_area).FindInlineSites(function.locals_count);
+
+    // an inlined CALL is replaced by the callee's body and stack shuffling
+    // the backend always compiles
+    size_t next_site = 0;
+    for (int pc = 0; pc < (int)code.size(); ++pc) {
+        if (next_site < sites.size() && sites[next_site].pc == pc) {
+            for (const auto& op : sites[next_site++].callee->code) {
+                if (!CanCompile(op)) {
+                    return false;
+                }
+            }
+            continue;
+        }
+
+        if (!CanCompile(code[pc])) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
 } // namespace czffvm_jit
\ No newline at end of file
@@ -0,0 +1,68 @@
+#include <ostream>
+
+#include "jit/jit_compiler.hpp"
+#include "jit/jit_pass_manager.hpp"
+
+namespace czffvm_jit {
+
+JitPassManager::JitPassManager(GenericJitOptimizer& optimizer)
+    : optimizer_(optimizer) {}
+
+void JitPassManager::Add(std::string name, Pass pass) {
+    passes_.emplace_back(std::move(name), std::move(pass));
+}
+
+void JitPassManager::AddCleanupPasses() {
+    Add("dead-code", [](GenericJitOptimizer& o) {
+        o.RemoveDeadCode();
+        o.CompactCode();
+    });
+    Add("constant-folding", [](GenericJitOptimizer& o) { o.ConstantFolding(); });
+    Add("dead-stack", [](GenericJitOptimizer& o) { o.DeadStackElimination(); });
+    Add("redundant-jumps", [](GenericJitOptimizer& o) { o.RemoveRedundantJumps(); });
+}
+
+void JitPassManager::Run() {
+    reports_.clear();
+    reports_.reserve(passes_.size());
+
+    for (auto& [name, pass] : passes_) {
+        size_t before = optimizer_.Code().size();
+        auto start = std::chrono::steady_clock::now();
+
+        pass(optimizer_);
+
+        auto time = std::chrono::steady_clock::now() - start;
+        reports_.push_back(PassReport{
+            name,
+            std::chrono::duration_cast<std::chrono::nanoseconds>(time),
+            before,
+            optimizer_.Code().size()
+        });
+    }
+}
+
+const std::vector<PassReport>& JitPassManager::Reports() const {
+    return reports_;
+}
+
+void JitPassManager::PrintReports(std::ostream& out) const {
+    for (const auto& r : reports_) {
+        out << "[JIT] " << r.name << ": " << r.size_before << " -> " << r.size_after
+            << " operations, " << std::chrono::duration_cast<std::chrono::microseconds>(r.time).count()
+            << " us" << std::endl;
+    }
+}
+
+void OptimizeBytecode(czffvm::RuntimeFunction& function, czffvm::MethodArea& method_area) {
+    if (function.code.empty()) return;
+
+    GenericJitOptimizer optimizer(function.code, method_area);
+    optimizer.SetInterpreterSemantics(true);
+
+    JitPassManager passes(optimizer);
+    passes.AddCleanupPasses();
+    passes.Run();
+}
+
+}  // namespace czffvm_jit
@@ -0,0 +1,216 @@
+#include <algorithm>
+
+#include "jit/jit_stack_maps.hpp"
+
+namespace czffvm_jit {
+
+using namespace czffvm;
+
+static uint16_t DecodeU2(const Operation& op) {
+    return (op.arguments[0] << 8) | op.arguments[1];
+}
+
+static std::string ConstantString(MethodArea& method_area, uint16_t index) {
+    const Constant& c = method_area.GetConstant(index);
+    return std::string(c.data.begin(), c.data.end());
+}
+
+StackMapBuilder::StackMapBuilder(const std::vector<Operation>& code,
+                                 const RuntimeFunction& function,
+                                 uint16_t locals_count,
+                                 MethodArea& method_area)
+    : code_(code), function_(function), locals_count_(locals_count), method_area_(method_area) {}
+
+std::vector<StackMap> StackMapBuilder::Build(uint32_t operand_base) {
+    std::vector<State> states(code_.size());
+    std::vector<size_t> worklist;
+
+    if (!code_.empty()) {
+        states[0] = EntryState();
+        worklist.push_back(0);
+    }
+
+    while (!worklist.empty()) {
+        size_t pc = worklist.back();
+        worklist.pop_back();
+
+        State out = states[pc];
+        Transfer(code_[pc], out);
+
+        std::vector<size_t> successors;
+        switch (code_[pc].code) {
+            case OperationCode::JMP:
+                successors.push_back(DecodeU2(code_[pc]));
+                break;
+            case OperationCode::JZ:
+            case OperationCode::JNZ:
+                successors.push_back(DecodeU2(code_[pc]));
+                successors.push_back(pc + 1);
+                break;
+            case OperationCode::RET:
+                break;
+            default:
+                successors.push_back(pc + 1);
+                break;
+        }
+
+        for (size_t next : successors) {
+            if (next < code_.size() && Merge(states[next], out)) {
+                worklist.push_back(next);
+            }
+        }
+    }
+
+    std::vector<StackMap> maps;
+    for (size_t pc = 0; pc < code_.size(); ++pc) {
+        if (code_[pc].code != OperationCode::NEWARR) continue;
+
+        StackMap map;
+        const State& s = states[pc];
+        for (size_t i = 0; i < s.locals.size(); ++i) {
+            if (s.locals[i] != Slot::INT) map.push_back(static_cast<uint32_t>(i));
+        }
+        // the array size is already popped when the helper runs
+        size_t depth = s.stack.empty() ? 0 : s.stack.size() - 1;
+        for (size_t k = 0; k < depth; ++k) {
+            if (s.stack[k] != Slot::INT) map.push_back(operand_base + static_cast<uint32_t>(k));
+        }
+        maps.push_back(std::move(map));
+    }
+
+    return maps;
+}
+
+// Arguments are on the operand stack, the last parameter at the bottom
+StackMapBuilder::State StackMapBuilder::EntryState() {
+    State s;
+    s.reached = true;
+    s.locals.assign(locals_count_, Slot::INT);
+
+    std::string params = ConstantString(method_area_, function_.params_descriptor_index);
+    std::vector<Slot> slots;
+    size_t i = 0;
+    while (i < params.size()) {
+        size_t depth = 0;
+        while (i < params.size() && params[i] == '[') {
+            depth++;
+            i++;
+        }
+
+        size_t end = params.find(';', i);
+        i = end == std::string::npos ? params.size() : end + 1;
+
+        if (depth == 0)      slots.push_back(Slot::INT);
+        else if (depth == 1) slots.push_back(Slot::REF);
+        else                 slots.push_back(Slot::REF_OF_REFS);
+    }
+
+    s.stack.assign(slots.rbegin(), slots.rend());
+    return s;
+}
+
+StackMapBuilder::Slot StackMapBuilder::ArrayOf(const std::string& element) const {
+    return !element.empty() && element[0] == '[' ? Slot::REF_OF_REFS : Slot::REF;
+}
+
+bool StackMapBuilder::Merge(State& into, const State& from) const {
+    if (!into.reached) {
+        into = from;
+        return true;
+    }
+
+    bool changed = false;
+    auto join = [&](std::vector<Slot>& a, const std::vector<Slot>& b) {
+        for (size_t i = 0; i < std::min(a.size(), b.size()); ++i) {
+            if (b[i] > a[i]) {
+                a[i] = b[i];
+                changed = true;
+            }
+        }
+    };
+    join(into.locals, from.locals);
+    join(into.stack, from.stack);
+
+    return changed;
+}
+
+void StackMapBuilder::Transfer(const Operation& op, State& s) const {
+    auto pop = [&]() {
+        if (s.stack.empty()) return Slot::INT;
+        Slot top = s.stack.back();
+        s.stack.pop_back();
+        return top;
+    };
+
+    switch (op.code) {
+        case OperationCode::NOP:
+        case OperationCode::JMP:
+            break;
+
+        case OperationCode::LDC:
+            s.stack.push_back(Slot::INT);
+            break;
+
+        case OperationCode::LDV: {
+            uint16_t local = DecodeU2(op);
+            s.stack.push_back(local < s.locals.size() ? s.locals[local] : Slot::INT);
+            break;
+        }
+
+        case OperationCode::STORE: {
+            uint16_t local = DecodeU2(op);
+            Slot v = pop();
+            if (local < s.locals.size()) s.locals[local] = v;
+            break;
+        }
+
+        case OperationCode::DUP:
+            s.stack.push_back(s.stack.empty() ? Slot::INT : s.stack.back());
+            break;
+
+        case OperationCode::SWAP:
+            if (s.stack.size() >= 2) {
+                std::swap(s.stack[s.stack.size() - 1], s.stack[s.stack.size() - 2]);
+            }
+            break;
+
+        case OperationCode::NEWARR:
+            pop();
+            s.stack.push_back(ArrayOf(ConstantString(method_area_, DecodeU2(op))));
+            break;
+
+        case OperationCode::LDELEM: {
+            pop();
+            Slot array = pop();
+            s.stack.push_back(array == Slot::REF_OF_REFS ? Slot::REF_OF_REFS : Slot::INT);
+            break;
+        }
+
+        case OperationCode::STELEM:
+            pop();
+            pop();
+            pop();
+            break;
+
+        case OperationCode::NEG:
+            pop();
+            s.stack.push_back(Slot::INT);
+            break;
+
+        case OperationCode::JZ:
+        case OperationCode::JNZ:
+        case OperationCode::PRINT:
+        case OperationCode::RET:
+            pop();
+            break;
+
+        default:
+            // binary arithmetic, comparison and logical operations
+            pop();
+            pop();
+            s.stack.push_back(Slot::INT);
+            break;
+    }
+}
+
+}  // namespace czffvm_jit
@@ -6,12 +6,67 @@
 
 #include "common.hpp"
 #include "jit/generic_jit_optimizer.hpp"
+#include "jit/jit_pass_manager.hpp"
+#include "jit/jit_stack_maps.hpp"
+#include "jit/ssa_ir.hpp"
 #include "jit/jit_x86_64.hpp"
 
 namespace czffvm_jit {
 
 using namespace czffvm;
 
+// Runtime helpers called from compiled code, numbered for CodePatch::index
+enum class Helper : uint16_t {
+    NEW_ARRAY,
+    STORE_ELEM,
+    STORE_ELEM_IN_BOUNDS,
+    LOAD_ELEM,
+    LOAD_ELEM_IN_BOUNDS,
+    PRINT,
+    COUNT,
+};
+
+static uint64_t HelperAddress(Helper helper) {
+    switch (helper) {
+        case Helper::NEW_ARRAY:            return (uint64_t)&JIT_NewArray;
+        case Helper::STORE_ELEM:           return (uint64_t)&JIT_StoreElem_I4;
+        case Helper::STORE_ELEM_IN_BOUNDS: return (uint64_t)&JIT_StoreElem_I4_InBounds;
+        case Helper::LOAD_ELEM:            return (uint64_t)&JIT_LoadElem;
+        case Helper::LOAD_ELEM_IN_BOUNDS:  return (uint64_t)&JIT_LoadElem_InBounds;
+        case Helper::PRINT:                return (uint64_t)&JIT_Print;
+        default:                           return 0;
+    }
+}
+
+// rax = address of the helper. asmjit picks the shortest encoding of the
+// move, so the address is either the last 8 or the last 4 bytes of it.
+static void MoveHelper(asmjit::x86::Assembler& a, Helper helper, CachedCode& cached) {
+    size_t start = a.offset();
+    a.mov(asmjit::x86::rax, HelperAddress(helper));
+    size_t end = a.offset();
+
+    uint8_t width = end - start >= 10 ? 8 : 4;
+    cached.patches.push_back({static_cast<uint32_t>(end - width), width, CodePatchKind::HELPER,
+                              static_cast<uint16_t>(helper), 0});
+}
+
+// dst = constant pool index | bias, always a mov r32, imm32
+static void MoveConstantIndex(asmjit::x86::Assembler& a, asmjit::x86::Gp dst, uint16_t idx, uint32_t bias,
+                              czffvm::RuntimeDataArea& rda, CachedCode& cached) {
+    a.mov(dst, (int32_t)(idx | bias));
+
+    cached.patches.push_back({static_cast<uint32_t>(a.offset() - 4), 4, CodePatchKind::CONSTANT,
+                              static_cast<uint16_t>(cached.constants.size()), bias});
+    cached.constants.push_back(rda.GetMethodArea().GetConstant(idx));
+}
+
+// The code only uses baseline x86-64, but the features still name the
+// target a cache entry was compiled for
+static uint64_t HostTarget() {
+    const asmjit::CpuFeatures& features = asmjit::CpuInfo::host().features();
+    return HashBytes(reinterpret_cast<const uint8_t*>(&features), sizeof(features));
+}
+
 X86JitCompiler::X86JitCompiler()
     : runtime(std::make_shared<asmjit::JitRuntime>()) {
 
@@ -40,21 +95,45 @@ std::unique_ptr<CompiledRuntimeFunction> X86JitCompiler::CompileFunction(const c
 
     std::vector<czffvm::Operation> func_code = function.code;
 
+    // the key covers the bytecode as it is now, before any rewriting
+    uint64_t cache_key = code_cache_ ? code_cache_->Key(function, rda.GetMethodArea()) : 0;
+    CachedCode cached;
+
+    uint16_t locals_count = function.locals_count;
+    std::vector<bool> in_bounds;     // per pc, no bounds check needed
+
     GenericJitOptimizer optimizer(func_code, rda.GetMethodArea());
 
-    optimizer.BuildControlFlowGraph();
-    optimizer.MarkReachableBlocks();
-    optimizer.RemoveDeadCode();
-    optimizer.CompactCode();
-    optimizer.ConstantFolding();
-    optimizer.DeadStackElimination();
-    optimizer.RemoveRedundantJumps();
-    optimizer.CompactCode();
+    JitPassManager passes(optimizer);
+    passes.Add("inline", [&](GenericJitOptimizer& o) { o.InlineCalls(locals_count); });
+    passes.AddCleanupPasses();
+    passes.Run();
+
+#ifdef DEBUG_BUILD
+    passes.PrintReports(std::cout);
+#endif
+
+    // round trip through SSA: drops LDV/STORE/DUP/SWAP shuffling and dead
+    // values, moves invariant work out of loops
+    if (auto ssa = SsaBuilder(func_code, function, locals_count, rda.GetMethodArea()).Build()) {
+        ssa->HoistLoopInvariants();
+        ssa->ReduceInductionVariables();
+        ssa->EliminateBoundsChecks(rda.GetMethodArea());
+        ssa->EliminateDeadValues();
+        LoweredFunction lowered = ssa->Lower();
+        func_code = std::move(lowered.code);
+        locals_count = lowered.locals_count;
+        in_bounds = std::move(lowered.in_bounds);
+    }
 
 #ifdef DEBUG_BUILD
     std::cout << "[JIT] Optimized to " << func_code.size() << " operations" << std::endl;
 #endif
 
+    uint32_t operand_base = ((locals_count * 4) + 15) / 16 * 4;
+    std::vector<StackMap> stack_maps =
+        StackMapBuilder(func_code, function, locals_count, rda.GetMethodArea()).Build(operand_base);
+
     asmjit::CodeHolder code;
     auto err = code.init(runtime->environment());
     if (err != asmjit::kErrorOk) {
@@ -96,19 +175,35 @@ std::unique_ptr<CompiledRuntimeFunction> X86JitCompiler::CompileFunction(const c
     a.sub(asmjit::x86::rsp, 40); // shadow space for windows x64
 
     a.mov(stackBase, asmjit::x86::rcx);
-    a.lea(stackPtr, ptr(stackBase, ((function.locals_count * 4) + 15) / 16 * 16 + argc * 4));
+    a.lea(stackPtr, ptr(stackBase, ((locals_count * 4) + 15) / 16 * 16 + argc * 4));
     a.mov(heapPtr, asmjit::x86::rdx);
 
     std::vector<asmjit::v1_21::Label> labels(func_code.size());
     for (auto& l : labels)
         l = a.new_label();
+    asmjit::v1_21::Label epilogue = a.new_label();
+    uint32_t next_safepoint = 0;
     
 #ifdef DEBUG_BUILD
     std::cout << "[JIT] Compiling operations..." << std::endl;
 #endif
 
-    size_t ip = 0;
+    // the loader does not check jump targets, so a malformed one is refused
+    // here instead of indexing past the labels
+    std::vector<bool> jump_targets(func_code.size() + 1, false);
     for (const auto& op : func_code) {
+        if (IsJump(op)) {
+            uint16_t target = (op.arguments[0] << 8) | op.arguments[1];
+            if (target >= func_code.size()) {
+                std::cerr << "[JIT] ERROR: Jump target " << target << " is out of the function" << std::endl;
+                return nullptr;
+            }
+            jump_targets[target] = true;
+        }
+    }
+
+    for (size_t ip = 0; ip < func_code.size(); ++ip) {
+        const auto& op = func_code[ip];
 #ifdef DEBUG_BUILD
         std::cout << "[JIT-OP] Code: 0x" << std::hex << (uint16_t)op.code << std::dec 
                   << ", args: " << op.arguments.size() << " - ";
@@ -119,10 +214,17 @@ std::unique_ptr<CompiledRuntimeFunction> X86JitCompiler::CompileFunction(const c
 #endif
 
         a.bind(labels[ip]);
-        CompileOperation(a, stackPtr, stackBase, heapPtr, op, labels, rda);
-        ip += 1;
+        if (ip + 1 < func_code.size() && !jump_targets[ip + 1] &&
+            CompilePowerOfTwo(a, stackPtr, op, func_code[ip + 1], rda)) {
+            a.bind(labels[ip + 1]);
+            ip++;
+            continue;
+        }
+        CompileOperation(a, stackPtr, stackBase, heapPtr, op, labels, epilogue, next_safepoint,
+                         ip < in_bounds.size() && in_bounds[ip], rda, cached);
     }
 
+    a.bind(epilogue);
     a.mov(asmjit::x86::eax, 0);
     
     // epilogue
@@ -148,14 +250,98 @@ std::unique_ptr<CompiledRuntimeFunction> X86JitCompiler::CompileFunction(const c
     std::cout << "[JIT] Code size: " << code.code_size() << " bytes" << std::endl;
 #endif
 
+    // every absolute value in the code is in the patch list, and jumps are
+    // relative, so the bytes can run at any address once patched
+    if (code_cache_ && cached.constants.size() <= UINT16_MAX) {
+        const uint8_t* bytes = static_cast<const uint8_t*>(funcPtr);
+        cached.code.assign(bytes, bytes + code.code_size());
+        cached.argument_count = static_cast<uint32_t>(argc);
+        cached.locals_count = locals_count;
+        cached.stack_maps = stack_maps;
+
+        // a cache that cannot be written only costs the next run its speed
+        try {
+            code_cache_->Store(cache_key, cached);
+        } catch (const std::runtime_error& e) {
+            std::cerr << "Warning: " << e.what() << std::endl;
+        }
+    }
+
     return std::make_unique<X86CompiledRuntimeFunction>(
         funcPtr,
         code.code_size(),
         runtime,
-        argc
+        argc,
+        locals_count,
+        std::move(stack_maps)
     );
 }
 
+bool X86JitCompiler::CompilePowerOfTwo(
+    asmjit::x86::Assembler& a,
+    asmjit::x86::Gp& stackPtr,
+    const Operation& ldc,
+    const Operation& op,
+    czffvm::RuntimeDataArea& rda
+) {
+    using namespace asmjit::x86;
+
+    if (ldc.code != OperationCode::LDC || ldc.arguments.empty()) return false;
+    if (op.code != OperationCode::MUL && op.code != OperationCode::DIV && op.code != OperationCode::MOD) {
+        return false;
+    }
+
+    uint16_t idx = (ldc.arguments[0] << 8) | ldc.arguments[1];
+    const Constant& c = rda.GetMethodArea().GetConstant(idx);
+    if (c.tag == ConstantTag::STRING || c.tag == ConstantTag::BOOL) return false;
+
+    std::optional<int32_t> constant = SafeValueToInteger<int32_t>(ConstantToValue(c));
+    if (!constant) return false;
+    int32_t value = *constant;
+    if (value <= 0 || (value & (value - 1)) != 0) return false;
+
+    uint32_t k = 0;
+    while ((1 << k) != value) k++;
+
+    // the other operand is on top of the stack and the result replaces it
+    switch (op.code) {
+        case OperationCode::MUL:
+            if (k > 0) a.shl(dword_ptr(stackPtr, -4), k);
+            break;
+
+        case OperationCode::DIV:
+            // idiv rounds toward zero: add 2^k - 1 to negative dividends
+            if (k > 0) {
+                a.mov(eax, dword_ptr(stackPtr, -4));
+                a.mov(edx, eax);
+                a.sar(edx, 31);
+                a.shr(edx, 32 - k);
+                a.add(eax, edx);
+                a.sar(eax, k);
+                a.mov(dword_ptr(stackPtr, -4), eax);
+            }
+            break;
+
+        default:
+            // the remainder keeps the sign of the dividend
+            if (k == 0) {
+                a.mov(dword_ptr(stackPtr, -4), 0);
+            } else {
+                a.mov(eax, dword_ptr(stackPtr, -4));
+                a.mov(edx, eax);
+                a.sar(edx, 31);
+                a.shr(edx, 32 - k);
+                a.add(edx, eax);
+                a.and_(edx, -value);
+                a.sub(eax, edx);
+                a.mov(dword_ptr(stackPtr, -4), eax);
+            }
+            break;
+    }
+
+    return true;
+}
+
 void X86JitCompiler::CompileOperation(
     asmjit::x86::Assembler& a, 
     asmjit::x86::Gp& stackPtr, 
@@ -163,7 +349,11 @@ void X86JitCompiler::CompileOperation(
     asmjit::x86::Gp heapPtr, 
     const Operation& op,
     const std::vector<asmjit::v1_21::Label>& labels,
-    czffvm::RuntimeDataArea& rda
+    asmjit::v1_21::Label epilogue,
+    uint32_t& next_safepoint,
+    bool in_bounds,
+    czffvm::RuntimeDataArea& rda,
+    CachedCode& cached
 ) {
     using namespace asmjit::x86;
 
@@ -184,7 +374,7 @@ void X86JitCompiler::CompileOperation(
                 const Constant& c = rda.GetMethodArea().GetConstant(idx);
 
                 if (c.tag == ConstantTag::STRING) {
-                    a.mov(eax, (int32_t)(idx | 0xbf600000));
+                    MoveConstantIndex(a, eax, idx, 0xbf600000, rda, cached);
                 } else {
                     a.mov(eax, ValueToInteger<int32_t>(ConstantToValue(c)));
                 }
@@ -262,6 +452,7 @@ void X86JitCompiler::CompileOperation(
             pop32(eax);                       // pop result
             a.mov(stackPtr, stackBase);       // reset stackPtr to stackBase
             a.mov(dword_ptr(stackBase), eax); // store result at stack[0]
+            a.jmp(epilogue);                  // stack maps assume RET ends the frame
             break;
         }
         case OperationCode::NEWARR: {
@@ -269,11 +460,12 @@ void X86JitCompiler::CompileOperation(
 
             // ─── pop size (uint32) ─────────────
             pop32(edx);                        // EDX = size
-            a.mov(r8d, type_idx);              // R8D = type_idx
+            MoveConstantIndex(a, r8d, type_idx, 0, rda, cached); // R8D = type_idx
+            a.mov(r9d, next_safepoint++);      // R9D = stack map of this call
 
             // ─── call helper ──────────────────
             a.mov(rcx, heapPtr);               // RCX = heap
-            a.mov(rax, (uint64_t)&JIT_NewArray);
+            MoveHelper(a, Helper::NEW_ARRAY, cached);
             a.call(rax);                       // EAX = heapRef.id
 
             // ─── push heapRef.id onto VM stack ─
@@ -290,7 +482,7 @@ void X86JitCompiler::CompileOperation(
             a.mov(rcx, heapPtr);
 
             // ─── call helper ───────────────────────────
-            a.mov(rax, (uint64_t)&JIT_StoreElem_I4);
+            MoveHelper(a, in_bounds ? Helper::STORE_ELEM_IN_BOUNDS : Helper::STORE_ELEM, cached);
             a.call(rax);
             break;
         }
@@ -300,7 +492,7 @@ void X86JitCompiler::CompileOperation(
 
             // ─── call helper ───────────────────
             a.mov(rcx, heapPtr);                // RCX = heap
-            a.mov(rax, (uint64_t)&JIT_LoadElem);
+            MoveHelper(a, in_bounds ? Helper::LOAD_ELEM_IN_BOUNDS : Helper::LOAD_ELEM, cached);
             a.call(rax);                        // EAX = int32 value
 
             // ─── push value back to VM stack ───
@@ -400,7 +592,7 @@ void X86JitCompiler::CompileOperation(
 
             // ─── call helper ───────────────────
             a.mov(rcx, heapPtr);                // RCX = heap
-            a.mov(rax, (uint64_t)&JIT_Print);
+            MoveHelper(a, Helper::PRINT, cached);
             a.call(rax);                        // EAX = int32 value
             break;
         }
@@ -413,6 +605,54 @@ void X86JitCompiler::CompileOperation(
     }
 }
 
+void X86JitCompiler::SetCodeCache(const std::string& directory) {
+    code_cache_.emplace(directory, HostTarget());
+}
+
+std::unique_ptr<CompiledRuntimeFunction> X86JitCompiler::LoadCachedFunction(
+    const czffvm::RuntimeFunction& function,
+    czffvm::RuntimeDataArea& rda
+) {
+    if (!code_cache_) return nullptr;
+
+    std::optional<CachedCode> cached = code_cache_->Load(code_cache_->Key(function, rda.GetMethodArea()));
+    if (!cached) return nullptr;
+
+    std::vector<uint8_t>& bytes = cached->code;
+    for (const CodePatch& patch : cached->patches) {
+        uint64_t value;
+        if (patch.kind == CodePatchKind::HELPER) {
+            if (patch.index >= static_cast<uint16_t>(Helper::COUNT)) return nullptr;
+            value = HelperAddress(static_cast<Helper>(patch.index));
+            // a 4 byte move may sign-extend its immediate
+            if (patch.width == 4 && value > INT32_MAX) return nullptr;
+        } else {
+            value = rda.GetMethodArea().InternConstant(cached->constants[patch.index]) | patch.bias;
+        }
+
+        for (uint8_t i = 0; i < patch.width; ++i) {
+            bytes[patch.offset + i] = uint8_t(value >> (8 * i));
+        }
+    }
+
+    asmjit::CodeHolder code;
+    if (code.init(runtime->environment()) != asmjit::kErrorOk) return nullptr;
+    asmjit::x86::Assembler a(&code);
+    a.embed(bytes.data(), bytes.size());
+
+    void* funcPtr = nullptr;
+    if (runtime->add(&funcPtr, &code) != asmjit::kErrorOk) return nullptr;
+
+    return std::make_unique<X86CompiledRuntimeFunction>(
+        funcPtr,
+        bytes.size(),
+        runtime,
+        cached->argument_count,
+        cached->locals_count,
+        std::move(cached->stack_maps)
+    );
+}
+
 X86JitCompiler::~X86JitCompiler() {
 #ifdef DEBUG_BUILD
     std::cout << "[JIT] Destructor: destroying runtime at " << runtime.get() << std::endl;
@@ -447,6 +687,16 @@ bool X86JitCompiler::CanCompile(czffvm::OperationCode opcode) {
         case OperationCode::JNZ:
         case OperationCode::PRINT:
             return true;
+
+        // fused operations only exist in the interpreter's copy of the code
+        case OperationCode::LDV_LDV:
+        case OperationCode::LDV_LDC:
+        case OperationCode::LDV_LDV_ADD_STORE:
+        case OperationCode::LDV_LDC_ADD_STORE:
+        case OperationCode::CMP_JZ:
+        case OperationCode::LDV_LDC_CMP_JZ:
+        case OperationCode::LDV_LDV_LDELEM:
+            return false;
     }
     return false;
 }
@@ -456,8 +706,8 @@ bool X86JitCompiler::CanCompile(czffvm::Operation op) {
 }
 
 
-extern "C" uint32_t JIT_NewArray(X86JitHeapHelper* heap, uint32_t size, uint16_t type) {
-    HeapRef out_ref = heap->NewArray(size, type);
+extern "C" uint32_t JIT_NewArray(X86JitHeapHelper* heap, uint32_t size, uint16_t type, uint32_t safepoint) {
+    HeapRef out_ref = heap->NewArray(size, type, safepoint);
 
     return out_ref.id;
 }
@@ -478,6 +728,17 @@ JIT_StoreElem_I4(
     JIT_StoreElem(heap, &ref, index, &v);
 }
 
+extern "C" void
+JIT_StoreElem_I4_InBounds(
+    X86JitHeapHelper* heap,
+    uint32_t arrId,
+    uint32_t index,
+    int32_t value
+) {
+    Value v(value);
+    heap->StoreElem(HeapRef{arrId}, index, &v, false);
+}
+
 extern "C" int32_t JIT_LoadElem(
     X86JitHeapHelper* heap,
     uint32_t refId,
@@ -489,6 +750,14 @@ extern "C" int32_t JIT_LoadElem(
     return ValueToInteger<int32_t>(v);
 }
 
+extern "C" int32_t JIT_LoadElem_InBounds(
+    X86JitHeapHelper* heap,
+    uint32_t refId,
+    uint32_t index
+) {
+    return ValueToInteger<int32_t>(heap->LoadElem(HeapRef{refId}, index, false));
+}
+
 extern "C" void JIT_Print(
     X86JitHeapHelper* heap,
     uint32_t refId
@@ -499,32 +768,32 @@ extern "C" void JIT_Print(
 
 
 
-czffvm::HeapRef X86JitHeapHelper::NewArray(uint32_t arr_size, uint16_t type_idx) {
-    const Constant& type_c =
-        rda_.GetMethodArea().GetConstant(type_idx);
+czffvm::HeapRef X86JitHeapHelper::NewArray(uint32_t arr_size, uint16_t type_idx, uint32_t safepoint) {
+    uint32_t type_id = rda_.ArrayTypeFor(type_idx);
 
-    std::string elem_type(type_c.data.begin(), type_c.data.end());
-    std::string array_type = "[" + elem_type;
+    // lets a collection triggered by this allocation find the frame's roots
+    if (JitFrame* frame = rda_.GetStack().CurrentJitFrame()) {
+        frame->safepoint = safepoint;
+    }
 
-    std::vector<Value> elements(arr_size);
-    return rda_.GetHeap().Allocate(array_type, std::move(elements));
+    return rda_.GetHeap().AllocateArray(type_id, arr_size, Value{});
 }
 
-void X86JitHeapHelper::StoreElem(czffvm::HeapRef ref, uint32_t index, czffvm::Value* value) {
+void X86JitHeapHelper::StoreElem(czffvm::HeapRef ref, uint32_t index, czffvm::Value* value, bool check_bounds) {
     HeapObject& obj = rda_.GetHeap().Get(ref);
 
-    if (obj.type.empty() || obj.type[0] != '[')
+    if (obj.element_kind == ElementKind::NONE)
         throw std::runtime_error("STELEM: not array");
 
-    if (index >= obj.fields.size())
+    if (check_bounds && index >= obj.fields.size())
         throw std::runtime_error("STELEM: OOB");
 
-    switch (obj.type[1]) {
-        case 'B': {
+    switch (obj.element_kind) {
+        case ElementKind::BOOL: {
             obj.fields[index] = (bool)(ValueToInteger<int32_t>(*value));
             break;
         }
-        case 'I': {
+        case ElementKind::SIGNED_INT: {
             obj.fields[index] = *value;
             break;
         }
@@ -533,13 +802,13 @@ void X86JitHeapHelper::StoreElem(czffvm::HeapRef ref, uint32_t index, czffvm::Va
     }
 }
 
-czffvm::Value X86JitHeapHelper::LoadElem(czffvm::HeapRef ref, uint32_t index) {
+czffvm::Value X86JitHeapHelper::LoadElem(czffvm::HeapRef ref, uint32_t index, bool check_bounds) {
     HeapObject& obj = rda_.GetHeap().Get(ref);
 
-    if (obj.type.empty() || obj.type[0] != '[')
+    if (obj.element_kind == ElementKind::NONE)
         throw std::runtime_error("LDELEM: not array");
 
-    if (index >= obj.fields.size())
+    if (check_bounds && index >= obj.fields.size())
         throw std::runtime_error("LDELEM: OOB");
 
     return obj.fields[index];
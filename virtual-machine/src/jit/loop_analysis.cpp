@@ -0,0 +1,153 @@
+#include <algorithm>
+
+#include "jit/loop_analysis.hpp"
+
+namespace czffvm_jit {
+
+LoopAnalysis::LoopAnalysis(const std::vector<std::vector<int>>& succs, int entry)
+    : succs_(succs), preds_(succs.size()), idom_(succs.size(), -1),
+      rpo_index_(succs.size(), -1), depth_(succs.size(), 0), entry_(entry) {
+    for (size_t b = 0; b < succs_.size(); ++b) {
+        for (int s : succs_[b]) preds_[s].push_back(static_cast<int>(b));
+    }
+
+    ComputeDominators();
+    FindLoops();
+}
+
+int LoopAnalysis::ImmediateDominator(int block) const {
+    return block == entry_ ? -1 : idom_[block];
+}
+
+bool LoopAnalysis::Dominates(int a, int b) const {
+    if (rpo_index_[a] < 0 || rpo_index_[b] < 0) return false;
+    while (b != a && b != entry_) b = idom_[b];
+    return b == a;
+}
+
+const std::vector<Loop>& LoopAnalysis::Loops() const {
+    return loops_;
+}
+
+bool LoopAnalysis::Contains(const Loop& loop, int block) const {
+    return std::binary_search(loop.blocks.begin(), loop.blocks.end(), block);
+}
+
+int LoopAnalysis::LoopDepth(int block) const {
+    return depth_[block];
+}
+
+// Cooper, Harvey, Kennedy: iterate over reverse postorder until stable
+void LoopAnalysis::ComputeDominators() {
+    if (succs_.empty()) return;
+
+    std::vector<int> postorder;
+    std::vector<bool> visited(succs_.size(), false);
+    std::vector<std::pair<int, size_t>> stack{{entry_, 0}};
+    visited[entry_] = true;
+    while (!stack.empty()) {
+        auto& [b, next] = stack.back();
+        if (next < succs_[b].size()) {
+            int s = succs_[b][next++];
+            if (!visited[s]) {
+                visited[s] = true;
+                stack.push_back({s, 0});
+            }
+        } else {
+            postorder.push_back(b);
+            stack.pop_back();
+        }
+    }
+
+    std::vector<int> rpo(postorder.rbegin(), postorder.rend());
+    for (size_t i = 0; i < rpo.size(); ++i) rpo_index_[rpo[i]] = static_cast<int>(i);
+
+    auto intersect = [&](int a, int b) {
+        while (a != b) {
+            while (rpo_index_[a] > rpo_index_[b]) a = idom_[a];
+            while (rpo_index_[b] > rpo_index_[a]) b = idom_[b];
+        }
+        return a;
+    };
+
+    idom_[entry_] = entry_;
+    bool changed = true;
+    while (changed) {
+        changed = false;
+        for (size_t i = 1; i < rpo.size(); ++i) {
+            int b = rpo[i];
+            int dom = -1;
+            for (int p : preds_[b]) {
+                if (idom_[p] < 0) continue;
+                dom = dom < 0 ? p : intersect(p, dom);
+            }
+            if (dom != idom_[b]) {
+                idom_[b] = dom;
+                changed = true;
+            }
+        }
+    }
+}
+
+// A back edge t -> h has h dominating t; the loop body is everything that
+// reaches t without passing through h
+void LoopAnalysis::FindLoops() {
+    std::vector<int> header_loop(succs_.size(), -1);
+
+    for (size_t t = 0; t < succs_.size(); ++t) {
+        if (rpo_index_[t] < 0) continue;
+        for (int h : succs_[t]) {
+            if (!Dominates(h, static_cast<int>(t))) continue;
+
+            if (header_loop[h] < 0) {
+                header_loop[h] = static_cast<int>(loops_.size());
+                loops_.push_back(Loop{h, {h}, {}});
+            }
+            Loop& loop = loops_[header_loop[h]];
+            loop.latches.push_back(static_cast<int>(t));
+
+            std::vector<bool> in(succs_.size(), false);
+            for (int b : loop.blocks) in[b] = true;
+            std::vector<int> worklist;
+            if (!in[t]) {
+                in[t] = true;
+                worklist.push_back(static_cast<int>(t));
+            }
+            while (!worklist.empty()) {
+                int b = worklist.back();
+                worklist.pop_back();
+                for (int p : preds_[b]) {
+                    if (in[p] || rpo_index_[p] < 0) continue;
+                    in[p] = true;
+                    worklist.push_back(p);
+                }
+            }
+
+            loop.blocks.clear();
+            for (size_t b = 0; b < in.size(); ++b) {
+                if (in[b]) loop.blocks.push_back(static_cast<int>(b));
+            }
+        }
+    }
+
+    // inner loops are strictly smaller than the loops enclosing them
+    std::stable_sort(loops_.begin(), loops_.end(), [](const Loop& a, const Loop& b) {
+        return a.blocks.size() < b.blocks.size();
+    });
+
+    for (size_t i = 0; i < loops_.size(); ++i) {
+        for (size_t j = i + 1; j < loops_.size(); ++j) {
+            if (Contains(loops_[j], loops_[i].header)) {
+                loops_[i].parent = static_cast<int>(j);
+                break;
+            }
+        }
+    }
+    for (size_t i = loops_.size(); i-- > 0;) {
+        int parent = loops_[i].parent;
+        loops_[i].depth = parent < 0 ? 1 : loops_[parent].depth + 1;
+        for (int b : loops_[i].blocks) depth_[b] = std::max(depth_[b], loops_[i].depth);
+    }
+}
+
+}  // namespace czffvm_jit
@@ -0,0 +1,960 @@
+#include <algorithm>
+#include <climits>
+#include <stdexcept>
+
+#include "jit/generic_jit_optimizer.hpp"
+#include "jit/ssa_ir.hpp"
+
+namespace czffvm_jit {
+
+using namespace czffvm;
+
+static uint16_t DecodeU2(const Operation& op) {
+    return (op.arguments[0] << 8) | op.arguments[1];
+}
+
+static std::vector<uint8_t> EncodeU2(uint32_t value) {
+    return {uint8_t((value >> 8) & 0xFF), uint8_t(value & 0xFF)};
+}
+
+static std::string ConstantString(MethodArea& method_area, uint16_t index) {
+    const Constant& c = method_area.GetConstant(index);
+    return std::string(c.data.begin(), c.data.end());
+}
+
+static bool HasOperand(OperationCode code) {
+    switch (code) {
+        case OperationCode::NEWARR:
+        case OperationCode::CALL:
+        case OperationCode::HALT:
+        case OperationCode::JMP:
+        case OperationCode::JZ:
+        case OperationCode::JNZ:
+            return true;
+        default:
+            return false;
+    }
+}
+
+// Operations that may be removed when their result is unused
+static bool IsPure(OperationCode code) {
+    switch (code) {
+        case OperationCode::ADD:
+        case OperationCode::SUB:
+        case OperationCode::MUL:
+        case OperationCode::MIN:
+        case OperationCode::NEG:
+        case OperationCode::EQ:
+        case OperationCode::LT:
+        case OperationCode::LEQ:
+        case OperationCode::LAND:
+        case OperationCode::LOR:
+            return true;
+        default:
+            return false;
+    }
+}
+
+// ---------------------------------------------------------------------------
+// SsaBuilder
+// ---------------------------------------------------------------------------
+
+SsaBuilder::SsaBuilder(std::vector<Operation>& code,
+                       const RuntimeFunction& function,
+                       uint16_t locals_count,
+                       MethodArea& method_area)
+    : code_(code), function_(function), locals_count_(locals_count), method_area_(method_area) {}
+
+std::optional<SsaFunction> SsaBuilder::Build() {
+    if (code_.empty()) {
+        return std::nullopt;
+    }
+
+    GenericJitOptimizer optimizer(code_, method_area_);
+    optimizer.RemoveDeadCode();
+    optimizer.CompactCode();
+
+    const auto& cfg = optimizer.ControlFlowGraph();
+
+    SsaFunction fn;
+    fn.locals_count = locals_count_;
+    fn.argument_count = static_cast<uint16_t>(
+        CountParams(ConstantString(method_area_, function_.params_descriptor_index)));
+    bool returns_value = ConstantString(method_area_, function_.return_type_index) != "void;";
+
+    // original block -> SSA block; SSA block 0 is the synthetic entry
+    std::vector<int> ssa_of(cfg.size(), -1);
+    fn.blocks.push_back(SsaBlock{0});
+    for (const auto& bb : cfg) {
+        if (!bb.reachable) continue;
+        ssa_of[bb.id] = static_cast<int>(fn.blocks.size());
+        fn.blocks.push_back(SsaBlock{static_cast<int>(fn.blocks.size())});
+    }
+
+    for (const auto& bb : cfg) {
+        if (!bb.reachable) continue;
+        SsaBlock& sb = fn.blocks[ssa_of[bb.id]];
+        if (bb.id == 0) {
+            sb.preds.push_back(0);
+        }
+        for (int p : bb.preds) {
+            if (cfg[p].reachable) sb.preds.push_back(ssa_of[p]);
+        }
+        for (int s : bb.succs) {
+            sb.succs.push_back(ssa_of[s]);
+        }
+    }
+    fn.blocks[0].succs.push_back(ssa_of[0]);
+
+    auto add = [&](SsaInstruction ins, int block) -> SsaId {
+        ins.block = block;
+        SsaId id = static_cast<SsaId>(fn.values.size());
+        fn.values.push_back(std::move(ins));
+        return id;
+    };
+
+    struct State {
+        bool done = false;
+        std::vector<SsaId> locals;
+        std::vector<SsaId> stack;
+    };
+    std::vector<State> exit(fn.blocks.size());
+    std::vector<bool> joined(fn.blocks.size(), false);
+
+    // synthetic entry
+    State& entry = exit[0];
+    for (uint16_t i = 0; i < fn.locals_count; ++i) {
+        SsaId v = add({SsaKind::LOCAL, OperationCode::NOP, i, {}, -1, true}, 0);
+        fn.blocks[0].body.push_back(v);
+        entry.locals.push_back(v);
+    }
+    for (uint16_t k = 0; k < fn.argument_count; ++k) {
+        SsaId v = add({SsaKind::ARGUMENT, OperationCode::NOP, k, {}, -1, true}, 0);
+        fn.blocks[0].body.push_back(v);
+        entry.stack.push_back(v);
+    }
+    entry.done = true;
+
+    // reverse post-order, so that every block but loop headers sees its
+    // predecessors first
+    std::vector<int> order;
+    {
+        std::vector<bool> visited(fn.blocks.size(), false);
+        std::vector<std::pair<int, size_t>> stack{{0, 0}};
+        visited[0] = true;
+        while (!stack.empty()) {
+            auto& [b, next] = stack.back();
+            if (next < fn.blocks[b].succs.size()) {
+                int s = fn.blocks[b].succs[next++];
+                if (!visited[s]) {
+                    visited[s] = true;
+                    stack.push_back({s, 0});
+                }
+            } else {
+                order.push_back(b);
+                stack.pop_back();
+            }
+        }
+        std::reverse(order.begin(), order.end());
+    }
+
+    std::vector<int> orig_of(fn.blocks.size(), -1);
+    for (const auto& bb : cfg) {
+        if (bb.reachable) orig_of[ssa_of[bb.id]] = bb.id;
+    }
+
+    for (int b : order) {
+        if (b == 0) continue;
+        SsaBlock& sb = fn.blocks[b];
+
+        State state;
+        if (sb.preds.size() == 1 && exit[sb.preds[0]].done) {
+            state = exit[sb.preds[0]];
+        } else {
+            const State* known = nullptr;
+            for (int p : sb.preds) {
+                if (exit[p].done) {
+                    known = &exit[p];
+                    break;
+                }
+            }
+            if (!known) {
+                return std::nullopt;
+            }
+            joined[b] = true;
+
+            auto phi = [&]() {
+                SsaId v = add({SsaKind::PHI, OperationCode::NOP, 0, {}, -1, true}, b);
+                fn.blocks[b].phis.push_back(v);
+                return v;
+            };
+            for (size_t i = 0; i < known->locals.size(); ++i) state.locals.push_back(phi());
+            for (size_t i = 0; i < known->stack.size(); ++i) state.stack.push_back(phi());
+        }
+
+        auto pop = [&](SsaId& out) {
+            if (state.stack.empty()) return false;
+            out = state.stack.back();
+            state.stack.pop_back();
+            return true;
+        };
+        auto pop_inputs = [&](size_t n, std::vector<SsaId>& inputs) {
+            inputs.assign(n, kNoSsaValue);
+            for (size_t i = n; i-- > 0;) {
+                if (!pop(inputs[i])) return false;
+            }
+            return true;
+        };
+
+        const BasicBlock& bb = cfg[orig_of[b]];
+        for (int pc = bb.start; pc < bb.end; ++pc) {
+            const Operation& op = code_[pc];
+            SsaInstruction ins{SsaKind::OPERATION, op.code};
+            size_t consumes = 0;
+
+            switch (op.code) {
+                case OperationCode::NOP:
+                    continue;
+
+                case OperationCode::LDC: {
+                    SsaId v = add({SsaKind::CONSTANT, OperationCode::NOP, DecodeU2(op), {}, -1, true}, b);
+                    fn.blocks[b].body.push_back(v);
+                    state.stack.push_back(v);
+                    continue;
+                }
+
+                case OperationCode::LDV: {
+                    uint16_t local = DecodeU2(op);
+                    if (local >= state.locals.size()) return std::nullopt;
+                    state.stack.push_back(state.locals[local]);
+                    continue;
+                }
+
+                case OperationCode::STORE: {
+                    uint16_t local = DecodeU2(op);
+                    if (local >= state.locals.size()) return std::nullopt;
+                    if (!pop(state.locals[local])) return std::nullopt;
+                    continue;
+                }
+
+                case OperationCode::DUP:
+                    if (state.stack.empty()) return std::nullopt;
+                    state.stack.push_back(state.stack.back());
+                    continue;
+
+                case OperationCode::SWAP:
+                    if (state.stack.size() < 2) return std::nullopt;
+                    std::swap(state.stack[state.stack.size() - 1], state.stack[state.stack.size() - 2]);
+                    continue;
+
+                case OperationCode::CALL: {
+                    uint16_t fn_idx = DecodeU2(op);
+                    if (fn_idx >= method_area_.Functions().size()) return std::nullopt;
+                    RuntimeFunction* callee = method_area_.GetFunction(fn_idx);
+                    consumes = CountParams(ConstantString(method_area_, callee->params_descriptor_index));
+                    ins.has_result = ConstantString(method_area_, callee->return_type_index) != "void;";
+                    break;
+                }
+
+                case OperationCode::RET:
+                    consumes = returns_value ? 1 : 0;
+                    break;
+
+                case OperationCode::HALT:
+                case OperationCode::JMP:
+                    break;
+
+                case OperationCode::NEWARR:
+                    consumes = 1;
+                    ins.has_result = true;
+                    break;
+
+                case OperationCode::STELEM:
+                    consumes = 3;
+                    break;
+
+                case OperationCode::PRINT:
+                case OperationCode::JZ:
+                case OperationCode::JNZ:
+                    consumes = 1;
+                    break;
+
+                case OperationCode::NEG:
+                case OperationCode::MIN:
+                    consumes = 1;
+                    ins.has_result = true;
+                    break;
+
+                default:
+                    // binary arithmetic, comparison, logical operations and LDELEM
+                    consumes = 2;
+                    ins.has_result = true;
+                    break;
+            }
+
+            if (HasOperand(op.code)) {
+                ins.operand = DecodeU2(op);
+            }
+            if (!pop_inputs(consumes, ins.inputs)) {
+                return std::nullopt;
+            }
+
+            SsaId v = add(std::move(ins), b);
+            fn.blocks[b].body.push_back(v);
+            if (fn.values[v].has_result) {
+                state.stack.push_back(v);
+            }
+
+            if (IsTerminator(op) || op.code == OperationCode::HALT) {
+                break;
+            }
+        }
+
+        state.done = true;
+        exit[b] = std::move(state);
+    }
+
+    // phi inputs, and stack depth agreement on every join
+    for (auto& sb : fn.blocks) {
+        if (!joined[sb.id]) continue;
+
+        for (int p : sb.preds) {
+            const State& from = exit[p];
+            if (!from.done || from.locals.size() + from.stack.size() != sb.phis.size()) {
+                return std::nullopt;
+            }
+            for (size_t i = 0; i < sb.phis.size(); ++i) {
+                SsaId input = i < from.locals.size()
+                    ? from.locals[i]
+                    : from.stack[i - from.locals.size()];
+                fn.values[sb.phis[i]].inputs.push_back(input);
+            }
+        }
+    }
+
+    // remove trivial phis (all inputs are the phi itself or one other value)
+    std::vector<SsaId> alias(fn.values.size());
+    for (SsaId i = 0; i < alias.size(); ++i) alias[i] = i;
+    auto find = [&](SsaId v) {
+        while (alias[v] != v) {
+            alias[v] = alias[alias[v]];
+            v = alias[v];
+        }
+        return v;
+    };
+
+    bool changed = true;
+    while (changed) {
+        changed = false;
+        for (auto& sb : fn.blocks) {
+            for (SsaId phi : sb.phis) {
+                if (fn.values[phi].removed) continue;
+
+                SsaId same = kNoSsaValue;
+                bool trivial = true;
+                for (SsaId in : fn.values[phi].inputs) {
+                    in = find(in);
+                    if (in == phi || in == same) continue;
+                    if (same != kNoSsaValue) {
+                        trivial = false;
+                        break;
+                    }
+                    same = in;
+                }
+
+                if (trivial && same != kNoSsaValue) {
+                    alias[phi] = same;
+                    fn.values[phi].removed = true;
+                    changed = true;
+                }
+            }
+        }
+    }
+
+    for (auto& v : fn.values) {
+        for (auto& in : v.inputs) in = find(in);
+    }
+    for (auto& sb : fn.blocks) {
+        std::vector<SsaId> live;
+        for (SsaId phi : sb.phis) {
+            if (!fn.values[phi].removed) live.push_back(phi);
+        }
+        sb.phis = std::move(live);
+    }
+
+    return fn;
+}
+
+// ---------------------------------------------------------------------------
+// SsaFunction
+// ---------------------------------------------------------------------------
+
+std::vector<uint32_t> SsaFunction::UseCounts() const {
+    std::vector<uint32_t> uses(values.size(), 0);
+    for (const auto& v : values) {
+        if (v.removed) continue;
+        for (SsaId in : v.inputs) uses[in]++;
+    }
+    return uses;
+}
+
+size_t SsaFunction::EliminateDeadValues() {
+    std::vector<bool> live(values.size(), false);
+    std::vector<SsaId> worklist;
+
+    for (SsaId id = 0; id < values.size(); ++id) {
+        const auto& v = values[id];
+        if (v.removed) continue;
+
+        bool root = v.kind == SsaKind::ARGUMENT ||
+                    (v.kind == SsaKind::OPERATION && !IsPure(v.code));
+        if (root) {
+            live[id] = true;
+            worklist.push_back(id);
+        }
+    }
+
+    while (!worklist.empty()) {
+        SsaId id = worklist.back();
+        worklist.pop_back();
+        for (SsaId in : values[id].inputs) {
+            if (!live[in]) {
+                live[in] = true;
+                worklist.push_back(in);
+            }
+        }
+    }
+
+    size_t removed = 0;
+    for (SsaId id = 0; id < values.size(); ++id) {
+        if (!live[id] && !values[id].removed) {
+            values[id].removed = true;
+            removed++;
+        }
+    }
+
+    auto prune = [&](std::vector<SsaId>& list) {
+        std::vector<SsaId> kept;
+        for (SsaId id : list) {
+            if (!values[id].removed) kept.push_back(id);
+        }
+        list = std::move(kept);
+    };
+    for (auto& b : blocks) {
+        prune(b.phis);
+        prune(b.body);
+    }
+
+    return removed;
+}
+
+LoopAnalysis SsaFunction::FindLoops() const {
+    std::vector<std::vector<int>> succs;
+    succs.reserve(blocks.size());
+    for (const auto& b : blocks) {
+        succs.push_back(b.succs);
+    }
+
+    return LoopAnalysis(succs, 0);
+}
+
+// The only block outside the loop that enters the header, if it has no
+// other successor
+static int Preheader(const SsaFunction& fn, const LoopAnalysis& loops, const Loop& loop) {
+    int preheader = -1;
+    for (int p : fn.blocks[loop.header].preds) {
+        if (loops.Contains(loop, p)) continue;
+        if (preheader >= 0 && preheader != p) return -1;
+        preheader = p;
+    }
+
+    if (preheader < 0 || fn.blocks[preheader].succs.size() != 1) return -1;
+    return preheader;
+}
+
+static void InsertBeforeTerminator(SsaFunction& fn, int block, SsaId id) {
+    auto& body = fn.blocks[block].body;
+    auto at = body.end();
+    if (!body.empty()) {
+        const auto& last = fn.values[body.back()];
+        if (last.kind == SsaKind::OPERATION && (IsTerminator(Operation{last.code, {}}) ||
+                                                last.code == OperationCode::HALT)) {
+            at = body.end() - 1;
+        }
+    }
+    body.insert(at, id);
+    fn.values[id].block = block;
+}
+
+static bool IsInvariant(const SsaFunction& fn, const LoopAnalysis& loops,
+                        const Loop& loop, SsaId id) {
+    const auto& v = fn.values[id];
+    return v.kind == SsaKind::CONSTANT || !loops.Contains(loop, v.block);
+}
+
+size_t SsaFunction::HoistLoopInvariants() {
+    LoopAnalysis loops = FindLoops();
+    size_t hoisted = 0;
+
+    // inner loops first, so values can move out level by level
+    for (const Loop& loop : loops.Loops()) {
+        int preheader = Preheader(*this, loops, loop);
+        if (preheader < 0) continue;
+
+        bool changed = true;
+        while (changed) {
+            changed = false;
+            for (int b : loop.blocks) {
+                auto& body = blocks[b].body;
+                for (size_t i = 0; i < body.size();) {
+                    SsaId id = body[i];
+                    const auto& v = values[id];
+
+                    bool invariant = v.kind == SsaKind::OPERATION && IsPure(v.code);
+                    for (SsaId in : v.inputs) {
+                        invariant = invariant && IsInvariant(*this, loops, loop, in);
+                    }
+                    if (!invariant) {
+                        i++;
+                        continue;
+                    }
+
+                    body.erase(body.begin() + i);
+                    InsertBeforeTerminator(*this, preheader, id);
+                    hoisted++;
+                    changed = true;
+                }
+            }
+        }
+    }
+
+    return hoisted;
+}
+
+// Basic induction variable i = phi(init, i + c) or phi(init, i - c)
+struct Induction {
+    SsaId phi;
+    SsaId init;
+    SsaId next;
+    SsaId step;
+};
+
+static std::vector<Induction> BasicInductions(const SsaFunction& fn, const LoopAnalysis& loops,
+                                              const Loop& loop, size_t entry_index) {
+    const SsaBlock& header = fn.blocks[loop.header];
+    std::vector<Induction> inductions;
+
+    for (SsaId phi : header.phis) {
+        const auto& p = fn.values[phi];
+        SsaId next = kNoSsaValue;
+        bool ok = true;
+        for (size_t i = 0; i < header.preds.size() && ok; ++i) {
+            if (i == entry_index) continue;
+            ok = next == kNoSsaValue || next == p.inputs[i];
+            next = p.inputs[i];
+        }
+        if (!ok || next == kNoSsaValue) continue;
+
+        const auto& n = fn.values[next];
+        if (n.kind != SsaKind::OPERATION || n.removed || n.inputs.size() != 2) continue;
+
+        SsaId step = kNoSsaValue;
+        if (n.code == OperationCode::ADD || n.code == OperationCode::SUB) {
+            if (n.inputs[0] == phi) step = n.inputs[1];
+        }
+        if (n.code == OperationCode::ADD && n.inputs[1] == phi) step = n.inputs[0];
+        if (step == kNoSsaValue || !IsInvariant(fn, loops, loop, step)) continue;
+
+        inductions.push_back({phi, p.inputs[entry_index], next, step});
+    }
+
+    return inductions;
+}
+
+size_t SsaFunction::ReduceInductionVariables() {
+    LoopAnalysis loops = FindLoops();
+    size_t reduced = 0;
+
+    auto add_value = [&](SsaInstruction ins) {
+        values.push_back(std::move(ins));
+        return static_cast<SsaId>(values.size() - 1);
+    };
+
+    for (const Loop& loop : loops.Loops()) {
+        int preheader = Preheader(*this, loops, loop);
+        if (preheader < 0) continue;
+
+        SsaBlock& header = blocks[loop.header];
+        size_t entry_index = 0;
+        while (header.preds[entry_index] != preheader) entry_index++;
+
+        std::vector<Induction> inductions = BasicInductions(*this, loops, loop, entry_index);
+
+        // derived variables i * k, shared between multiplications by the same k
+        struct Derived {
+            SsaId phi;
+            SsaId factor;
+            SsaId value;
+        };
+        std::vector<Derived> derived;
+
+        for (int b : loop.blocks) {
+            auto& body = blocks[b].body;
+            for (size_t i = 0; i < body.size(); ++i) {
+                SsaId id = body[i];
+                const auto& mul = values[id];
+                if (mul.kind != SsaKind::OPERATION || mul.code != OperationCode::MUL) continue;
+
+                const Induction* iv = nullptr;
+                SsaId factor = kNoSsaValue;
+                for (const auto& candidate : inductions) {
+                    if (mul.inputs[0] == candidate.phi) factor = mul.inputs[1];
+                    else if (mul.inputs[1] == candidate.phi) factor = mul.inputs[0];
+                    else continue;
+                    iv = &candidate;
+                    break;
+                }
+                if (!iv || !IsInvariant(*this, loops, loop, factor)) continue;
+
+                SsaId replacement = kNoSsaValue;
+                for (const auto& d : derived) {
+                    if (d.phi == iv->phi && d.factor == factor) replacement = d.value;
+                }
+
+                if (replacement == kNoSsaValue) {
+                    SsaId init = add_value({SsaKind::OPERATION, OperationCode::MUL, 0,
+                                            {iv->init, factor}, -1, true});
+                    InsertBeforeTerminator(*this, preheader, init);
+                    SsaId step = add_value({SsaKind::OPERATION, OperationCode::MUL, 0,
+                                            {iv->step, factor}, -1, true});
+                    InsertBeforeTerminator(*this, preheader, step);
+
+                    SsaId phi = add_value({SsaKind::PHI, OperationCode::NOP, 0, {}, loop.header, true});
+                    SsaId next = add_value({SsaKind::OPERATION, values[iv->next].code, 0,
+                                            {phi, step}, values[iv->next].block, true});
+
+                    for (size_t p = 0; p < header.preds.size(); ++p) {
+                        values[phi].inputs.push_back(p == entry_index ? init : next);
+                    }
+                    header.phis.push_back(phi);
+
+                    auto& next_body = blocks[values[iv->next].block].body;
+                    next_body.insert(std::find(next_body.begin(), next_body.end(), iv->next) + 1, next);
+
+                    derived.push_back({iv->phi, factor, phi});
+                    replacement = phi;
+                }
+
+                for (auto& v : values) {
+                    for (SsaId& in : v.inputs) {
+                        if (in == id) in = replacement;
+                    }
+                }
+                values[id].removed = true;
+                // the increment may have been inserted before the multiplication
+                i = std::find(body.begin(), body.end(), id) - body.begin();
+                body.erase(body.begin() + i);
+                --i;
+                reduced++;
+            }
+        }
+    }
+
+    return reduced;
+}
+
+// Integer value of a CONSTANT, as compiled code sees it
+static std::optional<int64_t> ConstantValue(const SsaFunction& fn, MethodArea& method_area, SsaId id) {
+    const auto& v = fn.values[id];
+    if (v.kind != SsaKind::CONSTANT) return std::nullopt;
+
+    const Constant& c = method_area.GetConstant(v.operand);
+    if (c.tag == ConstantTag::STRING) return std::nullopt;
+    auto value = SafeValueToInteger<int32_t>(ConstantToValue(c));
+    if (!value) return std::nullopt;
+    return *value;
+}
+
+// Length of an array as `base + offset`, base is kNoSsaValue for arrays
+// of constant length. Only arrays created by a NEWARR of this function
+// have a known length.
+struct ArrayLength {
+    SsaId base;
+    int64_t offset;
+};
+
+static std::optional<ArrayLength> LengthOf(const SsaFunction& fn, MethodArea& method_area, SsaId array) {
+    const auto& a = fn.values[array];
+    if (a.kind != SsaKind::OPERATION || a.code != OperationCode::NEWARR) return std::nullopt;
+
+    SsaId size = a.inputs[0];
+    if (auto n = ConstantValue(fn, method_area, size)) {
+        return ArrayLength{kNoSsaValue, *n};
+    }
+
+    const auto& s = fn.values[size];
+    if (s.kind == SsaKind::OPERATION && s.code == OperationCode::ADD) {
+        for (int i = 0; i < 2; ++i) {
+            if (auto k = ConstantValue(fn, method_area, s.inputs[i])) {
+                return ArrayLength{s.inputs[1 - i], *k};
+            }
+        }
+    }
+    return ArrayLength{size, 0};
+}
+
+size_t SsaFunction::EliminateBoundsChecks(MethodArea& method_area) {
+    LoopAnalysis loops = FindLoops();
+    size_t proven = 0;
+
+    for (const Loop& loop : loops.Loops()) {
+        int preheader = Preheader(*this, loops, loop);
+        if (preheader < 0) continue;
+
+        const SsaBlock& header = blocks[loop.header];
+        size_t entry_index = 0;
+        while (header.preds[entry_index] != preheader) entry_index++;
+
+        // the header must leave the loop unless `cond` holds
+        if (header.body.empty() || header.succs.size() != 2) continue;
+        const auto& branch = values[header.body.back()];
+        if (branch.kind != SsaKind::OPERATION || !IsConditionalJump(Operation{branch.code, {}})) continue;
+
+        bool target_inside = loops.Contains(loop, header.succs[0]);
+        bool fallthrough_inside = loops.Contains(loop, header.succs[1]);
+        bool stays_when_true = branch.code == OperationCode::JNZ ? target_inside : fallthrough_inside;
+        if (target_inside == fallthrough_inside || !stays_when_true) continue;
+
+        const auto& cond = values[branch.inputs[0]];
+        if (cond.kind != SsaKind::OPERATION ||
+            (cond.code != OperationCode::LT && cond.code != OperationCode::LEQ)) {
+            continue;
+        }
+        SsaId bound = cond.inputs[1];
+        // i < bound or i <= bound, i.e. i < bound + strict_offset
+        int64_t bound_offset = cond.code == OperationCode::LT ? 0 : 1;
+
+        for (const auto& iv : BasicInductions(*this, loops, loop, entry_index)) {
+            if (cond.inputs[0] != iv.phi || values[iv.next].code != OperationCode::ADD) continue;
+
+            auto init = ConstantValue(*this, method_area, iv.init);
+            auto step = ConstantValue(*this, method_area, iv.step);
+            if (!init || !step || *init < 0 || *step <= 0) continue;
+
+            // the increment of a value that passed the test must not wrap
+            auto constant_bound = ConstantValue(*this, method_area, bound);
+            if (constant_bound) {
+                if (*constant_bound + bound_offset - 1 + *step > INT32_MAX) continue;
+            } else if (*step != 1) {
+                continue;
+            }
+
+            for (int b : loop.blocks) {
+                // inside the header the test has not happened yet
+                if (b == loop.header) continue;
+
+                for (SsaId id : blocks[b].body) {
+                    auto& access = values[id];
+                    if (access.kind != SsaKind::OPERATION || access.in_bounds) continue;
+                    if (access.code != OperationCode::LDELEM && access.code != OperationCode::STELEM) continue;
+                    if (access.inputs[1] != iv.phi) continue;
+
+                    auto length = LengthOf(*this, method_area, access.inputs[0]);
+                    if (!length) continue;
+
+                    bool fits;
+                    if (constant_bound) {
+                        fits = length->base == kNoSsaValue &&
+                               *constant_bound + bound_offset <= length->offset;
+                    } else {
+                        fits = (length->base == bound && bound_offset <= length->offset) ||
+                               (values[access.inputs[0]].inputs[0] == bound && bound_offset == 0);
+                    }
+
+                    if (fits) {
+                        access.in_bounds = true;
+                        proven++;
+                    }
+                }
+            }
+        }
+    }
+
+    return proven;
+}
+
+LoweredFunction SsaFunction::Lower() const {
+    std::vector<uint32_t> uses = UseCounts();
+    std::vector<int64_t> local_of(values.size(), -1);
+    uint32_t next_local = locals_count;
+
+    std::vector<Operation> code;
+    std::vector<size_t> block_start(blocks.size(), 0);
+    std::vector<std::pair<size_t, int>> block_jumps;      // code pc -> block
+    std::vector<size_t> in_bounds;
+
+    struct Trampoline {
+        size_t jump;
+        int from;
+        int to;
+    };
+    std::vector<Trampoline> trampolines;
+
+    auto local_for = [&](SsaId v) {
+        if (local_of[v] < 0) local_of[v] = next_local++;
+        return static_cast<uint32_t>(local_of[v]);
+    };
+
+    auto emit = [&](OperationCode op, std::vector<uint8_t> args = {}) {
+        code.push_back(Operation{op, std::move(args)});
+    };
+
+    auto load = [&](SsaId v) {
+        const auto& ins = values[v];
+        if (ins.kind == SsaKind::CONSTANT) {
+            emit(OperationCode::LDC, EncodeU2(ins.operand));
+        } else if (ins.kind == SsaKind::LOCAL) {
+            emit(OperationCode::LDV, EncodeU2(ins.operand));
+        } else {
+            emit(OperationCode::LDV, EncodeU2(local_for(v)));
+        }
+    };
+
+    // result of the last emitted operation, still on the operand stack
+    SsaId pending = kNoSsaValue;
+    auto flush = [&]() {
+        if (pending != kNoSsaValue) {
+            emit(OperationCode::STORE, EncodeU2(local_for(pending)));
+            pending = kNoSsaValue;
+        }
+    };
+
+    auto load_inputs = [&](const SsaInstruction& ins) {
+        size_t first = 0;
+        if (pending != kNoSsaValue) {
+            if (!ins.inputs.empty() && ins.inputs[0] == pending && uses[pending] == 1) {
+                first = 1;
+                pending = kNoSsaValue;
+            } else {
+                flush();
+            }
+        }
+        for (size_t i = first; i < ins.inputs.size(); ++i) {
+            load(ins.inputs[i]);
+        }
+    };
+
+    // parallel copy into the phis of `to`: load everything, then store
+    auto copies = [&](int from, int to) {
+        flush();
+        const SsaBlock& target = blocks[to];
+        if (target.phis.empty()) return;
+
+        size_t index = 0;
+        while (target.preds[index] != from) index++;
+
+        for (SsaId phi : target.phis) {
+            load(values[phi].inputs[index]);
+        }
+        for (size_t i = target.phis.size(); i-- > 0;) {
+            emit(OperationCode::STORE, EncodeU2(local_for(target.phis[i])));
+        }
+    };
+
+    for (const auto& b : blocks) {
+        block_start[b.id] = code.size();
+
+        if (b.id == 0) {
+            // arguments arrive on the operand stack, the last one on top
+            std::vector<SsaId> arguments(argument_count, kNoSsaValue);
+            for (SsaId id : b.body) {
+                if (values[id].kind == SsaKind::ARGUMENT) arguments[values[id].operand] = id;
+            }
+            for (size_t k = arguments.size(); k-- > 0;) {
+                emit(OperationCode::STORE, EncodeU2(local_for(arguments[k])));
+            }
+        }
+
+        bool terminated = false;
+        for (SsaId id : b.body) {
+            const auto& ins = values[id];
+            if (ins.kind != SsaKind::OPERATION) continue;
+
+            switch (ins.code) {
+                case OperationCode::JMP:
+                    copies(b.id, b.succs[0]);
+                    block_jumps.push_back({code.size(), b.succs[0]});
+                    emit(OperationCode::JMP, EncodeU2(0));
+                    terminated = true;
+                    break;
+
+                case OperationCode::JZ:
+                case OperationCode::JNZ: {
+                    load_inputs(ins);
+                    int target = b.succs[0];
+                    if (blocks[target].phis.empty()) {
+                        block_jumps.push_back({code.size(), target});
+                    } else {
+                        trampolines.push_back({code.size(), b.id, target});
+                    }
+                    emit(ins.code, EncodeU2(0));
+
+                    if (b.succs.size() > 1) {
+                        int fallthrough = b.succs[1];
+                        copies(b.id, fallthrough);
+                        if (fallthrough != b.id + 1) {
+                            block_jumps.push_back({code.size(), fallthrough});
+                            emit(OperationCode::JMP, EncodeU2(0));
+                        }
+                    }
+                    terminated = true;
+                    break;
+                }
+
+                default:
+                    load_inputs(ins);
+                    if (ins.in_bounds) in_bounds.push_back(code.size());
+                    emit(ins.code, HasOperand(ins.code) ? EncodeU2(ins.operand) : std::vector<uint8_t>{});
+                    if (ins.has_result) pending = id;
+                    if (ins.code == OperationCode::RET || ins.code == OperationCode::HALT) {
+                        terminated = true;
+                    }
+                    break;
+            }
+        }
+
+        if (!terminated) {
+            flush();
+            if (!b.succs.empty()) {
+                copies(b.id, b.succs[0]);
+                if (b.succs[0] != b.id + 1) {
+                    block_jumps.push_back({code.size(), b.succs[0]});
+                    emit(OperationCode::JMP, EncodeU2(0));
+                }
+            }
+        }
+        flush();
+    }
+
+    for (const auto& t : trampolines) {
+        code[t.jump].arguments = EncodeU2(static_cast<uint32_t>(code.size()));
+        copies(t.from, t.to);
+        block_jumps.push_back({code.size(), t.to});
+        emit(OperationCode::JMP, EncodeU2(0));
+    }
+
+    if (code.size() > UINT16_MAX || next_local > UINT16_MAX) {
+        throw std::runtime_error("SSA lowering: function too large");
+    }
+
+    for (const auto& [pc, block] : block_jumps) {
+        code[pc].arguments = EncodeU2(static_cast<uint32_t>(block_start[block]));
+    }
+
+    std::vector<bool> unchecked(code.size(), false);
+    for (size_t pc : in_bounds) unchecked[pc] = true;
+
+    return LoweredFunction{std::move(code), static_cast<uint16_t>(next_local), std::move(unchecked)};
+}
+
+}  // namespace czffvm_jit
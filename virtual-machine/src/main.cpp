@@ -1,17 +1,37 @@
+#include <algorithm>
 #include <iostream>
+#include <thread>
 
 #include "virtual_machine.hpp"
 #include "common.hpp"
 #include "ball_disassembler.hpp"
+#include "memory_limit.hpp"
 
 struct CmdOptions {
     std::string ball_path;
     std::string stdlib_path;
-    uint32_t max_heap_size = 0;
+    uint32_t max_heap_size = czffvm::kDefaultMaxHeapSizeInKiB;
+    uint32_t gc_growth_percent = czffvm::kDefaultGcGrowthPercent;
+    uint32_t large_object_threshold = czffvm::kDefaultLargeObjectThresholdInKiB;
+    bool use_huge_pages = false;
+    uint32_t heap_percent = czffvm::kDefaultHeapPercentOfMemoryLimit;
+    std::string cgroup_root = czffvm::kDefaultCgroupRoot;
     bool is_set_max_heap_size = false;
     bool is_set_stdlib = false;
     bool is_set_debug_mode = false;
     bool no_jit = false;
+    bool no_escape_analysis = false;
+    bool no_tail_calls = false;
+    bool bytecode_opt = false;
+    bool no_superinstructions = false;
+    bool no_lazy_decode = false;
+    bool no_tree_shaking = false;
+    uint32_t load_threads = std::max(1u, std::thread::hardware_concurrency());
+    bool opcode_profile = false;
+    std::string image_cache;
+    std::string jit_cache;
+    std::string profile_in;
+    std::string profile_out;
     bool is_set_gc_off = false;
 };
 
@@ -19,7 +39,7 @@ CmdOptions parseArguments(int argc, char* argv[]) {
     CmdOptions options;
 
     if (argc < 2) {
-        throw std::runtime_error("Missing arguments. Use -p <file> [-mhs <number>] [--debug] [--no-jit]");
+        throw std::runtime_error("Missing arguments. Use -p <file> [-mhs <number>|auto] [-mhp <percent>] [--cgroup-root <path>] [-gcp <percent>] [-lot <KiB>] [--thp] [--debug] [--no-jit] [--no-escape-analysis] [--no-tail-calls] [--bytecode-opt] [--no-superinstructions] [--no-lazy-decode] [--no-tree-shaking] [--load-threads <number>] [--image-cache <dir>] [--jit-cache <dir>] [--profile-in <file>] [--profile-out <file>] [--opcode-profile]");
     }
 
     bool debug = false;
@@ -50,6 +70,11 @@ CmdOptions parseArguments(int argc, char* argv[]) {
             if (i + 1 >= argc) {
                 throw std::runtime_error("-mhs requires a number");
             }
+            if (std::string(argv[i + 1]) == "auto") {
+                ++i;
+                options.is_set_max_heap_size = false;
+                continue;
+            }
             try {
                 long long value = std::stoll(argv[++i]);
                 if (value < 0 || value > UINT32_MAX) {
@@ -60,10 +85,103 @@ CmdOptions parseArguments(int argc, char* argv[]) {
             } catch (const std::exception& e) {
                 throw std::runtime_error("Invalid -mhs value");
             }
+        } else if (arg == "-mhp") {
+            if (i + 1 >= argc) {
+                throw std::runtime_error("-mhp requires a number");
+            }
+            try {
+                long long value = std::stoll(argv[++i]);
+                if (value <= 0 || value > 100) {
+                    throw std::out_of_range("Heap percent is out of range (1-100)");
+                }
+                options.heap_percent = static_cast<uint32_t>(value);
+            } catch (const std::exception& e) {
+                throw std::runtime_error("Invalid -mhp value");
+            }
+        } else if (arg == "--cgroup-root") {
+            if (i + 1 >= argc) {
+                throw std::runtime_error("--cgroup-root requires path");
+            }
+            options.cgroup_root = argv[++i];
+        } else if (arg == "-lot") {
+            if (i + 1 >= argc) {
+                throw std::runtime_error("-lot requires a number");
+            }
+            try {
+                long long value = std::stoll(argv[++i]);
+                if (value < 0 || value > UINT32_MAX) {
+                    throw std::out_of_range("Large object threshold is out of range (uint32_t)");
+                }
+                options.large_object_threshold = static_cast<uint32_t>(value);
+            } catch (const std::exception& e) {
+                throw std::runtime_error("Invalid -lot value");
+            }
+        } else if (arg == "--thp") {
+            options.use_huge_pages = true;
+        } else if (arg == "-gcp") {
+            if (i + 1 >= argc) {
+                throw std::runtime_error("-gcp requires a number");
+            }
+            try {
+                long long value = std::stoll(argv[++i]);
+                if (value < 0 || value > UINT32_MAX) {
+                    throw std::out_of_range("GC growth percent is out of range (uint32_t)");
+                }
+                options.gc_growth_percent = static_cast<uint32_t>(value);
+            } catch (const std::exception& e) {
+                throw std::runtime_error("Invalid -gcp value");
+            }
         } else if (arg == "--debug") {
             debug = true;
         } else if (arg == "--no-jit") {
             options.no_jit = true;
+        } else if (arg == "--no-escape-analysis") {
+            options.no_escape_analysis = true;
+        } else if (arg == "--no-tail-calls") {
+            options.no_tail_calls = true;
+        } else if (arg == "--bytecode-opt") {
+            options.bytecode_opt = true;
+        } else if (arg == "--no-superinstructions") {
+            options.no_superinstructions = true;
+        } else if (arg == "--no-lazy-decode") {
+            options.no_lazy_decode = true;
+        } else if (arg == "--no-tree-shaking") {
+            options.no_tree_shaking = true;
+        } else if (arg == "--load-threads") {
+            if (i + 1 >= argc) {
+                throw std::runtime_error("--load-threads requires a number");
+            }
+            try {
+                long long value = std::stoll(argv[++i]);
+                if (value < 1 || value > UINT16_MAX) {
+                    throw std::out_of_range("Load threads is out of range");
+                }
+                options.load_threads = static_cast<uint32_t>(value);
+            } catch (const std::exception& e) {
+                throw std::runtime_error("Invalid --load-threads value");
+            }
+        } else if (arg == "--image-cache") {
+            if (i + 1 >= argc) {
+                throw std::runtime_error("--image-cache requires a directory");
+            }
+            options.image_cache = argv[++i];
+        } else if (arg == "--jit-cache") {
+            if (i + 1 >= argc) {
+                throw std::runtime_error("--jit-cache requires a directory");
+            }
+            options.jit_cache = argv[++i];
+        } else if (arg == "--profile-in") {
+            if (i + 1 >= argc) {
+                throw std::runtime_error("--profile-in requires a file");
+            }
+            options.profile_in = argv[++i];
+        } else if (arg == "--profile-out") {
+            if (i + 1 >= argc) {
+                throw std::runtime_error("--profile-out requires a file");
+            }
+            options.profile_out = argv[++i];
+        } else if (arg == "--opcode-profile") {
+            options.opcode_profile = true;
         } else if (arg == "--gcoff") {
             is_gc_off = true;
         } else {
@@ -74,6 +192,9 @@ CmdOptions parseArguments(int argc, char* argv[]) {
     if (options.ball_path.empty()) {
         throw std::runtime_error("Parameter -p is required");
     }
+    if (!options.is_set_max_heap_size) {
+        options.max_heap_size = czffvm::AutoMaxHeapSizeInKiB(options.heap_percent, options.cgroup_root);
+    }
     options.is_set_debug_mode = debug;
     options.is_set_gc_off = is_gc_off;
 
@@ -89,18 +210,56 @@ int main(int argc, char* argv[]) {
             disasm.Disassemble();
         }
 
-        czffvm::VirtualMachine vm = 
-            (opts.is_set_max_heap_size)
-            ? czffvm::VirtualMachine(opts.max_heap_size, opts.is_set_gc_off)
-            : czffvm::VirtualMachine(opts.is_set_gc_off);
+        czffvm::VirtualMachine vm(
+            opts.max_heap_size,
+            opts.is_set_gc_off,
+            opts.gc_growth_percent,
+            opts.large_object_threshold,
+            opts.use_huge_pages
+        );
+        if (!opts.no_escape_analysis) {
+            vm.EnableEscapeAnalysis();
+        }
+        if (!opts.no_tail_calls) {
+            vm.EnableTailCallElimination();
+        }
+        if (opts.bytecode_opt) {
+            vm.EnableBytecodeOptimization();
+        }
+        if (!opts.no_superinstructions) {
+            vm.EnableSuperinstructions();
+        }
+        if (!opts.no_lazy_decode) {
+            vm.EnableLazyDecoding();
+        }
+        if (!opts.no_tree_shaking) {
+            vm.EnableTreeShaking();
+        }
+        vm.SetLoadThreads(opts.load_threads);
+        if (!opts.image_cache.empty()) {
+            vm.SetImageCache(opts.image_cache);
+        }
+        if (!opts.jit_cache.empty()) {
+            vm.SetJitCodeCache(opts.jit_cache);
+        }
+        if (opts.opcode_profile) {
+            vm.EnableOpcodeProfile();
+        }
         if (opts.is_set_stdlib) {
             vm.LoadStdlib(opts.stdlib_path);
         }
         vm.LoadProgram(opts.ball_path);
+        if (!opts.profile_in.empty()) {
+            vm.LoadProfile(opts.profile_in);
+        }
         if (!opts.no_jit) {
             vm.EnableJIT();
         }
 
+        if (!opts.profile_out.empty()) {
+            vm.SetProfileOutput(opts.profile_out);
+        }
+
         vm.Run();
     } catch (const std::exception& e) {
         std::cerr << "Exception: " << e.what() << std::endl;
@@ -0,0 +1,73 @@
+#include <algorithm>
+#include <vector>
+
+#include "opcode_profile.hpp"
+#include "ball_disassembler.hpp"
+
+namespace czffvm {
+
+static uint32_t PairKey(OperationCode a, OperationCode b) {
+    return (uint32_t(a) << 16) | uint32_t(b);
+}
+
+static uint64_t TripleKey(OperationCode a, OperationCode b, OperationCode c) {
+    return (uint64_t(a) << 32) | (uint64_t(b) << 16) | uint64_t(c);
+}
+
+template<typename Key>
+static void PrintTop(std::ostream& out, const std::unordered_map<Key, uint64_t>& counts,
+                     size_t length, size_t limit) {
+    std::vector<std::pair<Key, uint64_t>> sorted(counts.begin(), counts.end());
+    std::sort(sorted.begin(), sorted.end(), [](const auto& a, const auto& b) {
+        return a.second != b.second ? a.second > b.second : a.first < b.first;
+    });
+    if (sorted.size() > limit) sorted.resize(limit);
+
+    for (const auto& [key, count] : sorted) {
+        out << "  " << count;
+        for (size_t i = length; i-- > 0;) {
+            auto code = static_cast<OperationCode>((uint64_t(key) >> (16 * i)) & 0xFFFF);
+            out << ' ' << BallDisassembler::OperationCodeToString(code);
+        }
+        out << '\n';
+    }
+}
+
+void OpcodeProfile::Record(const RuntimeFunction* function, size_t pc) {
+    OperationCode code = function->code[pc].code;
+
+    if (function != function_ || pc != next_pc_) {
+        run_ = 0;
+    }
+    if (run_ >= 1) {
+        pairs_[PairKey(last_[1], code)]++;
+    }
+    if (run_ >= 2) {
+        triples_[TripleKey(last_[0], last_[1], code)]++;
+    }
+
+    last_[0] = last_[1];
+    last_[1] = code;
+    run_ = std::min<size_t>(run_ + 1, 2);
+    function_ = function;
+    next_pc_ = pc + 1;
+}
+
+uint64_t OpcodeProfile::Count(OperationCode a, OperationCode b) const {
+    auto it = pairs_.find(PairKey(a, b));
+    return it == pairs_.end() ? 0 : it->second;
+}
+
+uint64_t OpcodeProfile::Count(OperationCode a, OperationCode b, OperationCode c) const {
+    auto it = triples_.find(TripleKey(a, b, c));
+    return it == triples_.end() ? 0 : it->second;
+}
+
+void OpcodeProfile::Print(std::ostream& out, size_t limit) const {
+    out << "Opcode pairs:\n";
+    PrintTop(out, pairs_, 2, limit);
+    out << "Opcode triples:\n";
+    PrintTop(out, triples_, 3, limit);
+}
+
+}  // namespace czffvm
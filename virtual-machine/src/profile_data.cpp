@@ -0,0 +1,134 @@
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+
+#include "profile_data.hpp"
+#include "image_cache.hpp"
+
+namespace czffvm {
+
+static const char* kProfileHeader = "czff-profile 1";
+
+static std::string FunctionName(MethodArea& method_area, const RuntimeFunction& fn) {
+    const Constant& c = method_area.GetConstant(fn.name_index);
+    return std::string(c.data.begin(), c.data.end());
+}
+
+static uint64_t HashConstant(const Constant& c, uint64_t h) {
+    uint32_t size = static_cast<uint32_t>(c.data.size());
+    uint8_t head[5] = {static_cast<uint8_t>(c.tag), uint8_t(size >> 24), uint8_t(size >> 16),
+                       uint8_t(size >> 8), uint8_t(size)};
+    h = HashBytes(head, sizeof(head), h);
+    return HashBytes(c.data.data(), c.data.size(), h);
+}
+
+uint64_t ProfileData::CodeHash(const RuntimeFunction& function, MethodArea& method_area) {
+    uint64_t h = HashBytes(nullptr, 0);
+    for (const Operation& op : function.code) {
+        uint8_t head[3] = {uint8_t(uint16_t(op.code) >> 8), uint8_t(op.code),
+                           static_cast<uint8_t>(op.arguments.size())};
+        h = HashBytes(head, sizeof(head), h);
+
+        // pool indices depend on the order constants were interned in, so
+        // the values behind them are hashed, and callees by name
+        uint16_t arg = op.arguments.size() >= 2 ? (op.arguments[0] << 8) | op.arguments[1] : 0;
+        const RuntimeFunction* callee = op.code == OperationCode::CALL && arg < method_area.Functions().size()
+                                            ? method_area.GetFunction(arg)
+                                            : nullptr;
+        if (op.code == OperationCode::LDC || op.code == OperationCode::NEWARR ||
+            op.code == OperationCode::HALT) {
+            h = HashConstant(method_area.GetConstant(arg), h);
+        } else if (callee) {
+            h = HashConstant(method_area.GetConstant(callee->name_index), h);
+        } else {
+            h = HashBytes(op.arguments.data(), op.arguments.size(), h);
+        }
+    }
+
+    return h;
+}
+
+ProfileData ProfileData::Collect(MethodArea& method_area) {
+    ProfileData profile;
+    for (RuntimeFunction* fn : method_area.Functions()) {
+        // a function that never ran may not even be decoded
+        if (!fn || (fn->call_count == 0 && fn->back_edge_count == 0)) continue;
+
+        profile.functions_.push_back(FunctionProfile{
+            FunctionName(method_area, *fn), CodeHash(*fn, method_area), fn->call_count, fn->back_edge_count});
+    }
+
+    return profile;
+}
+
+ProfileData ProfileData::Read(const std::string& path) {
+    std::ifstream in(path);
+    if (!in) {
+        throw std::runtime_error("Cannot read profile: " + path);
+    }
+
+    std::string line;
+    if (!std::getline(in, line) || line != kProfileHeader) {
+        throw std::runtime_error("Not a profile: " + path);
+    }
+
+    ProfileData profile;
+    while (std::getline(in, line)) {
+        if (line.empty()) continue;
+
+        std::istringstream fields(line);
+        FunctionProfile fn;
+        fields >> std::hex >> fn.code_hash >> std::dec >> fn.invocations >> fn.back_edges;
+        fields.ignore(1);
+        std::getline(fields, fn.name);
+        if (fields.fail() || fn.name.empty()) {
+            throw std::runtime_error("Malformed profile line in " + path + ": " + line);
+        }
+        profile.functions_.push_back(std::move(fn));
+    }
+
+    return profile;
+}
+
+void ProfileData::Write(const std::string& path) const {
+    std::ofstream out(path, std::ios::trunc);
+    out << kProfileHeader << '\n';
+    for (const FunctionProfile& fn : functions_) {
+        out << std::hex << fn.code_hash << std::dec << ' ' << fn.invocations << ' '
+            << fn.back_edges << ' ' << fn.name << '\n';
+    }
+
+    if (!out) {
+        throw std::runtime_error("Cannot write profile: " + path);
+    }
+}
+
+size_t ProfileData::Apply(MethodArea& method_area) const {
+    size_t applied = 0;
+    for (const FunctionProfile& saved : functions_) {
+        std::optional<uint16_t> index = method_area.FindFunction(saved.name);
+        if (!index) continue;
+
+        RuntimeFunction& fn = *method_area.GetFunction(*index);
+        method_area.EnsureCode(fn);
+        if (CodeHash(fn, method_area) != saved.code_hash) continue;
+
+        fn.call_count = std::max(fn.call_count, saved.invocations);
+        fn.back_edge_count = std::max(fn.back_edge_count, saved.back_edges);
+        // a flag rather than a raised call count, which Collect() would
+        // save as calls that never happened
+        if (saved.back_edges >= kHotBackEdges) {
+            fn.jit_on_first_call = true;
+        }
+        applied++;
+    }
+
+    return applied;
+}
+
+const std::vector<FunctionProfile>& ProfileData::Functions() const {
+    return functions_;
+}
+
+}  // namespace czffvm
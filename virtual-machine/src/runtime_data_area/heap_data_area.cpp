@@ -1,82 +1,105 @@
+#include <algorithm>
+
 #include "heap_data_area.hpp"
 
 namespace czffvm {
 
-Heap::Heap(StackDataArea& stack, uint32_t max_heap_size_in_kib, bool is_gc_off)
-    : stack_(stack), max_heap_size_in_kib_(max_heap_size_in_kib), is_gc_off_(is_gc_off) {}
+Heap::Heap(StackDataArea& stack,
+           uint32_t max_heap_size_in_kib,
+           bool is_gc_off,
+           uint32_t gc_growth_percent,
+           uint32_t large_object_threshold_in_kib,
+           bool use_huge_pages)
+    : large_objects_(large_object_threshold_in_kib, use_huge_pages),
+      stack_(stack),
+      max_heap_size_in_kib_(max_heap_size_in_kib),
+      is_gc_off_(is_gc_off),
+      gc_growth_percent_(gc_growth_percent) {
+    UpdateCollectionTrigger();
+}
 
-HeapRef Heap::Allocate(const std::string& type,
-                       std::vector<Value>&& fields) {
-    size_t approximate_size = EstimateSize(type, fields);
-    if ((used_bytes_ + approximate_size) / kBytesInKiB > max_heap_size_in_kib_ && !is_gc_off_) {
-        Collect();
+HeapRef Heap::AllocateArray(uint32_t type_id,
+                            uint32_t length,
+                            const Value& element) {
+    size_t approximate_size = sizeof(HeapObject) + size_t(length) * sizeof(Value);
+    if (auto* s = std::get_if<StringRef>(&element)) {
+        approximate_size += size_t(length) * (*s)->size();
     }
+    Reserve(approximate_size);
 
-    if ((used_bytes_ + approximate_size) / kBytesInKiB > max_heap_size_in_kib_) {
-        throw std::runtime_error("Heap memory limit exceeded");
-    }
+    return Place(HeapObject{
+        .marked = false,
+        .element_kind = types_.Get(type_id).element_kind,
+        .type_id = type_id,
+        .size = approximate_size,
+        .fields = HeapFields(length, element, HeapAllocator<Value>(&large_objects_))
+    });
+}
 
-    if (!free_list_.empty()) {
-        uint32_t id = free_list_.back();
-        free_list_.pop_back();
-        objects_[id] = HeapObject{
-            .marked = false,
-            .type = type,
-            .fields = std::move(fields)
-        };
-        used_bytes_ += approximate_size;
+HeapFields Heap::MakeFields(size_t length, const Value& element) {
+    return HeapFields(length, element, HeapAllocator<Value>(&large_objects_));
+}
 
-        return HeapRef(id);
+HeapRef Heap::Allocate(uint32_t type_id,
+                       HeapFields&& fields) {
+    size_t approximate_size = EstimateSize(fields);
+    Reserve(approximate_size);
+
+    // only a buffer from MakeFields is adopted as is; others are moved
+    // over so large ones still land in this heap's large object space
+    if (fields.get_allocator().Space() != &large_objects_) {
+        fields = HeapFields(std::make_move_iterator(fields.begin()),
+                            std::make_move_iterator(fields.end()),
+                            HeapAllocator<Value>(&large_objects_));
     }
 
-    HeapRef ref{ objects_.size() };
-
-    objects_.push_back(HeapObject{
+    return Place(HeapObject{
         .marked = false,
-        .type = type,
+        .element_kind = types_.Get(type_id).element_kind,
+        .type_id = type_id,
+        .size = approximate_size,
         .fields = std::move(fields)
     });
-    used_bytes_ += approximate_size;
-
-    return ref;
 }
 
-HeapRef Heap::Allocate(const std::string& type,
-                       std::vector<Value>& fields) {
-    size_t approximate_size = EstimateSize(type, fields);
-    if ((used_bytes_ + approximate_size) / kBytesInKiB > max_heap_size_in_kib_ && !is_gc_off_) {
+void Heap::Reserve(size_t bytes) {
+    if (used_bytes_ + bytes > next_gc_bytes_ && !is_gc_off_) {
         Collect();
     }
 
-    if ((used_bytes_ + approximate_size) / kBytesInKiB > max_heap_size_in_kib_) {
+    if ((used_bytes_ + bytes) / kBytesInKiB > max_heap_size_in_kib_) {
         throw std::runtime_error("Heap memory limit exceeded");
     }
 
+    used_bytes_ += bytes;
+}
+
+HeapRef Heap::Place(HeapObject&& obj) {
     if (!free_list_.empty()) {
         uint32_t id = free_list_.back();
         free_list_.pop_back();
-        objects_[id] = HeapObject{
-            .marked = false,
-            .type = type,
-            .fields = std::move(fields)
-        };
-        used_bytes_ += approximate_size;
+        objects_[id] = std::move(obj);
 
         return HeapRef(id);
     }
 
     HeapRef ref{ objects_.size() };
 
-    objects_.push_back(HeapObject{
-        .marked = false,
-        .type = type,
-        .fields = std::move(fields)
-    });
-    used_bytes_ += approximate_size;
+    objects_.push_back(std::move(obj));
 
     return ref;
 }
 
+HeapRef Heap::Allocate(const std::string& type,
+                       HeapFields&& fields) {
+    return Allocate(types_.Intern(type), std::move(fields));
+}
+
+HeapRef Heap::Allocate(const std::string& type,
+                       std::initializer_list<Value> fields) {
+    return Allocate(types_.Intern(type), HeapFields(fields, HeapAllocator<Value>(&large_objects_)));
+}
+
 HeapObject& Heap::Get(HeapRef ref) {
     if (ref.id >= objects_.size() || !objects_[ref.id]) {
         throw std::runtime_error("Invalid heap reference");
@@ -85,9 +108,50 @@ HeapObject& Heap::Get(HeapRef ref) {
     return objects_[ref.id].value();
 }
 
+// Releases an object whose lifetime is known to end here (frame arrays
+// proven not to escape by the escape analysis), without waiting for a GC.
+void Heap::Free(HeapRef ref) {
+    if (ref.id >= objects_.size() || !objects_[ref.id]) return;
+
+    used_bytes_ -= objects_[ref.id]->size;
+    objects_[ref.id].reset();
+    free_list_.push_back(ref.id);
+}
+
 void Heap::Collect() {
     MarkFromRoots();
     Sweep();
+    UpdateCollectionTrigger();
+}
+
+TypeTable& Heap::Types() {
+    return types_;
+}
+
+const TypeTable& Heap::Types() const {
+    return types_;
+}
+
+const LargeObjectSpace& Heap::LargeObjects() const {
+    return large_objects_;
+}
+
+uint64_t Heap::UsedBytes() const {
+    return used_bytes_;
+}
+
+uint64_t Heap::NextCollectionBytes() const {
+    return next_gc_bytes_;
+}
+
+// Next collection fires once the heap has grown by gc_growth_percent_
+// over what survived the last one (GOGC-style), never above the hard limit.
+void Heap::UpdateCollectionTrigger() {
+    uint64_t hard_limit = max_heap_size_in_kib_ * kBytesInKiB;
+    uint64_t target = used_bytes_ + used_bytes_ * gc_growth_percent_ / 100;
+
+    target = std::max<uint64_t>(target, uint64_t(kMinGcTriggerInKiB) * kBytesInKiB);
+    next_gc_bytes_ = std::min(target, hard_limit);
 }
 
 void Heap::MarkFromRoots() {
@@ -99,6 +163,16 @@ void Heap::MarkFromRoots() {
         for (auto& v : frame.operand_stack)
             if (auto* r = std::get_if<HeapRef>(&v))
                 Mark(*r);
+
+        for (auto& r : frame.frame_arrays)
+            Mark(r);
+    }
+
+    for (auto& frame : stack_.GetJitFrames()) {
+        if (!frame.stack_maps || frame.safepoint >= frame.stack_maps->size()) continue;
+
+        for (uint32_t word : (*frame.stack_maps)[frame.safepoint])
+            Mark(HeapRef{static_cast<uint32_t>(frame.base[word])});
     }
 }
 
@@ -121,7 +195,7 @@ void Heap::Sweep() {
         if (!obj) continue;
 
         if (!obj->marked) {
-            used_bytes_ -= EstimateSize(obj->type, obj->fields);
+            used_bytes_ -= obj->size;
             obj.reset();
             free_list_.push_back(i);
         } else {
@@ -130,11 +204,9 @@ void Heap::Sweep() {
     }
 }
 
-size_t Heap::EstimateSize(const std::string& type, const std::vector<Value>& fields) {
+size_t Heap::EstimateSize(const HeapFields& fields) {
     size_t size = sizeof(HeapObject);
 
-    size += type.size();
-
     size += fields.size() * sizeof(Value);
 
     for (auto& v : fields) {
@@ -145,20 +217,4 @@ size_t Heap::EstimateSize(const std::string& type, const std::vector<Value>& fie
     return size;
 }
 
-size_t Heap::EstimateSize(const std::string& type, const std::vector<Value>&& fields) {
-    size_t size = sizeof(HeapObject);
-
-    size += type.size();
-
-    size += fields.size() * sizeof(Value);
-
-    for (auto& v : fields) {
-        if (auto s = std::get_if<StringRef>(&v))
-            size += (*s)->size();
-    }
-
-    return size;
-}
-
-
 }
@@ -0,0 +1,82 @@
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#endif
+
+#include <stdexcept>
+
+#include "large_object_space.hpp"
+
+namespace czffvm {
+
+// Transparent huge pages only pay off for mappings of at least one huge page
+static constexpr size_t kHugePageSize = 2 * kBytesInKiB * kBytesInKiB;
+
+LargeObjectSpace::LargeObjectSpace(uint32_t threshold_in_kib, bool use_huge_pages)
+    : threshold_bytes_(size_t(threshold_in_kib) * kBytesInKiB),
+      use_huge_pages_(use_huge_pages) {}
+
+LargeObjectSpace::~LargeObjectSpace() {
+    for (auto& [ptr, bytes] : mappings_) {
+#ifdef _WIN32
+        VirtualFree(ptr, 0, MEM_RELEASE);
+#else
+        munmap(ptr, bytes);
+#endif
+    }
+}
+
+bool LargeObjectSpace::IsLarge(size_t bytes) const {
+    return threshold_bytes_ != 0 && bytes >= threshold_bytes_;
+}
+
+void* LargeObjectSpace::Map(size_t bytes) {
+#ifdef _WIN32
+    void* ptr = VirtualAlloc(nullptr, bytes, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+    if (!ptr) {
+        throw std::bad_alloc();
+    }
+#else
+    void* ptr = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (ptr == MAP_FAILED) {
+        throw std::bad_alloc();
+    }
+#ifdef MADV_HUGEPAGE
+    if (use_huge_pages_ && bytes >= kHugePageSize) {
+        madvise(ptr, bytes, MADV_HUGEPAGE);
+    }
+#endif
+#endif
+
+    mappings_.emplace(ptr, bytes);
+    mapped_bytes_ += bytes;
+
+    return ptr;
+}
+
+void LargeObjectSpace::Unmap(void* ptr, size_t bytes) {
+    auto it = mappings_.find(ptr);
+    if (it == mappings_.end()) {
+        return;
+    }
+
+    mapped_bytes_ -= it->second;
+    mappings_.erase(it);
+
+#ifdef _WIN32
+    VirtualFree(ptr, 0, MEM_RELEASE);
+#else
+    munmap(ptr, bytes);
+#endif
+}
+
+size_t LargeObjectSpace::MappedBytes() const {
+    return mapped_bytes_;
+}
+
+size_t LargeObjectSpace::MappingCount() const {
+    return mappings_.size();
+}
+
+}  // namespace czffvm
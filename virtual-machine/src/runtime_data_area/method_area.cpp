@@ -2,10 +2,42 @@
 
 namespace czffvm {
 
+static constexpr uint32_t kNoArrayType = UINT32_MAX;
+
+size_t MethodArea::ConstantHash::operator()(const Constant& c) const {
+    // FNV-1a over the tag and the bytes
+    uint64_t h = 14695981039346656037ull;
+    auto mix = [&](uint8_t byte) { h = (h ^ byte) * 1099511628211ull; };
+
+    mix(static_cast<uint8_t>(c.tag));
+    for (uint8_t byte : c.data) mix(byte);
+
+    return static_cast<size_t>(h);
+}
+
 uint16_t MethodArea::RegisterConstant(const Constant& constant) {
+    uint16_t index = static_cast<uint16_t>(constant_pool_.size());
+
+    // a string literal is allocated once, however often it is loaded
+    auto it = constant_index_.find(constant);
+    if (it != constant_index_.end()) {
+        constant_values_.push_back(constant_values_[it->second]);
+    } else {
+        constant_values_.push_back(ConstantToValue(constant));
+        constant_index_.emplace(constant, index);
+    }
     constant_pool_.push_back(constant);
 
-    return static_cast<uint16_t>(constant_pool_.size() - 1);
+    return index;
+}
+
+uint16_t MethodArea::InternConstant(const Constant& constant) {
+    auto it = constant_index_.find(constant);
+    if (it != constant_index_.end()) {
+        return it->second;
+    }
+
+    return RegisterConstant(constant);
 }
 
 const Constant& MethodArea::GetConstant(uint16_t index) const {
@@ -16,6 +48,107 @@ const Constant& MethodArea::GetConstant(uint16_t index) const {
     return constant_pool_[index];
 }
 
+const Value& MethodArea::GetConstantValue(uint16_t index) const {
+    if (index >= constant_values_.size()) {
+        throw std::out_of_range("MethodArea: constant pool index out of range");
+    }
+
+    return constant_values_[index];
+}
+
+std::vector<std::optional<uint16_t>> MethodArea::RetainFunctions(const std::vector<bool>& live) {
+    std::vector<std::optional<uint16_t>> index(functions_.size());
+    std::vector<RuntimeFunction*> kept;
+    for (size_t i = 0; i < functions_.size(); ++i) {
+        if (i < live.size() && live[i]) {
+            index[i] = static_cast<uint16_t>(kept.size());
+            kept.push_back(functions_[i]);
+        }
+    }
+    functions_ = std::move(kept);
+
+    function_names_.clear();
+    for (size_t i = 0; i < functions_.size(); ++i) {
+        IndexName(function_names_, functions_[i]->name_index, static_cast<uint16_t>(i));
+    }
+
+    for (RuntimeClass* cls : classes_) {
+        for (uint16_t& method : cls->methods) {
+            if (method >= index.size() || !index[method]) {
+                throw std::runtime_error("MethodArea: a class method is not retained");
+            }
+            method = *index[method];
+        }
+    }
+
+    return index;
+}
+
+std::vector<std::optional<uint16_t>> MethodArea::RetainConstants(const std::vector<bool>& live) {
+    std::vector<std::optional<uint16_t>> index(constant_pool_.size());
+    std::vector<Constant> pool;
+    std::vector<Value> values;
+    std::vector<uint32_t> array_types;
+    for (size_t i = 0; i < constant_pool_.size(); ++i) {
+        if (i >= live.size() || !live[i]) continue;
+
+        uint16_t kept = static_cast<uint16_t>(pool.size());
+        index[i] = kept;
+        pool.push_back(std::move(constant_pool_[i]));
+        values.push_back(std::move(constant_values_[i]));
+        if (i < array_types_.size() && array_types_[i] != kNoArrayType) {
+            array_types.resize(kept + 1, kNoArrayType);
+            array_types[kept] = array_types_[i];
+        }
+    }
+    constant_pool_ = std::move(pool);
+    constant_values_ = std::move(values);
+    array_types_ = std::move(array_types);
+
+    constant_index_.clear();
+    for (size_t i = 0; i < constant_pool_.size(); ++i) {
+        constant_index_.emplace(constant_pool_[i], static_cast<uint16_t>(i));
+    }
+
+    auto remap = [&](uint16_t& constant) {
+        if (constant >= index.size() || !index[constant]) {
+            throw std::runtime_error("MethodArea: a retained signature refers to a dropped constant");
+        }
+        constant = *index[constant];
+    };
+    for (RuntimeFunction* fn : functions_) {
+        remap(fn->name_index);
+        remap(fn->params_descriptor_index);
+        remap(fn->return_type_index);
+    }
+    for (RuntimeClass* cls : classes_) {
+        remap(cls->name_index);
+        for (RuntimeField& field : cls->fields) {
+            remap(field.name_index);
+            remap(field.field_descriptor_index);
+        }
+    }
+
+    return index;
+}
+
+void MethodArea::SetArrayType(uint16_t element_type_index, uint32_t type_id) {
+    if (element_type_index >= array_types_.size()) {
+        array_types_.resize(element_type_index + 1, kNoArrayType);
+    }
+
+    array_types_[element_type_index] = type_id;
+}
+
+std::optional<uint32_t> MethodArea::ArrayType(uint16_t element_type_index) const {
+    if (element_type_index >= array_types_.size() ||
+        array_types_[element_type_index] == kNoArrayType) {
+        return std::nullopt;
+    }
+
+    return array_types_[element_type_index];
+}
+
 uint16_t MethodArea::RegisterClass(RuntimeClass* cls) {
     if (!cls) {
         throw std::invalid_argument("MethodArea: null RuntimeClass");
@@ -23,7 +156,10 @@ uint16_t MethodArea::RegisterClass(RuntimeClass* cls) {
 
     classes_.push_back(std::move(cls));
 
-    return static_cast<uint16_t>(classes_.size() - 1);
+    uint16_t index = static_cast<uint16_t>(classes_.size() - 1);
+    IndexName(class_names_, cls->name_index, index);
+
+    return index;
 }
 
 uint16_t MethodArea::RegisterFunction(RuntimeFunction* fn) {
@@ -33,7 +169,28 @@ uint16_t MethodArea::RegisterFunction(RuntimeFunction* fn) {
 
     functions_.push_back(fn);
 
-    return static_cast<uint16_t>(functions_.size() - 1);
+    uint16_t index = static_cast<uint16_t>(functions_.size() - 1);
+    IndexName(function_names_, fn->name_index, index);
+
+    return index;
+}
+
+std::optional<uint16_t> MethodArea::FindFunction(const std::string& name) const {
+    auto it = function_names_.find(name);
+    if (it == function_names_.end()) {
+        return std::nullopt;
+    }
+
+    return it->second;
+}
+
+std::optional<uint16_t> MethodArea::FindClass(const std::string& name) const {
+    auto it = class_names_.find(name);
+    if (it == class_names_.end()) {
+        return std::nullopt;
+    }
+
+    return it->second;
 }
 
 const RuntimeClass* MethodArea::GetClass(uint16_t index) const {
@@ -64,6 +221,21 @@ const std::vector<Constant>& MethodArea::ConstantPool() const {
     return constant_pool_;
 }
 
+void MethodArea::SetCodeLoader(CodeLoader loader) {
+    code_loader_ = std::move(loader);
+}
+
+void MethodArea::EnsureCode(RuntimeFunction& fn) {
+    if (!fn.code_pending) {
+        return;
+    }
+    if (!code_loader_) {
+        throw std::runtime_error("MethodArea: no loader for a function body");
+    }
+
+    code_loader_(fn);
+}
+
 std::string MethodArea::ResolveName(uint16_t constant_index) const {
     const Constant& c = GetConstant(constant_index);
 
@@ -74,4 +246,15 @@ std::string MethodArea::ResolveName(uint16_t constant_index) const {
     return std::string(c.data.begin(), c.data.end());
 }
 
+// A later definition with the same name does not replace the first one
+void MethodArea::IndexName(std::unordered_map<std::string, uint16_t>& names,
+                           uint16_t name_index, uint16_t index) {
+    // functions built by hand may be registered before their name
+    if (name_index >= constant_pool_.size() || constant_pool_[name_index].tag != ConstantTag::STRING) {
+        return;
+    }
+
+    names.emplace(ResolveName(name_index), index);
+}
+
 } // namespace czffvm
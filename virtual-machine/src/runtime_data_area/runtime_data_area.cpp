@@ -2,10 +2,15 @@
 
 namespace czffvm {
 
-RuntimeDataArea::RuntimeDataArea(uint32_t max_heap_size_in_kib, bool is_gc_off)
+RuntimeDataArea::RuntimeDataArea(uint32_t max_heap_size_in_kib,
+                                 bool is_gc_off,
+                                 uint32_t gc_growth_percent,
+                                 uint32_t large_object_threshold_in_kib,
+                                 bool use_huge_pages)
     : stack_(),
     method_area_(),
-    heap_(Heap(stack_, max_heap_size_in_kib, is_gc_off)) { }
+    heap_(stack_, max_heap_size_in_kib, is_gc_off, gc_growth_percent,
+          large_object_threshold_in_kib, use_huge_pages) { }
 
 RuntimeDataArea::~RuntimeDataArea() = default;
 
@@ -21,4 +26,16 @@ Heap& RuntimeDataArea::GetHeap() {
     return heap_;
 }
 
+uint32_t RuntimeDataArea::ArrayTypeFor(uint16_t element_type_index) {
+    if (auto type_id = method_area_.ArrayType(element_type_index)) {
+        return *type_id;
+    }
+
+    const Constant& c = method_area_.GetConstant(element_type_index);
+    uint32_t type_id = heap_.Types().InternArrayOf(std::string(c.data.begin(), c.data.end()));
+    method_area_.SetArrayType(element_type_index, type_id);
+
+    return type_id;
+}
+
 }  // namespace czffvm
@@ -1,3 +1,5 @@
+#include <cassert>
+
 #include "stack_data_area.hpp"
 
 namespace czffvm {
@@ -19,6 +21,16 @@ void StackDataArea::PopFrame() {
     frames_.pop_back();
 }
 
+void StackDataArea::ReplaceFrame(RuntimeFunction* fn) {
+    CallFrame& frame = CurrentFrame();
+    frame.function = fn;
+    frame.pc = 0;
+    frame.locals.assign(fn->locals_count, Value{});
+    frame.operand_stack.clear();
+    frame.operand_stack.reserve(fn->max_stack);
+    frame.frame_arrays.clear();
+}
+
 CallFrame& StackDataArea::CurrentFrame() {
     if (frames_.empty()) {
         throw std::runtime_error("No active frame");
@@ -34,4 +46,23 @@ bool StackDataArea::Empty() const {
     return frames_.empty();
 }
 
+void StackDataArea::PushJitFrame(const JitFrame& frame) {
+    jit_frames_.push_back(frame);
+}
+
+void StackDataArea::PopJitFrame() noexcept {
+    assert(!jit_frames_.empty() && "JIT stack underflow");
+    if (!jit_frames_.empty()) {
+        jit_frames_.pop_back();
+    }
+}
+
+const std::vector<JitFrame>& StackDataArea::GetJitFrames() const {
+    return jit_frames_;
+}
+
+JitFrame* StackDataArea::CurrentJitFrame() {
+    return jit_frames_.empty() ? nullptr : &jit_frames_.back();
+}
+
 } // namespace czffvm
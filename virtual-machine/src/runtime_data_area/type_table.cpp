@@ -0,0 +1,72 @@
+#include "type_table.hpp"
+
+namespace czffvm {
+
+static ElementKind ClassifyElement(const std::string& element) {
+    if (element.empty())                return ElementKind::OTHER;
+    if (element == "B;")                return ElementKind::BOOL;
+    if (element == "String;")           return ElementKind::STRING;
+    if (element[0] == '[')              return ElementKind::ARRAY;
+    if (element[0] == 'I')              return ElementKind::SIGNED_INT;
+    if (element[0] == 'U')              return ElementKind::UNSIGNED_INT;
+    return ElementKind::OTHER;
+}
+
+static std::optional<Value> DefaultElement(const std::string& element) {
+    if (element == "U1;") return uint8_t(0);
+    if (element == "I1;") return int8_t(0);
+    if (element == "U2;") return uint16_t(0);
+    if (element == "I2;") return int16_t(0);
+    if (element == "U;") return uint32_t(0);
+    if (element == "I;") return int32_t(0);
+    if (element == "U8;") return uint64_t(0);
+    if (element == "I8;") return int64_t(0);
+    if (element == "U16;") return stdint128::uint128_t(0);
+    if (element == "I16;") return stdint128::int128_t(0);
+    if (element == "B;") return false;
+    if (element == "String;") return std::make_shared<std::string>(std::string());
+    return std::nullopt;
+}
+
+uint32_t TypeTable::Intern(const std::string& descriptor) {
+    auto it = ids_.find(descriptor);
+    if (it != ids_.end()) {
+        return it->second;
+    }
+
+    TypeInfo info;
+    info.descriptor = descriptor;
+    if (!descriptor.empty() && descriptor[0] == '[') {
+        std::string element = descriptor.substr(1);
+        info.element_kind = ClassifyElement(element);
+        info.element_default = DefaultElement(element);
+    }
+
+    uint32_t id = static_cast<uint32_t>(types_.size());
+    types_.push_back(std::move(info));
+    ids_.emplace(descriptor, id);
+
+    return id;
+}
+
+uint32_t TypeTable::InternArrayOf(const std::string& element_descriptor) {
+    return Intern("[" + element_descriptor);
+}
+
+const TypeInfo& TypeTable::Get(uint32_t id) const {
+    if (id >= types_.size()) {
+        throw std::out_of_range("TypeTable: type id out of range");
+    }
+
+    return types_[id];
+}
+
+const std::string& TypeTable::Descriptor(uint32_t id) const {
+    return Get(id).descriptor;
+}
+
+size_t TypeTable::Size() const {
+    return types_.size();
+}
+
+}  // namespace czffvm
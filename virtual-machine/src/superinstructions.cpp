@@ -0,0 +1,95 @@
+#include "superinstructions.hpp"
+
+namespace czffvm {
+
+static void Append(Operation& fused, const Operation& op) {
+    fused.arguments.insert(fused.arguments.end(), op.arguments.begin(), op.arguments.end());
+}
+
+SuperinstructionSelector::SuperinstructionSelector(RuntimeFunction& function)
+    : function_(function) {}
+
+size_t SuperinstructionSelector::Run() {
+    const auto& code = function_.code;
+    std::vector<Operation> fused_code = code;
+    size_t fused = 0;
+
+    using OC = OperationCode;
+    for (size_t pc = 0; pc < code.size(); ++pc) {
+        Operation op{OC::NOP, {}};
+
+        // longest patterns first; every pc gets its own match, so the ones
+        // reached by a jump into a sequence are fused as well
+        if (Match(pc, {OC::LDV, OC::LDV, OC::ADD, OC::STORE})) {
+            op.code = OC::LDV_LDV_ADD_STORE;
+            Append(op, code[pc]); Append(op, code[pc + 1]); Append(op, code[pc + 3]);
+        } else if (Match(pc, {OC::LDV, OC::LDC, OC::ADD, OC::STORE})) {
+            op.code = OC::LDV_LDC_ADD_STORE;
+            Append(op, code[pc]); Append(op, code[pc + 1]); Append(op, code[pc + 3]);
+        } else if (Match(pc, {OC::LDV, OC::LDC}) && IsComparison(pc + 2) && Match(pc + 3, {OC::JZ})) {
+            op.code = OC::LDV_LDC_CMP_JZ;
+            Append(op, code[pc]); Append(op, code[pc + 1]);
+            op.arguments.push_back(static_cast<uint8_t>(code[pc + 2].code));
+            Append(op, code[pc + 3]);
+        } else if (Match(pc, {OC::LDV, OC::LDV, OC::LDELEM})) {
+            op.code = OC::LDV_LDV_LDELEM;
+            Append(op, code[pc]); Append(op, code[pc + 1]);
+        } else if (IsComparison(pc) && Match(pc + 1, {OC::JZ})) {
+            op.code = OC::CMP_JZ;
+            op.arguments.push_back(static_cast<uint8_t>(code[pc].code));
+            Append(op, code[pc + 1]);
+        } else if (Match(pc, {OC::LDV, OC::LDV})) {
+            op.code = OC::LDV_LDV;
+            Append(op, code[pc]); Append(op, code[pc + 1]);
+        } else if (Match(pc, {OC::LDV, OC::LDC})) {
+            op.code = OC::LDV_LDC;
+            Append(op, code[pc]); Append(op, code[pc + 1]);
+        } else {
+            continue;
+        }
+
+        fused_code[pc] = std::move(op);
+        fused++;
+    }
+
+    if (fused == 0) {
+        function_.fused_code.clear();
+    } else {
+        function_.fused_code = std::move(fused_code);
+    }
+    return fused;
+}
+
+size_t SuperinstructionSelector::Length(OperationCode code) {
+    switch (code) {
+        case OperationCode::LDV_LDV:
+        case OperationCode::LDV_LDC:
+        case OperationCode::CMP_JZ:
+            return 2;
+        case OperationCode::LDV_LDV_LDELEM:
+            return 3;
+        case OperationCode::LDV_LDV_ADD_STORE:
+        case OperationCode::LDV_LDC_ADD_STORE:
+        case OperationCode::LDV_LDC_CMP_JZ:
+            return 4;
+        default:
+            return 1;
+    }
+}
+
+bool SuperinstructionSelector::Match(size_t pc, std::initializer_list<OperationCode> pattern) const {
+    const auto& code = function_.code;
+    if (pc + pattern.size() > code.size()) return false;
+    for (OperationCode expected : pattern) {
+        if (code[pc++].code != expected) return false;
+    }
+    return true;
+}
+
+bool SuperinstructionSelector::IsComparison(size_t pc) const {
+    if (pc >= function_.code.size()) return false;
+    OperationCode code = function_.code[pc].code;
+    return code == OperationCode::EQ || code == OperationCode::LT || code == OperationCode::LEQ;
+}
+
+}  // namespace czffvm
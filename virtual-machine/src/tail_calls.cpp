@@ -0,0 +1,292 @@
+#include "tail_calls.hpp"
+
+namespace czffvm {
+
+static uint16_t DecodeU2(const Operation& op) {
+    return (op.arguments[0] << 8) | op.arguments[1];
+}
+
+static Operation WithU2(OperationCode code, uint32_t value) {
+    return Operation{code, {uint8_t((value >> 8) & 0xFF), uint8_t(value & 0xFF)}};
+}
+
+static bool IsJump(OperationCode code) {
+    return code == OperationCode::JMP ||
+           code == OperationCode::JZ ||
+           code == OperationCode::JNZ;
+}
+
+static std::string ConstantString(MethodArea& method_area, uint16_t index) {
+    const Constant& c = method_area.GetConstant(index);
+    return std::string(c.data.begin(), c.data.end());
+}
+
+TailCallEliminator::TailCallEliminator(RuntimeFunction& function, MethodArea& method_area)
+    : function_(function), method_area_(method_area) {}
+
+size_t TailCallEliminator::Run() {
+    auto& code = function_.code;
+    argc_ = ArgumentCount(function_);
+
+    std::vector<size_t> sites;
+    std::vector<int> depth = StackDepths();
+    for (size_t pc = 0; pc + 1 < code.size(); ++pc) {
+        if (code[pc].code != OperationCode::CALL || code[pc + 1].code != OperationCode::RET) continue;
+        if (depth[pc] != static_cast<int>(argc_)) continue;
+
+        uint16_t fn_idx = DecodeU2(code[pc]);
+        if (fn_idx < method_area_.Functions().size() && method_area_.GetFunction(fn_idx) == &function_) {
+            sites.push_back(pc);
+        }
+    }
+    if (sites.empty()) return 0;
+
+    // a frame starts with default values, Value{} is I1 0
+    std::vector<bool> reset = LocalsReadBeforeWrite();
+    uint16_t zero = 0;
+    bool needs_zero = false;
+    for (bool r : reset) needs_zero = needs_zero || r;
+    if (needs_zero) {
+        zero = method_area_.InternConstant(Constant{ConstantTag::I1, {0}});
+    }
+
+    size_t prologue = ParameterStores();
+    bool use_temps = prologue == 0 && argc_ > 2;
+    uint32_t temps = function_.locals_count;
+    if (use_temps && temps + argc_ > UINT16_MAX) return 0;
+
+    std::vector<Operation> out;
+    std::vector<size_t> new_pc(code.size() + 1, 0);
+    std::vector<size_t> jumps;
+
+    size_t next_site = 0;
+    for (size_t pc = 0; pc < code.size(); ++pc) {
+        new_pc[pc] = out.size();
+
+        if (next_site == sites.size() || sites[next_site] != pc) {
+            if (IsJump(code[pc].code)) jumps.push_back(out.size());
+            out.push_back(code[pc]);
+            continue;
+        }
+        next_site++;
+
+        uint32_t entry = 0;
+        if (prologue > 0) {
+            // the top of the stack is the last parameter
+            for (size_t k = argc_; k-- > 0;) {
+                out.push_back(code[k]);
+            }
+            entry = static_cast<uint32_t>(prologue);
+        } else if (argc_ == 2) {
+            out.push_back(Operation{OperationCode::SWAP, {}});
+        } else if (use_temps) {
+            for (size_t k = argc_; k-- > 0;) {
+                out.push_back(WithU2(OperationCode::STORE, temps + k));
+            }
+            for (size_t k = argc_; k-- > 0;) {
+                out.push_back(WithU2(OperationCode::LDV, temps + k));
+            }
+        }
+
+        for (size_t local = 0; local < reset.size(); ++local) {
+            if (!reset[local]) continue;
+            out.push_back(WithU2(OperationCode::LDC, zero));
+            out.push_back(WithU2(OperationCode::STORE, local));
+        }
+
+        // nothing is inserted before the entry, so its pc stays the same
+        out.push_back(WithU2(OperationCode::JMP, entry));
+    }
+    new_pc[code.size()] = out.size();
+
+    if (out.size() > UINT16_MAX) return 0;
+
+    for (size_t j : jumps) {
+        Operation& op = out[j];
+        uint32_t target = static_cast<uint32_t>(new_pc[DecodeU2(op)]);
+        op.arguments = WithU2(op.code, target).arguments;
+    }
+
+    code = std::move(out);
+    if (use_temps) {
+        function_.locals_count = static_cast<uint16_t>(temps + argc_);
+    }
+
+    return sites.size();
+}
+
+// Operand stack depth before each instruction, -1 when unreachable or
+// inconsistent (every depth is then -1 and nothing is rewritten)
+std::vector<int> TailCallEliminator::StackDepths() const {
+    const auto& code = function_.code;
+    std::vector<int> depth(code.size(), -1);
+    if (code.empty()) return depth;
+
+    std::vector<size_t> worklist{0};
+    depth[0] = static_cast<int>(argc_);
+
+    auto fail = [&]() {
+        depth.assign(code.size(), -1);
+        return depth;
+    };
+
+    while (!worklist.empty()) {
+        size_t pc = worklist.back();
+        worklist.pop_back();
+
+        const Operation& op = code[pc];
+        int d = depth[pc];
+        std::vector<size_t> successors{pc + 1};
+
+        switch (op.code) {
+            case OperationCode::RET:
+            case OperationCode::HALT:
+                successors.clear();
+                break;
+
+            case OperationCode::LDC:
+            case OperationCode::LDV:
+            case OperationCode::DUP:
+                d += 1;
+                break;
+
+            case OperationCode::NOP:
+            case OperationCode::SWAP:
+            case OperationCode::NEG:
+            case OperationCode::MIN:
+            case OperationCode::NEWARR:
+                break;
+
+            case OperationCode::STELEM:
+                d -= 3;
+                break;
+
+            case OperationCode::JMP:
+                successors = {DecodeU2(op)};
+                break;
+
+            case OperationCode::JZ:
+            case OperationCode::JNZ:
+                d -= 1;
+                successors.push_back(DecodeU2(op));
+                break;
+
+            case OperationCode::CALL: {
+                uint16_t fn_idx = DecodeU2(op);
+                if (fn_idx >= method_area_.Functions().size()) return fail();
+                const RuntimeFunction* callee = method_area_.GetFunction(fn_idx);
+                d -= static_cast<int>(ArgumentCount(*callee));
+                if (ReturnsValue(*callee)) d += 1;
+                break;
+            }
+
+            default:
+                // STORE, PRINT and binary operations
+                d -= 1;
+                break;
+        }
+
+        if (d < 0) return fail();
+
+        for (size_t next : successors) {
+            if (next >= code.size()) return fail();
+            if (depth[next] < 0) {
+                depth[next] = d;
+                worklist.push_back(next);
+            } else if (depth[next] != d) {
+                return fail();
+            }
+        }
+    }
+
+    return depth;
+}
+
+// Locals that some path from the entry loads before storing
+std::vector<bool> TailCallEliminator::LocalsReadBeforeWrite() const {
+    const auto& code = function_.code;
+    std::vector<bool> read(function_.locals_count, false);
+    if (code.empty()) return read;
+
+    // assigned[pc]: locals stored on every path reaching pc
+    std::vector<std::vector<bool>> assigned(code.size());
+    std::vector<bool> reached(code.size(), false);
+    std::vector<size_t> worklist{0};
+    assigned[0].assign(function_.locals_count, false);
+    reached[0] = true;
+
+    while (!worklist.empty()) {
+        size_t pc = worklist.back();
+        worklist.pop_back();
+
+        const Operation& op = code[pc];
+        std::vector<bool> state = assigned[pc];
+        std::vector<size_t> successors{pc + 1};
+
+        if (op.code == OperationCode::LDV) {
+            uint16_t local = DecodeU2(op);
+            if (local < read.size() && !state[local]) read[local] = true;
+        } else if (op.code == OperationCode::STORE) {
+            uint16_t local = DecodeU2(op);
+            if (local < state.size()) state[local] = true;
+        } else if (op.code == OperationCode::JMP) {
+            successors = {DecodeU2(op)};
+        } else if (op.code == OperationCode::JZ || op.code == OperationCode::JNZ) {
+            successors.push_back(DecodeU2(op));
+        } else if (op.code == OperationCode::RET || op.code == OperationCode::HALT) {
+            successors.clear();
+        }
+
+        for (size_t next : successors) {
+            if (next >= code.size()) continue;
+            if (!reached[next]) {
+                reached[next] = true;
+                assigned[next] = state;
+                worklist.push_back(next);
+                continue;
+            }
+
+            bool changed = false;
+            for (size_t i = 0; i < state.size(); ++i) {
+                if (assigned[next][i] && !state[i]) {
+                    assigned[next][i] = false;
+                    changed = true;
+                }
+            }
+            if (changed) worklist.push_back(next);
+        }
+    }
+
+    return read;
+}
+
+// Number of leading STOREs that take the parameters off the stack, 0 when
+// the function does not start that way or jumps into the middle of them
+size_t TailCallEliminator::ParameterStores() const {
+    const auto& code = function_.code;
+    if (argc_ == 0 || code.size() < argc_) return 0;
+
+    std::vector<bool> stored(function_.locals_count, false);
+    for (size_t k = 0; k < argc_; ++k) {
+        if (code[k].code != OperationCode::STORE) return 0;
+        uint16_t local = DecodeU2(code[k]);
+        if (local >= stored.size() || stored[local]) return 0;
+        stored[local] = true;
+    }
+
+    for (const auto& op : code) {
+        if (IsJump(op.code) && DecodeU2(op) > 0 && DecodeU2(op) < argc_) return 0;
+    }
+
+    return argc_;
+}
+
+size_t TailCallEliminator::ArgumentCount(const RuntimeFunction& fn) const {
+    return CountParams(ConstantString(method_area_, fn.params_descriptor_index));
+}
+
+bool TailCallEliminator::ReturnsValue(const RuntimeFunction& fn) const {
+    return ConstantString(method_area_, fn.return_type_index) != "void;";
+}
+
+}  // namespace czffvm
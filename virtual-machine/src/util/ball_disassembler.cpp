@@ -1,9 +1,11 @@
+#include <algorithm>
 #include <fstream>
 #include <iostream>
 #include <vector>
 #include <string>
 
 #include "ball_disassembler.hpp"
+#include "mapped_file.hpp"
 
 namespace czffvm {
 
@@ -11,20 +13,14 @@ BallDisassembler::BallDisassembler(const std::string& path)
         : path_(path) {}
 
 void BallDisassembler::Disassemble() {
-    std::ifstream file(path_, std::ios::binary);
-    if (!file) {
-        throw std::runtime_error("Cannot open file: " + path_);
-    }
-
-    std::vector<uint8_t> data(
-        (std::istreambuf_iterator<char>(file)),
-        std::istreambuf_iterator<char>()
-    );
-
-    ByteReader reader(data);
+    MappedFile file(path_);
+    ByteReader reader(file.Data(), file.Size());
 
     // Пропускаем заголовок и константы
-    LoadHeader(reader);
+    if (LoadHeader(reader) >= kIndexedBallVersion) {
+        DisassembleIndexed(file, reader);
+        return;
+    }
     LoadConstantPool(reader);
 
     // Читаем функции и печатаем opcodes
@@ -38,34 +34,70 @@ void BallDisassembler::Disassemble() {
 
         uint16_t code_len = reader.ReadU2();
         for (uint16_t b = 0; b < code_len; ++b) {
-            uint16_t op_code_raw = reader.ReadU2();
-            OperationCode op_code = static_cast<OperationCode>(op_code_raw);
+            PrintOperation(reader, b, false);
+        }
+    }
+}
 
-            std::string op_name = OperationCodeToString(op_code);
+// v2: the bodies are found through the function table, so the constants
+// need not be walked
+void BallDisassembler::DisassembleIndexed(const MappedFile& file, ByteReader& r) {
+    auto sections = ReadBallSections(r);
+    auto functions = sections.find(static_cast<uint32_t>(BallSection::FUNCTIONS));
+    auto code = sections.find(static_cast<uint32_t>(BallSection::CODE));
+    if (functions == sections.end() || code == sections.end())
+        throw std::runtime_error("Missing function table or code section");
+
+    ByteReader table(file.Data() + functions->second.offset, functions->second.size);
+    uint32_t fn_count = table.ReadU4();
+    table.ReadU4(); // reserved
+    for (uint32_t i = 0; i < fn_count; ++i) {
+        BallFunctionEntry entry = ReadBallFunctionEntry(table);
+        if (entry.code_offset > code->second.size)
+            throw std::runtime_error("Function body exceeds the code section");
+
+        const uint8_t* body = file.Data() + code->second.offset + entry.code_offset;
+        ByteReader reader(body, std::min<size_t>(entry.code_size, code->second.size - entry.code_offset));
+        for (uint32_t b = 0; b < entry.code_length; ++b) {
+            PrintOperation(reader, b, true);
+        }
+    }
+}
 
-            std::cout << b << "\t" << op_name;
+void BallDisassembler::PrintOperation(ByteReader& reader, uint32_t pc, bool wide_jumps) {
+    uint16_t op_code_raw = reader.ReadU2();
+    OperationCode op_code = static_cast<OperationCode>(op_code_raw);
 
-            // Считываем аргументы, если есть
-            if (HasArguments(op_code)) {
-                uint8_t arg1 = reader.ReadU1();
-                uint8_t arg2 = reader.ReadU1();
-                std::cout << "\t[" << (int)arg1 << ", " << (int)arg2 << "]";
-            }
+    std::string op_name = OperationCodeToString(op_code);
 
-            std::cout << "\n";
-        }
+    std::cout << pc << "\t" << op_name;
+
+    // Считываем аргументы, если есть
+    bool wide = wide_jumps && (op_code == OperationCode::JMP ||
+                               op_code == OperationCode::JZ ||
+                               op_code == OperationCode::JNZ);
+    if (wide) {
+        std::cout << "\t[" << reader.ReadU4() << "]";
+    } else if (HasArguments(op_code)) {
+        uint8_t arg1 = reader.ReadU1();
+        uint8_t arg2 = reader.ReadU1();
+        std::cout << "\t[" << (int)arg1 << ", " << (int)arg2 << "]";
     }
+
+    std::cout << "\n";
 }
 
-void BallDisassembler::LoadHeader(ByteReader& r) {
+uint8_t BallDisassembler::LoadHeader(ByteReader& r) {
     uint32_t magic = r.ReadU4();
     if (magic != kMagicNumber)
         throw std::runtime_error("Invalid magic number");
 
-    r.ReadU1(); // version major
+    uint8_t major = r.ReadU1(); // version major
     r.ReadU1(); // version minor
     r.ReadU1(); // version patch
     r.ReadU1(); // flags
+
+    return major;
 }
 
 void BallDisassembler::LoadConstantPool(ByteReader& r) {
@@ -73,16 +105,16 @@ void BallDisassembler::LoadConstantPool(ByteReader& r) {
     for (uint16_t i = 0; i < count; ++i) {
         ConstantTag tag = static_cast<ConstantTag>(r.ReadU1());
         switch (tag) {
-            case ConstantTag::U1: r.ReadU1(); break;
-            case ConstantTag::U2: r.ReadU1(); r.ReadU1(); break;
-            case ConstantTag::U4: r.ReadU1(); r.ReadU1(); r.ReadU1(); r.ReadU1(); break;
-            case ConstantTag::I4: r.ReadU1(); r.ReadU1(); r.ReadU1(); r.ReadU1(); break;
-            case ConstantTag::STRING: r.ReadString(); break;
-            case ConstantTag::U8: for(int i=0;i<8;i++) r.ReadU1(); break;
-            case ConstantTag::I8: for(int i=0;i<8;i++) r.ReadU1(); break;
-            case ConstantTag::U16: for(int i=0;i<16;i++) r.ReadU1(); break;
-            case ConstantTag::I16: for(int i=0;i<16;i++) r.ReadU1(); break;
-            case ConstantTag::BOOL: r.ReadU1(); break;
+            case ConstantTag::U1: r.ReadBytes(1); break;
+            case ConstantTag::U2: r.ReadBytes(2); break;
+            case ConstantTag::U4: r.ReadBytes(4); break;
+            case ConstantTag::I4: r.ReadBytes(4); break;
+            case ConstantTag::STRING: r.ReadBytes(r.ReadU2()); break;
+            case ConstantTag::U8: r.ReadBytes(8); break;
+            case ConstantTag::I8: r.ReadBytes(8); break;
+            case ConstantTag::U16: r.ReadBytes(16); break;
+            case ConstantTag::I16: r.ReadBytes(16); break;
+            case ConstantTag::BOOL: r.ReadBytes(1); break;
             default:
                 std::cerr << "Got tag: " << (int)static_cast<uint8_t>(tag) << "\n";
                 throw std::runtime_error("Unsupported constant in pool");
@@ -132,6 +164,18 @@ std::string BallDisassembler::OperationCodeToString(OperationCode code) {
         case OperationCode::JMP: return "JMP";
         case OperationCode::JZ: return "JZ";
         case OperationCode::JNZ: return "JNZ";
+        case OperationCode::NOP: return "NOP";
+        case OperationCode::NEG: return "NEG";
+        case OperationCode::MOD: return "MOD";
+        case OperationCode::LOR: return "LOR";
+        case OperationCode::LAND: return "LAND";
+        case OperationCode::LDV_LDV: return "LDV_LDV";
+        case OperationCode::LDV_LDC: return "LDV_LDC";
+        case OperationCode::LDV_LDV_ADD_STORE: return "LDV_LDV_ADD_STORE";
+        case OperationCode::LDV_LDC_ADD_STORE: return "LDV_LDC_ADD_STORE";
+        case OperationCode::CMP_JZ: return "CMP_JZ";
+        case OperationCode::LDV_LDC_CMP_JZ: return "LDV_LDC_CMP_JZ";
+        case OperationCode::LDV_LDV_LDELEM: return "LDV_LDV_LDELEM";
         default: return "UNKNOWN";
     }
 }
@@ -0,0 +1,82 @@
+#ifdef _WIN32
+#include <process.h>
+#else
+#include <unistd.h>
+#endif
+
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <stdexcept>
+
+#include "image_cache.hpp"
+#include "mapped_file.hpp"
+
+namespace czffvm {
+
+uint64_t HashBytes(const uint8_t* data, size_t size, uint64_t seed) {
+    uint64_t h = seed;
+    for (size_t i = 0; i < size; ++i) {
+        h = (h ^ data[i]) * 1099511628211ull;
+    }
+
+    return h;
+}
+
+ImageCache::ImageCache(std::string directory, std::string extension)
+    : directory_(std::move(directory)), extension_(std::move(extension)) {}
+
+uint64_t ImageCache::Key(const std::vector<std::string>& inputs, uint64_t options) {
+    uint8_t word[8];
+    auto mix = [&](uint64_t h, uint64_t value) {
+        for (int i = 0; i < 8; ++i) word[i] = uint8_t(value >> (8 * i));
+        return HashBytes(word, sizeof(word), h);
+    };
+
+    uint64_t h = mix(HashBytes(nullptr, 0), options);
+    for (const std::string& path : inputs) {
+        MappedFile file(path);
+        // the size separates the contents of consecutive inputs
+        h = mix(h, file.Size());
+        h = HashBytes(file.Data(), file.Size(), h);
+    }
+
+    return h;
+}
+
+std::string ImageCache::PathFor(uint64_t key) const {
+    char name[17];
+    std::snprintf(name, sizeof(name), "%016llx", static_cast<unsigned long long>(key));
+
+    return (std::filesystem::path(directory_) / (name + extension_)).string();
+}
+
+void ImageCache::Store(uint64_t key, const std::vector<uint8_t>& bytes) const {
+    std::error_code error;
+    std::filesystem::create_directories(directory_, error);
+    if (error) {
+        throw std::runtime_error("Cannot create cache directory: " + directory_);
+    }
+
+    std::string path = PathFor(key);
+#ifdef _WIN32
+    std::string temporary = path + "." + std::to_string(_getpid()) + ".tmp";
+#else
+    std::string temporary = path + "." + std::to_string(getpid()) + ".tmp";
+#endif
+    {
+        std::ofstream out(temporary, std::ios::binary | std::ios::trunc);
+        out.write(reinterpret_cast<const char*>(bytes.data()), static_cast<std::streamsize>(bytes.size()));
+        if (!out) {
+            throw std::runtime_error("Cannot write cache entry: " + temporary);
+        }
+    }
+
+    std::filesystem::rename(temporary, path, error);
+    if (error) {
+        std::filesystem::remove(temporary, error);
+        throw std::runtime_error("Cannot write cache entry: " + path);
+    }
+}
+
+}  // namespace czffvm
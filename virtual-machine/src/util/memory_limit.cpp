@@ -0,0 +1,116 @@
+#include <fstream>
+#include <limits>
+#include <sstream>
+
+#include "memory_limit.hpp"
+#include "common.hpp"
+
+namespace czffvm {
+
+static std::optional<uint64_t> ReadLimitFile(const std::string& path) {
+    std::ifstream file(path);
+    if (!file) {
+        return std::nullopt;
+    }
+
+    std::string raw;
+    file >> raw;
+    if (raw.empty() || raw == "max") {
+        return std::nullopt;
+    }
+
+    try {
+        size_t parsed = 0;
+        uint64_t value = std::stoull(raw, &parsed);
+        if (parsed != raw.size() || value == 0 || value >= kCgroupUnlimitedThreshold) {
+            return std::nullopt;
+        }
+        return value;
+    } catch (const std::exception&) {
+        return std::nullopt;
+    }
+}
+
+struct OwnCgroup {
+    std::string unified = "/";    // cgroup v2
+    std::string memory = "/";     // cgroup v1 memory controller
+};
+
+// Lines of /proc/self/cgroup are `<hierarchy id>:<controllers>:<path>`
+static OwnCgroup ReadOwnCgroup(const std::string& proc_cgroup) {
+    OwnCgroup own;
+    std::ifstream file(proc_cgroup);
+
+    std::string line;
+    while (std::getline(file, line)) {
+        size_t first = line.find(':');
+        size_t second = first == std::string::npos ? first : line.find(':', first + 1);
+        if (second == std::string::npos) continue;
+
+        std::string id = line.substr(0, first);
+        std::string controllers = line.substr(first + 1, second - first - 1);
+        std::string path = line.substr(second + 1);
+
+        if (id == "0" && controllers.empty()) {
+            own.unified = path;
+            continue;
+        }
+
+        std::istringstream names(controllers);
+        std::string name;
+        while (std::getline(names, name, ',')) {
+            if (name == "memory") own.memory = path;
+        }
+    }
+
+    return own;
+}
+
+// The tightest limit from the cgroup at `path` up to `base`
+static std::optional<uint64_t> ReadHierarchyLimit(const std::string& base, std::string path,
+                                                  const std::string& file) {
+    while (!path.empty() && path.back() == '/') path.pop_back();
+
+    std::optional<uint64_t> tightest;
+    while (true) {
+        auto limit = ReadLimitFile(base + path + "/" + file);
+        if (limit && (!tightest || *limit < *tightest)) {
+            tightest = limit;
+        }
+        if (path.empty()) break;
+
+        size_t slash = path.rfind('/');
+        path.erase(slash == std::string::npos ? 0 : slash);
+    }
+
+    return tightest;
+}
+
+std::optional<uint64_t> ReadCgroupMemoryLimit(const std::string& cgroup_root, const std::string& proc_cgroup) {
+    OwnCgroup own = ReadOwnCgroup(proc_cgroup);
+
+    if (auto limit = ReadHierarchyLimit(cgroup_root, own.unified, "memory.max")) {
+        return limit;
+    }
+
+    return ReadHierarchyLimit(cgroup_root + "/memory", own.memory, "memory.limit_in_bytes");
+}
+
+uint32_t AutoMaxHeapSizeInKiB(uint32_t percent, const std::string& cgroup_root,
+                              const std::string& proc_cgroup) {
+    auto limit = ReadCgroupMemoryLimit(cgroup_root, proc_cgroup);
+    if (!limit) {
+        return kDefaultMaxHeapSizeInKiB;
+    }
+
+    uint64_t heap_kib = *limit / kBytesInKiB * percent / 100;
+    if (heap_kib == 0) {
+        return 1;
+    }
+
+    return static_cast<uint32_t>(
+        std::min<uint64_t>(heap_kib, std::numeric_limits<uint32_t>::max())
+    );
+}
+
+}  // namespace czffvm
@@ -0,0 +1,91 @@
+#include <utility>
+
+#include "thread_pool.hpp"
+
+namespace czffvm {
+
+ThreadPool::ThreadPool(size_t threads) {
+    for (size_t i = 1; i < threads; ++i) {
+        workers_.emplace_back([this] { WorkerLoop(); });
+    }
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stop_ = true;
+    }
+    wake_.notify_all();
+    for (auto& worker : workers_) {
+        worker.join();
+    }
+}
+
+size_t ThreadPool::Size() const {
+    return workers_.size() + 1;
+}
+
+void ThreadPool::ParallelFor(size_t count, const std::function<void(size_t)>& body) {
+    if (count == 0) return;
+
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        body_ = &body;
+        count_ = count;
+        next_ = 0;
+        failed_index_ = SIZE_MAX;
+        error_ = nullptr;
+        running_ = workers_.size();
+        ++generation_;
+    }
+    wake_.notify_all();
+
+    RunItems();
+
+    std::exception_ptr error;
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        done_.wait(lock, [this] { return running_ == 0; });
+        body_ = nullptr;
+        error = std::exchange(error_, nullptr);
+    }
+
+    if (error) {
+        std::rethrow_exception(error);
+    }
+}
+
+void ThreadPool::WorkerLoop() {
+    uint64_t seen = 0;
+    std::unique_lock<std::mutex> lock(mutex_);
+
+    while (true) {
+        wake_.wait(lock, [&] { return stop_ || generation_ != seen; });
+        if (stop_) return;
+        seen = generation_;
+
+        lock.unlock();
+        RunItems();
+        lock.lock();
+
+        if (--running_ == 0) {
+            done_.notify_all();
+        }
+    }
+}
+
+void ThreadPool::RunItems() {
+    for (size_t i = next_++; i < count_; i = next_++) {
+        try {
+            (*body_)(i);
+        } catch (...) {
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (i < failed_index_) {
+                failed_index_ = i;
+                error_ = std::current_exception();
+            }
+        }
+    }
+}
+
+}  // namespace czffvm
@@ -1,3 +1,5 @@
+#include <iostream>
+
 #include "virtual_machine.hpp"
 
 namespace czffvm {
@@ -7,28 +9,126 @@ VirtualMachine::VirtualMachine(bool is_gc_off)
       loader_(runtime_data_area_),
       interpreter_(runtime_data_area_) {}
 
-VirtualMachine::VirtualMachine(uint32_t max_heap_size_in_kib, bool is_gc_off)
-    : runtime_data_area_(max_heap_size_in_kib, is_gc_off),
+VirtualMachine::VirtualMachine(uint32_t max_heap_size_in_kib,
+                               bool is_gc_off,
+                               uint32_t gc_growth_percent,
+                               uint32_t large_object_threshold_in_kib,
+                               bool use_huge_pages)
+    : runtime_data_area_(max_heap_size_in_kib, is_gc_off, gc_growth_percent,
+                         large_object_threshold_in_kib, use_huge_pages),
       loader_(runtime_data_area_),
       interpreter_(runtime_data_area_) {}
 
 void VirtualMachine::LoadStdlib(const std::string& path) {
+    if (image_cache_) {
+        stdlib_paths_.push_back(path);
+        return;
+    }
+
     loader_.LoadStdlib(path);
 }
 
 void VirtualMachine::LoadProgram(const std::string& path) {
+    if (!image_cache_) {
+        loader_.LoadProgram(path);
+        return;
+    }
+
+    std::vector<std::string> inputs = stdlib_paths_;
+    inputs.push_back(path);
+    uint64_t key;
+    try {
+        key = ImageCache::Key(inputs, loader_.ImageOptions());
+    } catch (const std::runtime_error&) {
+        // unreadable inputs are reported by the loader
+        for (const auto& stdlib : stdlib_paths_) loader_.LoadStdlib(stdlib);
+        loader_.LoadProgram(path);
+        return;
+    }
+
+    if (loader_.LoadImage(image_cache_->PathFor(key), key)) {
+        return;
+    }
+
+    for (const auto& stdlib : stdlib_paths_) loader_.LoadStdlib(stdlib);
     loader_.LoadProgram(path);
+
+    // a cache that cannot be written only costs the next start its speed
+    try {
+        image_cache_->Store(key, loader_.SaveImage(key));
+    } catch (const std::runtime_error& e) {
+        std::cerr << "Warning: " << e.what() << std::endl;
+    }
 }
 
 void VirtualMachine::Run() {
     interpreter_.Execute(loader_.EntryPoint());
+    interpreter_.PrintOpcodeProfile(std::cerr);
+    interpreter_.SaveProfile();
+}
+
+void VirtualMachine::EnableEscapeAnalysis() {
+    loader_.EnableEscapeAnalysis(true);
+}
+
+void VirtualMachine::EnableTailCallElimination() {
+    loader_.EnableTailCallElimination(true);
+}
+
+void VirtualMachine::EnableBytecodeOptimization() {
+    loader_.SetBytecodeOptimizer(czffvm_jit::OptimizeBytecode);
+}
+
+void VirtualMachine::EnableSuperinstructions() {
+    loader_.EnableSuperinstructions(true);
+}
+
+void VirtualMachine::EnableLazyDecoding() {
+    loader_.EnableLazyDecoding(true);
+}
+
+void VirtualMachine::EnableTreeShaking() {
+    loader_.EnableTreeShaking(true);
+}
+
+void VirtualMachine::SetLoadThreads(size_t threads) {
+    loader_.SetLoadThreads(threads);
+}
+
+void VirtualMachine::SetImageCache(const std::string& directory) {
+    image_cache_.emplace(directory, ".img");
+}
+
+void VirtualMachine::SetJitCodeCache(const std::string& directory) {
+    jit_code_cache_ = directory;
+}
+
+void VirtualMachine::LoadProfile(const std::string& path) {
+    try {
+        ProfileData::Read(path).Apply(runtime_data_area_.GetMethodArea());
+    } catch (const std::runtime_error& e) {
+        // e.g. the first run of a job that reads and writes the same file
+        std::cerr << "Warning: " << e.what() << std::endl;
+    }
+}
+
+void VirtualMachine::SetProfileOutput(const std::string& path) {
+    interpreter_.SetProfileOutput(path);
+}
+
+void VirtualMachine::EnableOpcodeProfile() {
+    interpreter_.EnableOpcodeProfile();
 }
 
 void VirtualMachine::EnableJIT() {
 #ifdef CZFF_JIT_DISABLED
     throw std::runtime_error("JIT is disabled on this platform");
 #else
-    interpreter_.SetJitCompiler(czffvm_jit::JitCompiler::create());
+    auto jit = czffvm_jit::JitCompiler::create();
+    if (!jit_code_cache_.empty()) {
+        jit->SetCodeCache(jit_code_cache_);
+    }
+    interpreter_.SetJitCompiler(std::move(jit));
 #endif
 }
 
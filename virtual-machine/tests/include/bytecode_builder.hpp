@@ -0,0 +1,45 @@
+#pragma once
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "common.hpp"
+#include "runtime_data_area/method_area.hpp"
+
+/**
+ * Helpers for tests that put functions together from operations instead
+ * of loading a .ball file. Constants are registered in the method area
+ * returned by BytecodeMethodArea().
+ */
+struct BytecodeBuilder {
+    virtual ~BytecodeBuilder() = default;
+    virtual czffvm::MethodArea& BytecodeMethodArea() = 0;
+
+    uint16_t Str(const std::string& s) {
+        return BytecodeMethodArea().RegisterConstant(
+            czffvm::Constant{czffvm::ConstantTag::STRING, std::vector<uint8_t>(s.begin(), s.end())});
+    }
+
+    czffvm::Operation LDC(czffvm::ConstantTag tag, std::vector<uint8_t> data) {
+        return WithU2(czffvm::OperationCode::LDC,
+                      BytecodeMethodArea().RegisterConstant(czffvm::Constant{tag, std::move(data)}));
+    }
+
+    czffvm::Operation LDC(int32_t value) {
+        return LDC(czffvm::ConstantTag::I4, {
+            uint8_t((value >> 24) & 0xFF), uint8_t((value >> 16) & 0xFF),
+            uint8_t((value >> 8) & 0xFF), uint8_t(value & 0xFF)});
+    }
+
+    czffvm::Operation NEWARR(const std::string& element) {
+        return WithU2(czffvm::OperationCode::NEWARR, Str(element));
+    }
+
+    static czffvm::Operation WithU2(czffvm::OperationCode code, uint16_t value) {
+        return czffvm::Operation{code, {uint8_t((value >> 8) & 0xFF), uint8_t(value & 0xFF)}};
+    }
+
+    static czffvm::Operation Op(czffvm::OperationCode code) {
+        return czffvm::Operation{code, {}};
+    }
+};
@@ -1,5 +1,8 @@
 #pragma once
+#include <list>
+
 #include "ball_builder.hpp"
+#include "class_loader.hpp"
 #include "common.hpp"
 
 inline std::vector<uint8_t> MakeMinimalBallWithMain() {
@@ -1093,3 +1096,368 @@ inline std::vector<uint8_t> MakeArrayWithForProgramBall() {
 
     return w.b;
 }
+
+// ---------- v2 (indexed) ----------
+
+namespace ball {
+
+// Sections of a v2 file, laid out 8-byte aligned after the section table
+struct IndexedBuilder {
+    std::list<std::pair<uint32_t, Builder>> sections;    // stable references
+
+    Builder& section(czffvm::BallSection id) {
+        sections.emplace_back(static_cast<uint32_t>(id), Builder{});
+        return sections.back().second;
+    }
+
+    std::vector<uint8_t> build(uint8_t major = 2) const {
+        Builder w;
+        w.u4(0x62616c6c);
+        w.u1(major); w.u1(0); w.u1(0);
+        w.u1(0);
+
+        auto align = [](size_t n) { return (n + 7) & ~size_t(7); };
+        size_t offset = align(w.b.size() + 4 + sections.size() * 12);
+
+        w.u2(sections.size());
+        w.u2(0);
+        for (const auto& [id, s] : sections) {
+            w.u4(id);
+            w.u4(offset);
+            w.u4(s.b.size());
+            offset = align(offset + s.b.size());
+        }
+        for (const auto& [id, s] : sections) {
+            w.b.resize(align(w.b.size()), 0);
+            w.b.insert(w.b.end(), s.b.begin(), s.b.end());
+        }
+
+        return w.b;
+    }
+};
+
+} // namespace ball
+
+// i = 0; while (i < 3) { print i; i = i + 1 }, with u4 jump targets.
+// `exit_target` replaces the loop exit to test out of range targets.
+inline std::vector<uint8_t> MakeIndexedLoopBall(uint32_t exit_target = 13) {
+    using namespace ball;
+    using czffvm::BallSection;
+    using czffvm::OperationCode;
+    IndexedBuilder ball;
+
+    // ---------- Strings ----------
+    std::vector<std::string> strings = {"Main", "", "void;"};
+    Builder& str = ball.section(BallSection::STRINGS);
+    str.u4(strings.size());
+    str.u4(0);
+    uint32_t blob = 8 + strings.size() * 8;
+    for (const auto& s : strings) {
+        str.u4(blob);
+        str.u4(s.size());
+        blob += s.size();
+    }
+    for (const auto& s : strings) str.b.insert(str.b.end(), s.begin(), s.end());
+
+    // ---------- Constants ----------
+    Builder& pool = ball.section(BallSection::CONSTANTS);
+    pool.u4(6);
+    for (uint32_t i = 0; i < strings.size(); ++i) {
+        pool.u1(static_cast<uint8_t>(czffvm::ConstantTag::STRING));
+        pool.u4(i);
+    }
+    for (int32_t v : {0, 3, 1}) {    // 3, 4, 5
+        pool.u1(static_cast<uint8_t>(czffvm::ConstantTag::I4));
+        pool.u4(v);
+    }
+
+    // ---------- Code ----------
+    Builder& code = ball.section(BallSection::CODE);
+    auto op  = [&](OperationCode c) { code.u2(static_cast<uint16_t>(c)); };
+    auto op2 = [&](OperationCode c, uint16_t a) { op(c); code.u2(a); };
+    auto jump = [&](OperationCode c, uint32_t target) { op(c); code.u4(target); };
+
+    op2(OperationCode::LDC, 3);          // 0
+    op2(OperationCode::STORE, 0);        // 1
+    op2(OperationCode::LDV, 0);          // 2
+    op2(OperationCode::LDC, 4);          // 3
+    op (OperationCode::LT);              // 4
+    jump(OperationCode::JZ, exit_target);// 5
+    op2(OperationCode::LDV, 0);          // 6
+    op (OperationCode::PRINT);           // 7
+    op2(OperationCode::LDV, 0);          // 8
+    op2(OperationCode::LDC, 5);          // 9
+    op (OperationCode::ADD);             // 10
+    op2(OperationCode::STORE, 0);        // 11
+    jump(OperationCode::JMP, 2);         // 12
+    op (OperationCode::RET);             // 13
+
+    // ---------- Functions ----------
+    Builder& functions = ball.section(BallSection::FUNCTIONS);
+    functions.u4(1);
+    functions.u4(0);
+    functions.u2(0);   // name
+    functions.u2(1);   // params
+    functions.u2(2);   // return
+    functions.u2(2);   // max_stack
+    functions.u2(1);   // locals
+    functions.u2(0);
+    functions.u4(14);  // code length
+    functions.u4(0);   // code offset
+    functions.u4(code.b.size());
+
+    // ---------- Classes ----------
+    ball.section(BallSection::CLASSES).u2(0);
+
+    return ball.build();
+}
+
+// Main plus `count` functions F(a) that build a small array, fill and sum
+// it, and call themselves in tail position while a > 0
+inline std::vector<uint8_t> MakeManyFunctionsBall(uint16_t count) {
+    using namespace ball;
+    using czffvm::OperationCode;
+    Builder w;
+
+    // ---------- Header ----------
+    w.u4(0x62616c6c);
+    w.u1(1); w.u1(0); w.u1(0);
+    w.u1(0);
+
+    // ---------- Constant pool ----------
+    w.u2(9);
+    for (const char* s : {"Main", "", "void;", "F", "I;", "I;"}) {    // 0..5
+        w.u1(static_cast<uint8_t>(czffvm::ConstantTag::STRING));
+        w.string(s);
+    }
+    for (int32_t v : {0, 1, 2}) {    // 6..8
+        w.u1(static_cast<uint8_t>(czffvm::ConstantTag::I4));
+        w.u4(v);
+    }
+
+    // ---------- Functions ----------
+    w.u2(count + 1);
+
+    w.u2(0); w.u2(1); w.u2(2);
+    w.u2(1); w.u2(0);
+    w.u2(1);
+    w.u2(static_cast<uint16_t>(OperationCode::RET));
+
+    for (uint16_t f = 0; f < count; ++f) {
+        std::vector<uint16_t> code;
+        size_t ops = 0;
+        auto op  = [&](OperationCode c) { code.push_back(static_cast<uint16_t>(c)); ops++; };
+        auto op2 = [&](OperationCode c, uint16_t a) { op(c); code.push_back(a); };
+
+        op2(OperationCode::STORE, 0);                                          // 0
+        op2(OperationCode::LDC, 8); op2(OperationCode::NEWARR, 5);             // 1..2
+        op2(OperationCode::STORE, 1);                                          // 3
+        op2(OperationCode::LDV, 1); op2(OperationCode::LDC, 6);
+        op2(OperationCode::LDV, 0); op (OperationCode::STELEM);                // 4..7
+        op2(OperationCode::LDV, 1); op2(OperationCode::LDC, 6);
+        op (OperationCode::LDELEM); op2(OperationCode::LDC, 7);
+        op (OperationCode::ADD); op2(OperationCode::STORE, 2);                 // 8..13
+        op2(OperationCode::LDV, 0); op2(OperationCode::LDC, 6);
+        op (OperationCode::LT); op2(OperationCode::JZ, 22);                    // 14..17
+        op2(OperationCode::LDV, 0); op2(OperationCode::LDC, 7);
+        op (OperationCode::SUB);                                               // 18..20
+        op2(OperationCode::JMP, 23);                                           // 21
+        op2(OperationCode::LDV, 2);                                            // 22
+        op2(OperationCode::CALL, f + 1); op (OperationCode::RET);              // 23..24
+
+        w.u2(3); w.u2(4); w.u2(5);    // F(I;) -> I;
+        w.u2(4); w.u2(3);
+        w.u2(ops);
+        for (uint16_t x : code) w.u2(x);
+    }
+
+    // ---------- Classes ----------
+    w.u2(0);
+
+    return w.b;
+}
+
+// ---------- Linking ----------
+
+// Helper() and Twice(I;) -> I;, without a Main
+inline std::vector<uint8_t> MakeLibraryBall() {
+    using namespace ball;
+    using czffvm::OperationCode;
+    Builder w;
+
+    w.u4(0x62616c6c);
+    w.u1(1); w.u1(0); w.u1(0);
+    w.u1(0);
+
+    w.u2(5);
+    for (const char* s : {"Helper", "", "void;", "Twice", "I;"}) {    // 0..4
+        w.u1(static_cast<uint8_t>(czffvm::ConstantTag::STRING));
+        w.string(s);
+    }
+
+    w.u2(2);
+
+    w.u2(0); w.u2(1); w.u2(2);
+    w.u2(0); w.u2(0);
+    w.u2(1);
+    w.u2(static_cast<uint16_t>(OperationCode::RET));
+
+    w.u2(3); w.u2(4); w.u2(4);
+    w.u2(2); w.u2(1);
+    w.u2(5);
+    w.u2(static_cast<uint16_t>(OperationCode::STORE)); w.u2(0);
+    w.u2(static_cast<uint16_t>(OperationCode::LDV)); w.u2(0);
+    w.u2(static_cast<uint16_t>(OperationCode::LDV)); w.u2(0);
+    w.u2(static_cast<uint16_t>(OperationCode::ADD));
+    w.u2(static_cast<uint16_t>(OperationCode::RET));
+
+    w.u2(0);
+
+    return w.b;
+}
+
+// Main prints Twice(21), with Twice declared as `params` -> I; and
+// defined by another module
+inline std::vector<uint8_t> MakeLinkedProgramBall(const char* params = "I;") {
+    using namespace ball;
+    using czffvm::OperationCode;
+    Builder w;
+
+    w.u4(0x62616c6c);
+    w.u1(1); w.u1(0); w.u1(0);
+    w.u1(0);
+
+    w.u2(7);
+    for (const char* s : {"Main", "", "void;", "Twice", params, "I;"}) {    // 0..5
+        w.u1(static_cast<uint8_t>(czffvm::ConstantTag::STRING));
+        w.string(s);
+    }
+    w.u1(static_cast<uint8_t>(czffvm::ConstantTag::I4));    // 6
+    w.u4(21);
+
+    w.u2(2);
+
+    w.u2(0); w.u2(1); w.u2(2);
+    w.u2(1); w.u2(0);
+    w.u2(4);
+    w.u2(static_cast<uint16_t>(OperationCode::LDC)); w.u2(6);
+    w.u2(static_cast<uint16_t>(OperationCode::CALL)); w.u2(1);
+    w.u2(static_cast<uint16_t>(OperationCode::PRINT));
+    w.u2(static_cast<uint16_t>(OperationCode::RET));
+
+    // declaration: no body
+    w.u2(3); w.u2(4); w.u2(5);
+    w.u2(0); w.u2(0);
+    w.u2(0);
+
+    w.u2(0);
+
+    return w.b;
+}
+
+// x = 10; if (x > 0) print 7; if (x >= 10) print 8; print x, as the
+// compiler emits it: `a > b` is SWAP; LT and `a >= b` is SWAP; LEQ
+inline std::vector<uint8_t> MakeComparisonProgramBall() {
+    using namespace ball;
+    using czffvm::OperationCode;
+    Builder w;
+
+    w.u4(0x62616c6c);
+    w.u1(1); w.u1(0); w.u1(0);
+    w.u1(0);
+
+    w.u2(7);
+    for (const char* s : {"Main", "", "void;"}) {    // 0..2
+        w.u1(static_cast<uint8_t>(czffvm::ConstantTag::STRING));
+        w.string(s);
+    }
+    for (int32_t v : {10, 0, 7, 8}) {                // 3..6
+        w.u1(static_cast<uint8_t>(czffvm::ConstantTag::I4));
+        w.u4(v);
+    }
+
+    w.u2(1);
+
+    auto op  = [&](OperationCode c) { w.u2(static_cast<uint16_t>(c)); };
+    auto op2 = [&](OperationCode c, uint16_t a) { op(c); w.u2(a); };
+
+    w.u2(0); w.u2(1); w.u2(2);
+    w.u2(2); w.u2(1);
+    w.u2(19);
+    op2(OperationCode::LDC, 3);      // 0
+    op2(OperationCode::STORE, 0);    // 1
+    op2(OperationCode::LDV, 0);      // 2
+    op2(OperationCode::LDC, 4);      // 3
+    op (OperationCode::SWAP);        // 4
+    op (OperationCode::LT);          // 5
+    op2(OperationCode::JZ, 9);       // 6
+    op2(OperationCode::LDC, 5);      // 7
+    op (OperationCode::PRINT);       // 8
+    op2(OperationCode::LDV, 0);      // 9
+    op2(OperationCode::LDC, 3);      // 10
+    op (OperationCode::SWAP);        // 11
+    op (OperationCode::LEQ);         // 12
+    op2(OperationCode::JZ, 16);      // 13
+    op2(OperationCode::LDC, 6);      // 14
+    op (OperationCode::PRINT);       // 15
+    op2(OperationCode::LDV, 0);      // 16
+    op (OperationCode::PRINT);       // 17
+    op (OperationCode::RET);         // 18
+
+    w.u2(0);
+
+    return w.b;
+}
+
+// Main calls B, then A; A prints the only element of a fresh U8 array and
+// B one of a U2 array. Scalar replacement interns the zero of each element
+// type, so the pool order depends on which body is analyzed first.
+inline std::vector<uint8_t> MakeCallOrderProgramBall() {
+    using namespace ball;
+    using czffvm::OperationCode;
+    Builder w;
+
+    w.u4(0x62616c6c);
+    w.u1(1); w.u1(0); w.u1(0);
+    w.u1(0);
+
+    w.u2(9);
+    for (const char* s : {"Main", "", "void;", "A", "B", "U8;", "U2;"}) {    // 0..6
+        w.u1(static_cast<uint8_t>(czffvm::ConstantTag::STRING));
+        w.string(s);
+    }
+    for (int32_t v : {1, 0}) {    // 7..8
+        w.u1(static_cast<uint8_t>(czffvm::ConstantTag::I4));
+        w.u4(v);
+    }
+
+    w.u2(3);
+
+    auto op  = [&](OperationCode c) { w.u2(static_cast<uint16_t>(c)); };
+    auto op2 = [&](OperationCode c, uint16_t a) { op(c); w.u2(a); };
+
+    w.u2(0); w.u2(1); w.u2(2);
+    w.u2(1); w.u2(0);
+    w.u2(3);
+    op2(OperationCode::CALL, 2);
+    op2(OperationCode::CALL, 1);
+    op (OperationCode::RET);
+
+    for (uint16_t name : {3, 4}) {
+        w.u2(name); w.u2(1); w.u2(2);
+        w.u2(2); w.u2(1);
+        w.u2(8);
+        op2(OperationCode::LDC, 7);
+        op2(OperationCode::NEWARR, name == 3 ? 5 : 6);
+        op2(OperationCode::STORE, 0);
+        op2(OperationCode::LDV, 0);
+        op2(OperationCode::LDC, 8);
+        op (OperationCode::LDELEM);
+        op (OperationCode::PRINT);
+        op (OperationCode::RET);
+    }
+
+    w.u2(0);
+
+    return w.b;
+}
@@ -0,0 +1,46 @@
+#pragma once
+
+#include <filesystem>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "class_loader.hpp"
+#include "class_loader_test_utils.hpp"
+#include "interpreter.hpp"
+#include "runtime_data_area.hpp"
+
+// A fresh directory under the system temp directory, removed again with
+// everything written into it
+struct TempDirectory {
+    std::filesystem::path root;
+
+    explicit TempDirectory(const std::string& name)
+        : root(std::filesystem::temp_directory_path() / name) {
+        std::filesystem::remove_all(root);
+        std::filesystem::create_directories(root);
+    }
+    ~TempDirectory() { std::filesystem::remove_all(root); }
+
+    std::string Write(const std::string& name, const std::vector<uint8_t>& data) {
+        std::string path = (root / name).string();
+        WriteBinaryFile(path, data);
+        return path;
+    }
+
+    std::string WriteText(const std::string& name, const std::string& text) {
+        return Write(name, std::vector<uint8_t>(text.begin(), text.end()));
+    }
+};
+
+// Runs the loaded program's entry point and returns what it printed
+inline std::string RunMain(czffvm::RuntimeDataArea& rda, czffvm::ClassLoader& loader) {
+    czffvm::Interpreter interpreter(rda);
+    std::ostringstream out;
+    auto* old = std::cout.rdbuf(out.rdbuf());
+    interpreter.Execute(loader.EntryPoint());
+    std::cout.rdbuf(old);
+
+    return out.str();
+}
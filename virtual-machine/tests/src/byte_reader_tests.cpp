@@ -107,3 +107,30 @@ TEST(ByteReaderTestSuite, EofBecomesTrueAfterReads) {
     reader.ReadU2();
     EXPECT_TRUE(reader.Eof());
 }
+
+TEST(ByteReaderTestSuite, ReadBytesPointsIntoInput) {
+    std::vector<uint8_t> data = {0x01, 0x02, 0x03};
+    czffvm::ByteReader reader(data);
+
+    reader.ReadU1();
+    EXPECT_EQ(reader.ReadBytes(2), data.data() + 1);
+    EXPECT_TRUE(reader.Eof());
+}
+
+TEST(ByteReaderTestSuite, ReadBytesOutOfBoundsThrows) {
+    std::vector<uint8_t> data = {0x01, 0x02};
+    czffvm::ByteReader reader(data);
+
+    EXPECT_THROW(reader.ReadBytes(3), std::out_of_range);
+    EXPECT_EQ(reader.Remaining(), 2u);
+}
+
+TEST(ByteReaderTestSuite, UncheckedReadsMatchCheckedOnes) {
+    std::vector<uint8_t> data = {0x12, 0x34, 0x56};
+    czffvm::ByteReader checked(data);
+    czffvm::ByteReader unchecked(data.data(), data.size());
+
+    EXPECT_EQ(unchecked.ReadU2Unchecked(), checked.ReadU2());
+    EXPECT_EQ(unchecked.ReadU1Unchecked(), checked.ReadU1());
+    EXPECT_EQ(unchecked.Remaining(), 0u);
+}
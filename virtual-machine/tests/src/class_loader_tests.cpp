@@ -46,6 +46,397 @@ TEST(ClassLoaderTestSuite, LoadsMinimalProgramAndResolvesEntryPoint) {
     EXPECT_TRUE(found);
 }
 
+TEST(ClassLoaderTestSuite, BytecodeOptimizerSeesEveryLoadedFunction) {
+    RuntimeDataArea rda;
+    ClassLoader loader(rda);
+
+    std::vector<size_t> code_sizes;
+    loader.SetBytecodeOptimizer([&](RuntimeFunction& fn, MethodArea&) {
+        code_sizes.push_back(fn.code.size());
+        fn.code.insert(fn.code.begin(), Operation{OperationCode::NOP, {}});
+    });
+
+    auto data = MakeMinimalBallWithMain();
+    TempFile tmp("optimized.ball");
+    WriteFile(tmp.path, data);
+
+    ASSERT_NO_THROW(loader.LoadProgram(tmp.path));
+    ASSERT_EQ(code_sizes, std::vector<size_t>{1});
+    EXPECT_EQ(loader.EntryPoint()->code.size(), 2u);
+    EXPECT_EQ(loader.EntryPoint()->code[0].code, OperationCode::NOP);
+}
+
+TEST(ClassLoaderTestSuite, LazyDecodingDefersFunctionBodies) {
+    auto data = MakeFirstProgramBall();
+    TempFile tmp("lazy.ball");
+    WriteFile(tmp.path, data);
+
+    RuntimeDataArea eager_rda;
+    ClassLoader eager(eager_rda);
+    ASSERT_NO_THROW(eager.LoadProgram(tmp.path));
+
+    RuntimeDataArea rda;
+    ClassLoader loader(rda);
+    loader.EnableLazyDecoding(true);
+    size_t optimized = 0;
+    loader.SetBytecodeOptimizer([&](RuntimeFunction&, MethodArea&) { optimized++; });
+    ASSERT_NO_THROW(loader.LoadProgram(tmp.path));
+
+    RuntimeFunction* main = loader.EntryPoint();
+    ASSERT_NE(main, nullptr);
+    EXPECT_TRUE(main->code_pending);
+    EXPECT_TRUE(main->code.empty());
+    EXPECT_EQ(optimized, 0u);
+
+    rda.GetMethodArea().EnsureCode(*main);
+    EXPECT_FALSE(main->code_pending);
+    EXPECT_EQ(optimized, 1u);
+
+    const auto& expected = eager.EntryPoint()->code;
+    ASSERT_EQ(main->code.size(), expected.size());
+    for (size_t pc = 0; pc < expected.size(); ++pc) {
+        EXPECT_EQ(main->code[pc].code, expected[pc].code);
+        EXPECT_EQ(main->code[pc].arguments, expected[pc].arguments);
+    }
+
+    // decoded once
+    rda.GetMethodArea().EnsureCode(*main);
+    EXPECT_EQ(optimized, 1u);
+}
+
+TEST(ClassLoaderTestSuite, LazyDecodingReportsBadBodyOnFirstUse) {
+    auto data = MakeMinimalBallWithMain();
+    // the RET of Main, right before the classes count
+    ASSERT_EQ(data[data.size() - 3], static_cast<uint8_t>(OperationCode::RET));
+    data[data.size() - 4] = 0x01;
+    data[data.size() - 3] = 0x00;    // LDV_LDV, internal only
+
+    TempFile tmp("lazy_bad.ball");
+    WriteFile(tmp.path, data);
+
+    RuntimeDataArea eager_rda;
+    ClassLoader eager(eager_rda);
+    EXPECT_THROW(eager.LoadProgram(tmp.path), ClassLoaderError);
+
+    RuntimeDataArea rda;
+    ClassLoader loader(rda);
+    loader.EnableLazyDecoding(true);
+    ASSERT_NO_THROW(loader.LoadProgram(tmp.path));
+    EXPECT_THROW(rda.GetMethodArea().EnsureCode(*loader.EntryPoint()), ClassLoaderError);
+}
+
+TEST(ClassLoaderTestSuite, ParallelDecodingMatchesSequentialLoad) {
+    auto data = MakeManyFunctionsBall(200);
+    TempFile tmp("many.ball");
+    WriteFile(tmp.path, data);
+
+    auto load = [&](RuntimeDataArea& rda, size_t threads) {
+        ClassLoader loader(rda);
+        loader.EnableTailCallElimination(true);
+        loader.EnableEscapeAnalysis(true);
+        loader.EnableSuperinstructions(true);
+        loader.SetLoadThreads(threads);
+        loader.LoadProgram(tmp.path);
+    };
+
+    RuntimeDataArea sequential;
+    ASSERT_NO_THROW(load(sequential, 1));
+    RuntimeDataArea parallel;
+    ASSERT_NO_THROW(load(parallel, 4));
+
+    const auto& expected = sequential.GetMethodArea().Functions();
+    const auto& functions = parallel.GetMethodArea().Functions();
+    ASSERT_EQ(functions.size(), 201u);
+    ASSERT_EQ(functions.size(), expected.size());
+    EXPECT_EQ(parallel.GetMethodArea().ConstantPool().size(),
+              sequential.GetMethodArea().ConstantPool().size());
+
+    for (size_t f = 0; f < functions.size(); ++f) {
+        EXPECT_FALSE(functions[f]->code_pending);
+        EXPECT_EQ(functions[f]->locals_count, expected[f]->locals_count);
+
+        ASSERT_EQ(functions[f]->code.size(), expected[f]->code.size()) << "function " << f;
+        for (size_t pc = 0; pc < expected[f]->code.size(); ++pc) {
+            EXPECT_EQ(functions[f]->code[pc].code, expected[f]->code[pc].code);
+            EXPECT_EQ(functions[f]->code[pc].arguments, expected[f]->code[pc].arguments);
+        }
+        ASSERT_EQ(functions[f]->fused_code.size(), expected[f]->fused_code.size());
+        for (size_t pc = 0; pc < expected[f]->fused_code.size(); ++pc) {
+            EXPECT_EQ(functions[f]->fused_code[pc].code, expected[f]->fused_code[pc].code);
+        }
+    }
+}
+
+TEST(ClassLoaderTestSuite, ParallelDecodingReportsBadBody) {
+    auto data = MakeMinimalBallWithMain();
+    data[data.size() - 4] = 0x01;
+    data[data.size() - 3] = 0x00;    // LDV_LDV, internal only
+
+    TempFile tmp("parallel_bad.ball");
+    WriteFile(tmp.path, data);
+
+    RuntimeDataArea rda;
+    ClassLoader loader(rda);
+    loader.SetLoadThreads(4);
+    EXPECT_THROW(loader.LoadProgram(tmp.path), ClassLoaderError);
+}
+
+// ---------- constants ----------
+
+TEST(ClassLoaderTestSuite, DuplicateConstantsAreInterned) {
+    auto data = MakeManyFunctionsBall(2);    // "I;" is constant 4 and 5
+    TempFile tmp("interned.ball");
+    WriteFile(tmp.path, data);
+
+    RuntimeDataArea rda;
+    ClassLoader loader(rda);
+    ASSERT_NO_THROW(loader.LoadProgram(tmp.path));
+
+    const auto& method_area = rda.GetMethodArea();
+    EXPECT_EQ(method_area.ConstantPool().size(), 8u);
+
+    // NEWARR 5 now names the first "I;"
+    const auto& code = method_area.Functions()[1]->code;
+    ASSERT_EQ(code[2].code, OperationCode::NEWARR);
+    EXPECT_EQ(code[2].arguments, (std::vector<uint8_t>{0, 4}));
+    EXPECT_EQ(method_area.Functions()[1]->params_descriptor_index, 4);
+
+    // the second file reuses every constant of the first
+    ASSERT_NO_THROW(loader.LoadStdlib(tmp.path));
+    EXPECT_EQ(method_area.ConstantPool().size(), 8u);
+}
+
+TEST(ClassLoaderTestSuite, ConstantValuesAreDecodedOnce) {
+    RuntimeDataArea rda;
+    auto& method_area = rda.GetMethodArea();
+    Constant hello{ConstantTag::STRING, {'h', 'i'}};
+
+    uint16_t first = method_area.RegisterConstant(hello);
+    uint16_t second = method_area.RegisterConstant(hello);
+    ASSERT_NE(first, second);
+    EXPECT_EQ(method_area.InternConstant(hello), first);
+
+    // equal strings share one allocation
+    auto a = std::get<StringRef>(method_area.GetConstantValue(first));
+    auto b = std::get<StringRef>(method_area.GetConstantValue(second));
+    EXPECT_EQ(a.get(), b.get());
+    EXPECT_EQ(*a, "hi");
+
+    uint16_t seven = method_area.InternConstant(Constant{ConstantTag::I4, {0, 0, 0, 7}});
+    EXPECT_EQ(std::get<int32_t>(method_area.GetConstantValue(seven)), 7);
+    EXPECT_THROW(method_area.GetConstantValue(100), std::out_of_range);
+}
+
+TEST(ClassLoaderTestSuite, ConstantIndexOutOfRangeThrows) {
+    auto data = MakeMinimalBallWithMain();
+    data[data.size() - 16] = 0x00;
+    data[data.size() - 15] = 0x09;    // Main's name, past the three constants
+
+    TempFile tmp("bad_constant.ball");
+    WriteFile(tmp.path, data);
+
+    RuntimeDataArea rda;
+    ClassLoader loader(rda);
+    EXPECT_THROW(loader.LoadProgram(tmp.path), ClassLoaderError);
+}
+
+// ---------- linking ----------
+
+TEST(ClassLoaderTestSuite, LinksDeclarationsToEarlierModules) {
+    TempFile library("library.ball");
+    WriteFile(library.path, MakeLibraryBall());
+    TempFile program("linked.ball");
+    WriteFile(program.path, MakeLinkedProgramBall());
+
+    RuntimeDataArea rda;
+    ClassLoader loader(rda);
+    ASSERT_NO_THROW(loader.LoadStdlib(library.path));
+    ASSERT_NO_THROW(loader.LoadProgram(program.path));
+
+    const auto& method_area = rda.GetMethodArea();
+    // the declaration is not registered as a function of its own
+    ASSERT_EQ(method_area.Functions().size(), 3u);
+    EXPECT_EQ(method_area.FindFunction("Helper"), 0);
+    EXPECT_EQ(method_area.FindFunction("Twice"), 1);
+    EXPECT_EQ(method_area.FindFunction("Main"), 2);
+    EXPECT_EQ(method_area.FindFunction("Missing"), std::nullopt);
+    EXPECT_EQ(loader.EntryPoint(), method_area.GetFunction(2));
+
+    // CALL 1 in the program is its declaration of Twice
+    const auto& code = loader.EntryPoint()->code;
+    ASSERT_EQ(code[1].code, OperationCode::CALL);
+    EXPECT_EQ(code[1].arguments, (std::vector<uint8_t>{0, 1}));
+}
+
+TEST(ClassLoaderTestSuite, UnresolvedDeclarationThrows) {
+    TempFile program("linked.ball");
+    WriteFile(program.path, MakeLinkedProgramBall());
+
+    RuntimeDataArea rda;
+    ClassLoader loader(rda);
+    EXPECT_THROW(loader.LoadProgram(program.path), ClassLoaderError);
+}
+
+TEST(ClassLoaderTestSuite, MismatchedDeclarationThrows) {
+    TempFile library("library.ball");
+    WriteFile(library.path, MakeLibraryBall());
+    TempFile program("linked.ball");
+    WriteFile(program.path, MakeLinkedProgramBall("I8;"));
+
+    RuntimeDataArea rda;
+    ClassLoader loader(rda);
+    ASSERT_NO_THROW(loader.LoadStdlib(library.path));
+    EXPECT_THROW(loader.LoadProgram(program.path), ClassLoaderError);
+}
+
+TEST(ClassLoaderTestSuite, CallOutsideTheFileThrows) {
+    auto data = MakeLinkedProgramBall();
+    data[data.size() - 19] = 0x05;    // CALL 5, the file has two functions
+
+    TempFile library("library.ball");
+    WriteFile(library.path, MakeLibraryBall());
+    TempFile program("linked.ball");
+    WriteFile(program.path, data);
+
+    RuntimeDataArea rda;
+    ClassLoader loader(rda);
+    ASSERT_NO_THROW(loader.LoadStdlib(library.path));
+    EXPECT_THROW(loader.LoadProgram(program.path), ClassLoaderError);
+}
+
+// ---------- tree shaking ----------
+
+TEST(ClassLoaderTestSuite, TreeShakingDropsUnreachableFunctions) {
+    TempFile library("library.ball");
+    WriteFile(library.path, MakeLibraryBall());
+    TempFile program("linked.ball");
+    WriteFile(program.path, MakeLinkedProgramBall());
+
+    RuntimeDataArea rda;
+    ClassLoader loader(rda);
+    loader.EnableLazyDecoding(true);
+    loader.EnableTreeShaking(true);
+    ASSERT_NO_THROW(loader.LoadStdlib(library.path));
+    ASSERT_NO_THROW(loader.LoadProgram(program.path));
+
+    auto& method_area = rda.GetMethodArea();
+    ASSERT_EQ(method_area.Functions().size(), 2u);
+    EXPECT_EQ(method_area.FindFunction("Helper"), std::nullopt);
+    EXPECT_EQ(method_area.FindFunction("Twice"), 0);
+    EXPECT_EQ(method_area.FindFunction("Main"), 1);
+    EXPECT_EQ(loader.EntryPoint(), method_area.GetFunction(1));
+
+    // "Helper" is gone, the rest is used by Main and Twice
+    for (const auto& c : method_area.ConstantPool()) {
+        EXPECT_NE(std::string(c.data.begin(), c.data.end()), "Helper");
+    }
+    EXPECT_EQ(method_area.ConstantPool().size(), 6u);
+
+    // bodies are decoded against the remapped tables
+    RuntimeFunction& main = *loader.EntryPoint();
+    ASSERT_TRUE(main.code_pending);
+    method_area.EnsureCode(main);
+    EXPECT_EQ(main.code[1].arguments, (std::vector<uint8_t>{0, 0}));
+    EXPECT_EQ(std::get<int32_t>(method_area.GetConstantValue(
+        (main.code[0].arguments[0] << 8) | main.code[0].arguments[1])), 21);
+}
+
+TEST(ClassLoaderTestSuite, TreeShakingNeedsLazyDecoding) {
+    TempFile library("library.ball");
+    WriteFile(library.path, MakeLibraryBall());
+    TempFile program("linked.ball");
+    WriteFile(program.path, MakeLinkedProgramBall());
+
+    RuntimeDataArea rda;
+    ClassLoader loader(rda);
+    loader.EnableTreeShaking(true);
+    ASSERT_NO_THROW(loader.LoadStdlib(library.path));
+    ASSERT_NO_THROW(loader.LoadProgram(program.path));
+
+    EXPECT_EQ(rda.GetMethodArea().Functions().size(), 3u);
+}
+
+// ---------- v2 ----------
+
+TEST(ClassLoaderTestSuite, LoadsIndexedBall) {
+    RuntimeDataArea rda;
+    ClassLoader loader(rda);
+
+    auto data = MakeIndexedLoopBall();
+    TempFile tmp("indexed.ball");
+    WriteFile(tmp.path, data);
+    ASSERT_NO_THROW(loader.LoadProgram(tmp.path));
+
+    RuntimeFunction* entry = loader.EntryPoint();
+    ASSERT_NE(entry, nullptr);
+    EXPECT_EQ(entry->locals_count, 1);
+    EXPECT_EQ(rda.GetMethodArea().ConstantPool().size(), 6u);
+
+    // u4 targets in the file, u2 in memory
+    ASSERT_EQ(entry->code.size(), 14u);
+    EXPECT_EQ(entry->code[5].code, OperationCode::JZ);
+    EXPECT_EQ(entry->code[5].arguments, (std::vector<uint8_t>{0x00, 13}));
+    EXPECT_EQ(entry->code[12].code, OperationCode::JMP);
+    EXPECT_EQ(entry->code[12].arguments, (std::vector<uint8_t>{0x00, 2}));
+    EXPECT_EQ(entry->code[13].code, OperationCode::RET);
+}
+
+TEST(ClassLoaderTestSuite, LazyDecodingOfIndexedBall) {
+    auto data = MakeIndexedLoopBall();
+    TempFile tmp("indexed_lazy.ball");
+    WriteFile(tmp.path, data);
+
+    RuntimeDataArea eager_rda;
+    ClassLoader eager(eager_rda);
+    ASSERT_NO_THROW(eager.LoadProgram(tmp.path));
+
+    RuntimeDataArea rda;
+    ClassLoader loader(rda);
+    loader.EnableLazyDecoding(true);
+    ASSERT_NO_THROW(loader.LoadProgram(tmp.path));
+
+    RuntimeFunction* main = loader.EntryPoint();
+    ASSERT_NE(main, nullptr);
+    EXPECT_TRUE(main->code_pending);
+
+    rda.GetMethodArea().EnsureCode(*main);
+    const auto& expected = eager.EntryPoint()->code;
+    ASSERT_EQ(main->code.size(), expected.size());
+    for (size_t pc = 0; pc < expected.size(); ++pc) {
+        EXPECT_EQ(main->code[pc].code, expected[pc].code);
+        EXPECT_EQ(main->code[pc].arguments, expected[pc].arguments);
+    }
+}
+
+TEST(ClassLoaderTestSuite, IndexedJumpBeyondU2Throws) {
+    RuntimeDataArea rda;
+    ClassLoader loader(rda);
+
+    auto data = MakeIndexedLoopBall(70000);
+    TempFile tmp("indexed_far.ball");
+    WriteFile(tmp.path, data);
+
+    EXPECT_THROW(loader.LoadProgram(tmp.path), ClassLoaderError);
+}
+
+TEST(ClassLoaderTestSuite, IndexedBodyOutsideCodeSectionThrows) {
+    RuntimeDataArea rda;
+    ClassLoader loader(rda);
+
+    auto data = MakeIndexedLoopBall();
+    // the function table is the fourth section; bump the high byte of the
+    // code size of its only entry
+    size_t entry = 12 + 3 * kSectionEntrySize;
+    ASSERT_EQ(data[entry + 3], static_cast<uint8_t>(BallSection::FUNCTIONS));
+    size_t table = (data[entry + 6] << 8) | data[entry + 7];
+    data[table + 8 + kFunctionEntrySize - 4] = 0x10;
+
+    TempFile tmp("indexed_oob.ball");
+    WriteFile(tmp.path, data);
+
+    EXPECT_THROW(loader.LoadProgram(tmp.path), ClassLoaderError);
+}
+
 // ---------- header ----------
 
 TEST(ClassLoaderTestSuite, InvalidMagicThrows) {
@@ -61,6 +452,41 @@ TEST(ClassLoaderTestSuite, InvalidMagicThrows) {
     EXPECT_THROW(loader.LoadProgram(tmp.path), ClassLoaderError);
 }
 
+TEST(ClassLoaderTestSuite, UnsupportedVersionThrows) {
+    RuntimeDataArea rda;
+    ClassLoader loader(rda);
+
+    auto data = MakeMinimalBallWithMain();
+    data[4] = kIndexedBallVersion + 1;
+
+    TempFile tmp("future.ball");
+    WriteFile(tmp.path, data);
+
+    EXPECT_THROW(loader.LoadProgram(tmp.path), ClassLoaderError);
+}
+
+TEST(ClassLoaderTestSuite, MissingFileThrows) {
+    RuntimeDataArea rda;
+    ClassLoader loader(rda);
+
+    EXPECT_THROW(loader.LoadProgram("does_not_exist.ball"), ClassLoaderError);
+}
+
+TEST(ClassLoaderTestSuite, TruncatedFileThrows) {
+    auto data = MakeMinimalBallWithMain();
+
+    for (size_t cut : {1u, 4u, 8u}) {
+        RuntimeDataArea rda;
+        ClassLoader loader(rda);
+
+        std::vector<uint8_t> truncated(data.begin(), data.end() - cut);
+        TempFile tmp("truncated.ball");
+        WriteFile(tmp.path, truncated);
+
+        EXPECT_THROW(loader.LoadProgram(tmp.path), std::exception) << "cut=" << cut;
+    }
+}
+
 // ---------- entry point ----------
 
 TEST(ClassLoaderTestSuite, MissingMainThrows) {
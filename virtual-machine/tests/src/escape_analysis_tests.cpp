@@ -0,0 +1,181 @@
+#include <gtest/gtest.h>
+
+#include <iostream>
+#include <sstream>
+
+#include "bytecode_builder.hpp"
+#include "common.hpp"
+#include "escape_analysis.hpp"
+#include "interpreter.hpp"
+#include "runtime_data_area.hpp"
+
+using namespace czffvm;
+
+class EscapeAnalysisTest : public testing::Test, protected BytecodeBuilder {
+protected:
+    RuntimeDataArea rda;
+    RuntimeFunction fn;
+
+    MethodArea& BytecodeMethodArea() override { return rda.GetMethodArea(); }
+
+    void SetUp() override {
+        fn.name_index = Str("Main");
+        fn.params_descriptor_index = Str("");
+        fn.return_type_index = Str("void;");
+        fn.max_stack = 8;
+        fn.locals_count = 2;
+    }
+
+    size_t Count(OperationCode code) const {
+        size_t n = 0;
+        for (const auto& op : fn.code) n += op.code == code;
+        return n;
+    }
+
+    std::string Execute() {
+        Interpreter interpreter(rda);
+
+        std::ostringstream captured;
+        auto* old_buf = std::cout.rdbuf(captured.rdbuf());
+        interpreter.Execute(&fn);
+        std::cout.rdbuf(old_buf);
+
+        return captured.str();
+    }
+};
+
+TEST_F(EscapeAnalysisTest, ReplacesConstantIndexedArrayWithLocals) {
+    fn.code = {
+        LDC(3), NEWARR("I;"), WithU2(OperationCode::STORE, 0),
+        WithU2(OperationCode::LDV, 0), LDC(1), LDC(7), Op(OperationCode::STELEM),
+        WithU2(OperationCode::LDV, 0), LDC(1), Op(OperationCode::LDELEM),
+        WithU2(OperationCode::LDV, 0), LDC(2), Op(OperationCode::LDELEM),
+        Op(OperationCode::ADD),
+        Op(OperationCode::PRINT),
+        Op(OperationCode::RET)
+    };
+
+    EscapeAnalyzer analyzer(fn, rda.GetMethodArea());
+    analyzer.Run();
+
+    EXPECT_EQ(analyzer.ScalarReplacedCount(), 1u);
+    EXPECT_EQ(Count(OperationCode::NEWARR), 0u);
+    EXPECT_EQ(Count(OperationCode::LDELEM), 0u);
+    EXPECT_EQ(Count(OperationCode::STELEM), 0u);
+    EXPECT_EQ(fn.locals_count, 5);
+
+    EXPECT_EQ(Execute(), "7");
+    EXPECT_EQ(rda.GetHeap().UsedBytes(), 0u);
+}
+
+TEST_F(EscapeAnalysisTest, ReturnedArrayEscapes) {
+    fn.return_type_index = Str("[I;");
+    fn.code = {
+        LDC(2), NEWARR("I;"), WithU2(OperationCode::STORE, 0),
+        WithU2(OperationCode::LDV, 0), LDC(0), LDC(5), Op(OperationCode::STELEM),
+        WithU2(OperationCode::LDV, 0),
+        Op(OperationCode::RET)
+    };
+    auto before = fn.code.size();
+
+    EscapeAnalyzer analyzer(fn, rda.GetMethodArea());
+    analyzer.Run();
+
+    EXPECT_EQ(analyzer.ScalarReplacedCount(), 0u);
+    EXPECT_EQ(analyzer.FrameAllocatedCount(), 0u);
+    EXPECT_EQ(fn.code.size(), before);
+}
+
+TEST_F(EscapeAnalysisTest, ArrayStoredIntoAnotherArrayEscapes) {
+    fn.code = {
+        LDC(1), NEWARR("[I;"), WithU2(OperationCode::STORE, 0),
+        LDC(1), NEWARR("I;"), WithU2(OperationCode::STORE, 1),
+        WithU2(OperationCode::LDV, 0), LDC(0), WithU2(OperationCode::LDV, 1),
+        Op(OperationCode::STELEM),
+        Op(OperationCode::RET)
+    };
+
+    EscapeAnalyzer analyzer(fn, rda.GetMethodArea());
+    analyzer.Run();
+
+    // only the outer array stays in the frame, the inner one is its element
+    EXPECT_EQ(analyzer.ScalarReplacedCount(), 0u);
+    EXPECT_EQ(analyzer.FrameAllocatedCount(), 1u);
+    EXPECT_TRUE(fn.frame_arrays[1]);
+    EXPECT_FALSE(fn.frame_arrays[4]);
+}
+
+TEST_F(EscapeAnalysisTest, DynamicallyIndexedArrayIsFreedOnReturn) {
+    fn.code = {
+        LDC(1), WithU2(OperationCode::STORE, 1),
+        LDC(100), NEWARR("I;"), WithU2(OperationCode::STORE, 0),
+        WithU2(OperationCode::LDV, 0), WithU2(OperationCode::LDV, 1), LDC(9),
+        Op(OperationCode::STELEM),
+        WithU2(OperationCode::LDV, 0), WithU2(OperationCode::LDV, 1),
+        Op(OperationCode::LDELEM),
+        Op(OperationCode::PRINT),
+        Op(OperationCode::RET)
+    };
+
+    EscapeAnalyzer analyzer(fn, rda.GetMethodArea());
+    analyzer.Run();
+
+    EXPECT_EQ(analyzer.ScalarReplacedCount(), 0u);
+    EXPECT_EQ(analyzer.FrameAllocatedCount(), 1u);
+    ASSERT_EQ(fn.frame_arrays.size(), fn.code.size());
+    EXPECT_TRUE(fn.frame_arrays[3]);
+
+    EXPECT_EQ(Execute(), "9");
+    EXPECT_EQ(rda.GetHeap().UsedBytes(), 0u);
+}
+
+TEST_F(EscapeAnalysisTest, AllocationInsideLoopIsNotFrameAllocated) {
+    // 0..1: i = 3
+    // 2..4: a = new I[i]
+    // 5..8: i = i - 1
+    // 9..10: if i != 0 goto 2
+    fn.code = {
+        LDC(3), WithU2(OperationCode::STORE, 1),
+        WithU2(OperationCode::LDV, 1), NEWARR("I;"), WithU2(OperationCode::STORE, 0),
+        WithU2(OperationCode::LDV, 1), LDC(1), Op(OperationCode::SUB),
+        WithU2(OperationCode::STORE, 1),
+        WithU2(OperationCode::LDV, 1), WithU2(OperationCode::JNZ, 2),
+        Op(OperationCode::RET)
+    };
+
+    EscapeAnalyzer analyzer(fn, rda.GetMethodArea());
+    analyzer.Run();
+
+    EXPECT_EQ(analyzer.FrameAllocatedCount(), 0u);
+    EXPECT_NO_THROW(Execute());
+}
+
+TEST_F(EscapeAnalysisTest, AllocationsAroundLoopAreFrameAllocated) {
+    // 0..2: a = new I[5]
+    // 3..4: i = 3
+    // 5..8: i = i - 1
+    // 9..10: if i != 0 goto 5
+    // 11..13: a = new I[6], then a[i] is read and printed
+    fn.code = {
+        LDC(5), NEWARR("I;"), WithU2(OperationCode::STORE, 0),
+        LDC(3), WithU2(OperationCode::STORE, 1),
+        WithU2(OperationCode::LDV, 1), LDC(1), Op(OperationCode::SUB),
+        WithU2(OperationCode::STORE, 1),
+        WithU2(OperationCode::LDV, 1), WithU2(OperationCode::JNZ, 5),
+        LDC(6), NEWARR("I;"), WithU2(OperationCode::STORE, 0),
+        WithU2(OperationCode::LDV, 0), WithU2(OperationCode::LDV, 1),
+        Op(OperationCode::LDELEM), Op(OperationCode::PRINT),
+        Op(OperationCode::RET)
+    };
+
+    EscapeAnalyzer analyzer(fn, rda.GetMethodArea());
+    analyzer.Run();
+
+    EXPECT_EQ(analyzer.FrameAllocatedCount(), 2u);
+    ASSERT_EQ(fn.frame_arrays.size(), fn.code.size());
+    EXPECT_TRUE(fn.frame_arrays[1]);
+    EXPECT_TRUE(fn.frame_arrays[12]);
+
+    EXPECT_EQ(Execute(), "0");
+    EXPECT_EQ(rda.GetHeap().UsedBytes(), 0u);
+}
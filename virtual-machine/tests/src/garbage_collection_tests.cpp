@@ -68,6 +68,36 @@ TEST_F(HeapTest, ReferencedFromOperandStackSurvives) {
     EXPECT_NO_THROW(heap_.Get(ref));
 }
 
+TEST_F(HeapTest, ReferencedFromJitFrameAtSafepointSurvives) {
+    HeapRef kept = heap_.Allocate("int;", {});
+    HeapRef dropped = heap_.Allocate("int;", {});
+
+    int32_t words[8] = {};
+    words[1] = static_cast<int32_t>(kept.id);
+    words[2] = static_cast<int32_t>(dropped.id);
+    std::vector<czffvm_jit::StackMap> maps = {{1}};
+
+    stack_.PushJitFrame({words, &maps, 0});
+    heap_.Collect();
+    stack_.PopJitFrame();
+
+    EXPECT_NO_THROW(heap_.Get(kept));
+    EXPECT_THROW(heap_.Get(dropped), std::runtime_error);
+}
+
+TEST_F(HeapTest, JitFrameOutsideSafepointHasNoRoots) {
+    HeapRef ref = heap_.Allocate("int;", {});
+
+    int32_t words[4] = {static_cast<int32_t>(ref.id)};
+    std::vector<czffvm_jit::StackMap> maps = {{0}};
+
+    stack_.PushJitFrame({words, &maps});
+    heap_.Collect();
+    stack_.PopJitFrame();
+
+    EXPECT_THROW(heap_.Get(ref), std::runtime_error);
+}
+
 TEST_F(HeapTest, ChainedReferencesSurvive) {
     PushDummyFrame();
     CallFrame& frame = stack_.CurrentFrame();
@@ -173,4 +203,139 @@ TEST_F(HeapTest, DeepGraphSurvives) {
     EXPECT_NO_THROW(heap_.Get(d));
 }
 
+TEST_F(HeapTest, SweepReleasesAccountedSize) {
+    PushDummyFrame();
+    CallFrame& frame = stack_.CurrentFrame();
+
+    HeapRef kept = heap_.Allocate("[I;", heap_.MakeFields(10, int32_t(0)));
+    uint64_t kept_bytes = heap_.UsedBytes();
+
+    heap_.Allocate("[String;", {std::make_shared<std::string>("garbage")});
+    EXPECT_GT(heap_.UsedBytes(), kept_bytes);
+
+    frame.locals[0] = kept;
+    heap_.Collect();
+
+    EXPECT_EQ(heap_.UsedBytes(), kept_bytes);
+}
+
+TEST(HeapTriggerTest, CollectsWhenHeapDoublesBeforeHardLimit) {
+    StackDataArea stack;
+    Heap heap(stack, kBytesInKiB * 64, false, 100);
+
+    uint64_t trigger = heap.NextCollectionBytes();
+    EXPECT_EQ(trigger, uint64_t(kMinGcTriggerInKiB) * kBytesInKiB);
+
+    size_t elements = trigger / sizeof(Value) / 4;
+    HeapRef garbage = heap.Allocate("[I;", heap.MakeFields(elements, int32_t(0)));
+    for (int i = 0; i < 4; ++i) {
+        heap.Allocate("[I;", heap.MakeFields(elements, int32_t(0)));
+    }
+
+    EXPECT_THROW(heap.Get(garbage), std::runtime_error);
+    EXPECT_LT(heap.UsedBytes(), trigger);
+}
+
+TEST(HeapTriggerTest, TriggerNeverExceedsHardLimit) {
+    StackDataArea stack;
+    Heap heap(stack, 100);
+
+    EXPECT_EQ(heap.NextCollectionBytes(), 100 * kBytesInKiB);
+}
+
+TEST(HeapTriggerTest, NoCollectionWhenGcIsOff) {
+    StackDataArea stack;
+    Heap heap(stack, kBytesInKiB * 64, true);
+
+    size_t elements = heap.NextCollectionBytes() / sizeof(Value) / 4;
+    HeapRef garbage = heap.Allocate("[I;", heap.MakeFields(elements, int32_t(0)));
+    for (int i = 0; i < 4; ++i) {
+        heap.Allocate("[I;", heap.MakeFields(elements, int32_t(0)));
+    }
+
+    EXPECT_NO_THROW(heap.Get(garbage));
+}
+
+TEST(TypeTableTest, InternReturnsSameIdForSameDescriptor) {
+    TypeTable types;
+
+    uint32_t a = types.Intern("[I;");
+    uint32_t b = types.InternArrayOf("I;");
+
+    EXPECT_EQ(a, b);
+    EXPECT_NE(a, types.Intern("[B;"));
+    EXPECT_EQ(types.Descriptor(a), "[I;");
+}
+
+TEST(TypeTableTest, CachesElementKindAndDefault) {
+    TypeTable types;
+
+    const TypeInfo& ints = types.Get(types.Intern("[I8;"));
+    EXPECT_EQ(ints.element_kind, ElementKind::SIGNED_INT);
+    ASSERT_TRUE(ints.element_default.has_value());
+    EXPECT_TRUE(std::holds_alternative<int64_t>(*ints.element_default));
+
+    EXPECT_EQ(types.Get(types.Intern("[B;")).element_kind, ElementKind::BOOL);
+    EXPECT_EQ(types.Get(types.Intern("[String;")).element_kind, ElementKind::STRING);
+    EXPECT_EQ(types.Get(types.Intern("[[U;")).element_kind, ElementKind::ARRAY);
+    EXPECT_EQ(types.Get(types.Intern("obj;")).element_kind, ElementKind::NONE);
+}
+
+TEST_F(HeapTest, HeaderStoresTypeIdAndElementKind) {
+    HeapRef arr = heap_.Allocate("[U;", heap_.MakeFields(3, uint32_t(0)));
+    HeapRef obj = heap_.Allocate("obj;", {});
+
+    EXPECT_EQ(heap_.Types().Descriptor(heap_.Get(arr).type_id), "[U;");
+    EXPECT_EQ(heap_.Get(arr).element_kind, ElementKind::UNSIGNED_INT);
+    EXPECT_EQ(heap_.Get(obj).element_kind, ElementKind::NONE);
+}
+
+TEST_F(HeapTest, AllocateAdoptsFieldBuffer) {
+    HeapFields fields = heap_.MakeFields(4, int32_t(1));
+    const Value* buffer = fields.data();
+
+    HeapRef ref = heap_.Allocate("[I;", std::move(fields));
+
+    EXPECT_EQ(heap_.Get(ref).fields.data(), buffer);
+    EXPECT_EQ(heap_.Get(ref).fields.size(), 4u);
+}
+
+TEST(LargeObjectSpaceTest, LargeArrayIsMappedAndUnmappedOnSweep) {
+    StackDataArea stack;
+    Heap heap(stack, kBytesInKiB * 64, false, kDefaultGcGrowthPercent, 64);
+
+    uint32_t type_id = heap.Types().Intern("[I;");
+    size_t length = 64 * kBytesInKiB / sizeof(Value) + 1;
+
+    HeapRef big = heap.AllocateArray(type_id, length, int32_t(7));
+
+    EXPECT_EQ(heap.LargeObjects().MappingCount(), 1u);
+    EXPECT_GE(heap.LargeObjects().MappedBytes(), length * sizeof(Value));
+    EXPECT_EQ(std::get<int32_t>(heap.Get(big).fields[length - 1]), 7);
+
+    heap.Collect();
+
+    EXPECT_THROW(heap.Get(big), std::runtime_error);
+    EXPECT_EQ(heap.LargeObjects().MappingCount(), 0u);
+    EXPECT_EQ(heap.LargeObjects().MappedBytes(), 0u);
+}
+
+TEST(LargeObjectSpaceTest, SmallArrayStaysInRegularHeap) {
+    StackDataArea stack;
+    Heap heap(stack, kBytesInKiB * 64, false, kDefaultGcGrowthPercent, 64);
+
+    heap.AllocateArray(heap.Types().Intern("[I;"), 16, int32_t(0));
+
+    EXPECT_EQ(heap.LargeObjects().MappingCount(), 0u);
+}
+
+TEST(LargeObjectSpaceTest, ZeroThresholdDisablesLargeObjectSpace) {
+    StackDataArea stack;
+    Heap heap(stack, kBytesInKiB * 64, false, kDefaultGcGrowthPercent, 0);
+
+    heap.AllocateArray(heap.Types().Intern("[I;"), 1u << 16, int32_t(0));
+
+    EXPECT_EQ(heap.LargeObjects().MappingCount(), 0u);
+}
+
 } // namespace czffvm
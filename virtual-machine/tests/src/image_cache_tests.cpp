@@ -0,0 +1,104 @@
+#include <gtest/gtest.h>
+#include <filesystem>
+
+#include "class_loader.hpp"
+#include "image_cache.hpp"
+#include "minimal_ball.hpp"
+#include "program_test_utils.hpp"
+#include "runtime_data_area.hpp"
+
+using namespace czffvm;
+
+namespace fs = std::filesystem;
+
+TEST(ImageCacheTestSuite, KeyFollowsContentsAndOptions) {
+    TempDirectory dir("czff_image_key");
+    std::string library = dir.Write("library.ball", MakeLibraryBall());
+    std::string program = dir.Write("linked.ball", MakeLinkedProgramBall());
+
+    uint64_t key = ImageCache::Key({library, program}, 0);
+    EXPECT_EQ(ImageCache::Key({library, program}, 0), key);
+    EXPECT_NE(ImageCache::Key({library, program}, 1), key);
+    EXPECT_NE(ImageCache::Key({program, library}, 0), key);
+
+    dir.Write("linked.ball", MakeLinkedProgramBall("I8;"));
+    EXPECT_NE(ImageCache::Key({library, program}, 0), key);
+
+    EXPECT_THROW(ImageCache::Key({(dir.root / "missing.ball").string()}, 0), std::runtime_error);
+}
+
+TEST(ImageCacheTestSuite, StoresUnderTheKey) {
+    TempDirectory dir("czff_image_store");
+    ImageCache cache((dir.root / "nested").string(), ".img");
+
+    cache.Store(0x1234, {1, 2, 3});
+
+    std::string path = cache.PathFor(0x1234);
+    EXPECT_EQ(fs::path(path).filename(), "0000000000001234.img");
+    EXPECT_EQ(fs::file_size(path), 3u);
+    EXPECT_EQ(std::distance(fs::directory_iterator(dir.root / "nested"), fs::directory_iterator()), 1);
+}
+
+TEST(ImageCacheTestSuite, ImageRunsLikeTheLoadedProgram) {
+    TempDirectory dir("czff_image_roundtrip");
+    std::string library = dir.Write("library.ball", MakeLibraryBall());
+    std::string program = dir.Write("linked.ball", MakeLinkedProgramBall());
+    auto configure = [](ClassLoader& loader, bool lazy) {
+        loader.EnableLazyDecoding(lazy);
+        loader.EnableTreeShaking(true);
+        loader.EnableTailCallElimination(true);
+        loader.EnableEscapeAnalysis(true);
+        loader.EnableSuperinstructions(true);
+    };
+
+    for (bool lazy : {false, true}) {
+        std::vector<uint8_t> image;
+        {
+            RuntimeDataArea rda;
+            ClassLoader loader(rda);
+            configure(loader, lazy);
+            loader.LoadStdlib(library);
+            loader.LoadProgram(program);
+            image = loader.SaveImage(42);
+            EXPECT_EQ(RunMain(rda, loader), "42");
+        }
+        std::string path = dir.Write("program.img", image);
+
+        RuntimeDataArea rda;
+        ClassLoader loader(rda);
+        configure(loader, lazy);
+        ASSERT_TRUE(loader.LoadImage(path, 42)) << "lazy=" << lazy;
+
+        const auto& method_area = rda.GetMethodArea();
+        // tree shaking only runs with lazy decoding
+        EXPECT_EQ(method_area.Functions().size(), lazy ? 2u : 3u);
+        EXPECT_EQ(method_area.FindFunction("Helper").has_value(), !lazy);
+        EXPECT_EQ(loader.EntryPoint()->code_pending, lazy);
+        EXPECT_EQ(RunMain(rda, loader), "42") << "lazy=" << lazy;
+    }
+}
+
+TEST(ImageCacheTestSuite, OtherKeyOrDamagedImageIsAMiss) {
+    TempDirectory dir("czff_image_miss");
+    std::string program = dir.Write("first.ball", MakeFirstProgramBall());
+
+    std::vector<uint8_t> image;
+    {
+        RuntimeDataArea rda;
+        ClassLoader loader(rda);
+        loader.LoadProgram(program);
+        image = loader.SaveImage(7);
+    }
+
+    RuntimeDataArea rda;
+    ClassLoader loader(rda);
+    EXPECT_FALSE(loader.LoadImage((dir.root / "missing.img").string(), 7));
+    EXPECT_FALSE(loader.LoadImage(dir.Write("program.img", image), 8));
+
+    image.resize(image.size() / 2);
+    EXPECT_FALSE(loader.LoadImage(dir.Write("program.img", image), 7));
+
+    // nothing was registered by the misses
+    EXPECT_TRUE(rda.GetMethodArea().Functions().empty());
+    EXPECT_TRUE(rda.GetMethodArea().ConstantPool().empty());
+}
@@ -309,3 +309,82 @@ TEST(InterpreterIntegrationTestSuite, ExecutesArrayWithForProgram) {
     EXPECT_EQ(out.str(), "4545454545");
     EXPECT_TRUE(rda.GetStack().Empty());
 }
+
+TEST(InterpreterIntegrationTestSuite, ExecutesIndexedBall) {
+    auto data = MakeIndexedLoopBall();
+    TempFile tmp("indexed.ball");
+    WriteFile(tmp.path, data);
+
+    for (bool lazy : {false, true}) {
+        RuntimeDataArea rda;
+        ClassLoader loader(rda);
+        loader.EnableLazyDecoding(lazy);
+        Interpreter interpreter(rda);
+
+        loader.LoadProgram(tmp.path);
+
+        std::ostringstream out;
+        auto* old = std::cout.rdbuf(out.rdbuf());
+
+        interpreter.Execute(loader.EntryPoint());
+
+        std::cout.rdbuf(old);
+
+        EXPECT_EQ(out.str(), "012") << "lazy=" << lazy;
+    }
+}
+
+TEST(InterpreterIntegrationTestSuite, ExecutesLinkedModules) {
+    TempFile library("library.ball");
+    WriteFile(library.path, MakeLibraryBall());
+    TempFile program("linked.ball");
+    WriteFile(program.path, MakeLinkedProgramBall());
+
+    for (bool lazy : {false, true}) {
+        RuntimeDataArea rda;
+        ClassLoader loader(rda);
+        loader.EnableLazyDecoding(lazy);
+        Interpreter interpreter(rda);
+
+        loader.LoadStdlib(library.path);
+        loader.LoadProgram(program.path);
+
+        std::ostringstream out;
+        auto* old = std::cout.rdbuf(out.rdbuf());
+
+        interpreter.Execute(loader.EntryPoint());
+
+        std::cout.rdbuf(old);
+
+        EXPECT_EQ(out.str(), "42") << "lazy=" << lazy;
+    }
+}
+
+TEST(InterpreterIntegrationTestSuite, ExecutesTreeShakenProgram) {
+    TempFile library("library.ball");
+    WriteFile(library.path, MakeLibraryBall());
+    TempFile program("linked.ball");
+    WriteFile(program.path, MakeLinkedProgramBall());
+
+    RuntimeDataArea rda;
+    ClassLoader loader(rda);
+    loader.EnableLazyDecoding(true);
+    loader.EnableTreeShaking(true);
+    loader.EnableTailCallElimination(true);
+    loader.EnableEscapeAnalysis(true);
+    loader.EnableSuperinstructions(true);
+    Interpreter interpreter(rda);
+
+    loader.LoadStdlib(library.path);
+    loader.LoadProgram(program.path);
+    ASSERT_EQ(rda.GetMethodArea().Functions().size(), 2u);
+
+    std::ostringstream out;
+    auto* old = std::cout.rdbuf(out.rdbuf());
+
+    interpreter.Execute(loader.EntryPoint());
+
+    std::cout.rdbuf(old);
+
+    EXPECT_EQ(out.str(), "42");
+}
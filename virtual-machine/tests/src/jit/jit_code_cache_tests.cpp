@@ -0,0 +1,138 @@
+#include <gtest/gtest.h>
+
+#include <filesystem>
+#include <list>
+
+#include "bytecode_builder.hpp"
+#include "common.hpp"
+#include "jit/jit_code_cache.hpp"
+#include "runtime_data_area.hpp"
+
+using namespace czffvm;
+using namespace czffvm_jit;
+
+namespace fs = std::filesystem;
+
+class JitCodeCacheTest : public testing::Test {
+protected:
+    fs::path root = fs::temp_directory_path() / "czff_jit_cache";
+
+    void SetUp() override {
+        fs::remove_all(root);
+    }
+
+    void TearDown() override {
+        fs::remove_all(root);
+    }
+
+    // A program of its own: functions and constant pool
+    struct Program : BytecodeBuilder {
+        RuntimeDataArea rda;
+        std::list<RuntimeFunction> functions;    // stable addresses for the method area
+
+        MethodArea& BytecodeMethodArea() override { return rda.GetMethodArea(); }
+
+        RuntimeFunction& Add(const std::string& params, const std::string& ret, std::vector<Operation> body) {
+            RuntimeFunction& fn = functions.emplace_back();
+            fn.name_index = Str("F");
+            fn.params_descriptor_index = Str(params);
+            fn.return_type_index = Str(ret);
+            fn.max_stack = 8;
+            fn.locals_count = 1;
+            fn.code = std::move(body);
+            rda.GetMethodArea().RegisterFunction(&fn);
+            return fn;
+        }
+    };
+
+    uint64_t Key(Program& program, const RuntimeFunction& fn, uint64_t target = 0) {
+        return JitCodeCache(root.string(), target).Key(fn, program.rda.GetMethodArea());
+    }
+};
+
+TEST_F(JitCodeCacheTest, KeyFollowsConstantValuesNotIndices) {
+    Program a;
+    RuntimeFunction& fa = a.Add("", "I;", {a.LDC(7), Operation{OperationCode::RET, {}}});
+
+    // the same function behind a differently laid out constant pool
+    Program b;
+    b.Str("padding");
+    b.LDC(123);
+    RuntimeFunction& fb = b.Add("", "I;", {b.LDC(7), Operation{OperationCode::RET, {}}});
+    ASSERT_NE(fa.code[0].arguments, fb.code[0].arguments);
+    EXPECT_EQ(Key(a, fa), Key(b, fb));
+
+    Program c;
+    RuntimeFunction& fc = c.Add("", "I;", {c.LDC(8), Operation{OperationCode::RET, {}}});
+    EXPECT_NE(Key(a, fa), Key(c, fc));
+
+    Program d;
+    RuntimeFunction& fd = d.Add("I;", "I;", {d.LDC(7), Operation{OperationCode::RET, {}}});
+    EXPECT_NE(Key(a, fa), Key(d, fd));
+
+    // another CPU
+    EXPECT_NE(Key(a, fa), Key(a, fa, 1));
+}
+
+TEST_F(JitCodeCacheTest, KeyCoversCallees) {
+    auto build = [](Program& p, int32_t callee_value) -> RuntimeFunction& {
+        p.Add("", "I;", {p.LDC(callee_value), Operation{OperationCode::RET, {}}});
+        return p.Add("", "I;", {
+            Program::WithU2(OperationCode::CALL, 0), Operation{OperationCode::RET, {}}});
+    };
+
+    Program a;
+    Program b;
+    Program c;
+    RuntimeFunction& fa = build(a, 1);
+    RuntimeFunction& fb = build(b, 1);
+    RuntimeFunction& fc = build(c, 2);
+    EXPECT_EQ(Key(a, fa), Key(b, fb));
+    EXPECT_NE(Key(a, fa), Key(c, fc));
+
+    // recursion ends at the function already hashed
+    Program r;
+    RuntimeFunction& self = r.Add("", "I;", {
+        Program::WithU2(OperationCode::CALL, 0), Operation{OperationCode::RET, {}}});
+    EXPECT_NE(Key(r, self), 0u);
+}
+
+TEST_F(JitCodeCacheTest, StoresAndLoadsEntries) {
+    JitCodeCache cache(root.string(), 0);
+
+    CachedCode stored;
+    stored.code = {0x55, 0xb8, 0, 0, 0, 0, 0xc3};
+    stored.patches = {{2, 4, CodePatchKind::CONSTANT, 0, 0xbf600000}};
+    stored.constants = {Constant{ConstantTag::STRING, {'h', 'i'}}};
+    stored.argument_count = 2;
+    stored.locals_count = 3;
+    stored.stack_maps = {{0, 5}, {}};
+    cache.Store(42, stored);
+
+    std::optional<CachedCode> loaded = cache.Load(42);
+    ASSERT_TRUE(loaded.has_value());
+    EXPECT_EQ(loaded->code, stored.code);
+    ASSERT_EQ(loaded->patches.size(), 1u);
+    EXPECT_EQ(loaded->patches[0].offset, 2u);
+    EXPECT_EQ(loaded->patches[0].width, 4);
+    EXPECT_EQ(loaded->patches[0].kind, CodePatchKind::CONSTANT);
+    EXPECT_EQ(loaded->patches[0].bias, 0xbf600000u);
+    EXPECT_EQ(loaded->constants, stored.constants);
+    EXPECT_EQ(loaded->argument_count, 2u);
+    EXPECT_EQ(loaded->locals_count, 3);
+    EXPECT_EQ(loaded->stack_maps, stored.stack_maps);
+
+    EXPECT_FALSE(cache.Load(43).has_value());
+
+    // an entry under another key's name
+    fs::copy_file(root / "000000000000002a.jit", root / "000000000000002b.jit");
+    EXPECT_FALSE(cache.Load(43).has_value());
+
+    // a patch outside the code
+    stored.patches[0].offset = 5;
+    cache.Store(44, stored);
+    EXPECT_FALSE(cache.Load(44).has_value());
+
+    fs::resize_file(root / "000000000000002a.jit", 20);
+    EXPECT_FALSE(cache.Load(42).has_value());
+}
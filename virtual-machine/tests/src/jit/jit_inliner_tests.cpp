@@ -0,0 +1,222 @@
+#include <gtest/gtest.h>
+
+#include <iostream>
+#include <list>
+#include <sstream>
+
+#include "bytecode_builder.hpp"
+#include "common.hpp"
+#include "interpreter.hpp"
+#include "jit/generic_jit_optimizer.hpp"
+#include "jit/jit_compiler.hpp"
+#include "runtime_data_area.hpp"
+
+using namespace czffvm;
+using namespace czffvm_jit;
+
+class InlinerTest : public testing::Test, protected BytecodeBuilder {
+protected:
+    RuntimeDataArea rda;
+    std::list<RuntimeFunction> functions;    // stable addresses for the method area
+    std::vector<Operation> code;
+    uint16_t locals_count = 1;
+
+    MethodArea& BytecodeMethodArea() override { return rda.GetMethodArea(); }
+
+    uint16_t addFunction(const std::string& params, const std::string& ret,
+                         uint16_t locals, std::vector<Operation> body) {
+        RuntimeFunction& fn = functions.emplace_back();
+        fn.name_index = Str("F");
+        fn.params_descriptor_index = Str(params);
+        fn.return_type_index = Str(ret);
+        fn.max_stack = 8;
+        fn.locals_count = locals;
+        fn.code = std::move(body);
+        return rda.GetMethodArea().RegisterFunction(&fn);
+    }
+
+    size_t inline_calls() {
+        GenericJitOptimizer optimizer(code, rda.GetMethodArea());
+        return optimizer.InlineCalls(locals_count);
+    }
+
+    std::string run() {
+        RuntimeFunction main;
+        main.name_index = Str("Main");
+        main.params_descriptor_index = Str("");
+        main.return_type_index = Str("void;");
+        main.max_stack = 8;
+        main.locals_count = locals_count;
+        main.code = code;
+
+        Interpreter interpreter(rda);
+        std::ostringstream captured;
+        auto* old_buf = std::cout.rdbuf(captured.rdbuf());
+        interpreter.Execute(&main);
+        std::cout.rdbuf(old_buf);
+
+        return captured.str();
+    }
+
+    size_t count(OperationCode op) const {
+        size_t n = 0;
+        for (const auto& o : code) n += o.code == op;
+        return n;
+    }
+};
+
+TEST_F(InlinerTest, ArgumentsKeepTheirOrder) {
+    // F(a, b, c) = a * 100 + b * 10 + c
+    uint16_t f = addFunction("I;I;I;", "I;", 3, {
+        WithU2(OperationCode::STORE, 0), WithU2(OperationCode::STORE, 1),
+        WithU2(OperationCode::STORE, 2),
+        WithU2(OperationCode::LDV, 0), LDC(100), Op(OperationCode::MUL),
+        WithU2(OperationCode::LDV, 1), LDC(10), Op(OperationCode::MUL),
+        Op(OperationCode::ADD),
+        WithU2(OperationCode::LDV, 2), Op(OperationCode::ADD),
+        Op(OperationCode::RET)
+    });
+
+    code = {
+        LDC(1), LDC(2), LDC(3),
+        WithU2(OperationCode::CALL, f), Op(OperationCode::PRINT),
+        Op(OperationCode::RET)
+    };
+    EXPECT_EQ(run(), "123");
+
+    EXPECT_EQ(inline_calls(), 1u);
+    EXPECT_EQ(count(OperationCode::CALL), 0u);
+    // callee locals and argument temporaries live above the caller's locals
+    EXPECT_EQ(locals_count, 1 + 3 + 3);
+    EXPECT_EQ(run(), "123");
+}
+
+TEST_F(InlinerTest, BranchesAndReturnsAreRemapped) {
+    // Max(a, b), called in a loop
+    uint16_t max = addFunction("I;I;", "I;", 2, {
+        WithU2(OperationCode::STORE, 0), WithU2(OperationCode::STORE, 1), // 0..1
+        WithU2(OperationCode::LDV, 0), WithU2(OperationCode::LDV, 1),     // 2..3
+        Op(OperationCode::LT), WithU2(OperationCode::JZ, 8),              // 4..5
+        WithU2(OperationCode::LDV, 1), Op(OperationCode::RET),            // 6..7
+        WithU2(OperationCode::LDV, 0), Op(OperationCode::RET)             // 8..9
+    });
+
+    // i = 0; while (i < 3) { print Max(i, 1); i = i + 1 }
+    code = {
+        LDC(0), WithU2(OperationCode::STORE, 0),                    // 0..1
+        WithU2(OperationCode::LDV, 0), LDC(3),                      // 2..3
+        Op(OperationCode::LT), WithU2(OperationCode::JZ, 15),       // 4..5
+        WithU2(OperationCode::LDV, 0), LDC(1),                      // 6..7
+        WithU2(OperationCode::CALL, max), Op(OperationCode::PRINT), // 8..9
+        WithU2(OperationCode::LDV, 0), LDC(1),
+        Op(OperationCode::ADD), WithU2(OperationCode::STORE, 0),    // 10..13
+        WithU2(OperationCode::JMP, 2),                              // 14
+        Op(OperationCode::RET)                                      // 15
+    };
+    EXPECT_EQ(run(), "112");
+
+    EXPECT_EQ(inline_calls(), 1u);
+    EXPECT_EQ(count(OperationCode::CALL), 0u);
+    EXPECT_EQ(count(OperationCode::RET), 1u);
+    EXPECT_EQ(run(), "112");
+}
+
+TEST_F(InlinerTest, VoidCalleeWithSideEffects) {
+    uint16_t show = addFunction("I;", "void;", 1, {
+        WithU2(OperationCode::STORE, 0),
+        WithU2(OperationCode::LDV, 0), Op(OperationCode::PRINT),
+        WithU2(OperationCode::LDV, 0), Op(OperationCode::PRINT),
+        Op(OperationCode::RET)
+    });
+
+    code = {
+        LDC(4), WithU2(OperationCode::CALL, show),
+        LDC(5), WithU2(OperationCode::CALL, show),
+        Op(OperationCode::RET)
+    };
+
+    EXPECT_EQ(inline_calls(), 2u);
+    // both bodies share the same caller slots
+    EXPECT_EQ(locals_count, 2);
+    EXPECT_EQ(run(), "4455");
+}
+
+TEST_F(InlinerTest, RejectedCallees) {
+    // leaves a value below the result, which RET would discard
+    uint16_t unbalanced = addFunction("", "I;", 0, {
+        LDC(5), LDC(6), Op(OperationCode::RET)
+    });
+    // not a leaf
+    uint16_t caller = addFunction("", "I;", 0, {
+        WithU2(OperationCode::CALL, unbalanced), Op(OperationCode::RET)
+    });
+
+    std::vector<Operation> large(kInlineSmallSize + 1, Op(OperationCode::NOP));
+    large.push_back(Op(OperationCode::RET));
+    uint16_t big = addFunction("", "void;", 0, large);
+
+    code = {
+        WithU2(OperationCode::CALL, unbalanced), Op(OperationCode::PRINT),
+        WithU2(OperationCode::CALL, caller), Op(OperationCode::PRINT),
+        WithU2(OperationCode::CALL, big),
+        Op(OperationCode::RET)
+    };
+
+    EXPECT_EQ(inline_calls(), 0u);
+    EXPECT_EQ(count(OperationCode::CALL), 3u);
+
+    // a hot callee may be larger
+    rda.GetMethodArea().GetFunction(big)->call_count = kInlineHotCalls;
+    EXPECT_EQ(inline_calls(), 1u);
+    EXPECT_EQ(count(OperationCode::CALL), 2u);
+}
+
+// compiles everything but CALL, like the x86 backend
+class CallFreeJitCompiler : public JitCompiler {
+public:
+    bool CanCompile(OperationCode opcode) override { return opcode != OperationCode::CALL; }
+    bool CanCompile(Operation op) override { return CanCompile(op.code); }
+    std::unique_ptr<CompiledRuntimeFunction> CompileFunction(const RuntimeFunction&, RuntimeDataArea&) override {
+        return nullptr;
+    }
+};
+
+TEST_F(InlinerTest, CanCompileFunctionHasNoSideEffects) {
+    // inlining its local would intern a zero constant
+    uint16_t increment = addFunction("I;", "I;", 1, {
+        WithU2(OperationCode::STORE, 0), WithU2(OperationCode::LDV, 0),
+        LDC(1), Op(OperationCode::ADD), Op(OperationCode::RET)
+    });
+    // never decoded, and the method area has no loader to decode it
+    uint16_t pending = addFunction("", "void;", 0, {});
+    rda.GetMethodArea().GetFunction(pending)->code_pending = true;
+
+    RuntimeFunction main;
+    main.locals_count = 0;
+    main.code = {
+        LDC(2), WithU2(OperationCode::CALL, increment), Op(OperationCode::PRINT),
+        Op(OperationCode::RET)
+    };
+
+    CallFreeJitCompiler jit;
+    size_t pool = rda.GetMethodArea().ConstantPool().size();
+    EXPECT_TRUE(jit.CanCompileFunction(main, rda.GetMethodArea()));
+    EXPECT_EQ(rda.GetMethodArea().ConstantPool().size(), pool);
+    EXPECT_EQ(main.code.size(), 4u);
+
+    main.code.insert(main.code.begin(), WithU2(OperationCode::CALL, pending));
+    EXPECT_FALSE(jit.CanCompileFunction(main, rda.GetMethodArea()));
+    EXPECT_TRUE(rda.GetMethodArea().GetFunction(pending)->code_pending);
+}
+
+TEST_F(InlinerTest, CanCompileFunctionRejectsJumpsOutOfTheFunction) {
+    RuntimeFunction main;
+    main.locals_count = 0;
+    main.code = {WithU2(OperationCode::JMP, 100), Op(OperationCode::RET)};
+
+    CallFreeJitCompiler jit;
+    EXPECT_FALSE(jit.CanCompileFunction(main, rda.GetMethodArea()));
+
+    main.code[0] = WithU2(OperationCode::JMP, 1);
+    EXPECT_TRUE(jit.CanCompileFunction(main, rda.GetMethodArea()));
+}
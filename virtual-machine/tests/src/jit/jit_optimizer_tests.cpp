@@ -1,7 +1,17 @@
 #include <gtest/gtest.h>
 
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+
+#include "bytecode_builder.hpp"
+#include "class_loader.hpp"
 #include "common.hpp"
+#include "interpreter.hpp"
 #include "jit/generic_jit_optimizer.hpp"
+#include "jit/jit_pass_manager.hpp"
+#include "minimal_ball.hpp"
 
 using namespace czffvm;
 using namespace czffvm_jit;
@@ -307,6 +317,24 @@ protected:
     Operation makeOp(OperationCode op) {
         return Operation{op, {}};
     }
+
+    Operation makeOp(OperationCode op, int arg) {
+        return Operation{op, {uint8_t((arg >> 8) & 0xFF), uint8_t(arg & 0xFF)}};
+    }
+
+    Operation makeConst(ConstantTag tag, std::vector<uint8_t> data) {
+        return makeOp(OperationCode::LDC, method_area.RegisterConstant(Constant{tag, std::move(data)}));
+    }
+
+    const Constant& constantAt(size_t pc) const {
+        return method_area.GetConstant((code[pc].arguments[0] << 8) | code[pc].arguments[1]);
+    }
+
+    size_t count(OperationCode op) const {
+        size_t n = 0;
+        for (const auto& o : code) n += o.code == op;
+        return n;
+    }
 };
 
 TEST_F(ConstantFoldingTest, SimpleAdd) {
@@ -399,6 +427,175 @@ TEST_F(ConstantFoldingTest, ChainAdd) {
     EXPECT_EQ(code[1].code, OperationCode::RET);
 }
 
+TEST_F(ConstantFoldingTest, KeepsWideResultType) {
+    // U8 0xFFFFFFFF + U8 1 needs all eight bytes
+    code = {
+        makeConst(ConstantTag::U8, {0, 0, 0, 0, 0xFF, 0xFF, 0xFF, 0xFF}),
+        makeConst(ConstantTag::U8, {0, 0, 0, 0, 0, 0, 0, 1}),
+        makeOp(OperationCode::ADD),
+        makeOp(OperationCode::RET)
+    };
+
+    runFolding();
+
+    ASSERT_EQ(code.size(), 2);
+    const Constant& c = constantAt(0);
+    EXPECT_EQ(c.tag, ConstantTag::U8);
+    EXPECT_EQ(c.data, (std::vector<uint8_t>{0, 0, 0, 1, 0, 0, 0, 0}));
+}
+
+TEST_F(ConstantFoldingTest, ComparisonIsBool) {
+    // 7 % 4 < 5
+    code = {
+        makeLDC(7), makeLDC(4), makeOp(OperationCode::MOD),
+        makeLDC(5), makeOp(OperationCode::LT),
+        makeOp(OperationCode::RET)
+    };
+
+    runFolding();
+
+    ASSERT_EQ(code.size(), 2);
+    EXPECT_EQ(constantAt(0).tag, ConstantTag::BOOL);
+    EXPECT_EQ(constantAt(0).data, (std::vector<uint8_t>{1}));
+}
+
+TEST_F(ConstantFoldingTest, DivisionByZeroIsKept) {
+    code = {
+        makeLDC(1), makeLDC(0), makeOp(OperationCode::DIV),
+        makeOp(OperationCode::RET)
+    };
+
+    runFolding();
+
+    EXPECT_EQ(count(OperationCode::DIV), 1u);
+}
+
+TEST_F(ConstantFoldingTest, DecidedBranchDropsDeadBlock) {
+    // if (2 < 3) print 1 else print 2
+    code = {
+        makeLDC(2), makeLDC(3), makeOp(OperationCode::LT),   // 0..2
+        makeOp(OperationCode::JZ, 7),                         // 3
+        makeLDC(1), makeOp(OperationCode::PRINT),             // 4..5
+        makeOp(OperationCode::RET),                           // 6
+        makeLDC(2), makeOp(OperationCode::PRINT),             // 7..8
+        makeOp(OperationCode::RET)                            // 9
+    };
+
+    runFolding();
+
+    ASSERT_EQ(code.size(), 3);
+    EXPECT_EQ(code[0].code, OperationCode::LDC);
+    EXPECT_EQ(constantAt(0).data, (std::vector<uint8_t>{0, 1}));
+    EXPECT_EQ(code[1].code, OperationCode::PRINT);
+    EXPECT_EQ(code[2].code, OperationCode::RET);
+}
+
+TEST_F(ConstantFoldingTest, PropagatesThroughLocalsAcrossBlocks) {
+    code = {
+        makeLDC(4), makeOp(OperationCode::STORE, 0),          // 0..1
+        makeLDV(1), makeOp(OperationCode::JZ, 6),             // 2..3
+        makeLDC(9), makeOp(OperationCode::PRINT),             // 4..5
+        makeLDV(0), makeLDC(1), makeOp(OperationCode::ADD),   // 6..8
+        makeOp(OperationCode::RET)                            // 9
+    };
+
+    runFolding();
+
+    EXPECT_EQ(count(OperationCode::ADD), 0u);
+    EXPECT_EQ(count(OperationCode::JZ), 1u);
+    ASSERT_EQ(code[code.size() - 2].code, OperationCode::LDC);
+    const Constant& c = constantAt(code.size() - 2);
+    EXPECT_EQ(c.tag, ConstantTag::I4);
+    EXPECT_EQ(c.data, (std::vector<uint8_t>{0, 0, 0, 5}));
+}
+
+TEST_F(ConstantFoldingTest, LoopVariableIsNotConstant) {
+    // i = 0; while (i < 3) i = i + 1; return i
+    code = {
+        makeLDC(0), makeOp(OperationCode::STORE, 0),          // 0..1
+        makeLDV(0), makeLDC(3), makeOp(OperationCode::LT),    // 2..4
+        makeOp(OperationCode::JZ, 11),                        // 5
+        makeLDV(0), makeLDC(1), makeOp(OperationCode::ADD),   // 6..8
+        makeOp(OperationCode::STORE, 0),                      // 9
+        makeOp(OperationCode::JMP, 2),                        // 10
+        makeLDV(0), makeOp(OperationCode::RET)                // 11..12
+    };
+    std::vector<Operation> before = code;
+
+    runFolding();
+
+    ASSERT_EQ(code.size(), before.size());
+    for (size_t i = 0; i < code.size(); ++i) {
+        EXPECT_EQ(code[i].code, before[i].code);
+    }
+}
+
+TEST_F(ConstantFoldingTest, ReusesPoolEntries) {
+    makeConst(ConstantTag::I4, {0, 0, 0, 5});
+    code = {
+        makeLDC(2), makeLDC(3), makeOp(OperationCode::ADD), makeOp(OperationCode::PRINT),
+        makeLDC(1), makeLDC(4), makeOp(OperationCode::ADD), makeOp(OperationCode::PRINT),
+        makeOp(OperationCode::RET)
+    };
+    size_t pool = method_area.ConstantPool().size();
+
+    runFolding();
+
+    EXPECT_EQ(method_area.ConstantPool().size(), pool);
+    EXPECT_EQ(code[0].arguments, code[2].arguments);
+}
+
+TEST_F(ConstantFoldingTest, SwappedOperandsTakeTheSwapAlong) {
+    // x = 10; if (x > 0) print 7; if (x >= 10) print 8; the compiler emits
+    // `a > b` as SWAP; LT and `a >= b` as SWAP; LEQ
+    code = {
+        makeLDC(99), makeLDC(10), makeOp(OperationCode::STORE, 0),            // 0..2
+        makeLDV(0), makeLDC(0), makeOp(OperationCode::SWAP),                  // 3..5
+        makeOp(OperationCode::LT), makeOp(OperationCode::JZ, 10),             // 6..7
+        makeLDC(7), makeOp(OperationCode::PRINT),                             // 8..9
+        makeLDV(0), makeLDC(10), makeOp(OperationCode::SWAP),                 // 10..12
+        makeOp(OperationCode::LEQ), makeOp(OperationCode::JZ, 17),            // 13..14
+        makeLDC(8), makeOp(OperationCode::PRINT),                             // 15..16
+        makeOp(OperationCode::PRINT),                                         // 17
+        makeOp(OperationCode::RET)                                            // 18
+    };
+
+    runFolding();
+
+    EXPECT_EQ(count(OperationCode::SWAP), 0u);
+    EXPECT_EQ(count(OperationCode::JZ), 0u);
+    // 99 is still the bottom value printed last
+    std::vector<OperationCode> expected = {
+        OperationCode::LDC, OperationCode::LDC, OperationCode::STORE,
+        OperationCode::LDC, OperationCode::PRINT,
+        OperationCode::LDC, OperationCode::PRINT,
+        OperationCode::PRINT, OperationCode::RET
+    };
+    ASSERT_EQ(code.size(), expected.size());
+    for (size_t i = 0; i < code.size(); ++i) {
+        EXPECT_EQ(code[i].code, expected[i]) << "at " << i;
+    }
+    EXPECT_EQ(constantAt(0).data, (std::vector<uint8_t>{0, 99}));
+}
+
+TEST_F(ConstantFoldingTest, SwapWithUnknownValue) {
+    // x stays in place once the constant it was swapped with folds away
+    code = {
+        makeLDV(0), makeLDC(5), makeOp(OperationCode::SWAP),
+        makeOp(OperationCode::STORE, 1),
+        makeLDC(1), makeOp(OperationCode::ADD), makeOp(OperationCode::PRINT),
+        makeOp(OperationCode::RET)
+    };
+
+    runFolding();
+
+    ASSERT_EQ(code.size(), 5u);
+    EXPECT_EQ(code[0].code, OperationCode::LDV);
+    EXPECT_EQ(code[1].code, OperationCode::STORE);
+    EXPECT_EQ(code[2].code, OperationCode::LDC);
+    EXPECT_EQ(constantAt(2).data, (std::vector<uint8_t>{0, 0, 0, 6}));
+}
+
 TEST_F(GenericJitOptimizerTest, DSE_RemovesUnusedLDC) {
     // 0: LDC 10
     // 1: RET
@@ -558,3 +755,271 @@ TEST_F(GenericJitOptimizerTest, DSE_RemovesUnusedLDV) {
 
 
 
+
+
+TEST_F(GenericJitOptimizerTest, FindsNestedLoops) {
+    // 0: NOP         B0
+    // 1: LDC 1       B1  outer header
+    // 2: JZ -> 6
+    // 3: LDC 1       B2  inner header and latch
+    // 4: JNZ -> 3
+    // 5: JMP -> 1    B3  outer latch
+    // 6: RET         B4
+
+    code = {
+        makeOp(OperationCode::NOP),
+        makeLDC(1),
+        makeJump(OperationCode::JZ, 6),
+        makeLDC(1),
+        makeJump(OperationCode::JNZ, 3),
+        makeJump(OperationCode::JMP, 1),
+        makeOp(OperationCode::RET)
+    };
+
+    GenericJitOptimizer opt(code, method_area);
+    opt.BuildControlFlowGraph();
+    LoopAnalysis loops = opt.FindLoops();
+
+    EXPECT_EQ(loops.ImmediateDominator(2), 1);
+    EXPECT_EQ(loops.ImmediateDominator(4), 1);
+    EXPECT_TRUE(loops.Dominates(1, 3));
+    EXPECT_FALSE(loops.Dominates(3, 4));
+
+    ASSERT_EQ(loops.Loops().size(), 2);
+
+    const Loop& inner = loops.Loops()[0];
+    EXPECT_EQ(inner.header, 2);
+    EXPECT_EQ(inner.blocks, std::vector<int>({2}));
+    EXPECT_EQ(inner.latches, std::vector<int>({2}));
+    EXPECT_EQ(inner.parent, 1);
+
+    const Loop& outer = loops.Loops()[1];
+    EXPECT_EQ(outer.header, 1);
+    EXPECT_EQ(outer.blocks, std::vector<int>({1, 2, 3}));
+    EXPECT_EQ(outer.latches, std::vector<int>({3}));
+
+    EXPECT_EQ(loops.LoopDepth(0), 0);
+    EXPECT_EQ(loops.LoopDepth(2), 2);
+    EXPECT_EQ(loops.LoopDepth(3), 1);
+}
+
+TEST_F(GenericJitOptimizerTest, ForwardBranchesAreNotLoops) {
+    // 0: LDC 1
+    // 1: JZ -> 3
+    // 2: JMP -> 4
+    // 3: NOP
+    // 4: RET
+
+    code = {
+        makeLDC(1),
+        makeJump(OperationCode::JZ, 3),
+        makeJump(OperationCode::JMP, 4),
+        makeOp(OperationCode::NOP),
+        makeOp(OperationCode::RET)
+    };
+
+    GenericJitOptimizer opt(code, method_area);
+    opt.BuildControlFlowGraph();
+    LoopAnalysis loops = opt.FindLoops();
+
+    EXPECT_TRUE(loops.Loops().empty());
+    EXPECT_EQ(loops.ImmediateDominator(3), 0);
+}
+
+TEST_F(GenericJitOptimizerTest, CompactCodeOnLargeFunction) {
+    // every other operation is a NOP and every block jumps to the next one
+    const int blocks = 16000;
+    for (int b = 0; b < blocks; ++b) {
+        int next = 4 * (b + 1);
+        code.push_back(makeOp(OperationCode::NOP));
+        code.push_back(makeLDC(1));
+        code.push_back(makeOp(OperationCode::NOP));
+        code.push_back(makeJump(OperationCode::JNZ, next));
+    }
+    code.push_back(makeOp(OperationCode::RET));
+
+    GenericJitOptimizer opt(code, method_area);
+    opt.CompactCode();
+
+    ASSERT_EQ(code.size(), size_t(2 * blocks + 1));
+    for (int b = 0; b < blocks; ++b) {
+        const Operation& jump = code[2 * b + 1];
+        int target = (jump.arguments[0] << 8) | jump.arguments[1];
+        EXPECT_EQ(target, 2 * (b + 1));
+    }
+}
+
+TEST_F(GenericJitOptimizerTest, ControlFlowGraphIsCachedUntilCodeChanges) {
+    code = {
+        makeLDC(1),                       // 0
+        makeJump(OperationCode::JMP, 3),  // 1
+        makeLDC(2),                       // 2 (dead)
+        makeOp(OperationCode::RET)        // 3
+    };
+
+    GenericJitOptimizer opt(code, method_area);
+    ASSERT_EQ(opt.ControlFlowGraph().size(), 3u);
+    EXPECT_FALSE(opt.ControlFlowGraph()[1].reachable);
+    EXPECT_TRUE(opt.ControlFlowGraph()[2].reachable);
+
+    opt.RemoveDeadCode();
+    opt.CompactCode();
+    ASSERT_EQ(code.size(), 3u);
+
+    // rebuilt for the compacted code
+    ASSERT_EQ(opt.ControlFlowGraph().size(), 2u);
+    EXPECT_EQ(opt.ControlFlowGraph()[0].end, 2);
+    EXPECT_TRUE(opt.ControlFlowGraph()[1].reachable);
+}
+
+TEST_F(GenericJitOptimizerTest, PassManagerReportsEachPass) {
+    code = {
+        makeLDC(2), makeLDC(3), makeOp(OperationCode::ADD),
+        makeJump(OperationCode::JMP, 4),
+        makeOp(OperationCode::PRINT),
+        makeOp(OperationCode::RET)
+    };
+
+    GenericJitOptimizer opt(code, method_area);
+    JitPassManager passes(opt);
+    passes.AddCleanupPasses();
+    passes.Run();
+
+    const auto& reports = passes.Reports();
+    ASSERT_EQ(reports.size(), 4u);
+    EXPECT_EQ(reports[0].name, "dead-code");
+    EXPECT_EQ(reports[0].size_before, 6u);
+    EXPECT_EQ(reports[0].size_after, 6u);
+    EXPECT_EQ(reports[1].name, "constant-folding");
+    EXPECT_EQ(reports[1].Removed(), 2u);
+    EXPECT_EQ(reports.back().name, "redundant-jumps");
+    EXPECT_EQ(reports.back().size_after, code.size());
+
+    // LDC 5, PRINT, RET
+    ASSERT_EQ(code.size(), 3u);
+    EXPECT_EQ(code[1].code, OperationCode::PRINT);
+}
+
+class BytecodeOptimizerTest : public testing::Test, protected BytecodeBuilder {
+protected:
+    RuntimeDataArea rda;
+    RuntimeFunction fn;
+
+    MethodArea& BytecodeMethodArea() override { return rda.GetMethodArea(); }
+
+    void SetUp() override {
+        fn.name_index = Str("Main");
+        fn.params_descriptor_index = Str("");
+        fn.return_type_index = Str("void;");
+        fn.max_stack = 8;
+        fn.locals_count = 2;
+    }
+
+    size_t Count(OperationCode code) const {
+        size_t n = 0;
+        for (const auto& op : fn.code) n += op.code == code;
+        return n;
+    }
+
+    std::string Execute() {
+        Interpreter interpreter(rda);
+
+        std::ostringstream captured;
+        auto* old_buf = std::cout.rdbuf(captured.rdbuf());
+        interpreter.Execute(&fn);
+        std::cout.rdbuf(old_buf);
+
+        return captured.str();
+    }
+};
+
+TEST_F(BytecodeOptimizerTest, InterpretedCodeRunsFewerOperations) {
+    // n = 10; if (n * 2 < 15) print n else print 0; i = 0; while (i < n) i = i + 3; print i
+    fn.code = {
+        LDC(10), WithU2(OperationCode::STORE, 0),                                 // 0..1
+        WithU2(OperationCode::LDV, 0), LDC(2), Op(OperationCode::MUL),            // 2..4
+        LDC(15), Op(OperationCode::LT), WithU2(OperationCode::JZ, 11),            // 5..7
+        WithU2(OperationCode::LDV, 0), Op(OperationCode::PRINT),                  // 8..9
+        WithU2(OperationCode::JMP, 13),                                           // 10
+        LDC(0), Op(OperationCode::PRINT),                                         // 11..12
+        LDC(0), WithU2(OperationCode::STORE, 1),                                  // 13..14
+        WithU2(OperationCode::LDV, 1), WithU2(OperationCode::LDV, 0),             // 15..16
+        Op(OperationCode::LT), WithU2(OperationCode::JZ, 25),                     // 17..18
+        WithU2(OperationCode::LDV, 1), LDC(3), Op(OperationCode::ADD),            // 19..21
+        WithU2(OperationCode::STORE, 1), WithU2(OperationCode::JMP, 15),          // 22..23
+        Op(OperationCode::NOP),                                                   // 24
+        WithU2(OperationCode::LDV, 1), Op(OperationCode::PRINT),                  // 25..26
+        Op(OperationCode::RET)                                                    // 27
+    };
+    std::string expected = Execute();
+    size_t size = fn.code.size();
+
+    OptimizeBytecode(fn, rda.GetMethodArea());
+
+    EXPECT_LT(fn.code.size(), size);
+    EXPECT_EQ(Count(OperationCode::MUL), 0u);
+    // the loop condition stays, the folded branch is gone
+    EXPECT_EQ(Count(OperationCode::JZ), 1u);
+    EXPECT_EQ(Execute(), expected);
+}
+
+TEST_F(BytecodeOptimizerTest, KeepsInterpreterErrors) {
+    fn.code = {
+        // U2 + I4 throws in the interpreter
+        LDC(ConstantTag::U2, {0, 1}), LDC(2), Op(OperationCode::ADD), Op(OperationCode::PRINT),
+        // unused, but dividing by zero throws
+        LDC(1), LDC(0), Op(OperationCode::DIV), WithU2(OperationCode::STORE, 0),
+        LDC(1), LDC(0), Op(OperationCode::DIV),
+        Op(OperationCode::RET)
+    };
+
+    OptimizeBytecode(fn, rda.GetMethodArea());
+
+    EXPECT_EQ(Count(OperationCode::ADD), 1u);
+    EXPECT_EQ(Count(OperationCode::DIV), 2u);
+}
+
+TEST(BytecodeOptimizerIntegrationTest, RunsComparisonsOnConstantLocal) {
+    std::filesystem::path path = std::filesystem::temp_directory_path() / "czff_comparisons.ball";
+    {
+        std::vector<uint8_t> data = MakeComparisonProgramBall();
+        std::ofstream f(path, std::ios::binary);
+        f.write(reinterpret_cast<const char*>(data.data()), data.size());
+    }
+
+    RuntimeDataArea rda;
+    ClassLoader loader(rda);
+    loader.SetBytecodeOptimizer(OptimizeBytecode);
+    loader.LoadProgram(path.string());
+    std::filesystem::remove(path);
+
+    const RuntimeFunction& main = *loader.EntryPoint();
+    for (const Operation& op : main.code) {
+        EXPECT_NE(op.code, OperationCode::SWAP);
+    }
+
+    Interpreter interpreter(rda);
+    std::ostringstream captured;
+    auto* old_buf = std::cout.rdbuf(captured.rdbuf());
+    interpreter.Execute(loader.EntryPoint());
+    std::cout.rdbuf(old_buf);
+
+    EXPECT_EQ(captured.str(), "7810");
+}
+
+TEST_F(GenericJitOptimizerTest, DSE_KeepsValuesMergedFromBranches) {
+    // print (LDV 0 != 0 ? 1 : 2) with the value left on the stack across blocks
+    code = {
+        Operation{OperationCode::LDV, {0, 0}},   // 0
+        makeJump(OperationCode::JZ, 4),          // 1
+        makeLDC(1),                              // 2
+        makeJump(OperationCode::JMP, 5),         // 3
+        makeLDC(2),                              // 4
+        makeOp(OperationCode::PRINT),            // 5
+        makeOp(OperationCode::RET)               // 6
+    };
+
+    runDSE();
+
+    EXPECT_EQ(code.size(), 7u);
+}
@@ -0,0 +1,390 @@
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <iostream>
+#include <sstream>
+
+#include "bytecode_builder.hpp"
+#include "common.hpp"
+#include "interpreter.hpp"
+#include "jit/ssa_ir.hpp"
+#include "runtime_data_area.hpp"
+
+using namespace czffvm;
+using namespace czffvm_jit;
+
+class SsaTest : public testing::Test, protected BytecodeBuilder {
+protected:
+    RuntimeDataArea rda;
+    RuntimeFunction function;
+    std::vector<Operation> code;
+
+    MethodArea& BytecodeMethodArea() override { return rda.GetMethodArea(); }
+
+    void SetUp() override {
+        function.name_index = Str("Main");
+        function.params_descriptor_index = Str("");
+        function.return_type_index = Str("void;");
+        function.max_stack = 8;
+        function.locals_count = 3;
+    }
+
+    std::optional<SsaFunction> build() {
+        function.code = code;
+        return SsaBuilder(function.code, function, function.locals_count, rda.GetMethodArea()).Build();
+    }
+
+    std::string run(const std::vector<Operation>& body, uint16_t locals_count) {
+        RuntimeFunction fn;
+        fn.name_index = function.name_index;
+        fn.params_descriptor_index = function.params_descriptor_index;
+        fn.return_type_index = function.return_type_index;
+        fn.max_stack = function.max_stack;
+        fn.locals_count = locals_count;
+        fn.code = body;
+
+        Interpreter interpreter(rda);
+        std::ostringstream captured;
+        auto* old_buf = std::cout.rdbuf(captured.rdbuf());
+        interpreter.Execute(&fn);
+        std::cout.rdbuf(old_buf);
+
+        return captured.str();
+    }
+
+    // lowered code must print the same as the original
+    LoweredFunction expectSameOutput(const std::string& expected) {
+        EXPECT_EQ(run(code, function.locals_count), expected);
+
+        auto ssa = build();
+        EXPECT_TRUE(ssa.has_value());
+        ssa->EliminateDeadValues();
+        LoweredFunction lowered = ssa->Lower();
+
+        EXPECT_EQ(run(lowered.code, lowered.locals_count), expected);
+        return lowered;
+    }
+
+    static size_t countPhis(const SsaFunction& fn) {
+        size_t n = 0;
+        for (const auto& b : fn.blocks) n += b.phis.size();
+        return n;
+    }
+
+    static size_t count(const std::vector<Operation>& body, OperationCode op) {
+        size_t n = 0;
+        for (const auto& o : body) n += o.code == op;
+        return n;
+    }
+};
+
+TEST_F(SsaTest, StackShufflingBecomesDataFlow) {
+    code = {
+        LDC(2), WithU2(OperationCode::STORE, 0),
+        WithU2(OperationCode::LDV, 0), Op(OperationCode::DUP), Op(OperationCode::ADD),
+        WithU2(OperationCode::STORE, 1),
+        WithU2(OperationCode::LDV, 1), Op(OperationCode::PRINT),
+        Op(OperationCode::RET)
+    };
+
+    auto ssa = build();
+    ASSERT_TRUE(ssa.has_value());
+    EXPECT_EQ(countPhis(*ssa), 0u);
+
+    // ADD reads the same constant twice
+    const SsaInstruction* add = nullptr;
+    for (const auto& v : ssa->values) {
+        if (v.kind == SsaKind::OPERATION && v.code == OperationCode::ADD) add = &v;
+    }
+    ASSERT_NE(add, nullptr);
+    ASSERT_EQ(add->inputs.size(), 2u);
+    EXPECT_EQ(add->inputs[0], add->inputs[1]);
+    EXPECT_EQ(ssa->values[add->inputs[0]].kind, SsaKind::CONSTANT);
+
+    LoweredFunction lowered = expectSameOutput("4");
+    EXPECT_EQ(count(lowered.code, OperationCode::DUP), 0u);
+    EXPECT_EQ(count(lowered.code, OperationCode::STORE), 0u);
+}
+
+TEST_F(SsaTest, LoopCarriedLocalsGetPhis) {
+    // i = 0; s = 0; while (i < 10) { s = s + i; i = i + 1 } print s
+    code = {
+        LDC(0), WithU2(OperationCode::STORE, 0),                 // 0..1
+        LDC(0), WithU2(OperationCode::STORE, 1),                 // 2..3
+        WithU2(OperationCode::LDV, 0), LDC(10),                  // 4..5
+        Op(OperationCode::LT), WithU2(OperationCode::JZ, 18),    // 6..7
+        WithU2(OperationCode::LDV, 1), WithU2(OperationCode::LDV, 0),
+        Op(OperationCode::ADD), WithU2(OperationCode::STORE, 1), // 8..11
+        WithU2(OperationCode::LDV, 0), LDC(1),
+        Op(OperationCode::ADD), WithU2(OperationCode::STORE, 0), // 12..15
+        WithU2(OperationCode::JMP, 4),                           // 16
+        Op(OperationCode::NOP),                                  // 17
+        WithU2(OperationCode::LDV, 1), Op(OperationCode::PRINT), // 18..19
+        Op(OperationCode::RET)                                   // 20
+    };
+
+    auto ssa = build();
+    ASSERT_TRUE(ssa.has_value());
+    // i and s merge at the loop header, the untouched local does not
+    EXPECT_EQ(countPhis(*ssa), 2u);
+
+    expectSameOutput("45");
+}
+
+TEST_F(SsaTest, SwappedLocalsUseParallelCopies) {
+    // a = 1; b = 2; n = 3; do { t = a; a = b; b = t; n = n - 1 } while (n); print a; print b
+    function.locals_count = 4;
+    code = {
+        LDC(1), WithU2(OperationCode::STORE, 0),
+        LDC(2), WithU2(OperationCode::STORE, 1),
+        LDC(3), WithU2(OperationCode::STORE, 2),
+        WithU2(OperationCode::LDV, 0), WithU2(OperationCode::STORE, 3),   // 6
+        WithU2(OperationCode::LDV, 1), WithU2(OperationCode::STORE, 0),
+        WithU2(OperationCode::LDV, 3), WithU2(OperationCode::STORE, 1),
+        WithU2(OperationCode::LDV, 2), LDC(1), Op(OperationCode::SUB),
+        WithU2(OperationCode::STORE, 2),
+        WithU2(OperationCode::LDV, 2), WithU2(OperationCode::JNZ, 6),
+        WithU2(OperationCode::LDV, 0), Op(OperationCode::PRINT),
+        WithU2(OperationCode::LDV, 1), Op(OperationCode::PRINT),
+        Op(OperationCode::RET)
+    };
+
+    expectSameOutput("21");
+}
+
+TEST_F(SsaTest, OperandStackValuesMergeAtJoin) {
+    // 1 + (x == 0 ? 20 : 10), the 1 stays on the stack across the branch
+    code = {
+        LDC(0), WithU2(OperationCode::STORE, 0), // 0..1
+        LDC(1),                                  // 2
+        WithU2(OperationCode::LDV, 0),           // 3
+        WithU2(OperationCode::JZ, 7),            // 4
+        LDC(10),                                 // 5
+        WithU2(OperationCode::JMP, 8),           // 6
+        LDC(20),                                 // 7
+        Op(OperationCode::ADD),                  // 8
+        Op(OperationCode::PRINT),                // 9
+        Op(OperationCode::RET)                   // 10
+    };
+
+    auto ssa = build();
+    ASSERT_TRUE(ssa.has_value());
+    // only the second operand differs between the two paths
+    EXPECT_EQ(countPhis(*ssa), 1u);
+
+    expectSameOutput("21");
+}
+
+TEST_F(SsaTest, UnusedPureValuesAreRemoved) {
+    code = {
+        LDC(3), WithU2(OperationCode::STORE, 0),
+        WithU2(OperationCode::LDV, 0), LDC(4), Op(OperationCode::MUL),
+        WithU2(OperationCode::STORE, 1),
+        WithU2(OperationCode::LDV, 0), Op(OperationCode::PRINT),
+        Op(OperationCode::RET)
+    };
+
+    auto ssa = build();
+    ASSERT_TRUE(ssa.has_value());
+    EXPECT_GT(ssa->EliminateDeadValues(), 0u);
+
+    LoweredFunction lowered = expectSameOutput("3");
+    EXPECT_EQ(count(lowered.code, OperationCode::MUL), 0u);
+}
+
+TEST_F(SsaTest, InconsistentStackDepthIsRejected) {
+    // the join at 4 is reached with one and with zero values on the stack
+    code = {
+        LDC(1),
+        WithU2(OperationCode::JZ, 4),
+        LDC(5),
+        Op(OperationCode::NOP),
+        Op(OperationCode::RET)
+    };
+
+    EXPECT_FALSE(build().has_value());
+}
+
+TEST_F(SsaTest, InvariantMultiplicationIsHoisted) {
+    // i = 0; s = 0; a = 3; while (i < 5) { s = s + a * 7; i = i + 1 } print s
+    code = {
+        LDC(3), WithU2(OperationCode::STORE, 2),                 // 0..1
+        LDC(0), WithU2(OperationCode::STORE, 0),                 // 2..3
+        LDC(0), WithU2(OperationCode::STORE, 1),                 // 4..5
+        WithU2(OperationCode::LDV, 0), LDC(5),                   // 6..7
+        Op(OperationCode::LT), WithU2(OperationCode::JZ, 21),    // 8..9
+        WithU2(OperationCode::LDV, 1), WithU2(OperationCode::LDV, 2),
+        LDC(7), Op(OperationCode::MUL),
+        Op(OperationCode::ADD), WithU2(OperationCode::STORE, 1), // 10..15
+        WithU2(OperationCode::LDV, 0), LDC(1),
+        Op(OperationCode::ADD), WithU2(OperationCode::STORE, 0), // 16..19
+        WithU2(OperationCode::JMP, 6),                           // 20
+        WithU2(OperationCode::LDV, 1), Op(OperationCode::PRINT), // 21..22
+        Op(OperationCode::RET)                                   // 23
+    };
+
+    auto ssa = build();
+    ASSERT_TRUE(ssa.has_value());
+    EXPECT_EQ(ssa->HoistLoopInvariants(), 1u);
+
+    LoopAnalysis loops = ssa->FindLoops();
+    ASSERT_EQ(loops.Loops().size(), 1u);
+    for (const auto& v : ssa->values) {
+        if (v.kind == SsaKind::OPERATION && v.code == OperationCode::MUL) {
+            EXPECT_EQ(loops.LoopDepth(v.block), 0);
+        }
+    }
+
+    EXPECT_EQ(run(code, function.locals_count), "105");
+    ssa->EliminateDeadValues();
+    LoweredFunction lowered = ssa->Lower();
+    EXPECT_EQ(run(lowered.code, lowered.locals_count), "105");
+}
+
+TEST_F(SsaTest, MultiplicationByInductionVariableBecomesAddition) {
+    // i = 0; s = 0; while (i < 10) { s = s + i * 4; i = i + 1 } print s
+    code = {
+        LDC(0), WithU2(OperationCode::STORE, 0),                 // 0..1
+        LDC(0), WithU2(OperationCode::STORE, 1),                 // 2..3
+        WithU2(OperationCode::LDV, 0), LDC(10),                  // 4..5
+        Op(OperationCode::LT), WithU2(OperationCode::JZ, 19),    // 6..7
+        WithU2(OperationCode::LDV, 1), WithU2(OperationCode::LDV, 0),
+        LDC(4), Op(OperationCode::MUL),
+        Op(OperationCode::ADD), WithU2(OperationCode::STORE, 1), // 8..13
+        WithU2(OperationCode::LDV, 0), LDC(1),
+        Op(OperationCode::ADD), WithU2(OperationCode::STORE, 0), // 14..17
+        WithU2(OperationCode::JMP, 4),                           // 18
+        WithU2(OperationCode::LDV, 1), Op(OperationCode::PRINT), // 19..20
+        Op(OperationCode::RET)                                   // 21
+    };
+
+    auto ssa = build();
+    ASSERT_TRUE(ssa.has_value());
+    EXPECT_EQ(ssa->ReduceInductionVariables(), 1u);
+    // i * 4 is now a second loop-carried value
+    EXPECT_EQ(countPhis(*ssa), 3u);
+
+    LoopAnalysis loops = ssa->FindLoops();
+    for (const auto& v : ssa->values) {
+        if (!v.removed && v.kind == SsaKind::OPERATION && v.code == OperationCode::MUL) {
+            EXPECT_EQ(loops.LoopDepth(v.block), 0);
+        }
+    }
+
+    EXPECT_EQ(run(code, function.locals_count), "180");
+    ssa->EliminateDeadValues();
+    LoweredFunction lowered = ssa->Lower();
+    EXPECT_EQ(run(lowered.code, lowered.locals_count), "180");
+}
+
+TEST_F(SsaTest, DecreasingInductionVariableIsReduced) {
+    // i = 10; s = 0; do { s = s + 3 * i; i = i - 2 } while (i); print s
+    code = {
+        LDC(10), WithU2(OperationCode::STORE, 0),                     // 0..1
+        LDC(0), WithU2(OperationCode::STORE, 1),                      // 2..3
+        WithU2(OperationCode::LDV, 1), LDC(3),
+        WithU2(OperationCode::LDV, 0), Op(OperationCode::MUL),
+        Op(OperationCode::ADD), WithU2(OperationCode::STORE, 1),      // 4..9
+        WithU2(OperationCode::LDV, 0), LDC(2),
+        Op(OperationCode::SUB), WithU2(OperationCode::STORE, 0),      // 10..13
+        WithU2(OperationCode::LDV, 0), WithU2(OperationCode::JNZ, 4), // 14..15
+        WithU2(OperationCode::LDV, 1), Op(OperationCode::PRINT),      // 16..17
+        Op(OperationCode::RET)                                        // 18
+    };
+
+    auto ssa = build();
+    ASSERT_TRUE(ssa.has_value());
+    EXPECT_EQ(ssa->HoistLoopInvariants(), 0u);
+    EXPECT_EQ(ssa->ReduceInductionVariables(), 1u);
+
+    EXPECT_EQ(run(code, function.locals_count), "90");
+    ssa->EliminateDeadValues();
+    LoweredFunction lowered = ssa->Lower();
+    EXPECT_EQ(run(lowered.code, lowered.locals_count), "90");
+}
+
+TEST_F(SsaTest, LoopOverConstantLengthArraySkipsBoundsChecks) {
+    // arr = new int[10]; i = 0; while (i < 10) { arr[i] = i; i = i + 1 } print arr[3]
+    code = {
+        LDC(10), NEWARR("I;"), WithU2(OperationCode::STORE, 1),   // 0..2
+        LDC(0), WithU2(OperationCode::STORE, 0),                  // 3..4
+        WithU2(OperationCode::LDV, 0), LDC(10),                   // 5..6
+        Op(OperationCode::LT), WithU2(OperationCode::JZ, 18),     // 7..8
+        WithU2(OperationCode::LDV, 1), WithU2(OperationCode::LDV, 0),
+        WithU2(OperationCode::LDV, 0), Op(OperationCode::STELEM), // 9..12
+        WithU2(OperationCode::LDV, 0), LDC(1),
+        Op(OperationCode::ADD), WithU2(OperationCode::STORE, 0),  // 13..16
+        WithU2(OperationCode::JMP, 5),                            // 17
+        WithU2(OperationCode::LDV, 1), LDC(3),
+        Op(OperationCode::LDELEM), Op(OperationCode::PRINT),      // 18..21
+        Op(OperationCode::RET)                                    // 22
+    };
+
+    auto ssa = build();
+    ASSERT_TRUE(ssa.has_value());
+    // the access after the loop is not indexed by an induction variable
+    EXPECT_EQ(ssa->EliminateBoundsChecks(rda.GetMethodArea()), 1u);
+
+    ssa->EliminateDeadValues();
+    LoweredFunction lowered = ssa->Lower();
+    ASSERT_EQ(lowered.in_bounds.size(), lowered.code.size());
+    for (size_t pc = 0; pc < lowered.code.size(); ++pc) {
+        EXPECT_EQ(lowered.in_bounds[pc], lowered.code[pc].code == OperationCode::STELEM);
+    }
+
+    EXPECT_EQ(run(code, function.locals_count), "3");
+    EXPECT_EQ(run(lowered.code, lowered.locals_count), "3");
+}
+
+TEST_F(SsaTest, LoopBoundedByArraySizeSkipsBoundsChecks) {
+    // n = 4 + 1; arr = new int[n + 1]; i = 0; while (i <= n) { arr[i] = 2; i = i + 1 } print arr[n]
+    code = {
+        LDC(4), LDC(1), Op(OperationCode::ADD),
+        WithU2(OperationCode::STORE, 2),                         // 0..3
+        WithU2(OperationCode::LDV, 2), LDC(1), Op(OperationCode::ADD),
+        NEWARR("I;"), WithU2(OperationCode::STORE, 1),           // 4..8
+        LDC(0), WithU2(OperationCode::STORE, 0),                 // 9..10
+        WithU2(OperationCode::LDV, 0), WithU2(OperationCode::LDV, 2),
+        Op(OperationCode::LEQ), WithU2(OperationCode::JZ, 24),   // 11..14
+        WithU2(OperationCode::LDV, 1), WithU2(OperationCode::LDV, 0),
+        LDC(2), Op(OperationCode::STELEM),                       // 15..18
+        WithU2(OperationCode::LDV, 0), LDC(1),
+        Op(OperationCode::ADD), WithU2(OperationCode::STORE, 0), // 19..22
+        WithU2(OperationCode::JMP, 11),                          // 23
+        WithU2(OperationCode::LDV, 1), WithU2(OperationCode::LDV, 2),
+        Op(OperationCode::LDELEM), Op(OperationCode::PRINT),     // 24..27
+        Op(OperationCode::RET)                                   // 28
+    };
+
+    auto ssa = build();
+    ASSERT_TRUE(ssa.has_value());
+    EXPECT_EQ(ssa->EliminateBoundsChecks(rda.GetMethodArea()), 1u);
+
+    ssa->EliminateDeadValues();
+    LoweredFunction lowered = ssa->Lower();
+    EXPECT_EQ(run(code, function.locals_count), "2");
+    EXPECT_EQ(run(lowered.code, lowered.locals_count), "2");
+}
+
+TEST_F(SsaTest, BoundPastArrayLengthKeepsBoundsChecks) {
+    // arr = new int[10]; i = 0; while (i < 11) { arr[i] = i; i = i + 1 }
+    code = {
+        LDC(10), NEWARR("I;"), WithU2(OperationCode::STORE, 1),   // 0..2
+        LDC(0), WithU2(OperationCode::STORE, 0),                  // 3..4
+        WithU2(OperationCode::LDV, 0), LDC(11),                   // 5..6
+        Op(OperationCode::LT), WithU2(OperationCode::JZ, 18),     // 7..8
+        WithU2(OperationCode::LDV, 1), WithU2(OperationCode::LDV, 0),
+        WithU2(OperationCode::LDV, 0), Op(OperationCode::STELEM), // 9..12
+        WithU2(OperationCode::LDV, 0), LDC(1),
+        Op(OperationCode::ADD), WithU2(OperationCode::STORE, 0),  // 13..16
+        WithU2(OperationCode::JMP, 5),                            // 17
+        Op(OperationCode::RET)                                    // 18
+    };
+
+    auto ssa = build();
+    ASSERT_TRUE(ssa.has_value());
+    EXPECT_EQ(ssa->EliminateBoundsChecks(rda.GetMethodArea()), 0u);
+
+    LoweredFunction lowered = ssa->Lower();
+    EXPECT_EQ(std::count(lowered.in_bounds.begin(), lowered.in_bounds.end(), true), 0);
+}
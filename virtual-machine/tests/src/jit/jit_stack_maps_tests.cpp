@@ -0,0 +1,128 @@
+#include <gtest/gtest.h>
+
+#include "bytecode_builder.hpp"
+#include "common.hpp"
+#include "jit/jit_stack_maps.hpp"
+
+using namespace czffvm;
+using namespace czffvm_jit;
+
+class StackMapBuilderTest : public testing::Test, protected BytecodeBuilder {
+protected:
+    MethodArea method_area;
+    RuntimeFunction function;
+    std::vector<Operation> code;
+
+    MethodArea& BytecodeMethodArea() override { return method_area; }
+
+    static constexpr uint32_t kOperandBase = 4;
+
+    void SetUp() override {
+        function.params_descriptor_index = Str("");
+        function.return_type_index = Str("void;");
+        function.locals_count = 2;
+    }
+
+    std::vector<StackMap> build() {
+        return StackMapBuilder(code, function, function.locals_count, method_area).Build(kOperandBase);
+    }
+};
+
+TEST_F(StackMapBuilderTest, ReportsArrayStoredInLocal) {
+    code = {
+        LDC(4), NEWARR("I;"), WithU2(OperationCode::STORE, 1),
+        LDC(4), NEWARR("I;"), WithU2(OperationCode::STORE, 0),
+        Op(OperationCode::RET)
+    };
+
+    auto maps = build();
+
+    ASSERT_EQ(maps.size(), 2u);
+    EXPECT_TRUE(maps[0].empty());
+    EXPECT_EQ(maps[1], StackMap({1}));
+}
+
+TEST_F(StackMapBuilderTest, ReportsArrayOnOperandStack) {
+    // first array is still on the stack while the second is allocated
+    code = {
+        LDC(4), NEWARR("I;"),
+        LDC(1), NEWARR("I;"),
+        WithU2(OperationCode::STORE, 0),
+        WithU2(OperationCode::STORE, 1),
+        Op(OperationCode::RET)
+    };
+
+    auto maps = build();
+
+    ASSERT_EQ(maps.size(), 2u);
+    EXPECT_EQ(maps[1], StackMap({kOperandBase}));
+}
+
+TEST_F(StackMapBuilderTest, IntegersAreNotReported) {
+    code = {
+        LDC(7), WithU2(OperationCode::STORE, 0),
+        LDC(3),
+        LDC(4), NEWARR("I;"), WithU2(OperationCode::STORE, 1),
+        Op(OperationCode::PRINT),
+        Op(OperationCode::RET)
+    };
+
+    auto maps = build();
+
+    ASSERT_EQ(maps.size(), 1u);
+    EXPECT_TRUE(maps[0].empty());
+}
+
+TEST_F(StackMapBuilderTest, ArrayParametersAreReported) {
+    // arguments start on the operand stack, the last parameter at the bottom
+    function.params_descriptor_index = Str("[I;I;");
+    code = {
+        WithU2(OperationCode::STORE, 0),
+        WithU2(OperationCode::STORE, 1),
+        LDC(4), NEWARR("I;"), WithU2(OperationCode::STORE, 0),
+        Op(OperationCode::RET)
+    };
+
+    auto maps = build();
+
+    ASSERT_EQ(maps.size(), 1u);
+    EXPECT_EQ(maps[0], StackMap({0}));
+}
+
+TEST_F(StackMapBuilderTest, ReferenceOnAnyIncomingPathIsReported) {
+    // 0: LDC 1
+    // 1: JZ -> 5
+    // 2: LDC 2
+    // 3: NEWARR I
+    // 4: STORE 0
+    // 5: LDC 8
+    // 6: NEWARR I
+    // 7: STORE 1
+    // 8: RET
+    code = {
+        LDC(1),
+        WithU2(OperationCode::JZ, 5),
+        LDC(2), NEWARR("I;"), WithU2(OperationCode::STORE, 0),
+        LDC(8), NEWARR("I;"), WithU2(OperationCode::STORE, 1),
+        Op(OperationCode::RET)
+    };
+
+    auto maps = build();
+
+    ASSERT_EQ(maps.size(), 2u);
+    EXPECT_EQ(maps[1], StackMap({0}));
+}
+
+TEST_F(StackMapBuilderTest, ElementsOfNestedArraysAreReported) {
+    code = {
+        LDC(2), NEWARR("[I;"), WithU2(OperationCode::STORE, 0),
+        WithU2(OperationCode::LDV, 0), LDC(0), Op(OperationCode::LDELEM),
+        LDC(2), NEWARR("I;"),
+        Op(OperationCode::RET)
+    };
+
+    auto maps = build();
+
+    ASSERT_EQ(maps.size(), 2u);
+    EXPECT_EQ(maps[1], StackMap({0, kOperandBase}));
+}
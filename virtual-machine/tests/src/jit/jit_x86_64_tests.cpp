@@ -1,5 +1,6 @@
 
 #include <gtest/gtest.h>
+#include <filesystem>
 
 #include "jit/jit_x86_64.hpp"
 #include "common.hpp"
@@ -262,7 +263,7 @@ TEST(BasicJITCompilationTestSuite, ArrayCreation) {
     ASSERT_NO_THROW(rda.GetHeap().Get({0}));
     auto array = rda.GetHeap().Get({0});
 
-    ASSERT_EQ(array.type, "[I;");
+    ASSERT_EQ(rda.GetHeap().Types().Descriptor(array.type_id), "[I;");
     ASSERT_EQ(array.fields.size(), 3);
 }
 
@@ -316,7 +317,7 @@ TEST(BasicJITCompilationTestSuite, ArrayStore) {
     ASSERT_NO_THROW(rda.GetHeap().Get({0}));
     auto array = rda.GetHeap().Get({0});
 
-    ASSERT_EQ(array.type, "[I;");
+    ASSERT_EQ(rda.GetHeap().Types().Descriptor(array.type_id), "[I;");
     ASSERT_EQ(array.fields.size(), 3);
 
     uint32_t arr_elem;
@@ -425,7 +426,7 @@ TEST(BasicJITCompilationTestSuite, ArrayOperations) {
     ASSERT_NO_THROW(rda.GetHeap().Get({0}));
     auto array = rda.GetHeap().Get({0});
 
-    ASSERT_EQ(array.type, "[I");
+    ASSERT_EQ(rda.GetHeap().Types().Descriptor(array.type_id), "[I");
     ASSERT_EQ(array.fields.size(), 8);
     ASSERT_EQ(stack[0], 14);
 }
@@ -663,3 +664,82 @@ TEST(BasicJITCompilationTestSuite, ConditionalJumpTest) {
     ASSERT_EQ(stack[0], 42);
 }
 
+
+TEST(BasicJITCompilationTestSuite, CodeCacheRestoresCompiledFunction) {
+    std::string directory = (std::filesystem::temp_directory_path() / "czff_jit_x86_cache").string();
+    std::filesystem::remove_all(directory);
+
+    czffvm::RuntimeFunction func;
+    func.locals_count = 0;
+    func.max_stack = 4;
+    func.params_descriptor_index = 1;
+    func.return_type_index = 2;
+    func.code = {
+        {czffvm::OperationCode::LDC, {0, 0}},
+        {czffvm::OperationCode::LDC, {0, 3}},
+        {czffvm::OperationCode::PRINT, {}},
+        {czffvm::OperationCode::RET, {}}
+    };
+    std::vector<czffvm::Constant> constants = {
+        {czffvm::ConstantTag::I4, {0, 0, 0, 42}},
+        {czffvm::ConstantTag::STRING, {'[', 'v', 'o', 'i', 'd', ';'}},
+        {czffvm::ConstantTag::STRING, {'v', 'o', 'i', 'd', ';'}},
+        {czffvm::ConstantTag::STRING, {'h', 'i'}},
+    };
+
+    {
+        auto rda = czffvm::RuntimeDataArea(10000);
+        auto jit = std::make_unique<czffvm_jit::X86JitCompiler>();
+        jit->SetCodeCache(directory);
+        EXPECT_EQ(jit->LoadCachedFunction(func, rda), nullptr);
+
+        int32_t stack[4] = {};
+        CompileAndExecute(rda, jit, func, constants, stack);
+        ASSERT_EQ(stack[0], 42);
+    }
+
+    // a new process whose constant pool has the string at another index
+    auto rda = czffvm::RuntimeDataArea(10000);
+    rda.GetMethodArea().RegisterConstant({czffvm::ConstantTag::STRING, {'x'}});
+    for (auto& c : constants) rda.GetMethodArea().RegisterConstant(c);
+    func.params_descriptor_index = 2;
+    func.return_type_index = 3;
+    func.code[0] = {czffvm::OperationCode::LDC, {0, 1}};
+    func.code[1] = {czffvm::OperationCode::LDC, {0, 4}};
+
+    auto jit = std::make_unique<czffvm_jit::X86JitCompiler>();
+    jit->SetCodeCache(directory);
+    auto compiled = jit->LoadCachedFunction(func, rda);
+    ASSERT_NE(compiled, nullptr);
+
+    czffvm_jit::X86JitHeapHelper heapHelper(rda);
+    int32_t stack[4] = {};
+    testing::internal::CaptureStdout();
+    compiled->getFunction<void(*)(int32_t*, czffvm_jit::X86JitHeapHelper*)>()(stack, &heapHelper);
+    EXPECT_EQ(testing::internal::GetCapturedStdout(), "hi");
+    EXPECT_EQ(stack[0], 42);
+
+    std::filesystem::remove_all(directory);
+}
+
+TEST(BasicJITCompilationTestSuite, RejectsFusedOperations) {
+    auto rda = czffvm::RuntimeDataArea(10000);
+    auto jit = std::make_unique<czffvm_jit::X86JitCompiler>();
+
+    czffvm::RuntimeFunction func;
+    func.locals_count = 2;
+    func.max_stack = 4;
+    func.params_descriptor_index = rda.GetMethodArea().RegisterConstant({czffvm::ConstantTag::STRING, {}});
+    func.return_type_index = rda.GetMethodArea().RegisterConstant(
+        {czffvm::ConstantTag::STRING, {'v', 'o', 'i', 'd', ';'}});
+
+    for (auto fused : {czffvm::OperationCode::LDV_LDV, czffvm::OperationCode::LDV_LDC,
+                       czffvm::OperationCode::LDV_LDV_ADD_STORE, czffvm::OperationCode::LDV_LDC_ADD_STORE,
+                       czffvm::OperationCode::CMP_JZ, czffvm::OperationCode::LDV_LDC_CMP_JZ,
+                       czffvm::OperationCode::LDV_LDV_LDELEM}) {
+        EXPECT_FALSE(jit->CanCompile(fused));
+
+        func.code = {{fused, {0, 0, 0, 1}}, {czffvm::OperationCode::RET, {}}};
+        EXPECT_FALSE(jit->CanCompileFunction(func, rda.GetMethodArea()));
+    }
+}
@@ -0,0 +1,134 @@
+#include <gtest/gtest.h>
+#include <filesystem>
+#include <fstream>
+
+#include "common.hpp"
+#include "memory_limit.hpp"
+
+using namespace czffvm;
+
+namespace fs = std::filesystem;
+
+struct FakeCgroupRoot {
+    fs::path root;
+
+    explicit FakeCgroupRoot(const std::string& name)
+        : root(fs::temp_directory_path() / name) {
+        fs::remove_all(root);
+        fs::create_directories(root);
+    }
+    ~FakeCgroupRoot() {
+        fs::remove_all(root);
+        fs::remove(root.string() + ".proc");
+    }
+
+    void Write(const std::string& relative, const std::string& content) {
+        fs::path path = root / relative;
+        fs::create_directories(path.parent_path());
+        std::ofstream(path) << content;
+    }
+
+    // Stands in for /proc/self/cgroup, outside the cgroup tree
+    std::string WriteProcCgroup(const std::string& content) {
+        fs::path path = root.string() + ".proc";
+        std::ofstream(path) << content;
+        return path.string();
+    }
+};
+
+TEST(MemoryLimitTestSuite, ReadsCgroupV2Limit) {
+    FakeCgroupRoot fake("czff_cgroup_v2");
+    fake.Write("memory.max", "536870912\n");
+
+    auto limit = ReadCgroupMemoryLimit(fake.root.string());
+
+    ASSERT_TRUE(limit.has_value());
+    EXPECT_EQ(*limit, 536870912u);
+}
+
+TEST(MemoryLimitTestSuite, CgroupV2MaxMeansNoLimit) {
+    FakeCgroupRoot fake("czff_cgroup_v2_max");
+    fake.Write("memory.max", "max\n");
+
+    EXPECT_FALSE(ReadCgroupMemoryLimit(fake.root.string()).has_value());
+}
+
+TEST(MemoryLimitTestSuite, ReadsCgroupV1Limit) {
+    FakeCgroupRoot fake("czff_cgroup_v1");
+    fake.Write("memory/memory.limit_in_bytes", "268435456\n");
+
+    auto limit = ReadCgroupMemoryLimit(fake.root.string());
+
+    ASSERT_TRUE(limit.has_value());
+    EXPECT_EQ(*limit, 268435456u);
+}
+
+TEST(MemoryLimitTestSuite, CgroupV1UnlimitedIsIgnored) {
+    FakeCgroupRoot fake("czff_cgroup_v1_unlimited");
+    fake.Write("memory/memory.limit_in_bytes", "9223372036854771712\n");
+
+    EXPECT_FALSE(ReadCgroupMemoryLimit(fake.root.string()).has_value());
+}
+
+TEST(MemoryLimitTestSuite, AutoHeapSizeUsesPercentOfLimit) {
+    FakeCgroupRoot fake("czff_cgroup_auto");
+    fake.Write("memory.max", std::to_string(100 * kBytesInKiB * kBytesInKiB));
+
+    EXPECT_EQ(AutoMaxHeapSizeInKiB(75, fake.root.string()), 75 * kBytesInKiB);
+}
+
+TEST(MemoryLimitTestSuite, AutoHeapSizeFallsBackToDefault) {
+    FakeCgroupRoot fake("czff_cgroup_empty");
+
+    EXPECT_EQ(AutoMaxHeapSizeInKiB(75, fake.root.string()), kDefaultMaxHeapSizeInKiB);
+}
+
+TEST(MemoryLimitTestSuite, ReadsOwnCgroupV2Limit) {
+    FakeCgroupRoot fake("czff_cgroup_v2_own");
+    fake.Write("system.slice/app.scope/memory.max", "134217728\n");
+    fake.Write("system.slice/other.scope/memory.max", "1024\n");
+    std::string proc = fake.WriteProcCgroup("0::/system.slice/app.scope\n");
+
+    auto limit = ReadCgroupMemoryLimit(fake.root.string(), proc);
+
+    ASSERT_TRUE(limit.has_value());
+    EXPECT_EQ(*limit, 134217728u);
+}
+
+TEST(MemoryLimitTestSuite, ParentCgroupLimitIsTighter) {
+    FakeCgroupRoot fake("czff_cgroup_v2_parent");
+    fake.Write("kubepods/memory.max", "67108864\n");
+    fake.Write("kubepods/pod/memory.max", "max\n");
+    std::string proc = fake.WriteProcCgroup("0::/kubepods/pod\n");
+
+    auto limit = ReadCgroupMemoryLimit(fake.root.string(), proc);
+
+    ASSERT_TRUE(limit.has_value());
+    EXPECT_EQ(*limit, 67108864u);
+}
+
+TEST(MemoryLimitTestSuite, ReadsOwnCgroupV1Limit) {
+    FakeCgroupRoot fake("czff_cgroup_v1_own");
+    fake.Write("memory/docker/abc/memory.limit_in_bytes", "33554432\n");
+    fake.Write("memory/memory.limit_in_bytes", "9223372036854771712\n");
+    std::string proc = fake.WriteProcCgroup(
+        "5:cpuacct,cpu:/docker/other\n"
+        "4:memory:/docker/abc\n"
+        "0::/\n");
+
+    auto limit = ReadCgroupMemoryLimit(fake.root.string(), proc);
+
+    ASSERT_TRUE(limit.has_value());
+    EXPECT_EQ(*limit, 33554432u);
+}
+
+TEST(MemoryLimitTestSuite, MissingOwnCgroupFallsBackToRoot) {
+    FakeCgroupRoot fake("czff_cgroup_v2_fallback");
+    fake.Write("memory.max", "16777216\n");
+    std::string proc = fake.WriteProcCgroup("0::/not/mounted/here\n");
+
+    auto limit = ReadCgroupMemoryLimit(fake.root.string(), proc);
+
+    ASSERT_TRUE(limit.has_value());
+    EXPECT_EQ(*limit, 16777216u);
+}
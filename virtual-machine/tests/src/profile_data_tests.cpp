@@ -0,0 +1,215 @@
+#include <gtest/gtest.h>
+#include <filesystem>
+#include <sstream>
+
+#include "class_loader.hpp"
+#include "interpreter.hpp"
+#include "minimal_ball.hpp"
+#include "profile_data.hpp"
+#include "program_test_utils.hpp"
+#include "runtime_data_area.hpp"
+
+using namespace czffvm;
+
+static const FunctionProfile* Find(const ProfileData& profile, const std::string& name) {
+    for (const FunctionProfile& fn : profile.Functions()) {
+        if (fn.name == name) return &fn;
+    }
+    return nullptr;
+}
+
+TEST(ProfileDataTestSuite, CollectsCallsAndBackEdges) {
+    TempDirectory files("czff_profile");
+
+    RuntimeDataArea factorial_rda;
+    ClassLoader factorial_loader(factorial_rda);
+    factorial_loader.LoadProgram(files.Write("factorial.ball", MakeFactorialProgramBall()));
+    RunMain(factorial_rda, factorial_loader);
+
+    ProfileData calls = ProfileData::Collect(factorial_rda.GetMethodArea());
+    const FunctionProfile* factorial = Find(calls, "Factorial");
+    ASSERT_NE(factorial, nullptr);
+    EXPECT_EQ(factorial->invocations, 6u);
+    EXPECT_EQ(factorial->back_edges, 0u);
+    // Main is entered, not called, and has no loop
+    EXPECT_EQ(Find(calls, "Main"), nullptr);
+
+    RuntimeDataArea loop_rda;
+    ClassLoader loop_loader(loop_rda);
+    loop_loader.LoadProgram(files.Write("array_and_for.ball", MakeArrayWithForProgramBall()));
+    RunMain(loop_rda, loop_loader);
+
+    ProfileData loops = ProfileData::Collect(loop_rda.GetMethodArea());
+    const FunctionProfile* main = Find(loops, "Main");
+    ASSERT_NE(main, nullptr);
+    EXPECT_GT(main->back_edges, 0u);
+}
+
+TEST(ProfileDataTestSuite, SeedsCountersOfUnchangedFunctions) {
+    TempDirectory files("czff_profile");
+    std::string program = files.Write("factorial.ball", MakeFactorialProgramBall());
+    std::string path = (files.root / "run.profile").string();
+
+    {
+        RuntimeDataArea rda;
+        ClassLoader loader(rda);
+        loader.LoadProgram(program);
+        RunMain(rda, loader);
+        ProfileData::Collect(rda.GetMethodArea()).Write(path);
+    }
+
+    ProfileData saved = ProfileData::Read(path);
+    ASSERT_EQ(saved.Functions().size(), 1u);
+
+    RuntimeDataArea rda;
+    ClassLoader loader(rda);
+    loader.LoadProgram(program);
+    EXPECT_EQ(saved.Apply(rda.GetMethodArea()), 1u);
+
+    RuntimeFunction* factorial = rda.GetMethodArea().GetFunction(*rda.GetMethodArea().FindFunction("Factorial"));
+    EXPECT_EQ(factorial->call_count, 6u);
+
+    // the next run adds its own calls to the seeded ones
+    RunMain(rda, loader);
+    ProfileData next = ProfileData::Collect(rda.GetMethodArea());
+    ASSERT_NE(Find(next, "Factorial"), nullptr);
+    EXPECT_EQ(Find(next, "Factorial")->invocations, 12u);
+
+    // another body under the same name, and a function that is gone
+    std::ostringstream stale;
+    stale << "czff-profile 1\n"
+          << std::hex << saved.Functions()[0].code_hash + 1 << std::dec << " 100 0 Factorial\n"
+          << "1 100 0 Missing\n";
+    RuntimeDataArea other_rda;
+    ClassLoader other_loader(other_rda);
+    other_loader.LoadProgram(program);
+    EXPECT_EQ(ProfileData::Read(files.WriteText("stale.profile", stale.str())).Apply(other_rda.GetMethodArea()), 0u);
+}
+
+TEST(ProfileDataTestSuite, HotLoopsReachTheJitThreshold) {
+    TempDirectory files("czff_profile");
+    RuntimeDataArea rda;
+    ClassLoader loader(rda);
+    loader.LoadProgram(files.Write("factorial.ball", MakeFactorialProgramBall()));
+
+    RuntimeFunction* factorial = rda.GetMethodArea().GetFunction(*rda.GetMethodArea().FindFunction("Factorial"));
+    std::ostringstream text;
+    text << "czff-profile 1\n"
+         << std::hex << ProfileData::CodeHash(*factorial, rda.GetMethodArea()) << std::dec << " 1 " << kHotBackEdges << " Factorial\n";
+
+    EXPECT_EQ(ProfileData::Read(files.WriteText("hot.profile", text.str())).Apply(rda.GetMethodArea()), 1u);
+    EXPECT_TRUE(factorial->jit_on_first_call);
+    EXPECT_EQ(factorial->call_count, 1u);
+    EXPECT_EQ(factorial->back_edge_count, kHotBackEdges);
+}
+
+TEST(ProfileDataTestSuite, HotLoopsKeepTheRealCallCount) {
+    TempDirectory files("czff_profile");
+    std::string program = files.Write("factorial.ball", MakeFactorialProgramBall());
+    std::string path = (files.root / "run.profile").string();
+
+    {
+        RuntimeDataArea rda;
+        ClassLoader loader(rda);
+        loader.LoadProgram(program);
+        RuntimeFunction* factorial = rda.GetMethodArea().GetFunction(*rda.GetMethodArea().FindFunction("Factorial"));
+        std::ostringstream text;
+        text << "czff-profile 1\n"
+             << std::hex << ProfileData::CodeHash(*factorial, rda.GetMethodArea()) << std::dec << " 0 " << kHotBackEdges << " Factorial\n";
+        files.WriteText("run.profile", text.str());
+    }
+
+    // each run reads the profile, adds its 6 calls and writes it back
+    for (uint32_t run = 1; run <= 2; ++run) {
+        RuntimeDataArea rda;
+        ClassLoader loader(rda);
+        loader.LoadProgram(program);
+        ProfileData::Read(path).Apply(rda.GetMethodArea());
+        RunMain(rda, loader);
+        ProfileData::Collect(rda.GetMethodArea()).Write(path);
+
+        ProfileData saved = ProfileData::Read(path);
+        const FunctionProfile* factorial = Find(saved, "Factorial");
+        ASSERT_NE(factorial, nullptr);
+        EXPECT_EQ(factorial->invocations, 6 * run);
+        EXPECT_EQ(factorial->back_edges, kHotBackEdges);
+    }
+}
+
+TEST(ProfileDataTestSuite, MatchesAcrossDecodingModes) {
+    TempDirectory files("czff_profile");
+    std::string program = files.Write("call_order.ball", MakeCallOrderProgramBall());
+    std::string path = (files.root / "run.profile").string();
+
+    // lazily decoded bodies are analyzed in call order, B before A, and
+    // their interned constants land at other pool indices
+    for (bool lazy_first : {true, false}) {
+        {
+            RuntimeDataArea rda;
+            ClassLoader loader(rda);
+            loader.EnableLazyDecoding(lazy_first);
+            loader.EnableEscapeAnalysis(true);
+            loader.LoadProgram(program);
+            RunMain(rda, loader);
+            ProfileData::Collect(rda.GetMethodArea()).Write(path);
+        }
+
+        RuntimeDataArea rda;
+        ClassLoader loader(rda);
+        loader.EnableLazyDecoding(!lazy_first);
+        loader.EnableEscapeAnalysis(true);
+        loader.LoadProgram(program);
+        EXPECT_EQ(ProfileData::Read(path).Apply(rda.GetMethodArea()), 2u) << "lazy first: " << lazy_first;
+    }
+}
+
+TEST(ProfileDataTestSuite, HaltWritesTheProfile) {
+    TempDirectory files("czff_profile");
+    std::string path = (files.root / "halt.profile").string();
+
+    RuntimeDataArea rda;
+    MethodArea& method_area = rda.GetMethodArea();
+    auto str = [&](const std::string& s) {
+        return method_area.RegisterConstant(Constant{ConstantTag::STRING, std::vector<uint8_t>(s.begin(), s.end())});
+    };
+    auto with_u2 = [](OperationCode code, uint16_t value) {
+        return Operation{code, {uint8_t((value >> 8) & 0xFF), uint8_t(value & 0xFF)}};
+    };
+
+    RuntimeFunction helper;
+    helper.name_index = str("Helper");
+    helper.params_descriptor_index = str("");
+    helper.return_type_index = str("void;");
+    helper.code = {Operation{OperationCode::RET, {}}};
+    uint16_t helper_index = method_area.RegisterFunction(&helper);
+
+    RuntimeFunction main;
+    main.name_index = str("Main");
+    main.params_descriptor_index = helper.params_descriptor_index;
+    main.return_type_index = helper.return_type_index;
+    main.max_stack = 1;
+    main.code = {
+        with_u2(OperationCode::CALL, helper_index),
+        with_u2(OperationCode::HALT, method_area.RegisterConstant(Constant{ConstantTag::I4, {0, 0, 0, 3}}))
+    };
+
+    Interpreter interpreter(rda);
+    interpreter.SetProfileOutput(path);
+    EXPECT_EXIT(interpreter.Execute(&main), testing::ExitedWithCode(3), "");
+
+    ProfileData saved = ProfileData::Read(path);
+    const FunctionProfile* fn = Find(saved, "Helper");
+    ASSERT_NE(fn, nullptr);
+    EXPECT_EQ(fn->invocations, 1u);
+}
+
+TEST(ProfileDataTestSuite, RejectsMalformedFiles) {
+    TempDirectory files("czff_profile");
+
+    EXPECT_THROW(ProfileData::Read((files.root / "missing.profile").string()), std::runtime_error);
+    EXPECT_THROW(ProfileData::Read(files.WriteText("header.profile", "profile\n")), std::runtime_error);
+    EXPECT_THROW(ProfileData::Read(files.WriteText("line.profile", "czff-profile 1\nabc x 0 Main\n")),
+                 std::runtime_error);
+    EXPECT_THROW(ProfileData::Read(files.WriteText("name.profile", "czff-profile 1\n1 2 3\n")),
+                 std::runtime_error);
+}
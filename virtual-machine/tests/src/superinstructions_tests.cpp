@@ -0,0 +1,175 @@
+#include <gtest/gtest.h>
+
+#include <iostream>
+#include <list>
+#include <sstream>
+
+#include "bytecode_builder.hpp"
+#include "common.hpp"
+#include "interpreter.hpp"
+#include "runtime_data_area.hpp"
+#include "superinstructions.hpp"
+
+using namespace czffvm;
+
+class SuperinstructionTest : public testing::Test, protected BytecodeBuilder {
+protected:
+    RuntimeDataArea rda;
+    std::list<RuntimeFunction> functions;    // stable addresses for the method area
+
+    MethodArea& BytecodeMethodArea() override { return rda.GetMethodArea(); }
+
+    RuntimeFunction& AddMain(uint16_t locals, std::vector<Operation> code) {
+        RuntimeFunction& fn = functions.emplace_back();
+        fn.name_index = Str("Main");
+        fn.params_descriptor_index = Str("");
+        fn.return_type_index = Str("void;");
+        fn.max_stack = 8;
+        fn.locals_count = locals;
+        fn.code = std::move(code);
+        return fn;
+    }
+
+    std::string Execute(RuntimeFunction& main, Interpreter& interpreter) {
+        std::ostringstream captured;
+        auto* old_buf = std::cout.rdbuf(captured.rdbuf());
+        try {
+            interpreter.Execute(&main);
+        } catch (const std::exception& e) {
+            captured << "error: " << e.what();
+        }
+        std::cout.rdbuf(old_buf);
+        while (!rda.GetStack().Empty()) rda.GetStack().PopFrame();
+
+        return captured.str();
+    }
+
+    std::string Execute(RuntimeFunction& main) {
+        Interpreter interpreter(rda);
+        return Execute(main, interpreter);
+    }
+
+    // arr = new I[3]; arr[1] = 7; sum = 0; for (i = 0; i < 3; i = i + 1) { x = arr[i]; sum = sum + x }
+    RuntimeFunction& AddArraySum() {
+        return AddMain(4, {
+            LDC(3), WithU2(OperationCode::NEWARR, Str("I;")),
+            WithU2(OperationCode::STORE, 0),                                          // 0..2
+            WithU2(OperationCode::LDV, 0), LDC(1), LDC(7), Op(OperationCode::STELEM), // 3..6
+            LDC(0), WithU2(OperationCode::STORE, 1),                                  // 7..8
+            LDC(0), WithU2(OperationCode::STORE, 2),                                  // 9..10
+            WithU2(OperationCode::LDV, 1), LDC(3), Op(OperationCode::LT),
+            WithU2(OperationCode::JZ, 28),                                            // 11..14
+            WithU2(OperationCode::LDV, 0), WithU2(OperationCode::LDV, 1),
+            Op(OperationCode::LDELEM), WithU2(OperationCode::STORE, 3),               // 15..18
+            WithU2(OperationCode::LDV, 2), WithU2(OperationCode::LDV, 3),
+            Op(OperationCode::ADD), WithU2(OperationCode::STORE, 2),                  // 19..22
+            WithU2(OperationCode::LDV, 1), LDC(1),
+            Op(OperationCode::ADD), WithU2(OperationCode::STORE, 1),                  // 23..26
+            WithU2(OperationCode::JMP, 11),                                           // 27
+            WithU2(OperationCode::LDV, 2), Op(OperationCode::PRINT),
+            Op(OperationCode::RET)                                                    // 28..30
+        });
+    }
+};
+
+TEST_F(SuperinstructionTest, FusedLoopRunsTheSame) {
+    RuntimeFunction& main = AddArraySum();
+    std::vector<Operation> original = main.code;
+    EXPECT_EQ(Execute(main), "7");
+
+    EXPECT_EQ(SuperinstructionSelector(main).Run(), 6u);
+    ASSERT_EQ(main.fused_code.size(), main.code.size());
+    EXPECT_EQ(main.fused_code[3].code, OperationCode::LDV_LDC);
+    EXPECT_EQ(main.fused_code[11].code, OperationCode::LDV_LDC_CMP_JZ);
+    EXPECT_EQ(main.fused_code[15].code, OperationCode::LDV_LDV_LDELEM);
+    EXPECT_EQ(main.fused_code[19].code, OperationCode::LDV_LDV_ADD_STORE);
+    EXPECT_EQ(main.fused_code[23].code, OperationCode::LDV_LDC_ADD_STORE);
+    // the covered operations stay in place
+    EXPECT_EQ(main.fused_code[24].code, OperationCode::LDC);
+
+    // what the JIT and the other passes see is untouched
+    ASSERT_EQ(main.code.size(), original.size());
+    for (size_t pc = 0; pc < original.size(); ++pc) {
+        EXPECT_EQ(main.code[pc].code, original[pc].code);
+    }
+
+    EXPECT_EQ(Execute(main), "7");
+}
+
+TEST_F(SuperinstructionTest, JumpIntoFusedSequence) {
+    // x = 5; push 2; goto 5; the jump skips the first LDV of the fused ADD
+    RuntimeFunction& main = AddMain(1, {
+        LDC(5), WithU2(OperationCode::STORE, 0),                                  // 0..1
+        LDC(2), WithU2(OperationCode::JMP, 5),                                    // 2..3
+        WithU2(OperationCode::LDV, 0), WithU2(OperationCode::LDV, 0),
+        Op(OperationCode::ADD), WithU2(OperationCode::STORE, 0),                  // 4..7
+        WithU2(OperationCode::LDV, 0), Op(OperationCode::PRINT),
+        Op(OperationCode::RET)                                                    // 8..10
+    });
+
+    SuperinstructionSelector(main).Run();
+    EXPECT_EQ(main.fused_code[4].code, OperationCode::LDV_LDV_ADD_STORE);
+    EXPECT_EQ(main.fused_code[5].code, OperationCode::LDV);
+    EXPECT_EQ(Execute(main), "7");
+}
+
+TEST_F(SuperinstructionTest, CompareAndBranch) {
+    // a = 3; b = 4; if (a <= b) print 1; print 2
+    RuntimeFunction& main = AddMain(2, {
+        LDC(3), WithU2(OperationCode::STORE, 0),                                  // 0..1
+        LDC(4), WithU2(OperationCode::STORE, 1),                                  // 2..3
+        WithU2(OperationCode::LDV, 0), WithU2(OperationCode::LDV, 1),             // 4..5
+        Op(OperationCode::LEQ), WithU2(OperationCode::JZ, 10),                    // 6..7
+        LDC(1), Op(OperationCode::PRINT),                                         // 8..9
+        LDC(2), Op(OperationCode::PRINT),                                         // 10..11
+        Op(OperationCode::RET)                                                    // 12
+    });
+
+    SuperinstructionSelector(main).Run();
+    EXPECT_EQ(main.fused_code[4].code, OperationCode::LDV_LDV);
+    EXPECT_EQ(main.fused_code[6].code, OperationCode::CMP_JZ);
+    EXPECT_EQ(Execute(main), "12");
+
+    main.code[2] = LDC(2);
+    SuperinstructionSelector(main).Run();
+    EXPECT_EQ(Execute(main), "2");
+}
+
+TEST_F(SuperinstructionTest, ErrorsMatchPlainOperations) {
+    uint16_t flag = rda.GetMethodArea().RegisterConstant(Constant{ConstantTag::BOOL, {1}});
+    RuntimeFunction& main = AddMain(1, {
+        LDC(1), WithU2(OperationCode::STORE, 0),
+        WithU2(OperationCode::LDV, 0), WithU2(OperationCode::LDC, flag),
+        Op(OperationCode::LT), WithU2(OperationCode::JZ, 6),
+        Op(OperationCode::RET)
+    });
+
+    std::string plain = Execute(main);
+    EXPECT_EQ(plain, "error: LT: incompatible types");
+
+    SuperinstructionSelector(main).Run();
+    EXPECT_EQ(main.fused_code[2].code, OperationCode::LDV_LDC_CMP_JZ);
+    EXPECT_EQ(Execute(main), plain);
+}
+
+TEST_F(SuperinstructionTest, ProfileCountsPairsAndTriples) {
+    RuntimeFunction& main = AddArraySum();
+    SuperinstructionSelector(main).Run();
+
+    Interpreter interpreter(rda);
+    interpreter.EnableOpcodeProfile();
+    EXPECT_EQ(Execute(main, interpreter), "7");
+
+    const OpcodeProfile& profile = *interpreter.Profile();
+    // the original opcodes are counted, fused or not
+    EXPECT_EQ(profile.Count(OperationCode::LDV, OperationCode::LDC, OperationCode::LT), 4u);
+    EXPECT_EQ(profile.Count(OperationCode::LDV, OperationCode::LDC), 4u + 1u + 3u);
+    EXPECT_EQ(profile.Count(OperationCode::LDV, OperationCode::LDV, OperationCode::LDELEM), 3u);
+    // a taken jump starts a new sequence
+    EXPECT_EQ(profile.Count(OperationCode::JMP, OperationCode::LDV), 0u);
+    EXPECT_EQ(profile.Count(OperationCode::JZ, OperationCode::LDV), 3u);
+
+    std::ostringstream out;
+    profile.Print(out, 1);
+    EXPECT_EQ(out.str(), "Opcode pairs:\n  8 STORE LDV\nOpcode triples:\n  5 STORE LDV LDC\n");
+}
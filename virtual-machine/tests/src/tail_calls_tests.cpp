@@ -0,0 +1,171 @@
+#include <gtest/gtest.h>
+
+#include <iostream>
+#include <list>
+#include <sstream>
+
+#include "bytecode_builder.hpp"
+#include "common.hpp"
+#include "interpreter.hpp"
+#include "runtime_data_area.hpp"
+#include "tail_calls.hpp"
+
+using namespace czffvm;
+
+class TailCallTest : public testing::Test, protected BytecodeBuilder {
+protected:
+    RuntimeDataArea rda;
+    std::list<RuntimeFunction> functions;    // stable addresses for the method area
+
+    MethodArea& BytecodeMethodArea() override { return rda.GetMethodArea(); }
+
+    RuntimeFunction& AddFunction(const std::string& params, const std::string& ret,
+                                 uint16_t locals, std::vector<Operation> body) {
+        RuntimeFunction& fn = functions.emplace_back();
+        fn.name_index = Str("F");
+        fn.params_descriptor_index = Str(params);
+        fn.return_type_index = Str(ret);
+        fn.max_stack = 8;
+        fn.locals_count = locals;
+        fn.code = std::move(body);
+        return fn;
+    }
+
+    uint16_t Register(RuntimeFunction& fn) {
+        return rda.GetMethodArea().RegisterFunction(&fn);
+    }
+
+    size_t Count(const RuntimeFunction& fn, OperationCode code) const {
+        size_t n = 0;
+        for (const auto& op : fn.code) n += op.code == code;
+        return n;
+    }
+
+    std::string Execute(std::vector<Operation> code) {
+        RuntimeFunction& main = AddFunction("", "void;", 0, std::move(code));
+        Interpreter interpreter(rda);
+
+        std::ostringstream captured;
+        auto* old_buf = std::cout.rdbuf(captured.rdbuf());
+        interpreter.Execute(&main);
+        std::cout.rdbuf(old_buf);
+
+        return captured.str();
+    }
+
+    // frames_ never shrinks, so its capacity bounds the deepest call chain
+    size_t MaxFrames() const {
+        return const_cast<RuntimeDataArea&>(rda).GetStack().GetFrames().capacity();
+    }
+
+    // Count(n, acc) = n > 0 ? Count(n - 1, acc + 1) : acc
+    RuntimeFunction& AddCount() {
+        RuntimeFunction& fn = AddFunction("I;I;", "I;", 2, {});
+        uint16_t self = Register(fn);
+        fn.code = {
+            WithU2(OperationCode::STORE, 0), WithU2(OperationCode::STORE, 1),     // 0..1
+            LDC(0), WithU2(OperationCode::LDV, 0), Op(OperationCode::LT),         // 2..4
+            WithU2(OperationCode::JZ, 14),                                        // 5
+            WithU2(OperationCode::LDV, 0), LDC(1), Op(OperationCode::SUB),        // 6..8
+            WithU2(OperationCode::LDV, 1), LDC(1), Op(OperationCode::ADD),        // 9..11
+            WithU2(OperationCode::CALL, self), Op(OperationCode::RET),            // 12..13
+            WithU2(OperationCode::LDV, 1), Op(OperationCode::RET)                 // 14..15
+        };
+        return fn;
+    }
+};
+
+TEST_F(TailCallTest, SelfTailCallBecomesJump) {
+    RuntimeFunction& count = AddCount();
+    uint16_t idx = static_cast<uint16_t>(rda.GetMethodArea().Functions().size() - 1);
+
+    EXPECT_EQ(TailCallEliminator(count, rda.GetMethodArea()).Run(), 1u);
+    EXPECT_EQ(Count(count, OperationCode::CALL), 0u);
+    // the arguments go straight into the parameter locals
+    EXPECT_EQ(count.locals_count, 2);
+
+    EXPECT_EQ(Execute({LDC(10), LDC(5), WithU2(OperationCode::CALL, idx),
+                       Op(OperationCode::PRINT), Op(OperationCode::RET)}), "15");
+}
+
+TEST_F(TailCallTest, DeepRecursionRunsInOneFrame) {
+    RuntimeFunction& count = AddCount();
+    uint16_t idx = static_cast<uint16_t>(rda.GetMethodArea().Functions().size() - 1);
+    TailCallEliminator(count, rda.GetMethodArea()).Run();
+
+    EXPECT_EQ(Execute({LDC(100000), LDC(0), WithU2(OperationCode::CALL, idx),
+                       Op(OperationCode::PRINT), Op(OperationCode::RET)}), "100000");
+    EXPECT_LE(MaxFrames(), 2u);
+}
+
+TEST_F(TailCallTest, ArgumentsWithoutPrologueUseTemporaries) {
+    // F(a, b, c): prints the uninitialized local 3, then the arguments
+    // while a > 0, recursing as F(a - 1, c, b)
+    RuntimeFunction& fn = AddFunction("I;I;I;", "void;", 4, {});
+    uint16_t self = Register(fn);
+    fn.code = {
+        Op(OperationCode::NOP),                                                // 0
+        WithU2(OperationCode::STORE, 0), WithU2(OperationCode::STORE, 1),     // 1..2
+        WithU2(OperationCode::STORE, 2),                                      // 3
+        WithU2(OperationCode::LDV, 3), Op(OperationCode::PRINT),              // 4..5
+        LDC(7), WithU2(OperationCode::STORE, 3),                              // 6..7
+        WithU2(OperationCode::LDV, 1), Op(OperationCode::PRINT),              // 8..9
+        WithU2(OperationCode::LDV, 2), Op(OperationCode::PRINT),              // 10..11
+        LDC(0), WithU2(OperationCode::LDV, 0), Op(OperationCode::LT),         // 12..14
+        WithU2(OperationCode::JZ, 23),                                        // 15
+        WithU2(OperationCode::LDV, 0), LDC(1), Op(OperationCode::SUB),        // 16..18
+        WithU2(OperationCode::LDV, 2), WithU2(OperationCode::LDV, 1),         // 19..20
+        WithU2(OperationCode::CALL, self), Op(OperationCode::RET),            // 21..22
+        Op(OperationCode::RET)                                                // 23
+    };
+    std::vector<Operation> main = {
+        LDC(2), LDC(1), LDC(2), WithU2(OperationCode::CALL, self), Op(OperationCode::RET)
+    };
+    std::string expected = Execute(main);
+
+    EXPECT_EQ(TailCallEliminator(fn, rda.GetMethodArea()).Run(), 1u);
+    EXPECT_EQ(Count(fn, OperationCode::CALL), 0u);
+    EXPECT_EQ(fn.locals_count, 4 + 3);
+    EXPECT_EQ(Execute(main), expected);
+}
+
+TEST_F(TailCallTest, OtherCallsAreKept) {
+    RuntimeFunction& fn = AddFunction("I;", "I;", 1, {});
+    uint16_t self = Register(fn);
+    fn.code = {
+        WithU2(OperationCode::STORE, 0),
+        // a value below the arguments is still needed after the call
+        WithU2(OperationCode::LDV, 0), WithU2(OperationCode::LDV, 0),
+        WithU2(OperationCode::CALL, self), Op(OperationCode::ADD),
+        Op(OperationCode::RET)
+    };
+
+    EXPECT_EQ(TailCallEliminator(fn, rda.GetMethodArea()).Run(), 0u);
+    EXPECT_EQ(Count(fn, OperationCode::CALL), 1u);
+}
+
+TEST_F(TailCallTest, InterpreterReusesFrameForTailCalls) {
+    // mutual recursion is left to the interpreter:
+    // Even(n) = n > 0 ? Odd(n - 1) : 1, Odd(n) = n > 0 ? Even(n - 1) : 0
+    RuntimeFunction& even = AddFunction("I;", "I;", 1, {});
+    RuntimeFunction& odd = AddFunction("I;", "I;", 1, {});
+    uint16_t even_idx = Register(even);
+    uint16_t odd_idx = Register(odd);
+
+    auto body = [&](uint16_t other, int32_t base) {
+        return std::vector<Operation>{
+            WithU2(OperationCode::STORE, 0),                                  // 0
+            LDC(0), WithU2(OperationCode::LDV, 0), Op(OperationCode::LT),     // 1..3
+            WithU2(OperationCode::JZ, 10),                                    // 4
+            WithU2(OperationCode::LDV, 0), LDC(1), Op(OperationCode::SUB),    // 5..7
+            WithU2(OperationCode::CALL, other), Op(OperationCode::RET),       // 8..9
+            LDC(base), Op(OperationCode::RET)                                 // 10..11
+        };
+    };
+    even.code = body(odd_idx, 1);
+    odd.code = body(even_idx, 0);
+
+    EXPECT_EQ(Execute({LDC(100001), WithU2(OperationCode::CALL, even_idx),
+                       Op(OperationCode::PRINT), Op(OperationCode::RET)}), "0");
+    EXPECT_LE(MaxFrames(), 2u);
+}
@@ -0,0 +1,58 @@
+#include <atomic>
+#include <stdexcept>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "thread_pool.hpp"
+
+using namespace czffvm;
+
+TEST(ThreadPoolTestSuite, RunsEveryIndexOnce) {
+    ThreadPool pool(4);
+    EXPECT_EQ(pool.Size(), 4u);
+
+    std::vector<std::atomic<int>> hits(1000);
+    pool.ParallelFor(hits.size(), [&](size_t i) { hits[i]++; });
+
+    for (size_t i = 0; i < hits.size(); ++i) {
+        EXPECT_EQ(hits[i].load(), 1) << "index " << i;
+    }
+}
+
+TEST(ThreadPoolTestSuite, IsReusable) {
+    ThreadPool pool(3);
+    std::atomic<size_t> sum{0};
+
+    for (size_t round = 0; round < 50; ++round) {
+        pool.ParallelFor(round, [&](size_t i) { sum += i; });
+    }
+
+    // sum over rounds of 0 + ... + (round - 1)
+    EXPECT_EQ(sum.load(), 19600u);
+}
+
+TEST(ThreadPoolTestSuite, SingleThreadRunsOnCaller) {
+    ThreadPool pool(1);
+    EXPECT_EQ(pool.Size(), 1u);
+
+    std::vector<size_t> order;
+    pool.ParallelFor(5, [&](size_t i) { order.push_back(i); });
+
+    EXPECT_EQ(order, (std::vector<size_t>{0, 1, 2, 3, 4}));
+}
+
+TEST(ThreadPoolTestSuite, RethrowsLowestFailingIndex) {
+    ThreadPool pool(4);
+
+    for (int attempt = 0; attempt < 20; ++attempt) {
+        try {
+            pool.ParallelFor(200, [](size_t i) {
+                if (i % 37 == 5) throw std::runtime_error(std::to_string(i));
+            });
+            FAIL() << "expected an exception";
+        } catch (const std::runtime_error& e) {
+            EXPECT_STREQ(e.what(), "5");
+        }
+    }
+}